@@ -48,6 +48,11 @@
 #include <tpie/stream_arith.h>
 
 #include <tpie/gen_perm.h>
+// Get scan().
+#include <tpie/scan.h>
+
+// For sqrt().
+#include <cmath>
 
 namespace tpie {
     
@@ -33,6 +33,9 @@
 
 #include <iostream>
 
+// Get sort().
+#include <tpie/sort.h>
+
 // We need dense matrices to support some sparse/dense interactions.
 #include "matrix.h"
 
@@ -32,7 +32,7 @@
 
 #include <fstream>
 
-#include "rectangle.h"
+#include <tpie/rectangle.h>
 #include <tpie/block.h>  // for bid_t
 #include <tpie/scan_utils.h>
 #include <tpie/stream.h>
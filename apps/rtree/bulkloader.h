@@ -47,7 +47,7 @@
 #include <cstdlib>        //  strlen / strcpy
 #include <tpie/scan.h>    //  for scan 
 #include <tpie/sort.h>    //  for sort
-#include "rectangle.h"    //  Data.
+#include <tpie/rectangle.h>    //  Data.
 #include "rstartree.h"    //  Output data.
 #include "rstarnode.h"    //  Needed while bulk loading.
 #include "hilbert.h"      //  Computing Hilbert values.
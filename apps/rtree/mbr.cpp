@@ -35,7 +35,7 @@
 
 #include <tpie/stream.h>
 
-#include "rectangle.h"
+#include <tpie/rectangle.h>
 #include <tpie/scan.h>
 #include <tpie/block.h>
 #include <iostream>
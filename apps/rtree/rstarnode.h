@@ -60,7 +60,7 @@
 #include <tpie/vararray.h>
 
 //  Include declaration of bounding boxes.
-#include "rectangle.h"
+#include <tpie/rectangle.h>
 #include "rectangle_comparators.h"
 
 #include "rstarnode_info.h"
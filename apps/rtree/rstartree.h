@@ -59,7 +59,7 @@
 #include <tpie/stack.h>
 
 //  Include class rectangle.
-#include "rectangle.h"
+#include <tpie/rectangle.h>
 #include "rectangle_comparators.h"
 
 //  Include class RStarNode
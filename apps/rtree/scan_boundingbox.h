@@ -24,7 +24,7 @@
 #include <tpie/scan.h>
 #include <utility>
 
-#include "rectangle.h"
+#include <tpie/rectangle.h>
 
 namespace tpie {
 
@@ -58,11 +58,14 @@ extern int random_seed;
 // <><><><><><> Choose BTE STREAM  <><><><><><> //
 // <><><><><><><><><><><><><><><><><><><><><><> //
 
+#if (!defined(BTE_STREAM_IMP_UFS) && !defined(BTE_STREAM_IMP_PACKED))
 // Define only one (default is BTE_STREAM_IMP_UFS)
 #define BTE_STREAM_IMP_UFS
 //#define BTE_STREAM_IMP_MMAP
 //#define BTE_STREAM_IMP_STDIO
+//#define BTE_STREAM_IMP_PACKED
 //#define BTE_STREAM_IMP_USER_DEFINED
+#endif
 
 
 // <><><><><><><><><><><><><><><><><><><><><><><><> //
@@ -121,4 +124,16 @@ extern int random_seed;
 #define STREAM_UFS_READ_AHEAD 0
 #endif
 
+
+// <><><><><><><><><><><><><><><><><><><><><><><><> //
+// <> BTE_STREAM_PACKED configuration options <><> //
+// <><><><><><><><><><><><><><><><><><><><><><><><> //
+
+#ifdef BTE_STREAM_IMP_PACKED
+ // Define logical blocksize factor (default is 8)
+#ifndef STREAM_PACKED_BLOCK_FACTOR
+#define STREAM_PACKED_BLOCK_FACTOR 8
+#endif
+#endif
+
 #endif
@@ -28,6 +28,51 @@
 #include <iostream>
 #include <boost/cstdint.hpp>
 #include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+
+#define DIE(msg) {std::cerr << msg << std::endl; return false;}
+
+// Leave sz bytes of memory to the test. Allocations are only accounted
+// for once a limit is set, so this is called before anything is made.
+inline void limit_memory(tpie::size_type sz) {
+	tpie::MM_manager.set_memory_limit(sz);
+	tpie::MM_manager.ignore_memory_limit();
+}
+
+// Two-dimensional points with ids 1..count, shuffled with the given seed.
+// The coordinates in each dimension are a permutation of 0..count-1,
+// since the kd-tree loaders expect distinct coordinates.
+template <typename point_t>
+std::vector<point_t> make_points(size_t count, unsigned int seed) {
+	std::vector<int> xs, ys;
+	for (size_t i=0; i < count; ++i) {
+		xs.push_back(i);
+		ys.push_back(i);
+	}
+	srand(seed);
+	std::random_shuffle(xs.begin(), xs.end());
+	std::random_shuffle(ys.begin(), ys.end());
+	std::vector<point_t> pts;
+	pts.reserve(count);
+	for (size_t i=0; i < count; ++i) {
+		point_t p(i+1);
+		p[0] = xs[i];
+		p[1] = ys[i];
+		pts.push_back(p);
+	}
+	return pts;
+}
+
+// A random window over points from make_points(count, ...), at most a
+// quarter of their range wide in each dimension.
+template <typename point_t>
+void random_window(size_t count, point_t& lo, point_t& hi) {
+	const int range = static_cast<int>(count);
+	lo[0] = rand() % range; hi[0] = lo[0] + rand() % (range/4);
+	lo[1] = rand() % range; hi[1] = lo[1] + rand() % (range/4);
+}
 
 struct bit_permute {
 	boost::uint64_t operator()(boost::uint64_t i) const{
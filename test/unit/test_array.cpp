@@ -23,6 +23,8 @@
 #include <tpie/bit_array.h>
 #include <tpie/array.h>
 #include <tpie/concepts.h>
+#include <vector>
+#include <algorithm>
 using namespace tpie;
 
 bool basic_test() {
@@ -151,6 +153,61 @@ bool iterator_bool_test() {
 }
 
 
+// Compare the bulk operations against element by element operations on
+// a vector, on ranges with and without whole words.
+template <typename T, int B>
+bool bulk_test() {
+	typedef packed_array<T, B> pa_t;
+	const size_t n = 1000;
+	const int values = 1 << B;
+	srand(42);
+	pa_t a(n, T(0)), b(n);
+	std::vector<T> va(n, T(0)), vb(n);
+	for (size_t i=0; i < n; ++i) vb[i] = b[i] = T(rand() % values);
+
+	for (int round=0; round < 200; ++round) {
+		size_t from = rand() % (n+1);
+		size_t to = from + rand() % (n+1-from);
+		T v = T(rand() % values);
+		switch (round % 4) {
+		case 0:
+			a.fill(v, from, to);
+			std::fill(va.begin()+from, va.begin()+to, v);
+			break;
+		case 1: {
+			array<T> in(to-from+1);
+			for (size_t i=from; i < to; ++i) va[i] = in[i-from] = T(rand() % values);
+			a.pack(from, &in[0], to-from);
+			break; }
+		case 2:
+			a ^= b;
+			for (size_t i=0; i < n; ++i) va[i] = T(va[i] ^ vb[i]);
+			break;
+		case 3:
+			if (round % 8 == 3) {
+				a |= b;
+				for (size_t i=0; i < n; ++i) va[i] = T(va[i] | vb[i]);
+			} else {
+				a &= b;
+				for (size_t i=0; i < n; ++i) va[i] = T(va[i] & vb[i]);
+			}
+			break;
+		}
+		for (size_t i=0; i < n; ++i)
+			if (a[i] != va[i]) return false;
+		if (a.count(v, from, to) != size_t(std::count(va.begin()+from, va.begin()+to, v))) return false;
+		if (a.count(v) != size_t(std::count(va.begin(), va.end(), v))) return false;
+		if (a.rank(to) != size_t(std::count(va.begin(), va.begin()+to, T(1)))) return false;
+		array<T> out(to-from+1);
+		a.unpack(from, to, &out[0]);
+		for (size_t i=from; i < to; ++i)
+			if (out[i-from] != va[i]) return false;
+	}
+	a.fill(T(1));
+	if (a.count(T(1)) != n) return false;
+	return true;
+}
+
 class array_memory_test: public memory_test {
 public:
 	array<int> * a;
@@ -193,6 +250,10 @@ int main(int argc, char **argv) {
 		return iterator_bool_test()?EXIT_SUCCESS:EXIT_FAILURE;
 	else if (test == "bit_memory") 
 		return array_bool_memory_test()()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "bit_bulk")
+		return bulk_test<bool, 1>()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "packed_bulk")
+		return (bulk_test<int, 2>() && bulk_test<int, 4>())?EXIT_SUCCESS:EXIT_FAILURE;
 
 	return EXIT_FAILURE;
 }
@@ -0,0 +1,177 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2010, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#include "common.h"
+#include <tpie/bit_permute.h>
+#include <vector>
+#include <boost/random/linear_congruential.hpp>
+
+using namespace tpie;
+using namespace tpie::ami;
+using namespace std;
+
+typedef bit_matrix::word_t word_t;
+
+static bit_matrix random_invertible(boost::rand48 & prng, TPIE_OS_SIZE_T n) {
+	bit_matrix A(n, n), inv(n, n);
+	do {
+		for (TPIE_OS_SIZE_T i=0; i < n; ++i)
+			for (TPIE_OS_SIZE_T j=0; j < n; ++j)
+				A[i][j] = int(prng() & 1);
+	} while (!A.invert(inv));
+	return A;
+}
+
+static bool matrix_test() {
+	boost::rand48 prng(42);
+	for (TPIE_OS_SIZE_T n=1; n <= 40; n += 3) {
+		bit_matrix A = random_invertible(prng, n);
+		bit_matrix inv(n, n);
+		A.invert(inv);
+		if (A * inv != bit_matrix::identity(n)) DIE("wrong inverse for n = " << n);
+		if (A.rank() != n) DIE("wrong rank");
+		bit_matrix_kernel k(A);
+		bit_matrix x(n, 1);
+		for (int t=0; t < 100; ++t) {
+			word_t v = (word_t(prng()) << 32 ^ prng()) & ((word_t(1) << n) - 1);
+			x = TPIE_OS_OFFSET(v);
+			if (k(v) != A.apply(v)) DIE("wrong kernel product");
+			if (word_t(TPIE_OS_OFFSET(A * x)) != A.apply(v)) DIE("wrong product");
+		}
+		bit_matrix s = A.submatrix(0, n, 0, 1);
+		if (s.column(0) != A.column(0)) DIE("wrong submatrix");
+	}
+	bit_matrix S(3, 3);
+	S[0][0] = 1; S[1][1] = 1; S[2][0] = 1;
+	bit_matrix inv(3, 3);
+	if (S.invert(inv) || S.rank() != 2) DIE("singular matrix inverted");
+	return true;
+}
+
+// The passes multiply to A, each can be done in one pass, and there are
+// as few as promised.
+static bool factor_test() {
+	boost::rand48 prng(7);
+	for (int t=0; t < 200; ++t) {
+		TPIE_OS_SIZE_T n = 4 + prng() % 30;
+		TPIE_OS_SIZE_T m = 2 + prng() % (n - 2);
+		TPIE_OS_SIZE_T b = prng() % m;
+		bit_matrix A = random_invertible(prng, n);
+		vector<bit_matrix> passes;
+		if (!bmmc_factor(A, b, m, passes)) DIE("factor failed");
+		bit_matrix P = bit_matrix::identity(n);
+		for (size_t i=0; i < passes.size(); ++i) {
+			if (passes[i].submatrix(m, n - m, 0, b).rank() != 0) DIE("not a one-pass permutation");
+			P = passes[i] * P;
+		}
+		if (P != A) DIE("wrong factorization");
+		TPIE_OS_SIZE_T r = A.submatrix(m, n - m, 0, b).rank();
+		TPIE_OS_SIZE_T expect = r ? (r + m - b - 1) / (m - b) + 1 : 1;
+		if (passes.size() != expect) DIE("wrong pass count " << passes.size() << " " << expect);
+	}
+	return true;
+}
+
+enum kind {IDENTITY, TRANSPOSE, REVERSE, RANDOM};
+
+static bool permute_test(kind k, TPIE_OS_SIZE_T mbits) {
+	limit_memory(64*1024*1024);
+	boost::rand48 prng(3);
+	const TPIE_OS_SIZE_T n = 16;
+	bit_matrix A(n, n), c(n, 1);
+	switch (k) {
+	case IDENTITY:
+		A = bit_matrix::identity(n);
+		break;
+	case TRANSPOSE:
+		for (TPIE_OS_SIZE_T i=0; i < n; ++i) A[(i + n/2) % n][i] = 1;
+		break;
+	case REVERSE:
+		for (TPIE_OS_SIZE_T i=0; i < n; ++i) A[n-1-i][i] = 1;
+		break;
+	case RANDOM:
+		A = random_invertible(prng, n);
+		c = TPIE_OS_OFFSET(prng() & 0xffff);
+		break;
+	}
+
+	stream<word_t> in, out;
+	for (word_t x=0; x < (word_t(1) << n); ++x) in.write_item(x);
+	TPIE_OS_SIZE_T sz;
+	in.main_memory_usage(&sz, mem::STREAM_USAGE_MAXIMUM);
+	bmmc_permute_op<word_t> op(A, c, 3*sz + (TPIE_OS_SIZE_T(1) << mbits) * 3 * sizeof(word_t));
+	if (op.run(&in, &out) != NO_ERROR) DIE("bmmc_permute failed");
+	if (out.stream_len() != in.stream_len()) DIE("wrong length");
+	out.seek(0);
+	word_t * y;
+	vector<word_t> res(TPIE_OS_SIZE_T(1) << n);
+	for (size_t i=0; i < res.size(); ++i) {
+		if (out.read_item(&y) != NO_ERROR) DIE("read failed");
+		res[i] = *y;
+	}
+	for (word_t x=0; x < (word_t(1) << n); ++x)
+		if (res[A.apply(x) ^ c.column(0)] != x) DIE("wrong target of " << x);
+
+	// The op fits memoryloads of 2^mbits items, and takes as many
+	// passes as bmmc_factor() gives.
+	TPIE_OS_SIZE_T m = std::min(mbits, n), b;
+	for (b = 0; (TPIE_OS_SIZE_T(2) << b) <= in.chunk_size(); b++) ;
+	b = m < n ? std::min(b, m - 1) : std::min(b, n);
+	TPIE_OS_SIZE_T r = m < n ? A.submatrix(m, n - m, 0, b).rank() : 0;
+	TPIE_OS_SIZE_T expect = r ? (r + m - b - 1) / (m - b) + 1 : 1;
+	if (op.passes() != expect) DIE("wrong pass count " << op.passes() << " " << expect);
+	return true;
+}
+
+static bool legacy_test() {
+	limit_memory(64*1024*1024);
+	stream<TPIE_OS_OFFSET> in, out;
+	for (TPIE_OS_OFFSET x=0; x < 1024; ++x) in.write_item(x);
+	bit_matrix A(10, 10), c(10, 1);
+	for (TPIE_OS_SIZE_T i=0; i < 10; ++i) A[9-i][i] = 1;
+	c[0][0] = 1;
+	bit_perm_object bpo(A, c);
+	if (AMI_BMMC_permute(&in, &out, &bpo) != NO_ERROR) DIE("AMI_BMMC_permute failed");
+	stream<TPIE_OS_OFFSET> short_in;
+	for (TPIE_OS_OFFSET x=0; x < 1000; ++x) short_in.write_item(x);
+	if (bmmc_permute(&short_in, &out, bpo) != NOT_POWER_OF_2) DIE("accepted a stream of length 1000");
+	return true;
+}
+
+int main(int argc, char **argv) {
+	if(argc != 2) return 1;
+	std::string test(argv[1]);
+	if (test == "matrix")
+		return matrix_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "factor")
+		return factor_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "identity")
+		return permute_test(IDENTITY, 10)?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "transpose")
+		return permute_test(TRANSPOSE, 10)?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "reverse")
+		return permute_test(REVERSE, 10)?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "random")
+		return permute_test(RANDOM, 10)?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "memory")
+		return permute_test(RANDOM, 20)?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "legacy")
+		return legacy_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,150 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2010, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#include "common.h"
+#include <tpie/bkdtree.h>
+#include <vector>
+#include <algorithm>
+
+using namespace tpie;
+using namespace tpie::ami;
+using namespace std;
+
+typedef bkdtree<int, 2> bkdtree_t;
+typedef bkdtree_t::point_t point_t;
+
+// The number of points in the test trees.
+static const size_t point_count = 30000;
+
+static bkdtree_params small_params() {
+	bkdtree_params params;
+	params.leaf_size_max = 64;
+	params.node_size_max = 32;
+	params.buffer_size = 1000;
+	return params;
+}
+
+// Check the contents of t against the points, with unload, find and
+// window queries.
+static bool check_tree(bkdtree_t& t, const vector<point_t>& pts) {
+	if (t.size() != (TPIE_OS_OFFSET)pts.size()) DIE("size failed");
+
+	stream<point_t> out;
+	if (t.unload(&out) != NO_ERROR) DIE("unload failed");
+	if (out.stream_len() != (TPIE_OS_OFFSET)pts.size()) DIE("unload length failed");
+
+	for (size_t i=0; i < pts.size(); i += 37)
+		if (!t.find(pts[i])) DIE("find failed");
+
+	for (int w=0; w < 40; ++w) {
+		point_t lo, hi;
+		random_window(point_count, lo, hi);
+		TPIE_OS_OFFSET expected = 0;
+		for (size_t i=0; i < pts.size(); ++i)
+			if (lo < pts[i] && pts[i] < hi) ++expected;
+		stream<point_t> res;
+		if (t.window_query(lo, hi, &res) != expected) DIE("window_query failed");
+		if (res.stream_len() != expected) DIE("window_query output failed");
+		if (t.window_query(hi, lo, NULL) != expected) DIE("window_query count failed");
+	}
+	return true;
+}
+
+bool insert_test() {
+	limit_memory(16*1024*1024);
+	vector<point_t> pts = make_points<point_t>(point_count, 19);
+	bkdtree_t t(small_params());
+	vector<point_t> in;
+	for (size_t i=0; i < pts.size(); ++i) {
+		if (!t.insert(pts[i])) DIE("insert failed");
+		in.push_back(pts[i]);
+		// Check in between merges, and right after some.
+		if ((i+1) % 7000 == 0 && !check_tree(t, in)) return false;
+	}
+	// 30 buffers of 1000 points: 30 = 11110 in binary.
+	if (t.tree_count() != 4) DIE("tree_count failed");
+	return check_tree(t, in);
+}
+
+bool knn_test() {
+	limit_memory(16*1024*1024);
+	vector<point_t> pts = make_points<point_t>(point_count, 19);
+	pts.resize(12500);
+	bkdtree_t t(small_params());
+	for (size_t i=0; i < pts.size(); ++i)
+		if (!t.insert(pts[i])) DIE("insert failed");
+
+	const size_t k = 10;
+	for (int r=0; r < 50; ++r) {
+		point_t q;
+		q[0] = rand() % point_count;
+		q[1] = rand() % point_count;
+		vector<double> expected;
+		for (size_t i=0; i < pts.size(); ++i) {
+			double dx = double(pts[i][0]) - q[0];
+			double dy = double(pts[i][1]) - q[1];
+			expected.push_back(dx*dx + dy*dy);
+		}
+		partial_sort(expected.begin(), expected.begin()+k, expected.end());
+
+		stream<point_t> res;
+		if (t.k_nn_query(q, &res, k) != (TPIE_OS_OFFSET)k) DIE("k_nn_query count failed");
+		point_t* p;
+		res.seek(0);
+		for (size_t i=0; res.read_item(&p) == NO_ERROR; ++i) {
+			double dx = double((*p)[0]) - q[0];
+			double dy = double((*p)[1]) - q[1];
+			if (dx*dx + dy*dy != expected[i]) DIE("k_nn_query output failed");
+		}
+	}
+	return true;
+}
+
+bool erase_test() {
+	limit_memory(16*1024*1024);
+	vector<point_t> pts = make_points<point_t>(point_count, 19);
+	pts.resize(10500);
+	bkdtree_t t(small_params());
+	for (size_t i=0; i < pts.size(); ++i)
+		if (!t.insert(pts[i])) DIE("insert failed");
+
+	// Erase every third point, from the trees and the buffer alike.
+	vector<point_t> left;
+	for (size_t i=0; i < pts.size(); ++i) {
+		if (i % 3 == 0) {
+			if (!t.erase(pts[i])) DIE("erase failed");
+			if (t.find(pts[i])) DIE("erased point found");
+		} else
+			left.push_back(pts[i]);
+	}
+	if (t.erase(pts[0])) DIE("erase of missing point succeeded");
+	return check_tree(t, left);
+}
+
+int main(int argc, char **argv) {
+	if(argc != 2) return 1;
+	std::string test(argv[1]);
+	if (test == "insert")
+		return insert_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "knn")
+		return knn_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "erase")
+		return erase_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,376 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2010, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+
+#include "common.h"
+#include <tpie/bte/block_cache.h>
+#include <tpie/bte/coll.h>
+#include <tpie/tempname.h>
+#include <cstring>
+#include <boost/thread.hpp>
+
+using namespace tpie;
+using namespace tpie::bte;
+using namespace std;
+
+static const TPIE_OS_SIZE_T block = 1024;
+static TPIE_OS_SIZE_T released = 0;
+static boost::mutex released_mutex;
+
+static void release(void * place, TPIE_OS_SIZE_T size) {
+	if (size != block) std::cerr << "wrong size released" << std::endl;
+	delete [] (char *) place;
+	boost::mutex::scoped_lock lock(released_mutex);
+	++released;
+}
+
+static void give(TPIE_OS_SIZE_T coll, TPIE_OS_OFFSET bid) {
+	block_cache::instance().give(coll, bid, new char[block], block, &release);
+}
+
+// Hot blocks survive a long scan of blocks that are used once.
+static bool scan_test() {
+	limit_memory(64*1024*1024);
+	block_cache & c = block_cache::instance();
+	c.set_capacity(BTE_BLOCK_CACHE_SHARDS * 4 * block);
+	TPIE_OS_SIZE_T hot = c.new_collection();
+	TPIE_OS_SIZE_T cold = c.new_collection();
+	void * p;
+
+	// Use the hot blocks twice, so they move to the LRU queue.
+	for (TPIE_OS_OFFSET i=1; i <= BTE_BLOCK_CACHE_SHARDS; ++i) give(hot, i);
+	for (TPIE_OS_OFFSET i=1; i <= BTE_BLOCK_CACHE_SHARDS; ++i) {
+		if (!c.take(hot, i, p)) DIE("block " << i << " not cached");
+		c.give(hot, i, p, block, &release);
+	}
+	for (TPIE_OS_OFFSET i=1; i <= 100 * BTE_BLOCK_CACHE_SHARDS; ++i) give(cold, i);
+	if (c.size() > c.capacity()) DIE("over budget: " << c.size());
+
+	TPIE_OS_OFFSET hits = c.hits();
+	for (TPIE_OS_OFFSET i=1; i <= BTE_BLOCK_CACHE_SHARDS; ++i) {
+		if (!c.take(hot, i, p)) DIE("hot block " << i << " flushed by the scan");
+		c.give(hot, i, p, block, &release);
+	}
+	if (c.hits() != hits + BTE_BLOCK_CACHE_SHARDS) DIE("wrong hit count");
+
+	TPIE_OS_SIZE_T n = released;
+	c.drop(hot);
+	c.drop(cold);
+	if (c.size() != 0) DIE("blocks left after drop");
+	if (released - n != 4 * BTE_BLOCK_CACHE_SHARDS) DIE("wrong number released: " << released - n);
+	c.set_capacity(0);
+	return true;
+}
+
+// A block that comes back soon after it left the FIFO queue is hot.
+static bool ghost_test() {
+	limit_memory(64*1024*1024);
+	block_cache & c = block_cache::instance();
+	c.set_capacity(BTE_BLOCK_CACHE_SHARDS * 4 * block);
+	TPIE_OS_SIZE_T coll = c.new_collection();
+	void * p;
+	const TPIE_OS_OFFSET n = 5 * BTE_BLOCK_CACHE_SHARDS;
+
+	for (TPIE_OS_OFFSET i=1; i <= n; ++i) give(coll, i);
+	// Block 1 has left the cache; given again, it goes to the LRU queue.
+	if (c.take(coll, 1, p)) DIE("block 1 still cached");
+	give(coll, 1);
+	for (TPIE_OS_OFFSET i=n + 1; i <= 3 * n; ++i) give(coll, i);
+	if (!c.take(coll, 1, p)) DIE("block 1 flushed");
+	c.give(coll, 1, p, block, &release);
+
+	c.forget(coll, 2);
+	c.drop(coll);
+	if (c.size() != 0) DIE("blocks left after drop");
+	c.set_capacity(0);
+	return true;
+}
+
+// Blocks read ahead enter the cache once, and wait for take().
+static bool reserve_test() {
+	limit_memory(64*1024*1024);
+	block_cache & c = block_cache::instance();
+	c.set_capacity(BTE_BLOCK_CACHE_SHARDS * 4 * block);
+	TPIE_OS_SIZE_T coll = c.new_collection();
+	void * p;
+
+	if (!c.reserve(coll, 1)) DIE("reserve failed");
+	if (c.reserve(coll, 1)) DIE("reserved twice");
+	c.fill(coll, 1, new char[block], block, &release);
+	if (c.reserve(coll, 1)) DIE("reserved a cached block");
+	if (!c.take(coll, 1, p)) DIE("block read ahead not cached");
+	if (c.reserve(coll, 1)) DIE("reserved a block in memory");
+	c.give(coll, 1, p, block, &release);
+
+	if (!c.reserve(coll, 2)) DIE("reserve failed");
+	c.cancel(coll, 2);
+	if (c.take(coll, 2, p)) DIE("cancelled block cached");
+	c.forget(coll, 2);
+	if (!c.reserve(coll, 2)) DIE("reserve after forget failed");
+	c.cancel(coll, 2);
+
+	c.drop(coll);
+	if (c.size() != 0) DIE("blocks left after drop");
+	c.set_capacity(0);
+	return true;
+}
+
+template <typename coll_t>
+static bool collection_test() {
+	limit_memory(64*1024*1024);
+	block_cache & c = block_cache::instance();
+	c.set_capacity(1024 * 1024);
+	std::string name = tempname::tpie_name("block_cache");
+	{
+		coll_t coll(name, WRITE_COLLECTION);
+		coll.persist(PERSIST_DELETE);
+		const TPIE_OS_SIZE_T bs = coll.block_size();
+		vector<TPIE_OS_OFFSET> bids;
+		void * place;
+		for (int i=0; i < 8; ++i) {
+			TPIE_OS_OFFSET bid;
+			if (coll.new_block(bid, place) != NO_ERROR) DIE("new_block failed");
+			memset(place, i, bs);
+			if (coll.put_block(bid, place) != NO_ERROR) DIE("put_block failed");
+			bids.push_back(bid);
+		}
+		TPIE_OS_OFFSET hits = c.hits();
+		for (int i=0; i < 8; ++i) {
+			if (coll.get_block(bids[i], place) != NO_ERROR) DIE("get_block failed");
+			if (static_cast<char *>(place)[bs - 1] != i) DIE("wrong contents of block " << i);
+			if (i % 2) {
+				if (coll.delete_block(bids[i], place) != NO_ERROR) DIE("delete_block failed");
+			} else {
+				if (coll.put_block(bids[i], place) != NO_ERROR) DIE("put_block failed");
+			}
+		}
+		if (c.hits() - hits != 8) DIE("blocks not cached: " << c.hits() - hits);
+		if (c.size() != 4 * bs) DIE("wrong cache size " << c.size());
+
+		// A recycled block is read from the file.
+		TPIE_OS_OFFSET bid;
+		hits = c.hits();
+		if (coll.new_block(bid, place) != NO_ERROR) DIE("new_block failed");
+		if (c.hits() != hits) DIE("recycled block from the cache");
+		if (coll.put_block(bid, place) != NO_ERROR) DIE("put_block failed");
+	}
+	if (c.size() != 0) DIE("blocks left after close");
+	c.set_capacity(0);
+	return true;
+}
+
+// A block of a read-only collection that was changed is not cached.
+template <typename coll_t>
+static bool read_only_test() {
+	limit_memory(64*1024*1024);
+	block_cache & c = block_cache::instance();
+	c.set_capacity(1024 * 1024);
+	std::string name = tempname::tpie_name("block_cache");
+	TPIE_OS_OFFSET bid;
+	void * place;
+	{
+		coll_t coll(name, WRITE_COLLECTION);
+		if (coll.new_block(bid, place) != NO_ERROR) DIE("new_block failed");
+		memset(place, 1, coll.block_size());
+		if (coll.put_block(bid, place) != NO_ERROR) DIE("put_block failed");
+	}
+	{
+		coll_t coll(name, READ_COLLECTION);
+		const TPIE_OS_SIZE_T bs = coll.block_size();
+		if (coll.get_block(bid, place) != NO_ERROR) DIE("get_block failed");
+		memset(place, 2, bs);
+		if (coll.put_block(bid, place) != NO_ERROR) DIE("put_block failed");
+		if (c.size() != 0) DIE("changed block cached");
+		if (coll.get_block(bid, place) != NO_ERROR) DIE("get_block failed");
+		if (static_cast<char *>(place)[bs - 1] != 1) DIE("changed block read back");
+
+		// A clean block is cached.
+		if (coll.put_block(bid, place, 0) != NO_ERROR) DIE("put_block failed");
+		if (c.size() != bs) DIE("clean block not cached");
+	}
+	coll_t coll(name, WRITE_COLLECTION);
+	coll.persist(PERSIST_DELETE);
+	c.set_capacity(0);
+	return true;
+}
+
+// Blocks that are not cached are read ahead by prefetch().
+template <typename coll_t>
+static bool prefetch_test() {
+	limit_memory(64*1024*1024);
+	block_cache & c = block_cache::instance();
+	std::string name = tempname::tpie_name("block_cache");
+	{
+		coll_t coll(name, WRITE_COLLECTION);
+		coll.persist(PERSIST_DELETE);
+		const TPIE_OS_SIZE_T bs = coll.block_size();
+		const int n = 64;
+		vector<TPIE_OS_OFFSET> bids;
+		void * place;
+
+		// Nothing fits in the cache while the blocks are written.
+		c.set_capacity(1);
+		for (int i=0; i < n; ++i) {
+			TPIE_OS_OFFSET bid;
+			if (coll.new_block(bid, place) != NO_ERROR) DIE("new_block failed");
+			memset(place, i, bs);
+			if (coll.put_block(bid, place) != NO_ERROR) DIE("put_block failed");
+			bids.push_back(bid);
+		}
+		if (c.size() != 0) DIE("blocks cached");
+
+		c.set_capacity(4 * n * bs);
+		for (int i=0; i < n; ++i)
+			if (coll.prefetch(bids[i]) != NO_ERROR) DIE("prefetch failed");
+		if (coll.prefetch(0) == NO_ERROR) DIE("prefetched block 0");
+		if (coll.stats().get(BLOCK_PREFETCH) == 0) DIE("nothing read ahead");
+
+		TPIE_OS_OFFSET hits = c.hits();
+		for (int i=0; i < n; ++i) {
+			if (coll.get_block(bids[i], place) != NO_ERROR) DIE("get_block failed");
+			if (static_cast<char *>(place)[0] != i ||
+				static_cast<char *>(place)[bs - 1] != i) DIE("wrong contents of block " << i);
+			// A block in memory is not read ahead.
+			if (coll.prefetch(bids[i]) != NO_ERROR) DIE("prefetch failed");
+			if (coll.put_block(bids[i], place) != NO_ERROR) DIE("put_block failed");
+		}
+		if (c.hits() - hits != coll.stats().get(BLOCK_PREFETCH))
+			DIE("blocks read ahead not found: " << c.hits() - hits);
+
+		// Reads ahead that are not used are released on close.
+		c.set_capacity(1);
+		for (int i=0; i < n; ++i) {
+			if (coll.get_block(bids[i], place) != NO_ERROR) DIE("get_block failed");
+			if (coll.put_block(bids[i], place) != NO_ERROR) DIE("put_block failed");
+		}
+		c.set_capacity(4 * n * bs);
+		for (int i=0; i < n; ++i) coll.prefetch(bids[i]);
+	}
+	if (c.size() != 0) DIE("blocks left after close");
+	c.set_capacity(0);
+	return true;
+}
+
+// Cached blocks are released when an allocation would exceed the memory
+// limit.
+static bool reclaim_test() {
+	limit_memory(64*1024*1024);
+	block_cache & c = block_cache::instance();
+	c.set_capacity(1024 * 1024);
+	TPIE_OS_SIZE_T coll = c.new_collection();
+	for (TPIE_OS_OFFSET i=1; i <= 64; ++i) give(coll, i);
+	if (c.size() != 64 * block) DIE("blocks not cached: " << c.size());
+
+	// Leave room for less than the next allocation.
+	TPIE_OS_SIZE_T n = released;
+	MM_manager.set_memory_limit(MM_manager.memory_limit() - MM_manager.memory_available() + 256);
+	MM_manager.enforce_memory_limit();
+	char * p = new char[4 * block];
+	delete [] p;
+	limit_memory(64*1024*1024);
+
+	if (released - n < 4) DIE("too few blocks released: " << released - n);
+	if (c.size() != (64 - (released - n)) * block) DIE("wrong cache size " << c.size());
+	c.drop(coll);
+	c.set_capacity(0);
+	return true;
+}
+
+// Readers that take and give the same few blocks at once, as concurrent
+// btree reads do, each with a copy of its own on a miss.
+struct reader_thread {
+	TPIE_OS_SIZE_T coll;
+	int seed;
+	TPIE_OS_SIZE_T * read;
+	void operator()() {
+		block_cache & c = block_cache::instance();
+		void * p;
+		for (int i=0; i < 20000; ++i) {
+			TPIE_OS_OFFSET bid = 1 + (seed + i) % 4;
+			if (!c.take(coll, bid, p)) {
+				p = new char[block];
+				++*read;
+			}
+			boost::this_thread::yield();
+			c.give(coll, bid, p, block, &release);
+		}
+	}
+};
+
+static bool threads_test() {
+	limit_memory(64*1024*1024);
+	block_cache & c = block_cache::instance();
+	c.set_capacity(BTE_BLOCK_CACHE_SHARDS * 4 * block);
+	TPIE_OS_SIZE_T coll = c.new_collection();
+
+	const int threads = 8;
+	TPIE_OS_SIZE_T read[threads];
+	TPIE_OS_SIZE_T n = released;
+	boost::thread_group group;
+	for (int i=0; i < threads; ++i) {
+		read[i] = 0;
+		reader_thread r;
+		r.coll = coll;
+		r.seed = i;
+		r.read = &read[i];
+		group.create_thread(r);
+	}
+	group.join_all();
+
+	TPIE_OS_SIZE_T total = 0;
+	for (int i=0; i < threads; ++i) total += read[i];
+	if (c.size() > 4 * block) DIE("too many copies cached: " << c.size());
+	c.drop(coll);
+	if (c.size() != 0) DIE("blocks left after drop");
+	if (released - n != total) DIE("read " << total << ", released " << released - n);
+	c.set_capacity(0);
+	return true;
+}
+
+int main(int argc, char **argv) {
+	if(argc != 2) return 1;
+	std::string test(argv[1]);
+	if (test == "scan")
+		return scan_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "ghost")
+		return ghost_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "reserve")
+		return reserve_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "ufs")
+		return collection_test<COLLECTION_UFS>()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "mmap")
+		return collection_test<COLLECTION_MMAP>()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "prefetch_ufs")
+#ifdef _WIN32
+		// collection_ufs does not read ahead on Windows.
+		return EXIT_SUCCESS;
+#else
+		return prefetch_test<COLLECTION_UFS>()?EXIT_SUCCESS:EXIT_FAILURE;
+#endif
+	else if (test == "prefetch_mmap")
+		return prefetch_test<COLLECTION_MMAP>()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "read_only")
+		return (read_only_test<COLLECTION_UFS>() &&
+				read_only_test<collection_packed<TPIE_BLOCK_ID_TYPE> >())?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "reclaim")
+		return reclaim_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "threads")
+		return threads_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	return EXIT_FAILURE;
+}
@@ -24,6 +24,7 @@
 #include <tpie/bte/stream_ufs.h>
 #include <tpie/bte/stream_mmap.h>
 #include <tpie/bte/stream_cache.h>
+#include <tpie/bte/stream_packed.h>
 #include <tpie/stream.h>
 #include <tpie/bte/err.h>
 #include <cstring>
@@ -123,6 +124,10 @@ int main(int argc, char **argv) {
 		stream_ufs<int> stream(temp_stream_name, WRITE_STREAM);
 		return test_bte<stream_ufs<int>,tpie::bte::err>
 				(stream, argv[2], tpie::bte::NO_ERROR);
+	} else if(stream_type == "packed") {
+		stream_packed<int> stream(temp_stream_name, WRITE_STREAM);
+		return test_bte<stream_packed<int>,tpie::bte::err>
+				(stream, argv[2], tpie::bte::NO_ERROR);
 	}
 	return 1;
 }
@@ -0,0 +1,419 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2010, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#include "common.h"
+#include <tpie/btree.h>
+#include <boost/thread.hpp>
+#include <vector>
+#include <cstring>
+
+using namespace tpie;
+using namespace tpie::ami;
+using namespace std;
+
+struct el_t {
+	boost::int64_t key;
+	boost::int64_t value;
+	el_t(boost::int64_t k=0): key(k), value(k*3) {}
+};
+
+struct key_from_el {
+	boost::int64_t operator()(const el_t& v) const { return v.key; }
+};
+
+typedef btree<boost::int64_t, el_t, less<boost::int64_t>, key_from_el> btree_t;
+
+// Keys stored in the test trees: every third number.
+static const boost::int64_t key_count = 20000;
+static inline boost::int64_t key_at(boost::int64_t i) { return i*3; }
+
+static btree_params small_params() {
+	btree_params params;
+	params.leaf_size_max = 16;
+	params.node_size_max = 8;
+	params.leaf_cache_size = 8;
+	params.node_cache_size = 16;
+	return params;
+}
+
+static void fill(btree_t& t) {
+	// Insert in a scattered order to get splits all over the tree.
+	for (boost::int64_t i=0; i < key_count; ++i)
+		t.insert(el_t(key_at((i*7919) % key_count)));
+}
+
+// Check find, pred, succ and range_query against the known contents.
+static bool check_queries(btree_t& t, boost::int64_t from, boost::int64_t step) {
+	el_t v;
+	for (boost::int64_t i=from; i < key_count; i += step) {
+		if (!t.find(key_at(i), v) || v.value != key_at(i)*3) DIE("find failed");
+		if (t.find(key_at(i)+1, v)) DIE("find found a missing key");
+		if (i > 0 && (!t.pred(key_at(i), v) || v.key != key_at(i-1))) DIE("pred failed");
+		if (i+1 < key_count && (!t.succ(key_at(i), v) || v.key != key_at(i+1))) DIE("succ failed");
+		boost::int64_t lo = key_at(i);
+		boost::int64_t hi = key_at(std::min(i+40, key_count-1));
+		if (t.range_query(lo, hi, NULL) != (hi-lo)/3+1) DIE("range_query failed");
+	}
+	return true;
+}
+
+bool basic_test() {
+	btree_t t(small_params());
+	fill(t);
+	if (t.size() != key_count) DIE("size failed");
+	if (t.height() < 3) DIE("tree too shallow for the test");
+	if (!check_queries(t, 0, 1)) return false;
+	for (boost::int64_t i=0; i < key_count; i += 2)
+		if (!t.erase(key_at(i))) DIE("erase failed");
+	if (t.size() != key_count/2) DIE("size after erase failed");
+	el_t v;
+	for (boost::int64_t i=0; i < key_count; ++i)
+		if (t.find(key_at(i), v) != (i % 2 == 1)) DIE("find after erase failed");
+	return true;
+}
+
+struct query_thread {
+	btree_t* tree;
+	boost::int64_t from;
+	boost::int64_t step;
+	bool* ok;
+	void operator()() { *ok = check_queries(*tree, from, step); }
+};
+
+bool concurrent_test() {
+	btree_t t(small_params());
+	fill(t);
+
+	t.concurrent_reads(true);
+	if (!t.concurrent_reads()) DIE("concurrent_reads not enabled");
+	if (t.insert(el_t(1))) DIE("insert succeeded in concurrent read mode");
+
+	const int threads = 4;
+	bool ok[threads];
+	boost::thread_group group;
+	for (int i=0; i < threads; ++i) {
+		query_thread q;
+		q.tree = &t;
+		q.from = i;
+		q.step = threads;
+		q.ok = &ok[i];
+		group.create_thread(q);
+	}
+	group.join_all();
+	for (int i=0; i < threads; ++i)
+		if (!ok[i]) return false;
+
+	t.concurrent_reads(false);
+	if (!t.insert(el_t(1))) DIE("insert failed after concurrent read mode");
+	el_t v;
+	if (!t.find(1, v)) DIE("find failed after concurrent read mode");
+	return true;
+}
+
+bool batch_test() {
+	btree_t t(small_params());
+	fill(t);
+
+	// Probe every key present and the number right after it, in a
+	// scattered order.
+	stream<boost::int64_t> keys;
+	std::vector<boost::int64_t> probes;
+	for (boost::int64_t i=0; i < key_count; ++i) {
+		boost::int64_t k = key_at((i*7919) % key_count);
+		keys.write_item(k);
+		keys.write_item(k+1);
+		probes.push_back(k);
+		probes.push_back(k+1);
+	}
+
+	stream<el_t> found;
+	if (t.find_batch(&keys, &found) != (size_t)key_count) DIE("find_batch count failed");
+	found.seek(0);
+	el_t* v;
+	for (boost::int64_t i=0; i < key_count; ++i) {
+		if (found.read_item(&v) != NO_ERROR) DIE("find_batch output too short");
+		if (v->key != key_at(i) || v->value != key_at(i)*3) DIE("find_batch output wrong");
+	}
+
+	std::vector<el_t> values(probes.size());
+	bool* hit = new bool[probes.size()];
+	size_t n = t.find_batch(&probes[0], probes.size(), &values[0], hit);
+	bool ok = (n == (size_t)key_count);
+	for (size_t i=0; ok && i < probes.size(); ++i)
+		ok = (hit[i] == (i % 2 == 0)) && (!hit[i] || values[i].key == probes[i]);
+	delete[] hit;
+	if (!ok) DIE("find_batch on arrays failed");
+
+	// Ranges of 11 keys each, some overlapping, given in reverse.
+	stream<std::pair<boost::int64_t, boost::int64_t> > ranges;
+	for (boost::int64_t i=key_count-11; i >= 0; i -= 7)
+		ranges.write_item(std::make_pair(key_at(i+10), key_at(i)));
+	size_t expected = 11 * ranges.stream_len();
+	stream<el_t> out;
+	if (t.range_query_batch(&ranges, &out) != expected) DIE("range_query_batch count failed");
+	if ((size_t)out.stream_len() != expected) DIE("range_query_batch output failed");
+	out.seek(0);
+	boost::int64_t first = (key_count-11) % 7;
+	for (boost::int64_t r=0; r*7+first <= key_count-11; ++r)
+		for (boost::int64_t i=0; i < 11; ++i) {
+			if (out.read_item(&v) != NO_ERROR || v->key != key_at(r*7+first+i))
+				DIE("range_query_batch output wrong");
+		}
+
+	// Batches of a single key or range.
+	stream<boost::int64_t> one_key;
+	one_key.write_item(key_at(42));
+	if (t.find_batch(&one_key, NULL) != 1) DIE("find_batch of one key failed");
+	stream<std::pair<boost::int64_t, boost::int64_t> > one_range;
+	one_range.write_item(std::make_pair(key_at(50), key_at(40)));
+	if (t.range_query_batch(&one_range, NULL) != 11) DIE("range_query_batch of one range failed");
+
+	t.concurrent_reads(true);
+	if (t.find_batch(&keys, NULL) != (size_t)key_count) DIE("find_batch in concurrent read mode failed");
+	if (t.range_query_batch(&ranges, NULL) != expected) DIE("range_query_batch in concurrent read mode failed");
+	return true;
+}
+
+bool buffered_test() {
+	btree_t t(small_params());
+	t.buffered_updates(true);
+	if (!t.buffered_updates()) DIE("buffered_updates not enabled");
+	fill(t);
+	if (t.size() != 0) DIE("buffered inserts were applied early");
+
+	// Later updates to a key must win over earlier ones.
+	el_t e(key_at(5));
+	e.value = -1;
+	t.modify(e);
+	t.erase(key_at(7));
+	t.insert(el_t(key_at(7)));
+	t.erase(key_at(9));
+
+	el_t v;
+	if (!t.find(key_at(5), v) || v.value != -1) DIE("buffered modify failed");
+	if (t.size() != key_count-1) DIE("size after flush failed");
+	if (!t.find(key_at(7), v)) DIE("buffered erase and insert failed");
+	if (t.find(key_at(9), v)) DIE("buffered erase failed");
+	t.insert(el_t(key_at(9)));
+	t.modify(el_t(key_at(5)));
+	if (t.flush() != NO_ERROR) DIE("flush failed");
+	if (!check_queries(t, 0, 1)) return false;
+
+	// A single buffered update is applied.
+	btree_t w(small_params());
+	w.buffered_updates(true);
+	w.insert(el_t(key_at(3)));
+	if (w.flush() != NO_ERROR) DIE("flush of one update failed");
+	if (w.size() != 1 || !w.find(key_at(3), v)) DIE("single buffered insert was lost");
+
+	// A small buffer is flushed automatically.
+	btree_params params = small_params();
+	params.update_buffer_size = 100;
+	btree_t u(params);
+	u.buffered_updates(true);
+	fill(u);
+	if (u.size() < key_count - 100) DIE("update buffer was not flushed when full");
+	u.buffered_updates(false);
+	if (u.size() != key_count) DIE("leaving buffered mode did not flush");
+	return check_queries(u, 0, 7);
+}
+
+// Insert n keys spaced by step (in scattered order), then erase most of
+// them, checking the contents along the way.
+static bool compressed_run(btree_params params, boost::int64_t step, TPIE_OS_OFFSET& nodes) {
+	const boost::int64_t n = 40000;
+	btree_t t(params);
+	for (boost::int64_t i=0; i < n; ++i)
+		if (!t.insert(el_t(((i*7919) % n) * step))) DIE("insert failed");
+	if (t.size() != n) DIE("size failed");
+	nodes = t.stats().get(NODE_COUNT);
+
+	el_t v;
+	for (boost::int64_t i=0; i < n; ++i)
+		if (!t.find(i*step, v) || v.key != i*step) DIE("find failed");
+	if (t.range_query(0, (n-1)*step, NULL) != (size_t)n) DIE("range_query failed");
+
+	for (boost::int64_t i=0; i < n; ++i) {
+		boost::int64_t j = (i*7919) % n;
+		if (j % 10 != 0 && !t.erase(j*step)) DIE("erase failed");
+	}
+	for (boost::int64_t i=0; i < n; ++i)
+		if (t.find(i*step, v) != (i % 10 == 0)) DIE("find after erase failed");
+	if (t.size() != n/10) DIE("size after erase failed");
+	if (t.range_query(0, (n-1)*step, NULL) != (size_t)(n/10)) DIE("range_query after erase failed");
+	return true;
+}
+
+bool compressed_test() {
+	btree_params params;
+	params.leaf_size_max = 8;
+	TPIE_OS_OFFSET plain_nodes, dense_nodes, sparse_nodes, negative_nodes;
+	if (!compressed_run(params, 3, plain_nodes)) return false;
+
+	params.node_compression = 3;
+	// Small gaps: the node capacity is the limit.
+	if (!compressed_run(params, 3, dense_nodes)) return false;
+	// Gaps of several bytes: nodes fill their blocks before their capacity.
+	if (!compressed_run(params, 1234567891, sparse_nodes)) return false;
+	// Negative keys, spread over the whole range of the key type.
+	if (!compressed_run(params, -230584300921369LL, negative_nodes)) return false;
+
+	if (dense_nodes * 2 > plain_nodes) DIE("compression did not raise the fanout");
+	if (sparse_nodes > plain_nodes) DIE("compression lowered the fanout");
+
+	// A persistent tree is read in the node format it was written in,
+	// whatever the parameters say when it is opened again.
+	std::string name = tempname::tpie_name("btree");
+	{
+		btree_t t(name, WRITE_COLLECTION, params);
+		fill(t);
+	}
+	btree_params plain;
+	plain.leaf_size_max = 8;
+	btree_t t(name, WRITE_COLLECTION, plain);
+	t.persist(PERSIST_DELETE);
+	if (!t.is_valid()) DIE("reopening failed");
+	if (t.params().node_compression != params.node_compression) DIE("node format of the tree not used");
+	// Decoded nodes are larger, so fewer are cached.
+	if (t.params().node_cache_size != plain.node_cache_size / params.node_compression)
+		DIE("node cache not shrunk: " << t.params().node_cache_size);
+	if (t.size() != key_count) DIE("size after reopening failed");
+	return check_queries(t, 0, 13);
+}
+
+typedef std::pair<boost::int64_t, boost::int64_t> pair_key_t;
+
+struct pair_el_t {
+	pair_key_t key;
+	boost::int64_t value;
+	pair_el_t(pair_key_t k=pair_key_t()): key(k), value(k.second*3) {}
+};
+
+struct key_from_pair_el {
+	pair_key_t operator()(const pair_el_t& v) const { return v.key; }
+};
+
+typedef btree<pair_key_t, pair_el_t, less<pair_key_t>, key_from_pair_el> pair_btree_t;
+
+// Composite keys in groups that share their first component.
+static pair_key_t pair_at(boost::int64_t i) {
+	return pair_key_t((i / 50) * 1000000007LL - 5000000000LL, i * 977);
+}
+
+static bool front_coded_run(btree_params params, TPIE_OS_OFFSET& nodes) {
+	const boost::int64_t n = 40000;
+	pair_btree_t t(params);
+	for (boost::int64_t i=0; i < n; ++i)
+		if (!t.insert(pair_el_t(pair_at((i*7919) % n)))) DIE("insert failed");
+	if (t.size() != n) DIE("size failed");
+	nodes = t.stats().get(NODE_COUNT);
+
+	pair_el_t v;
+	for (boost::int64_t i=0; i < n; ++i)
+		if (!t.find(pair_at(i), v) || v.key != pair_at(i)) DIE("find failed");
+	if (t.range_query(pair_at(100), pair_at(199), NULL) != 100) DIE("range_query failed");
+
+	for (boost::int64_t i=0; i < n; ++i) {
+		boost::int64_t j = (i*7919) % n;
+		if (j % 10 != 0 && !t.erase(pair_at(j))) DIE("erase failed");
+	}
+	for (boost::int64_t i=0; i < n; ++i)
+		if (t.find(pair_at(i), v) != (i % 10 == 0)) DIE("find after erase failed");
+	if (t.size() != n/10) DIE("size after erase failed");
+	return true;
+}
+
+bool front_coded_test() {
+	// The byte representation keeps the order of the keys.
+	typedef btree_key_bytes<pair_key_t, less<pair_key_t> > bytes_t;
+	if (!btree_key_codec<pair_key_t, less<pair_key_t> >::enabled) DIE("pair keys cannot be compressed");
+	boost::int64_t parts[] = {-5000000000LL, -1, 0, 1, 977, 5000000000LL};
+	const size_t np = sizeof(parts) / sizeof(parts[0]);
+	for (size_t a=0; a < np*np; ++a)
+		for (size_t b=0; b < np*np; ++b) {
+			pair_key_t x(parts[a / np], parts[a % np]);
+			pair_key_t y(parts[b / np], parts[b % np]);
+			unsigned char bx[bytes_t::size], by[bytes_t::size];
+			bytes_t::put(bx, x);
+			bytes_t::put(by, y);
+			if (bytes_t::get(bx) != x) DIE("byte representation does not round trip");
+			if ((memcmp(bx, by, bytes_t::size) < 0) != (x < y)) DIE("byte representation out of order");
+		}
+
+	btree_params params;
+	params.leaf_size_max = 8;
+	TPIE_OS_OFFSET plain_nodes, coded_nodes;
+	if (!front_coded_run(params, plain_nodes)) return false;
+	params.node_compression = 3;
+	if (!front_coded_run(params, coded_nodes)) return false;
+	if (coded_nodes * 3 > plain_nodes * 2) DIE("front coding did not raise the fanout " << coded_nodes << " " << plain_nodes);
+	return true;
+}
+
+// Compare btree_key_search with std::lower_bound on sorted arrays of
+// random keys (with duplicates) of every length up to a few windows.
+template<class T>
+static bool search_run(const char* name) {
+	std::vector<T> a;
+	for (size_t n=0; n < 300; ++n) {
+		a.clear();
+		for (size_t i=0; i < n; ++i)
+			a.push_back((T)(((boost::uint64_t)rand() << 33) ^ ((boost::uint64_t)rand() << 11) ^ rand()) / 3 * 3);
+		std::sort(a.begin(), a.end());
+		for (size_t i=0; i < n+2; ++i) {
+			T k = (i < n) ? a[i] : (T)rand();
+			for (int d=-1; d <= 1; ++d) {
+				T p = (T)(k + d);
+				size_t want = std::lower_bound(a.begin(), a.end(), p) - a.begin();
+				size_t got = btree_key_search<T, less<T> >::lower_bound(n ? &a[0] : NULL, n, p, less<T>());
+				if (got != want) DIE("search failed for " << name << " keys");
+			}
+		}
+	}
+	return true;
+}
+
+bool search_test() {
+	return search_run<boost::int16_t>("int16")
+		&& search_run<boost::int32_t>("int32")
+		&& search_run<boost::uint32_t>("uint32")
+		&& search_run<boost::int64_t>("int64")
+		&& search_run<boost::uint64_t>("uint64")
+		&& search_run<double>("double");
+}
+
+int main(int argc, char **argv) {
+	if(argc != 2) return 1;
+	std::string test(argv[1]);
+	if (test == "basic")
+		return basic_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "concurrent")
+		return concurrent_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "batch")
+		return batch_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "buffered")
+		return buffered_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "compressed")
+		return compressed_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "front_coded")
+		return front_coded_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "search")
+		return search_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	return EXIT_FAILURE;
+}
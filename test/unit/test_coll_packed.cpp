@@ -0,0 +1,402 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2010, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+
+#include "common.h"
+#include <tpie/crc32c.h>
+#include <tpie/lz_codec.h>
+#include <tpie/bte/coll.h>
+#include <tpie/bte/block_cache.h>
+#include <tpie/btree.h>
+#include <tpie/tempname.h>
+#include <cstring>
+#include <cstdio>
+#include <vector>
+
+using namespace tpie;
+using namespace tpie::bte;
+using namespace std;
+
+typedef collection_packed<TPIE_BLOCK_ID_TYPE> coll_t;
+
+static void setup() {
+	limit_memory(64*1024*1024);
+	// Read every block from the file.
+	block_cache::instance().set_capacity(0);
+}
+
+// Block i holds a short run of words, the rest is zero.
+static void fill_block(char * place, TPIE_OS_SIZE_T bs, int i) {
+	memset(place, 0, bs);
+	for (TPIE_OS_SIZE_T j=0; j < bs / 16; j += sizeof(int)) {
+		int v = i * 1000 + static_cast<int>(j);
+		memcpy(place + j, &v, sizeof(int));
+	}
+}
+
+static bool check_block(const char * place, TPIE_OS_SIZE_T bs, int i) {
+	vector<char> expect(bs);
+	fill_block(&expect[0], bs, i);
+	return memcmp(place, &expect[0], bs) == 0;
+}
+
+static bool crc_test() {
+	const char * check = "123456789";
+	if (crc32c(check, 9) != 0xe3069283u) DIE("wrong check value " << hex << crc32c(check, 9));
+
+	// Checksums can be computed piecewise, at any alignment.
+	vector<char> buf(1000);
+	for (TPIE_OS_SIZE_T i=0; i < buf.size(); ++i) buf[i] = static_cast<char>(i * 37 + 11);
+	boost::uint32_t whole = crc32c(&buf[0] + 3, 997);
+	boost::uint32_t part = crc32c(&buf[0] + 3, 500);
+	if (crc32c(&buf[0] + 503, 497, part) != whole) DIE("piecewise checksum differs");
+	buf[700] ^= 1;
+	if (crc32c(&buf[0] + 3, 997) == whole) DIE("bit flip not detected");
+	return true;
+}
+
+static bool round_trip(const vector<char> & in) {
+	vector<char> packed(lz_compress_bound(in.size()));
+	TPIE_OS_SIZE_T n = lz_compress(in.empty() ? NULL : &in[0], in.size(), &packed[0], packed.size());
+	if (n == 0 && !in.empty()) DIE("compression failed for " << in.size() << " bytes");
+	vector<char> out(in.size() + 1);
+	if (!lz_decompress(&packed[0], n, &out[0], in.size())) DIE("decompression failed for " << in.size() << " bytes");
+	if (!equal(in.begin(), in.end(), out.begin())) DIE("round trip differs for " << in.size() << " bytes");
+	// The wrong size is detected.
+	if (!in.empty() && lz_decompress(&packed[0], n, &out[0], in.size() + 1)) DIE("wrong size accepted");
+	return true;
+}
+
+static bool lz_test() {
+	TPIE_OS_SIZE_T sizes[] = {0, 1, 5, 12, 13, 100, 4096, 65536, 100000};
+	boost::uint32_t x = 12345;
+	for (TPIE_OS_SIZE_T s=0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+		vector<char> in(sizes[s]);
+		// Random bytes.
+		for (TPIE_OS_SIZE_T i=0; i < in.size(); ++i) {
+			x = x * 1103515245 + 12345;
+			in[i] = static_cast<char>(x >> 16);
+		}
+		if (!round_trip(in)) return false;
+		// Repeats at several distances.
+		for (TPIE_OS_SIZE_T i=0; i < in.size(); ++i)
+			in[i] = static_cast<char>((i % 7) * (i % 300 < 150 ? 1 : 3));
+		if (!round_trip(in)) return false;
+	}
+
+	// Zeros compress well, and a small output buffer is refused.
+	vector<char> zeros(65536, 0), packed(lz_compress_bound(zeros.size()));
+	TPIE_OS_SIZE_T n = lz_compress(&zeros[0], zeros.size(), &packed[0], packed.size());
+	if (n == 0 || n > zeros.size() / 100) DIE("zeros compressed to " << n << " bytes");
+	if (lz_compress(&zeros[0], zeros.size(), &packed[0], n - 1) != 0) DIE("output overflow not reported");
+
+	// Truncated input is rejected.
+	vector<char> out(zeros.size());
+	if (lz_decompress(&packed[0], n - 1, &out[0], out.size())) DIE("truncated input accepted");
+	return true;
+}
+
+static bool write_blocks(coll_t & coll, int n, vector<TPIE_OS_OFFSET> & bids) {
+	const TPIE_OS_SIZE_T bs = coll.block_size();
+	void * place;
+	for (int i=0; i < n; ++i) {
+		TPIE_OS_OFFSET bid;
+		if (coll.new_block(bid, place) != NO_ERROR) DIE("new_block failed");
+		fill_block(static_cast<char *>(place), bs, i);
+		if (coll.put_block(bid, place) != NO_ERROR) DIE("put_block failed");
+		bids.push_back(bid);
+	}
+	return true;
+}
+
+static bool read_blocks(coll_t & coll, const vector<TPIE_OS_OFFSET> & bids) {
+	const TPIE_OS_SIZE_T bs = coll.block_size();
+	void * place;
+	for (TPIE_OS_SIZE_T i=0; i < bids.size(); ++i) {
+		if (coll.get_block(bids[i], place) != NO_ERROR) DIE("get_block failed for " << bids[i]);
+		if (!check_block(static_cast<char *>(place), bs, static_cast<int>(i))) DIE("wrong contents of block " << bids[i]);
+		if (coll.put_block(bids[i], place) != NO_ERROR) DIE("put_block failed");
+	}
+	return true;
+}
+
+static bool basic_test() {
+	setup();
+	std::string name = tempname::tpie_name("coll_packed");
+	coll_t coll(name, WRITE_COLLECTION);
+	coll.persist(PERSIST_DELETE);
+	if (coll.status() != COLLECTION_STATUS_VALID) DIE("collection not valid");
+	const int n = 200;
+	vector<TPIE_OS_OFFSET> bids;
+	if (!write_blocks(coll, n, bids)) return false;
+	if (!read_blocks(coll, bids)) return false;
+	TPIE_OS_OFFSET raw = static_cast<TPIE_OS_OFFSET>(n) * coll.block_size();
+	if (coll.stored_bytes() * 4 > raw) DIE("blocks not compressed: " << coll.stored_bytes() << " of " << raw);
+
+	// A block that was never written reads as zeros.
+	TPIE_OS_OFFSET bid;
+	void * place;
+	if (coll.new_block(bid, place) != NO_ERROR) DIE("new_block failed");
+	if (coll.delete_block(bid, place) != NO_ERROR) DIE("delete_block failed");
+	return true;
+}
+
+static bool reopen_test() {
+	setup();
+	std::string name = tempname::tpie_name("coll_packed");
+	vector<TPIE_OS_OFFSET> bids;
+	{
+		coll_t coll(name, WRITE_COLLECTION);
+		if (!write_blocks(coll, 100, bids)) return false;
+	}
+	{
+		coll_t coll(name, READ_COLLECTION);
+		if (coll.status() != COLLECTION_STATUS_VALID) DIE("collection not valid after reopening");
+		if (!read_blocks(coll, bids)) return false;
+	}
+	{
+		// The formats are not interchangeable.
+		collection_ufs<TPIE_BLOCK_ID_TYPE> coll(name, READ_COLLECTION);
+		if (coll.status() == COLLECTION_STATUS_VALID) DIE("packed collection opened as ufs");
+	}
+	coll_t coll(name, WRITE_COLLECTION);
+	coll.persist(PERSIST_DELETE);
+	return read_blocks(coll, bids);
+}
+
+// Blocks that change size move to other slots, and freed slots are
+// reused.
+static bool rewrite_test() {
+	setup();
+	std::string name = tempname::tpie_name("coll_packed");
+	vector<TPIE_OS_OFFSET> bids;
+	{
+		coll_t coll(name, WRITE_COLLECTION);
+		if (!write_blocks(coll, 50, bids)) return false;
+		const TPIE_OS_SIZE_T bs = coll.block_size();
+		void * place;
+
+		// Fill every other block with noise, so it does not compress.
+		boost::uint32_t x = 1;
+		for (TPIE_OS_SIZE_T i=0; i < bids.size(); i += 2) {
+			if (coll.get_block(bids[i], place) != NO_ERROR) DIE("get_block failed");
+			for (TPIE_OS_SIZE_T j=0; j < bs; ++j) {
+				x = x * 1103515245 + 12345;
+				static_cast<char *>(place)[j] = static_cast<char>(x >> 16);
+			}
+			if (coll.put_block(bids[i], place) != NO_ERROR) DIE("put_block failed");
+		}
+		if (coll.stored_bytes() < static_cast<TPIE_OS_OFFSET>(25 * bs)) DIE("noise compressed");
+
+		// And back.
+		for (TPIE_OS_SIZE_T i=0; i < bids.size(); i += 2) {
+			if (coll.get_block(bids[i], place) != NO_ERROR) DIE("get_block failed");
+			fill_block(static_cast<char *>(place), bs, static_cast<int>(i));
+			if (coll.put_block(bids[i], place) != NO_ERROR) DIE("put_block failed");
+		}
+		if (!read_blocks(coll, bids)) return false;
+		TPIE_OS_OFFSET stored = coll.stored_bytes();
+
+		// Deleted blocks free their slots.
+		for (TPIE_OS_SIZE_T i=1; i < bids.size(); i += 2) {
+			if (coll.get_block(bids[i], place) != NO_ERROR) DIE("get_block failed");
+			if (coll.delete_block(bids[i], place) != NO_ERROR) DIE("delete_block failed");
+		}
+		if (coll.stored_bytes() * 3 > stored * 2) DIE("slots of deleted blocks not freed " << coll.stored_bytes() << " " << stored);
+		vector<TPIE_OS_OFFSET> kept;
+		for (TPIE_OS_SIZE_T i=0; i < bids.size(); i += 2) kept.push_back(bids[i]);
+		bids = kept;
+	}
+	TPIE_OS_OFFSET size = 0;
+	{
+		coll_t coll(name, WRITE_COLLECTION);
+		const TPIE_OS_SIZE_T bs = coll.block_size();
+		void * place;
+		for (TPIE_OS_SIZE_T i=0; i < bids.size(); ++i) {
+			if (coll.get_block(bids[i], place) != NO_ERROR) DIE("get_block failed");
+			if (!check_block(static_cast<char *>(place), bs, static_cast<int>(2 * i))) DIE("wrong contents of block " << bids[i]);
+			if (coll.put_block(bids[i], place) != NO_ERROR) DIE("put_block failed");
+		}
+		size = coll.file_size();
+
+		// New blocks reuse the freed ids and slots.
+		vector<TPIE_OS_OFFSET> more;
+		if (!write_blocks(coll, 25, more)) return false;
+		if (coll.file_size() != size) DIE("freed block ids not reused");
+		coll.persist(PERSIST_DELETE);
+	}
+	return true;
+}
+
+// A damaged block is reported, not returned.
+static bool corrupt_test() {
+	setup();
+	std::string name = tempname::tpie_name("coll_packed");
+	vector<TPIE_OS_OFFSET> bids;
+	{
+		coll_t coll(name, WRITE_COLLECTION);
+		if (!write_blocks(coll, 4, bids)) return false;
+	}
+
+	// The first slot starts right after the header.
+	std::string blk = name + ".blk";
+	FILE * f = fopen(blk.c_str(), "r+b");
+	if (!f) DIE("cannot open " << blk);
+	fseek(f, static_cast<long>(TPIE_OS_BLOCKSIZE()) + 12, SEEK_SET);
+	int c = fgetc(f);
+	fseek(f, static_cast<long>(TPIE_OS_BLOCKSIZE()) + 12, SEEK_SET);
+	fputc(c ^ 0x10, f);
+	fclose(f);
+
+	coll_t coll(name, WRITE_COLLECTION);
+	coll.persist(PERSIST_DELETE);
+	void * place;
+	if (coll.get_block(bids[0], place) != CHECKSUM_ERROR) DIE("damaged block not detected");
+	for (TPIE_OS_SIZE_T i=1; i < bids.size(); ++i) {
+		if (coll.get_block(bids[i], place) != NO_ERROR) DIE("get_block failed for " << bids[i]);
+		if (!check_block(static_cast<char *>(place), coll.block_size(), static_cast<int>(i))) DIE("wrong contents of block " << bids[i]);
+		if (coll.put_block(bids[i], place) != NO_ERROR) DIE("put_block failed");
+	}
+	return true;
+}
+
+// A slot of another block is not taken for the block whose slot it
+// replaced.
+static bool stale_test() {
+	setup();
+	std::string name = tempname::tpie_name("coll_packed");
+	vector<TPIE_OS_OFFSET> bids;
+	TPIE_OS_SIZE_T bs;
+	{
+		// Uncompressed, so that all slots are the same size.
+		coll_t coll(name, WRITE_COLLECTION, 1, false);
+		bs = coll.block_size();
+		if (!write_blocks(coll, 2, bids)) return false;
+	}
+
+	// Copy the second slot over the first.
+	const long header = static_cast<long>(TPIE_OS_BLOCKSIZE());
+	const long slot = static_cast<long>((8 + bs + COLLECTION_PACKED_GRANULE - 1) /
+										COLLECTION_PACKED_GRANULE * COLLECTION_PACKED_GRANULE);
+	vector<char> data(slot);
+	std::string blk = name + ".blk";
+	FILE * f = fopen(blk.c_str(), "r+b");
+	if (!f) DIE("cannot open " << blk);
+	fseek(f, header + slot, SEEK_SET);
+	if (fread(&data[0], 1, slot, f) != static_cast<size_t>(slot)) DIE("short read");
+	fseek(f, header, SEEK_SET);
+	fwrite(&data[0], 1, slot, f);
+	fclose(f);
+
+	coll_t coll(name, WRITE_COLLECTION, 1, false);
+	coll.persist(PERSIST_DELETE);
+	void * place;
+	if (coll.get_block(bids[0], place) != CHECKSUM_ERROR) DIE("slot of another block not detected");
+	if (coll.get_block(bids[1], place) != NO_ERROR) DIE("get_block failed");
+	if (!check_block(static_cast<char *>(place), bs, 1)) DIE("wrong contents of block " << bids[1]);
+	return coll.put_block(bids[1], place) == NO_ERROR;
+}
+
+// A collection that was not closed, as after a crash, is not opened.
+static bool crash_test() {
+	setup();
+	std::string name = tempname::tpie_name("coll_packed");
+	std::string copy = tempname::tpie_name("coll_packed");
+	vector<TPIE_OS_OFFSET> bids;
+	{
+		coll_t coll(name, WRITE_COLLECTION);
+		coll.persist(PERSIST_DELETE);
+		if (!write_blocks(coll, 4, bids)) return false;
+
+		// Take the file as it is while the collection is open.
+		std::string blk = name + ".blk";
+		FILE * in = fopen(blk.c_str(), "rb");
+		FILE * out = fopen((copy + ".blk").c_str(), "wb");
+		if (!in || !out) DIE("cannot copy " << blk);
+		int c;
+		while ((c = fgetc(in)) != EOF) fputc(c, out);
+		fclose(in);
+		fclose(out);
+	}
+	{
+		coll_t coll(copy, READ_COLLECTION);
+		if (coll.status() == COLLECTION_STATUS_VALID) DIE("collection opened that was not closed");
+	}
+	coll_t coll(copy, WRITE_COLLECTION);
+	coll.persist(PERSIST_DELETE);
+	if (coll.status() == COLLECTION_STATUS_VALID) DIE("collection opened for writing that was not closed");
+	return true;
+}
+
+struct el_t {
+	boost::int64_t key;
+	boost::int64_t value;
+	el_t(boost::int64_t k=0): key(k), value(k*3) {}
+};
+
+struct key_from_el {
+	boost::int64_t operator()(const el_t& v) const { return v.key; }
+};
+
+typedef tpie::ami::btree<boost::int64_t, el_t, less<boost::int64_t>, key_from_el, bte::COLLECTION_PACKED> btree_t;
+
+// A B-tree works on packed collections.
+static bool btree_test() {
+	setup();
+	const boost::int64_t n = 20000;
+	std::string name = tempname::tpie_name("coll_packed");
+	{
+		btree_t t(name, tpie::ami::WRITE_COLLECTION);
+		for (boost::int64_t i=0; i < n; ++i)
+			t.insert(el_t((i*7919) % n));
+		if (t.size() != static_cast<TPIE_OS_OFFSET>(n)) DIE("wrong size " << t.size());
+	}
+	btree_t t(name, tpie::ami::READ_COLLECTION);
+	t.persist(PERSIST_DELETE);
+	if (t.size() != static_cast<TPIE_OS_OFFSET>(n)) DIE("wrong size after reopening " << t.size());
+	if (t.range_query(100, 5099, NULL) != 5000) DIE("range_query failed");
+	el_t e;
+	if (!t.find(4321, e) || e.value != 4321*3) DIE("find failed");
+	return true;
+}
+
+int main(int argc, char **argv) {
+	if (argc != 2) return 1;
+	std::string test(argv[1]);
+	if (test == "crc")
+		return crc_test() ? EXIT_SUCCESS : EXIT_FAILURE;
+	else if (test == "lz")
+		return lz_test() ? EXIT_SUCCESS : EXIT_FAILURE;
+	else if (test == "basic")
+		return basic_test() ? EXIT_SUCCESS : EXIT_FAILURE;
+	else if (test == "reopen")
+		return reopen_test() ? EXIT_SUCCESS : EXIT_FAILURE;
+	else if (test == "rewrite")
+		return rewrite_test() ? EXIT_SUCCESS : EXIT_FAILURE;
+	else if (test == "corrupt")
+		return corrupt_test() ? EXIT_SUCCESS : EXIT_FAILURE;
+	else if (test == "stale")
+		return stale_test() ? EXIT_SUCCESS : EXIT_FAILURE;
+	else if (test == "crash")
+		return crash_test() ? EXIT_SUCCESS : EXIT_FAILURE;
+	else if (test == "btree")
+		return btree_test() ? EXIT_SUCCESS : EXIT_FAILURE;
+	std::cerr << "No such test" << std::endl;
+	return EXIT_FAILURE;
+}
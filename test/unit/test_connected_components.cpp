@@ -0,0 +1,101 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2010, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#include "common.h"
+#include <tpie/connected_components.h>
+#include <map>
+#include <vector>
+#include <boost/random/linear_congruential.hpp>
+
+using namespace tpie;
+using namespace tpie::ami;
+using namespace std;
+
+typedef boost::uint64_t vertex_t;
+typedef pair<vertex_t, vertex_t> edge_t;
+
+static vertex_t find(map<vertex_t, vertex_t> & p, vertex_t v) {
+	while (p[v] != v) v = p[v] = p[p[v]];
+	return v;
+}
+
+// A sparse random graph on vertices 0, stride, 2 stride, ..., with some
+// isolated vertices given as loops.
+static bool cc_test(vertex_t stride, TPIE_OS_SIZE_T memory) {
+	limit_memory(16*1024*1024);
+	boost::rand48 prng(42);
+	const vertex_t n = 30000;
+	stream<edge_t> edges;
+	map<vertex_t, vertex_t> p;
+	for (int i=0; i < 20000; ++i) {
+		vertex_t a = (prng() % n) * stride;
+		vertex_t b = (i % 10 == 0) ? a : (prng() % n) * stride;
+		edges.write_item(edge_t(a, b));
+		if (!p.count(a)) p[a] = a;
+		if (!p.count(b)) p[b] = b;
+		vertex_t ra = find(p, a), rb = find(p, b);
+		if (ra < rb) p[rb] = ra; else p[ra] = rb;
+	}
+
+	stream<edge_t> out;
+	if (connected_components(&edges, &out, memory) != NO_ERROR) DIE("connected_components failed");
+	if (out.stream_len() != TPIE_OS_OFFSET(p.size())) DIE("wrong vertex count " << out.stream_len() << " " << p.size());
+	out.seek(0);
+	edge_t * e;
+	for (map<vertex_t, vertex_t>::iterator i=p.begin(); i != p.end(); ++i) {
+		if (out.read_item(&e) != NO_ERROR) DIE("read failed");
+		if (e->first != i->first) DIE("wrong vertex");
+		if (e->second != find(p, i->first)) DIE("wrong component of " << e->first);
+	}
+	return true;
+}
+
+// Recursion down to single edges.
+static bool tiny_test() {
+	limit_memory(16*1024*1024);
+	stream<edge_t> edges;
+	edges.write_item(edge_t(1000000, 2000000));
+	edges.write_item(edge_t(3000000, 4000000));
+	edges.write_item(edge_t(2000000, 3000000));
+	edges.write_item(edge_t(5000000, 5000000));
+	stream<edge_t> out;
+	if (connected_components(&edges, &out, 1) != NO_ERROR) DIE("connected_components failed");
+	if (out.stream_len() != 5) DIE("wrong vertex count " << out.stream_len());
+	out.seek(0);
+	edge_t * e;
+	for (vertex_t v=1; v <= 5; ++v) {
+		if (out.read_item(&e) != NO_ERROR) DIE("read failed");
+		if (e->first != v * 1000000 || e->second != (v < 5 ? 1000000 : 5000000)) DIE("wrong component of " << e->first);
+	}
+	return true;
+}
+
+int main(int argc, char **argv) {
+	if(argc != 2) return 1;
+	std::string test(argv[1]);
+	if (test == "memory")
+		return cc_test(1, 0)?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "semi_external")
+		return cc_test(1, 256*1024)?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "external")
+		return cc_test(1000003, 32*1024)?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "tiny")
+		return tiny_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	return EXIT_FAILURE;
+}
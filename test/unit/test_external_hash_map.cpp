@@ -0,0 +1,135 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2010, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#include "common.h"
+#include <tpie/external_hash_map.h>
+#include <map>
+#include <vector>
+#include <algorithm>
+#include <boost/random/linear_congruential.hpp>
+
+using namespace tpie;
+using namespace tpie::ami;
+using namespace std;
+
+typedef external_hash_map<int, int> map_t;
+typedef external_hash_map<int, short> map2_t;
+typedef pair<map_t::value_t, map2_t::value_t> joined_t;
+
+struct sum {
+	void operator()(int & acc, const int & d) const {acc += d;}
+};
+
+struct aggregate_sink {
+	map<int, int> res;
+	bool dup;
+	aggregate_sink(): dup(false) {}
+	void begin(TPIE_OS_OFFSET = 0) {}
+	void push(const map_t::value_t & v) {
+		if (res.count(v.first)) dup = true;
+		res[v.first] = v.second;
+	}
+	void end() {}
+};
+
+struct join_sink {
+	vector<joined_t> res;
+	void begin(TPIE_OS_OFFSET = 0) {}
+	void push(const joined_t & v) {res.push_back(v);}
+	void end() {}
+};
+
+// A small memory budget and fan-out, so buckets are split several times.
+static external_hash_params small_params() {
+	external_hash_params params;
+	params.memory = 16*1024;
+	params.fanout = 4;
+	return params;
+}
+
+static bool aggregate_test(const external_hash_params & params, int keys=20000) {
+	limit_memory(16*1024*1024);
+	boost::rand48 prng(42);
+	map_t m(params);
+	map<int, int> expected;
+	for (int i=0; i < 100000; ++i) {
+		int k = prng() % keys;
+		int d = prng() % 100;
+		m.insert(k, d);
+		expected[k] += d;
+	}
+	aggregate_sink sink;
+	if (m.aggregate(sum(), sink) != NO_ERROR) DIE("aggregate failed");
+	if (sink.dup) DIE("key reported twice");
+	if (sink.res != expected) DIE("wrong aggregate");
+	return true;
+}
+
+static bool join_test(const external_hash_params & params, bool skew) {
+	limit_memory(16*1024*1024);
+	boost::rand48 prng(17);
+	map_t left(params);
+	map2_t right(params);
+	vector<map_t::value_t> lv;
+	vector<map2_t::value_t> rv;
+	for (int i=0; i < 20000; ++i) {
+		int k = (skew && i % 4 == 0) ? 7 : int(prng() % 30000);
+		left.insert(k, i);
+		lv.push_back(map_t::value_t(k, i));
+	}
+	for (int i=0; i < 5000; ++i) {
+		int k = (skew && i % 100 == 0) ? 7 : int(prng() % 30000);
+		right.insert(k, short(i));
+		rv.push_back(map2_t::value_t(k, short(i)));
+	}
+	multimap<int, int> li;
+	for (size_t i=0; i < lv.size(); ++i) li.insert(lv[i]);
+	vector<joined_t> expected;
+	for (size_t j=0; j < rv.size(); ++j) {
+		pair<multimap<int, int>::iterator, multimap<int, int>::iterator> r = li.equal_range(rv[j].first);
+		for (multimap<int, int>::iterator i=r.first; i != r.second; ++i)
+			expected.push_back(joined_t(*i, rv[j]));
+	}
+	sort(expected.begin(), expected.end());
+
+	join_sink sink;
+	if (left.join(right, sink) != NO_ERROR) DIE("join failed");
+	sort(sink.res.begin(), sink.res.end());
+	if (sink.res != expected) DIE("wrong join: " << sink.res.size() << " pairs, " << expected.size() << " expected");
+	return true;
+}
+
+int main(int argc, char **argv) {
+	if(argc != 2) return 1;
+	std::string test(argv[1]);
+	if (test == "aggregate")
+		return aggregate_test(external_hash_params())?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "aggregate_partitioned")
+		return aggregate_test(small_params())?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "aggregate_few_keys")
+		// The keys fit in memory though the pairs do not, and around it.
+		return (aggregate_test(small_params(), 100) &&
+				aggregate_test(small_params(), 1000))?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "join")
+		return (join_test(external_hash_params(), false) &&
+				join_test(small_params(), false))?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "join_skew")
+		return join_test(small_params(), true)?EXIT_SUCCESS:EXIT_FAILURE;
+	return EXIT_FAILURE;
+}
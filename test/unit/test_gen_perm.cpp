@@ -0,0 +1,125 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2010, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+
+#include "common.h"
+#include <tpie/gen_perm.h>
+#include <boost/random/linear_congruential.hpp>
+
+using namespace tpie;
+using namespace tpie::ami;
+using namespace std;
+
+class reverse_order : public gen_perm_object {
+private:
+	TPIE_OS_OFFSET total_size;
+public:
+	reverse_order() : total_size(0) {}
+
+	err initialize(TPIE_OS_OFFSET ts) {
+		total_size = ts;
+		return NO_ERROR;
+	}
+
+	TPIE_OS_OFFSET destination(TPIE_OS_OFFSET source) {
+		return total_size - 1 - source;
+	}
+};
+
+// i -> a i + b mod n, a permutation for odd a and n a power of two.
+struct affine {
+	TPIE_OS_OFFSET a, b, n;
+	affine(TPIE_OS_OFFSET _a, TPIE_OS_OFFSET _b, TPIE_OS_OFFSET _n): a(_a), b(_b), n(_n) {}
+	TPIE_OS_OFFSET operator()(TPIE_OS_OFFSET i) {return (a * i + b) & (n - 1);}
+};
+
+static bool reverse_test() {
+	limit_memory(64*1024*1024);
+	stream<TPIE_OS_OFFSET> in, out;
+	for (TPIE_OS_OFFSET i=0; i < 100000; ++i) in.write_item(i);
+	reverse_order ro;
+	if (general_permute(&in, &out, &ro) != NO_ERROR) DIE("general_permute failed");
+	if (out.stream_len() != 100000) DIE("wrong length");
+	out.seek(0);
+	TPIE_OS_OFFSET * x;
+	for (TPIE_OS_OFFSET i=0; i < 100000; ++i) {
+		if (out.read_item(&x) != NO_ERROR) DIE("read failed");
+		if (*x != 99999 - i) DIE("wrong item at " << i);
+	}
+	return true;
+}
+
+// Permutes 2^lg items with room for the given number of streams and
+// extra bytes.
+static bool distribute_test(int lg, TPIE_OS_SIZE_T streams, TPIE_OS_SIZE_T extra, int passes) {
+	limit_memory(64*1024*1024);
+	const TPIE_OS_OFFSET n = TPIE_OS_OFFSET(1) << lg;
+	stream<TPIE_OS_OFFSET> in, out;
+	for (TPIE_OS_OFFSET i=0; i < n; ++i) in.write_item(i);
+	TPIE_OS_SIZE_T sz;
+	stream<permute_item<TPIE_OS_OFFSET> > probe;
+	probe.main_memory_usage(&sz, mem::STREAM_USAGE_MAXIMUM);
+	TPIE_OS_SIZE_T memory = streams * sz + extra;
+
+	affine f(12345, 678, n);
+	permute_op<TPIE_OS_OFFSET, affine> op(f, memory);
+	err ae = op.run(&in, &out);
+	if (ae != NO_ERROR) DIE("permute failed " << ae);
+	if (op.passes() != passes) DIE("wrong number of passes " << op.passes());
+	if (out.stream_len() != n) DIE("wrong length");
+	out.seek(0);
+	vector<TPIE_OS_OFFSET> res(n);
+	TPIE_OS_OFFSET * x;
+	for (TPIE_OS_OFFSET i=0; i < n; ++i) {
+		if (out.read_item(&x) != NO_ERROR) DIE("read failed");
+		res[i] = *x;
+	}
+	for (TPIE_OS_OFFSET i=0; i < n; ++i)
+		if (res[f(i)] != i) DIE("wrong destination of " << i);
+	return true;
+}
+
+static bool invalid_test() {
+	limit_memory(64*1024*1024);
+	stream<TPIE_OS_OFFSET> in, out, empty;
+	for (TPIE_OS_OFFSET i=0; i < 1000; ++i) in.write_item(i);
+	affine twice(2, 0, 1024);
+	if (permute(&in, &out, twice) != OBJECT_INVALID) DIE("accepted repeated destinations");
+	affine outside(1, 100, 1024);
+	if (permute(&in, &out, outside) != OBJECT_INVALID) DIE("accepted destinations out of range");
+	stream<TPIE_OS_OFFSET> out2;
+	if (permute(&empty, &out2, twice) != NO_ERROR || out2.stream_len() != 0) DIE("failed on the empty stream");
+	return true;
+}
+
+int main(int argc, char **argv) {
+	if(argc != 2) return 1;
+	std::string test(argv[1]);
+	if (test == "reverse")
+		return reverse_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "memory")
+		return distribute_test(16, 2, 65536 * 9, 1)?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "distribute")
+		return distribute_test(20, 2, 262144 * 9, 2)?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "recursive")
+		return distribute_test(16, 3, 1024, 4)?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "invalid")
+		return invalid_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	return EXIT_FAILURE;
+}
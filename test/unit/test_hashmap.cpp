@@ -68,6 +68,89 @@ bool basic_test() {
 	return true;
 }
 
+// Grow a table from nothing, with erases in between, so both growth and
+// clearing out deleted slots are exercised.
+bool growth_test() {
+	hash_map<int, int, hash<int>, std::equal_to<int>, swiss_hash_table> q1;
+	map<int, int> q2;
+	boost::rand48 prng(42);
+	for(int i=0; i < 200000; ++i) {
+		int k = prng() % 50000;
+		if (prng() % 3 == 0) {
+			if (q1.contains(k) != (q2.count(k) != 0)) {
+				std::cerr << "Contains differs" << std::endl;
+				return false;
+			}
+			if (q2.count(k)) {
+				q1.erase(k);
+				q2.erase(k);
+			}
+		} else {
+			q1[k] = i;
+			q2[k] = i;
+		}
+	}
+	if (q1.size() != q2.size()) {
+		std::cerr << "Size differs " << q1.size() << " " << q2.size() << std::endl;
+		return false;
+	}
+	for (map<int, int>::iterator i=q2.begin(); i != q2.end(); ++i) {
+		if (q1.find((*i).first) == q1.end() || q1[(*i).first] != (*i).second) {
+			std::cerr << "Value differs" << std::endl;
+			return false;
+		}
+	}
+	size_t n=0;
+	for (hash_map<int, int, hash<int>, std::equal_to<int>, swiss_hash_table>::iterator i=q1.begin();
+		 i != q1.end(); ++i) {
+		if (q2.count(i->first) == 0) {
+			std::cerr << "Element too much" << std::endl;
+			return false;
+		}
+		++n;
+	}
+	if (n != q2.size()) {
+		std::cerr << "Iteration differs " << n << " " << q2.size() << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// Keys below one million all hash alike, so they fill the groups one
+// after the other along a single probe sequence.
+struct clustered_hash {
+	inline size_t operator()(int k) const {return k < 1000000 ? 0 : k;}
+};
+
+// Leave a table with no empty slots to spare and many deleted ones, and
+// insert into it. The memory limit is enforced from just after the table
+// is made, so the deleted slots must be cleared out within the table.
+bool swiss_churn_test() {
+	typedef hash_map<int, int, clustered_hash, std::equal_to<int>, swiss_hash_table> map_t;
+	MM_manager.set_memory_limit(128*1024*1024);
+	MM_manager.enforce_memory_limit();
+	map_t * q1 = new map_t(100);
+	MM_manager.set_memory_limit(MM_manager.memory_limit() - MM_manager.memory_available() + 256);
+
+	// Fill 7 of the 8 groups with alike keys and erase most of them. The
+	// groups are full, so their slots become deleted rather than empty.
+	for (int k=0; k < 112; ++k) (*q1)[k] = k;
+	for (int k=0; k < 100; ++k) q1->erase(k);
+	// Some of these keys probe the empty group first, where no empty slot
+	// may be used up any more.
+	for (int k=1000000; k < 1000040; ++k) (*q1)[k] = k;
+
+	bool ok = q1->size() == 52;
+	for (int k=0; k < 112; ++k)
+		if ((q1->find(k) != q1->end()) != (k >= 100) || (k >= 100 && q1->find(k)->second != k)) ok = false;
+	for (int k=1000000; k < 1000040; ++k)
+		if (q1->find(k) == q1->end() || q1->find(k)->second != k) ok = false;
+	delete q1;
+	MM_manager.set_memory_limit(128*1024*1024);
+	if (!ok) std::cerr << "Contents differ" << std::endl;
+	return ok;
+}
+
 struct charm_gen {
 	static inline int key(int i) {
 		return (i*21467) % 0x7FFFFFFF;
@@ -145,6 +228,15 @@ public:
 	virtual size_type claimed_size() {return hash_map<int, char>::memory_usage(123456);}
 };
 
+class swiss_memory_test: public memory_test {
+public:
+	typedef hash_map<int, char, hash<int>, std::equal_to<int>, swiss_hash_table> map_t;
+	map_t * a;
+	virtual void alloc() {a = new map_t(123456);}
+	virtual void free() {delete a;}
+	virtual size_type claimed_size() {return map_t::memory_usage(123456);}
+};
+
 int main(int argc, char **argv) {
 
 	if(argc != 2) return 1;
@@ -153,6 +245,12 @@ int main(int argc, char **argv) {
 		return basic_test<chaining_hash_table>()?EXIT_SUCCESS:EXIT_FAILURE;
 	else if (test == "linear_probing")
 		return basic_test<linear_probing_hash_table>()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "swiss")
+		return basic_test<swiss_hash_table>()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "swiss_churn")
+		return swiss_churn_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "growth")
+		return growth_test()?EXIT_SUCCESS:EXIT_FAILURE;
 	else if (test == "speed") {
 		std::cout << "=====================> Linear Probing, Charm Dataset <========================" << std::endl;
 		test_speed<charm_gen, linear_probing_hash_table>();
@@ -162,12 +260,18 @@ int main(int argc, char **argv) {
 		test_speed<identity_gen, linear_probing_hash_table>();
 		std::cout << "=======================> Chaining, Identity Dataset <=========================" << std::endl;
 		test_speed<identity_gen, chaining_hash_table>();
+		std::cout << "=====================> Swiss Table, Charm Dataset <===========================" << std::endl;
+		test_speed<charm_gen, swiss_hash_table>();
+		std::cout << "====================> Swiss Table, Identity Dataset <=========================" << std::endl;
+		test_speed<identity_gen, swiss_hash_table>();
 		exit(EXIT_SUCCESS);
 	}
 	//else if (test == "iterators") 
 	//	return iterator_test()?EXIT_SUCCESS:EXIT_FAILURE;
 	else if (test == "memory") 
 		return hashmap_memory_test()()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "swiss_memory")
+		return swiss_memory_test()()?EXIT_SUCCESS:EXIT_FAILURE;
 	std::cerr << "No such test" << std::endl;
 	return EXIT_FAILURE;
 }
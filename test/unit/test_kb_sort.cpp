@@ -0,0 +1,138 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2010, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+
+#include "common.h"
+#include <tpie/kb_sort.h>
+#include <vector>
+#include <algorithm>
+#include <boost/random/linear_congruential.hpp>
+
+using namespace tpie;
+using namespace tpie::ami;
+using namespace std;
+
+typedef boost::uint64_t item_t;
+
+struct identity_key {
+	typedef item_t key_type;
+	item_t operator()(const item_t & x) const {return x;}
+};
+
+struct record {
+	boost::uint32_t key;
+	boost::uint32_t value;
+};
+
+struct record_key {
+	typedef boost::uint32_t key_type;
+	boost::uint32_t operator()(const record & r) const {return r.key;}
+};
+
+// Sorts n items drawn from [0, range) with memory for the given number of
+// streams, and checks the result and the number of passes.
+static bool sort_test(TPIE_OS_OFFSET n, item_t range, TPIE_OS_SIZE_T streams,
+					  int min_passes, int max_passes, TPIE_OS_SIZE_T threads = 1) {
+	limit_memory(64*1024*1024);
+	boost::rand48 prng(42);
+	stream<item_t> in, out;
+	vector<item_t> expect;
+	for (TPIE_OS_OFFSET i=0; i < n; ++i) {
+		item_t x = ((item_t(prng()) << 32) ^ prng()) % range;
+		expect.push_back(x);
+		in.write_item(x);
+	}
+	sort(expect.begin(), expect.end());
+	TPIE_OS_SIZE_T sz;
+	in.main_memory_usage(&sz, mem::STREAM_USAGE_MAXIMUM);
+
+	kb_sort_op<item_t, identity_key> op(identity_key(), streams * sz, threads);
+	err ae = op.run(&in, &out);
+	if (ae != NO_ERROR) DIE("kb_sort failed " << ae);
+	if (op.passes() < min_passes || op.passes() > max_passes) DIE("wrong number of passes " << op.passes());
+	if (out.stream_len() != n) DIE("wrong length " << out.stream_len());
+	out.seek(0);
+	item_t * x;
+	for (TPIE_OS_OFFSET i=0; i < n; ++i) {
+		if (out.read_item(&x) != NO_ERROR) DIE("read failed");
+		if (*x != expect[i]) DIE("wrong item at " << i);
+	}
+	return true;
+}
+
+static bool record_test() {
+	limit_memory(64*1024*1024);
+	boost::rand48 prng(7);
+	stream<record> in, out;
+	for (boost::uint32_t i=0; i < 100000; ++i) {
+		record r;
+		r.key = prng() % 1000;
+		r.value = r.key * 3;
+		in.write_item(r);
+	}
+	if (kb_sort(&in, &out, record_key()) != NO_ERROR) DIE("kb_sort failed");
+	if (out.stream_len() != 100000) DIE("wrong length");
+	out.seek(0);
+	record * r;
+	boost::uint32_t prev = 0;
+	while (out.read_item(&r) == NO_ERROR) {
+		if (r->key < prev || r->value != r->key * 3) DIE("wrong order");
+		prev = r->key;
+	}
+	return true;
+}
+
+static bool legacy_test() {
+	limit_memory(64*1024*1024);
+	boost::rand48 prng(3);
+	stream<int> in, out, empty, out2;
+	for (int i=0; i < 10000; ++i) in.write_item(int(prng() % 100000));
+	key_range range(KEY_MIN, KEY_MAX);
+	if (kb_sort(in, out, range) != NO_ERROR) DIE("kb_sort failed");
+	if (out.stream_len() != 10000) DIE("wrong length");
+	out.seek(0);
+	int * x;
+	int prev = 0;
+	while (out.read_item(&x) == NO_ERROR) {
+		if (*x < prev) DIE("wrong order");
+		prev = *x;
+	}
+	if (kb_sort(empty, out2, range) != NO_ERROR || out2.stream_len() != 0) DIE("failed on the empty stream");
+	return true;
+}
+
+int main(int argc, char **argv) {
+	if(argc != 2) return 1;
+	std::string test(argv[1]);
+	if (test == "memory")
+		return sort_test(100000, item_t(-1), 64, 1, 1)?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "distribute")
+		return sort_test(1 << 21, item_t(-1), 24, 2, 2)?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "recursive")
+		return sort_test(1 << 20, item_t(-1), 6, 3, 6)?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "duplicates")
+		return sort_test(1 << 20, 3, 6, 1, 6)?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "threads")
+		return sort_test(1 << 21, item_t(-1), 24, 2, 2, 4)?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "record")
+		return record_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "legacy")
+		return legacy_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,111 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2010, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#include "common.h"
+#include <tpie/kdbtree.h>
+#include <vector>
+#include <algorithm>
+
+using namespace tpie;
+using namespace tpie::ami;
+using namespace std;
+
+typedef kdbtree<int, 2> kdbtree_t;
+typedef kdbtree_t::point_t point_t;
+
+// The number of points in the test trees.
+static const size_t point_count = 20000;
+
+static kdbtree_params small_params() {
+	kdbtree_params params;
+	params.leaf_size_max = 64;
+	params.node_size_max = 32;
+	return params;
+}
+
+// Check the contents of t against the points, with find and window
+// queries.
+static bool check_tree(kdbtree_t& t, const vector<point_t>& pts) {
+	if (t.flush() != NO_ERROR) DIE("flush failed");
+	if (t.size() != (TPIE_OS_OFFSET)pts.size()) DIE("size failed");
+
+	for (size_t i=0; i < pts.size(); i += 37)
+		if (!t.find(pts[i])) DIE("find failed");
+
+	for (int w=0; w < 40; ++w) {
+		point_t lo, hi;
+		random_window(point_count, lo, hi);
+		TPIE_OS_OFFSET expected = 0;
+		for (size_t i=0; i < pts.size(); ++i)
+			if (lo < pts[i] && pts[i] < hi) ++expected;
+		stream<point_t> res;
+		if (t.window_query(lo, hi, &res) != expected) DIE("window_query failed");
+		if (res.stream_len() != expected) DIE("window_query output failed");
+	}
+	return true;
+}
+
+bool buffered_test() {
+	limit_memory(16*1024*1024);
+	vector<point_t> pts = make_points<point_t>(point_count, 23);
+	kdbtree_params params = small_params();
+	params.insert_buffer_size = 3000;
+	kdbtree_t t(tempname::tpie_name("kdbtree"), WRITE_COLLECTION, params);
+	t.persist(PERSIST_DELETE);
+	t.buffered_inserts(true);
+
+	vector<point_t> in;
+	for (size_t i=0; i < pts.size(); ++i) {
+		if (!t.insert(pts[i])) DIE("insert failed");
+		in.push_back(pts[i]);
+		// Queries flush the points buffered so far.
+		if ((i+1) % 7000 == 0 && !check_tree(t, in)) return false;
+	}
+	t.buffered_inserts(false);
+	return check_tree(t, in);
+}
+
+bool buffered_single_test() {
+	limit_memory(16*1024*1024);
+	vector<point_t> pts = make_points<point_t>(point_count, 23);
+	kdbtree_t t(tempname::tpie_name("kdbtree"), WRITE_COLLECTION, small_params());
+	t.persist(PERSIST_DELETE);
+	t.buffered_inserts(true);
+
+	// A buffer of a single point, into an empty tree and into a tree
+	// holding points.
+	for (size_t i=0; i < 3; ++i) {
+		if (!t.insert(pts[i])) DIE("insert failed");
+		if (t.flush() != NO_ERROR) DIE("flush failed");
+		if (t.size() != (TPIE_OS_OFFSET)(i+1)) DIE("size failed");
+		for (size_t j=0; j <= i; ++j)
+			if (!t.find(pts[j])) DIE("find failed");
+	}
+	return true;
+}
+
+int main(int argc, char **argv) {
+	if(argc != 2) return 1;
+	std::string test(argv[1]);
+	if (test == "buffered")
+		return buffered_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "buffered_single")
+		return buffered_single_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,277 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2010, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#include "common.h"
+#include <tpie/kdtree.h>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+using namespace tpie;
+using namespace tpie::ami;
+using namespace std;
+
+typedef kdtree<int, 2> kdtree_t;
+typedef kdtree_t::point_t point_t;
+
+// The number of points in the test trees.
+static const size_t point_count = 400000;
+
+static kdtree_params small_params() {
+	kdtree_params params;
+	params.leaf_size_max = 64;
+	params.node_size_max = 32;
+	return params;
+}
+
+// Check the contents of t against the points, with unload, find and
+// window queries.
+static bool check_tree(kdtree_t& t, const vector<point_t>& pts) {
+	if (t.size() != (TPIE_OS_OFFSET)pts.size()) DIE("size failed");
+
+	stream<point_t> out;
+	if (t.unload(&out) != NO_ERROR) DIE("unload failed");
+	if (out.stream_len() != (TPIE_OS_OFFSET)pts.size()) DIE("unload length failed");
+	vector<bool> seen(pts.size()+1, false);
+	point_t* p;
+	out.seek(0);
+	while (out.read_item(&p) == NO_ERROR) {
+		if (p->id() == 0 || p->id() > pts.size() || seen[p->id()]) DIE("unload output wrong");
+		seen[p->id()] = true;
+	}
+
+	for (size_t i=0; i < pts.size(); i += 97)
+		if (!t.find(pts[i])) DIE("find failed");
+
+	for (int w=0; w < 40; ++w) {
+		point_t lo, hi;
+		random_window(point_count, lo, hi);
+		TPIE_OS_OFFSET expected = 0;
+		for (size_t i=0; i < pts.size(); ++i)
+			if (lo < pts[i] && pts[i] < hi) ++expected;
+		stream<point_t> res;
+		if (t.window_query(lo, hi, &res) != expected) DIE("window_query failed");
+		if (res.stream_len() != expected) DIE("window_query output failed");
+	}
+	return true;
+}
+
+static bool load_run(const vector<point_t>& pts, TPIE_OS_SIZE_T threads, bool sample) {
+	stream<point_t> in;
+	for (size_t i=0; i < pts.size(); ++i)
+		in.write_item(pts[i]);
+
+	kdtree_params params = small_params();
+	params.load_threads = threads;
+	kdtree_t t(params);
+	if (sample) {
+		if (t.load_sample(&in) != NO_ERROR) DIE("load_sample failed");
+	} else {
+		if (t.load(&in) != NO_ERROR) DIE("load failed");
+	}
+	return check_tree(t, pts);
+}
+
+bool parallel_grid_test() {
+	// Leave too little memory to load in memory, so the grid loader is used.
+	limit_memory(16*1024*1024);
+	vector<point_t> pts = make_points<point_t>(point_count, 17);
+	return load_run(pts, 1, false) && load_run(pts, 4, false);
+}
+
+bool parallel_sample_test() {
+	limit_memory(16*1024*1024);
+	vector<point_t> pts = make_points<point_t>(point_count, 17);
+	return load_run(pts, 1, true) && load_run(pts, 4, true);
+}
+
+bool parallel_sort_test() {
+	// Enough memory to sort all dimensions in memory concurrently.
+	limit_memory(64*1024*1024);
+	vector<point_t> pts = make_points<point_t>(point_count, 17);
+	pts.resize(50000);
+	stream<point_t> in;
+	for (size_t i=0; i < pts.size(); ++i)
+		in.write_item(pts[i]);
+
+	kdtree_params params = small_params();
+	params.load_threads = 2;
+	kdtree_t t(params);
+	stream<point_t>* sorted[2] = {NULL, NULL};
+	if (t.sort(&in, sorted) != NO_ERROR) DIE("sort failed");
+	for (size_t d=0; d < 2; ++d) {
+		if (sorted[d]->stream_len() != (TPIE_OS_OFFSET)pts.size()) DIE("sort length failed");
+		point_t::cmp cmp(d);
+		point_t *p, prev;
+		sorted[d]->seek(0);
+		for (size_t i=0; sorted[d]->read_item(&p) == NO_ERROR; ++i) {
+			if (i > 0 && cmp.compare(prev, *p) > 0) DIE("sort order failed");
+			prev = *p;
+		}
+	}
+	if (t.load_sorted(sorted) != NO_ERROR) DIE("load_sorted failed");
+	return check_tree(t, pts);
+}
+
+// The squared distances of the k points of pts nearest to q, ascending.
+static vector<double> nearest(const vector<point_t>& pts, const point_t& q, size_t k) {
+	vector<double> d;
+	d.reserve(pts.size());
+	for (size_t i=0; i < pts.size(); ++i) {
+		double dx = double(pts[i][0]) - q[0];
+		double dy = double(pts[i][1]) - q[1];
+		d.push_back(dx*dx + dy*dy);
+	}
+	partial_sort(d.begin(), d.begin()+k, d.end());
+	d.resize(k);
+	return d;
+}
+
+static bool make_tree(kdtree_t& t, const vector<point_t>& pts) {
+	stream<point_t> in;
+	for (size_t i=0; i < pts.size(); ++i)
+		in.write_item(pts[i]);
+	return t.load(&in) == NO_ERROR;
+}
+
+static point_t random_query(size_t id) {
+	point_t q(id);
+	q[0] = rand() % point_count;
+	q[1] = rand() % point_count;
+	return q;
+}
+
+bool knn_test() {
+	limit_memory(16*1024*1024);
+	vector<point_t> pts = make_points<point_t>(point_count, 17);
+	pts.resize(20000);
+	kdtree_t t(small_params());
+	if (!make_tree(t, pts)) DIE("load failed");
+
+	const size_t k = 10;
+	for (int r=0; r < 50; ++r) {
+		point_t q = random_query(0);
+		vector<double> expected = nearest(pts, q, k);
+		stream<point_t> res;
+		if (t.k_nn_query(q, &res, k) != (TPIE_OS_OFFSET)k) DIE("k_nn_query count failed");
+		point_t* p;
+		res.seek(0);
+		for (size_t i=0; res.read_item(&p) == NO_ERROR; ++i) {
+			double dx = double((*p)[0]) - q[0];
+			double dy = double((*p)[1]) - q[1];
+			if (dx*dx + dy*dy != expected[i]) DIE("k_nn_query output failed");
+		}
+	}
+	return true;
+}
+
+static bool knn_batch_run(kdtree_t& t, const vector<point_t>& pts, 
+						  const vector<point_t>& queries, size_t k, TPIE_OS_SIZE_T threads) {
+	stream<point_t> qs;
+	for (size_t i=0; i < queries.size(); ++i)
+		qs.write_item(queries[i]);
+	kdtree_t::nn_stream_t out;
+	if (t.k_nn_query(&qs, &out, k, threads) != (TPIE_OS_OFFSET)(queries.size()*k)) 
+		DIE("batched k_nn_query count failed");
+
+	// The answers come grouped by query, nearest first.
+	vector<vector<double> > got(queries.size()+1);
+	kdtree_t::nn_result_t* r;
+	out.seek(0);
+	while (out.read_item(&r) == NO_ERROR) {
+		if (r->query_id == 0 || r->query_id > queries.size()) DIE("batched k_nn_query id failed");
+		got[r->query_id].push_back(r->distance * r->distance);
+	}
+	for (size_t i=0; i < queries.size(); ++i) {
+		vector<double> expected = nearest(pts, queries[i], k);
+		vector<double>& g = got[queries[i].id()];
+		if (g.size() != k) DIE("batched k_nn_query answer count failed");
+		for (size_t j=0; j < k; ++j)
+			if (fabs(g[j] - expected[j]) > 1e-6 * (1 + expected[j])) DIE("batched k_nn_query output failed");
+	}
+	return true;
+}
+
+bool knn_batch_test() {
+	limit_memory(16*1024*1024);
+	vector<point_t> pts = make_points<point_t>(point_count, 17);
+	pts.resize(20000);
+	kdtree_t t(small_params());
+	if (!make_tree(t, pts)) DIE("load failed");
+
+	vector<point_t> queries;
+	for (size_t i=0; i < 500; ++i)
+		queries.push_back(random_query(i+1));
+	// A batch of a single query is not sorted, only copied.
+	vector<point_t> single(1, random_query(1));
+	return knn_batch_run(t, pts, queries, 5, 1) && knn_batch_run(t, pts, queries, 5, 4)
+		&& knn_batch_run(t, pts, single, 5, 1) && knn_batch_run(t, pts, single, 5, 4)
+		&& check_tree(t, pts);
+}
+
+// The node fetches done by finding every 97th point.
+static TPIE_OS_OFFSET find_fetches(kdtree_t& t, const vector<point_t>& pts) {
+	TPIE_OS_OFFSET before = t.stats().get(NODE_FETCH);
+	for (size_t i=0; i < pts.size(); i += 97)
+		if (!t.find(pts[i])) return -1;
+	return t.stats().get(NODE_FETCH) - before;
+}
+
+bool top_levels_test() {
+	limit_memory(16*1024*1024);
+	vector<point_t> pts = make_points<point_t>(point_count, 17);
+	std::string name = tempname::tpie_name("kdtree_top");
+
+	kdtree_params off = small_params();
+	off.top_memory = 0;
+	TPIE_OS_OFFSET fetches_off, fetches_on;
+	{
+		kdtree_t t(name, WRITE_COLLECTION, off);
+		if (!make_tree(t, pts)) DIE("load failed");
+		fetches_off = find_fetches(t, pts);
+		if (fetches_off <= 0) DIE("find failed");
+	}
+
+	// Reopen the tree with the top levels in memory.
+	kdtree_t t(name, WRITE_COLLECTION, small_params());
+	fetches_on = find_fetches(t, pts);
+	if (fetches_on < 0) DIE("find failed");
+	if (fetches_on >= fetches_off) DIE("top levels not used");
+	bool ok = check_tree(t, pts);
+	t.persist(PERSIST_DELETE);
+	return ok;
+}
+
+int main(int argc, char **argv) {
+	if(argc != 2) return 1;
+	std::string test(argv[1]);
+	if (test == "parallel_grid")
+		return parallel_grid_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "parallel_sample")
+		return parallel_sample_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "parallel_sort")
+		return parallel_sort_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "knn")
+		return knn_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "knn_batch")
+		return knn_batch_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "top_levels")
+		return top_levels_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,168 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2010, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#include "common.h"
+#include <tpie/list_rank.h>
+#include <map>
+#include <vector>
+#include <algorithm>
+#include <boost/random/linear_congruential.hpp>
+
+using namespace tpie;
+using namespace tpie::ami;
+using namespace std;
+
+typedef boost::uint64_t node_t;
+typedef list_rank_edge<node_t> edge_t;
+typedef pair<node_t, TPIE_OS_OFFSET> rank_t;
+
+struct rand_fn {
+	boost::rand48 & prng;
+	rand_fn(boost::rand48 & p): prng(p) {}
+	ptrdiff_t operator()(ptrdiff_t n) {return prng() % n;}
+};
+
+// Ten lists over a random permutation of 0, stride, 2 stride, ..., with
+// random weights, and the edges in random order.
+static bool lr_test(node_t stride, TPIE_OS_SIZE_T memory, TPIE_OS_SIZE_T threads) {
+	limit_memory(16*1024*1024);
+	boost::rand48 prng(42);
+	rand_fn rnd(prng);
+	const node_t n = 50000;
+	vector<node_t> order;
+	for (node_t i=0; i < n; ++i) order.push_back(i * stride);
+	random_shuffle(order.begin(), order.end(), rnd);
+
+	vector<edge_t> es;
+	map<node_t, TPIE_OS_OFFSET> expect;
+	TPIE_OS_OFFSET r = 0;
+	for (node_t i=0; i < n; ++i) {
+		if (i % (n / 10) == 0) r = 0;
+		else {
+			TPIE_OS_OFFSET w = prng() % 5;
+			r += w;
+			es.push_back(edge_t(order[i-1], order[i], w));
+		}
+		expect[order[i]] = r;
+	}
+	random_shuffle(es.begin(), es.end(), rnd);
+	stream<edge_t> edges;
+	for (size_t i=0; i < es.size(); ++i) edges.write_item(es[i]);
+
+	stream<rank_t> out;
+	if (list_rank(&edges, &out, memory, threads) != NO_ERROR) DIE("list_rank failed");
+	if (out.stream_len() != TPIE_OS_OFFSET(n)) DIE("wrong node count " << out.stream_len());
+	out.seek(0);
+	rank_t * o;
+	for (map<node_t, TPIE_OS_OFFSET>::iterator i=expect.begin(); i != expect.end(); ++i) {
+		if (out.read_item(&o) != NO_ERROR) DIE("read failed");
+		if (o->first != i->first) DIE("wrong node");
+		if (o->second != i->second) DIE("wrong rank of " << o->first << ": " << o->second << " " << i->second);
+	}
+	return true;
+}
+
+static bool cycle_test() {
+	stream<edge_t> edges;
+	for (node_t i=0; i < 100; ++i) edges.write_item(edge_t(i, (i+1) % 100));
+	stream<rank_t> out;
+	return list_rank(&edges, &out, 1024) == OBJECT_INVALID;
+}
+
+// A random tree, where the parent of node i is a random smaller node.
+static bool euler_test(TPIE_OS_SIZE_T memory) {
+	limit_memory(16*1024*1024);
+	boost::rand48 prng(7);
+	const node_t n = 20000;
+	vector<node_t> parent(n, 0), depth(n, 0);
+	vector<TPIE_OS_OFFSET> size(n, 1);
+	stream<pair<node_t, node_t> > edges;
+	for (node_t i=1; i < n; ++i) {
+		parent[i] = (i < 10) ? i - 1 : i - 1 - prng() % 10;
+		depth[i] = depth[parent[i]] + 1;
+		if (i % 2) edges.write_item(make_pair(i, parent[i]));
+		else edges.write_item(make_pair(parent[i], i));
+	}
+	for (node_t i=n-1; i > 0; --i) size[parent[i]] += size[i];
+
+	stream<tree_node<node_t> > out;
+	if (euler_tour(&edges, node_t(0), &out, memory) != NO_ERROR) DIE("euler_tour failed");
+	if (out.stream_len() != TPIE_OS_OFFSET(n)) DIE("wrong node count " << out.stream_len());
+	out.seek(0);
+	tree_node<node_t> * t;
+	for (node_t i=0; i < n; ++i) {
+		if (out.read_item(&t) != NO_ERROR) DIE("read failed");
+		if (t->node != i) DIE("wrong node");
+		if (t->parent != parent[i]) DIE("wrong parent of " << i);
+		if (t->depth != TPIE_OS_OFFSET(depth[i])) DIE("wrong depth of " << i << ": " << t->depth << " " << depth[i]);
+		if (t->size != size[i]) DIE("wrong size of " << i << ": " << t->size << " " << size[i]);
+	}
+	return true;
+}
+
+// Short lists and a one-edge tree, recursing down to single links.
+static bool small_test() {
+	limit_memory(16*1024*1024);
+	for (node_t len=1; len <= 4; ++len) {
+		stream<edge_t> edges;
+		for (node_t i=0; i < len; ++i) edges.write_item(edge_t(10*i, 10*(i+1), 2));
+		stream<rank_t> out;
+		if (list_rank(&edges, &out, 1) != NO_ERROR) DIE("list_rank failed");
+		if (out.stream_len() != TPIE_OS_OFFSET(len + 1)) DIE("wrong node count " << out.stream_len());
+		out.seek(0);
+		rank_t * o;
+		for (node_t i=0; i <= len; ++i) {
+			if (out.read_item(&o) != NO_ERROR) DIE("read failed");
+			if (o->first != 10*i || o->second != TPIE_OS_OFFSET(2*i)) DIE("wrong rank of " << o->first);
+		}
+	}
+
+	stream<pair<node_t, node_t> > tree;
+	tree.write_item(make_pair(node_t(5), node_t(3)));
+	stream<tree_node<node_t> > nodes;
+	if (euler_tour(&tree, node_t(5), &nodes, 1) != NO_ERROR) DIE("euler_tour failed");
+	if (nodes.stream_len() != 2) DIE("wrong tree size " << nodes.stream_len());
+	tree_node<node_t> * t;
+	nodes.seek(0);
+	nodes.read_item(&t);
+	if (t->node != 3 || t->parent != 5 || t->depth != 1 || t->size != 1) DIE("wrong leaf");
+	nodes.read_item(&t);
+	if (t->node != 5 || t->parent != 5 || t->depth != 0 || t->size != 2) DIE("wrong root");
+	return true;
+}
+
+int main(int argc, char **argv) {
+	if(argc != 2) return 1;
+	std::string test(argv[1]);
+	if (test == "memory")
+		return lr_test(1, 0, 1)?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "threads")
+		return lr_test(3, 0, 4)?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "external")
+		return lr_test(1000003, 64*1024, 1)?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "small")
+		return small_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "cycle")
+		return cycle_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "euler")
+		return euler_test(0)?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "euler_external")
+		return euler_test(64*1024)?EXIT_SUCCESS:EXIT_FAILURE;
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,196 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2010, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#include "common.h"
+#include <tpie/rtree.h>
+#include <vector>
+#include <algorithm>
+
+using namespace tpie;
+using namespace tpie::ami;
+using namespace std;
+
+typedef rtree<double> rtree_t;
+typedef rtree_t::rect_t rect_t;
+
+static const size_t rect_count = 50000;
+
+// Small random rectangles in [0, 1000]^2, with ids 1..rect_count.
+static vector<rect_t> make_rects() {
+	srand(23);
+	vector<rect_t> rs;
+	for (size_t i=0; i < rect_count; ++i) {
+		double x = (rand() % 1000000) / 1000.0;
+		double y = (rand() % 1000000) / 1000.0;
+		rs.push_back(rect_t(i+1, x, y, x + (rand() % 1000) / 100.0, y + (rand() % 1000) / 100.0));
+	}
+	return rs;
+}
+
+static rtree_params small_params() {
+	rtree_params params;
+	params.node_size_max = 40;
+	return params;
+}
+
+static bool load_tree(rtree_t& t, const vector<rect_t>& rs, rtree_load_method method) {
+	stream<rect_t> in;
+	for (size_t i=0; i < rs.size(); ++i)
+		in.write_item(rs[i]);
+	return t.load(&in, method) == NO_ERROR;
+}
+
+// Counts the rectangles pushed into it, and checks that they intersect
+// the window.
+class check_sink {
+public:
+	check_sink(const rect_t& q): q_(q), count(0), began(false), ended(false), ok(true) {}
+	void begin(TPIE_OS_OFFSET = 0) { began = true; }
+	void push(const rect_t& r) { ++count; ok = ok && began && !ended && r.intersects(q_); }
+	void end() { ended = true; }
+	rect_t q_;
+	TPIE_OS_OFFSET count;
+	bool began, ended, ok;
+};
+
+// Check the contents of t against the rectangles, with unload, find and
+// window queries.
+static bool check_tree(rtree_t& t, const vector<rect_t>& rs) {
+	if (t.size() != (TPIE_OS_OFFSET)rs.size()) DIE("size failed");
+
+	stream<rect_t> out;
+	if (t.unload(&out) != NO_ERROR) DIE("unload failed");
+	if (out.stream_len() != (TPIE_OS_OFFSET)rs.size()) DIE("unload length failed");
+	vector<bool> seen(rs.size()+1, false);
+	rect_t* r;
+	out.seek(0);
+	while (out.read_item(&r) == NO_ERROR) {
+		if (r->get_id() == 0 || r->get_id() > (bid_t)rs.size() || seen[r->get_id()]) DIE("unload output wrong");
+		seen[r->get_id()] = true;
+	}
+
+	for (size_t i=0; i < rs.size(); i += 101)
+		if (!t.find(rs[i])) DIE("find failed");
+
+	for (int w=0; w < 30; ++w) {
+		double x = rand() % 1000, y = rand() % 1000;
+		rect_t q(0, x, y, x + rand() % 100, y + rand() % 100);
+		TPIE_OS_OFFSET expected = 0;
+		for (size_t i=0; i < rs.size(); ++i)
+			if (rs[i].intersects(q)) ++expected;
+		stream<rect_t> res;
+		if (t.window_query(q, &res) != expected) DIE("window_query failed");
+		if (res.stream_len() != expected) DIE("window_query output failed");
+		check_sink sink(q);
+		if (t.window_query(q, sink) != expected) DIE("window_query to sink failed");
+		if (sink.count != expected || !sink.ok || !sink.ended) DIE("window_query sink output failed");
+	}
+	return true;
+}
+
+bool hilbert_test() {
+	limit_memory(16*1024*1024);
+	vector<rect_t> rs = make_rects();
+	rtree_t t(small_params());
+	if (!load_tree(t, rs, RTREE_LOAD_HILBERT)) DIE("load failed");
+	// 1250 leaves, 32 nodes and the root.
+	if (t.height() != 3) DIE("height failed");
+	return check_tree(t, rs);
+}
+
+bool str_test() {
+	limit_memory(16*1024*1024);
+	vector<rect_t> rs = make_rects();
+	rtree_t t(small_params());
+	if (!load_tree(t, rs, RTREE_LOAD_STR)) DIE("load failed");
+	return check_tree(t, rs);
+}
+
+// A single rectangle, which the loaders do not sort but copy.
+bool single_test() {
+	limit_memory(16*1024*1024);
+	vector<rect_t> rs = make_rects();
+	rs.resize(1);
+	rtree_t h(small_params());
+	if (!load_tree(h, rs, RTREE_LOAD_HILBERT)) DIE("hilbert load failed");
+	if (!check_tree(h, rs)) return false;
+	rtree_t s(small_params());
+	if (!load_tree(s, rs, RTREE_LOAD_STR)) DIE("str load failed");
+	return check_tree(s, rs);
+}
+
+static double distance2(const rect_t& r, double x, double y) {
+	double dx = max(0.0, max(r.get_left() - x, x - r.get_right()));
+	double dy = max(0.0, max(r.get_lower() - y, y - r.get_upper()));
+	return dx*dx + dy*dy;
+}
+
+bool knn_test() {
+	limit_memory(16*1024*1024);
+	vector<rect_t> rs = make_rects();
+	rtree_t t(small_params());
+	if (!load_tree(t, rs, RTREE_LOAD_HILBERT)) DIE("load failed");
+
+	const size_t k = 10;
+	for (int q=0; q < 50; ++q) {
+		double x = rand() % 1000, y = rand() % 1000;
+		vector<double> expected;
+		for (size_t i=0; i < rs.size(); ++i)
+			expected.push_back(distance2(rs[i], x, y));
+		partial_sort(expected.begin(), expected.begin()+k, expected.end());
+
+		stream<rect_t> res;
+		if (t.k_nn_query(x, y, k, &res) != (TPIE_OS_OFFSET)k) DIE("k_nn_query count failed");
+		rect_t* r;
+		res.seek(0);
+		for (size_t i=0; res.read_item(&r) == NO_ERROR; ++i)
+			if (distance2(*r, x, y) != expected[i]) DIE("k_nn_query output failed");
+	}
+	return true;
+}
+
+bool reopen_test() {
+	limit_memory(16*1024*1024);
+	vector<rect_t> rs = make_rects();
+	std::string name = tempname::tpie_name("rtree");
+	{
+		rtree_t t(name, WRITE_COLLECTION, small_params());
+		if (!load_tree(t, rs, RTREE_LOAD_STR)) DIE("load failed");
+	}
+	rtree_t t(name, WRITE_COLLECTION, small_params());
+	bool ok = check_tree(t, rs);
+	t.persist(PERSIST_DELETE);
+	return ok;
+}
+
+int main(int argc, char **argv) {
+	if(argc != 2) return 1;
+	std::string test(argv[1]);
+	if (test == "hilbert")
+		return hilbert_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "str")
+		return str_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "single")
+		return single_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "knn")
+		return knn_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "reopen")
+		return reopen_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,158 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2010, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#include "common.h"
+#include <tpie/spatial_join.h>
+#include <vector>
+#include <algorithm>
+
+using namespace tpie;
+using namespace tpie::ami;
+using namespace std;
+
+typedef rectangle<double, bid_t> rect_t;
+typedef vector<spatial_join_pair_t> pairs_t;
+
+static const size_t rect_count = 5000;
+
+// Random rectangles in [0, 1000]^2 with ids from first_id. With skew, half
+// of them are crowded into [0, 10]^2.
+static vector<rect_t> make_rects(unsigned int seed, bid_t first_id, bool skew) {
+	srand(seed);
+	vector<rect_t> rs;
+	for (size_t i=0; i < rect_count; ++i) {
+		double s = (skew && i % 2 == 0) ? 0.01 : 1.0;
+		double x = s * (rand() % 1000000) / 1000.0;
+		double y = s * (rand() % 1000000) / 1000.0;
+		rs.push_back(rect_t(first_id + i, x, y, x + s * (rand() % 2000) / 100.0, y + s * (rand() % 2000) / 100.0));
+	}
+	return rs;
+}
+
+static pairs_t brute_force(const vector<rect_t>& red, const vector<rect_t>& blue) {
+	pairs_t res;
+	for (size_t i=0; i < red.size(); ++i)
+		for (size_t j=0; j < blue.size(); ++j)
+			if (red[i].get_left() <= blue[j].get_right() && blue[j].get_left() <= red[i].get_right() &&
+				red[i].get_lower() <= blue[j].get_upper() && blue[j].get_lower() <= red[i].get_upper())
+				res.push_back(spatial_join_pair_t(red[i].get_id(), blue[j].get_id()));
+	sort(res.begin(), res.end());
+	return res;
+}
+
+struct pair_sink {
+	pairs_t pairs;
+	int begun, ended;
+	pair_sink(): begun(0), ended(0) {}
+	void begin(TPIE_OS_OFFSET = 0) { ++begun; }
+	void push(const spatial_join_pair_t& p) { pairs.push_back(p); }
+	void end() { ++ended; }
+};
+
+static bool check_join(const vector<rect_t>& red, const vector<rect_t>& blue, 
+					   const spatial_join_params& params) {
+	limit_memory(16*1024*1024);
+	pairs_t expected = brute_force(red, blue);
+
+	stream<rect_t> red_in, blue_in;
+	for (size_t i=0; i < red.size(); ++i)
+		red_in.write_item(red[i]);
+	for (size_t i=0; i < blue.size(); ++i)
+		blue_in.write_item(blue[i]);
+
+	pair_sink sink;
+	if (spatial_join(&red_in, &blue_in, sink, params) != NO_ERROR) DIE("spatial_join failed");
+	if (sink.begun != 1 || sink.ended != 1) DIE("begin/end not called once");
+	sort(sink.pairs.begin(), sink.pairs.end());
+	if (sink.pairs != expected) DIE("wrong pairs: " << sink.pairs.size() << " found, " << expected.size() << " expected");
+
+	stream<spatial_join_pair_t> out;
+	if (spatial_join(&red_in, &blue_in, &out, params) != NO_ERROR) DIE("spatial_join to stream failed");
+	if (out.stream_len() != TPIE_OS_OFFSET(expected.size())) DIE("wrong stream output");
+	return true;
+}
+
+static bool check_join(bool skew, const spatial_join_params& params) {
+	vector<rect_t> red = make_rects(17, 1, skew);
+	vector<rect_t> blue = make_rects(42, rect_count + 1, skew);
+	if (brute_force(red, blue).size() < rect_count) DIE("too few intersections to test");
+	return check_join(red, blue, params);
+}
+
+// The inputs take 400 KB; this memory forces partitioning.
+static spatial_join_params small_params(spatial_join_method method) {
+	spatial_join_params params;
+	params.method = method;
+	params.memory = 64*1024;
+	return params;
+}
+
+bool pbsm_test() {
+	return check_join(false, small_params(SPATIAL_JOIN_PBSM)) &&
+		check_join(true, small_params(SPATIAL_JOIN_PBSM));
+}
+
+bool sssj_test() {
+	return check_join(false, small_params(SPATIAL_JOIN_SSSJ)) &&
+		check_join(true, small_params(SPATIAL_JOIN_SSSJ));
+}
+
+bool parallel_test() {
+	spatial_join_params params = small_params(SPATIAL_JOIN_AUTO);
+	params.threads = 4;
+	return check_join(false, params) && check_join(true, params);
+}
+
+bool auto_test() {
+	// In memory, and partitioned with skew (some partitions are swept
+	// from disk).
+	return check_join(false, spatial_join_params()) &&
+		check_join(true, small_params(SPATIAL_JOIN_AUTO));
+}
+
+// Inputs of a single rectangle, which the sweep does not sort but
+// copy, joined whole and in partitions.
+bool single_test() {
+	vector<rect_t> red(1, rect_t(1, 10, 10, 20, 20));
+	vector<rect_t> blue(1, rect_t(2, 15, 15, 25, 25));
+	vector<rect_t> many = make_rects(42, 2, false);
+	spatial_join_method methods[] = {SPATIAL_JOIN_SSSJ, SPATIAL_JOIN_PBSM, SPATIAL_JOIN_AUTO};
+	for (size_t m=0; m < 3; ++m) {
+		if (!check_join(red, blue, small_params(methods[m]))) return false;
+		if (!check_join(red, many, small_params(methods[m]))) return false;
+		if (!check_join(many, red, small_params(methods[m]))) return false;
+	}
+	return true;
+}
+
+int main(int argc, char **argv) {
+	if(argc != 2) return 1;
+	std::string test(argv[1]);
+	if (test == "pbsm")
+		return pbsm_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "sssj")
+		return sssj_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "parallel")
+		return parallel_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "auto")
+		return auto_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "single")
+		return single_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	return EXIT_FAILURE;
+}
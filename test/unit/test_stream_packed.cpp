@@ -0,0 +1,297 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2010, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+// All streams of this test, including the temporary streams of sort(),
+// are packed.
+#define BTE_STREAM_IMP_PACKED
+
+#include "common.h"
+#include <tpie/stream.h>
+#include <tpie/sort.h>
+#include <tpie/bte/stream_ufs.h>
+#include <tpie/tempname.h>
+#include <cstdio>
+#include <vector>
+
+using namespace tpie;
+using namespace tpie::bte;
+using namespace std;
+
+typedef stream_packed<int> packed_t;
+
+// Sorted runs of small numbers, which compress well.
+static int value(TPIE_OS_OFFSET i) {
+	return static_cast<int>(i / 5);
+}
+
+static bool write_values(packed_t & s, TPIE_OS_OFFSET n) {
+	for (TPIE_OS_OFFSET i=0; i < n; ++i)
+		if (s.write_item(value(i)) != NO_ERROR) DIE("write_item failed at " << i);
+	return true;
+}
+
+static bool read_values(packed_t & s, TPIE_OS_OFFSET n) {
+	if (s.stream_len() != n) DIE("wrong length " << s.stream_len() << " instead of " << n);
+	if (s.seek(0) != NO_ERROR) DIE("seek failed");
+	for (TPIE_OS_OFFSET i=0; i < n; ++i) {
+		int * x;
+		if (s.read_item(&x) != NO_ERROR) DIE("read_item failed at " << i);
+		if (*x != value(i)) DIE("wrong value " << *x << " at " << i);
+	}
+	int * x;
+	if (s.read_item(&x) != END_OF_STREAM) DIE("read past the end");
+	return true;
+}
+
+static bool basic_test() {
+	const TPIE_OS_OFFSET n = 1000000;
+	packed_t s(tempname::tpie_name("stream_packed"), WRITE_STREAM);
+	s.persist(PERSIST_DELETE);
+	if (s.status() == STREAM_STATUS_INVALID) DIE("stream not valid");
+	if (!write_values(s, n)) return false;
+	if (!read_values(s, n)) return false;
+	TPIE_OS_OFFSET raw = n * static_cast<TPIE_OS_OFFSET>(sizeof(int));
+	if (s.stored_bytes() * 2 > raw) DIE("blocks not compressed: " << s.stored_bytes() << " of " << raw);
+
+	// Arrays that do not line up with the blocks.
+	vector<int> buf(12345);
+	if (s.seek(777) != NO_ERROR) DIE("seek failed");
+	TPIE_OS_OFFSET i = 777;
+	while (i < n) {
+		TPIE_OS_SIZE_T count = buf.size();
+		err e = s.read_array(&buf[0], count);
+		if (e != NO_ERROR && e != END_OF_STREAM) DIE("read_array failed");
+		for (TPIE_OS_SIZE_T j=0; j < count; ++j, ++i)
+			if (buf[j] != value(i)) DIE("wrong value " << buf[j] << " at " << i);
+		if (e == END_OF_STREAM) break;
+	}
+	if (i != n) DIE("read_array stopped at " << i);
+	return true;
+}
+
+static bool reopen_test() {
+	const TPIE_OS_OFFSET n = 300000;
+	std::string name = tempname::tpie_name("stream_packed");
+	{
+		packed_t s(name, WRITE_STREAM);
+		if (!write_values(s, n)) return false;
+	}
+	{
+		packed_t s(name, READ_STREAM);
+		if (s.status() == STREAM_STATUS_INVALID) DIE("stream not valid after reopening");
+		if (!read_values(s, n)) return false;
+		if (s.write_item(0) != READ_ONLY) DIE("wrote to a read-only stream");
+	}
+	{
+		packed_t s(name, APPEND_STREAM);
+		if (s.tell() != n) DIE("append stream not at the end");
+		for (TPIE_OS_OFFSET i=n; i < 2*n; ++i)
+			if (s.write_item(value(i)) != NO_ERROR) DIE("write_item failed at " << i);
+	}
+	{
+		packed_t s(name, WRITE_STREAM);
+		s.persist(PERSIST_DELETE);
+		if (!read_values(s, 2*n)) return false;
+	}
+
+	// The formats are not interchangeable.
+	std::string ufs_name = tempname::tpie_name("stream_packed");
+	{
+		stream_ufs<int> s(ufs_name, WRITE_STREAM);
+		for (int i=0; i < 1000; ++i) s.write_item(i);
+	}
+	{
+		packed_t s(ufs_name, READ_STREAM);
+		if (s.status() != STREAM_STATUS_INVALID) DIE("ufs stream opened as packed");
+	}
+	remove(ufs_name.c_str());
+	return true;
+}
+
+// Blocks rewritten in the middle of the stream change size and move.
+static bool seek_test() {
+	const TPIE_OS_OFFSET n = 500000;
+	packed_t s(tempname::tpie_name("stream_packed"), WRITE_STREAM);
+	s.persist(PERSIST_DELETE);
+	if (!write_values(s, n)) return false;
+
+	vector<int> expect(n);
+	for (TPIE_OS_OFFSET i=0; i < n; ++i) expect[i] = value(i);
+
+	boost::uint32_t x = 42;
+	for (int r=0; r < 2000; ++r) {
+		x = x * 1103515245 + 12345;
+		TPIE_OS_OFFSET pos = (x >> 8) % n;
+		x = x * 1103515245 + 12345;
+		if (s.seek(pos) != NO_ERROR) DIE("seek failed");
+		if (r % 2) {
+			// Noise does not compress.
+			for (TPIE_OS_OFFSET i=pos; i < n && i < pos + 500; ++i) {
+				x = x * 1103515245 + 12345;
+				expect[i] = static_cast<int>(x);
+				if (s.write_item(expect[i]) != NO_ERROR) DIE("write_item failed at " << i);
+			}
+		} else {
+			int * v;
+			if (s.read_item(&v) != NO_ERROR) DIE("read_item failed at " << pos);
+			if (*v != expect[pos]) DIE("wrong value " << *v << " at " << pos);
+		}
+	}
+	if (s.stream_len() != n) DIE("overwriting changed the length");
+	if (s.seek(0) != NO_ERROR) DIE("seek failed");
+	for (TPIE_OS_OFFSET i=0; i < n; ++i) {
+		int * v;
+		if (s.read_item(&v) != NO_ERROR) DIE("read_item failed at " << i);
+		if (*v != expect[i]) DIE("wrong value " << *v << " at " << i);
+	}
+	if (s.seek(n + 1) == NO_ERROR) DIE("seek past the end");
+	return true;
+}
+
+static bool truncate_test() {
+	const TPIE_OS_OFFSET n = 200000;
+	packed_t s(tempname::tpie_name("stream_packed"), WRITE_STREAM);
+	s.persist(PERSIST_DELETE);
+	if (!write_values(s, n)) return false;
+	TPIE_OS_OFFSET stored = s.stored_bytes();
+
+	// Cut in the middle of a block the stream is not at.
+	const TPIE_OS_OFFSET m = n / 3 + 17;
+	if (s.seek(10) != NO_ERROR) DIE("seek failed");
+	int * v;
+	if (s.read_item(&v) != NO_ERROR) DIE("read_item failed");
+	if (s.truncate(m) != NO_ERROR) DIE("truncate failed");
+	if (s.tell() != m) DIE("truncate did not move to the end");
+	if (s.stored_bytes() * 2 > stored) DIE("slots not freed " << s.stored_bytes() << " " << stored);
+	if (!read_values(s, m)) return false;
+
+	// The new items read as zeros, also where the old ones were.
+	if (s.truncate(n) != NO_ERROR) DIE("truncate failed");
+	if (s.seek(0) != NO_ERROR) DIE("seek failed");
+	for (TPIE_OS_OFFSET i=0; i < n; ++i) {
+		if (s.read_item(&v) != NO_ERROR) DIE("read_item failed at " << i);
+		if (*v != (i < m ? value(i) : 0)) DIE("wrong value " << *v << " at " << i);
+	}
+
+	// And the stream can grow from there.
+	if (s.truncate(m) != NO_ERROR) DIE("truncate failed");
+	for (TPIE_OS_OFFSET i=m; i < n; ++i)
+		if (s.write_item(value(i)) != NO_ERROR) DIE("write_item failed at " << i);
+	return read_values(s, n);
+}
+
+static bool substream_test() {
+	const TPIE_OS_OFFSET n = 100000;
+	ami::stream<int> s(tempname::tpie_name("stream_packed"), ami::WRITE_STREAM);
+	s.persist(PERSIST_DELETE);
+	for (TPIE_OS_OFFSET i=0; i < n; ++i)
+		if (s.write_item(value(i)) != ami::NO_ERROR) DIE("write_item failed");
+
+	ami::stream<int> * sub;
+	if (s.new_substream(ami::WRITE_STREAM, 1000, 50999, &sub) != ami::NO_ERROR) DIE("new_substream failed");
+	if (sub->stream_len() != 50000) DIE("wrong substream length " << sub->stream_len());
+	int * v;
+	for (TPIE_OS_OFFSET i=0; i < 50000; ++i) {
+		if (sub->read_item(&v) != ami::NO_ERROR) DIE("read_item failed in substream");
+		if (*v != value(1000 + i)) DIE("wrong value " << *v << " in substream at " << i);
+	}
+	if (sub->read_item(&v) != ami::END_OF_STREAM) DIE("read past the end of the substream");
+	if (sub->seek(100) != ami::NO_ERROR) DIE("seek failed in substream");
+	if (sub->write_item(-1) != ami::NO_ERROR) DIE("write_item failed in substream");
+	delete sub;
+
+	if (s.seek(1100) != ami::NO_ERROR) DIE("seek failed");
+	if (s.read_item(&v) != ami::NO_ERROR || *v != -1) DIE("write to substream lost");
+	if (s.read_item(&v) != ami::NO_ERROR || *v != value(1101)) DIE("substream wrote too much");
+	return true;
+}
+
+// A damaged block is reported, not returned.
+static bool corrupt_test() {
+	const TPIE_OS_OFFSET n = 100000;
+	std::string name = tempname::tpie_name("stream_packed");
+	{
+		packed_t s(name, WRITE_STREAM);
+		if (!write_values(s, n)) return false;
+	}
+
+	// The first slot starts right after the header.
+	FILE * f = fopen(name.c_str(), "r+b");
+	if (!f) DIE("cannot open " << name);
+	fseek(f, static_cast<long>(TPIE_OS_BLOCKSIZE()) + 12, SEEK_SET);
+	int c = fgetc(f);
+	fseek(f, static_cast<long>(TPIE_OS_BLOCKSIZE()) + 12, SEEK_SET);
+	fputc(c ^ 0x10, f);
+	fclose(f);
+
+	packed_t s(name, WRITE_STREAM);
+	s.persist(PERSIST_DELETE);
+	int * v;
+	if (s.read_item(&v) != CHECKSUM_ERROR) DIE("damaged block not detected");
+	if (s.seek(s.chunk_size()) != NO_ERROR) DIE("seek failed");
+	for (TPIE_OS_OFFSET i=s.chunk_size(); i < n; ++i) {
+		if (s.read_item(&v) != NO_ERROR) DIE("read_item failed at " << i);
+		if (*v != value(i)) DIE("wrong value " << *v << " at " << i);
+	}
+	return true;
+}
+
+// The runs and merges of sort() go through packed streams.
+static bool sort_test() {
+	MM_manager.set_memory_limit(4*1024*1024);
+	const TPIE_OS_OFFSET n = 2000000;
+	ami::stream<int> in(tempname::tpie_name("stream_packed"), ami::WRITE_STREAM);
+	ami::stream<int> out(tempname::tpie_name("stream_packed"), ami::WRITE_STREAM);
+	in.persist(PERSIST_DELETE);
+	out.persist(PERSIST_DELETE);
+	for (TPIE_OS_OFFSET i=0; i < n; ++i)
+		if (in.write_item(static_cast<int>((i * 7919) % (n / 10))) != ami::NO_ERROR) DIE("write_item failed");
+	if (ami::sort(&in, &out) != ami::NO_ERROR) DIE("sort failed");
+	if (out.stream_len() != n) DIE("wrong length " << out.stream_len());
+	if (out.seek(0) != ami::NO_ERROR) DIE("seek failed");
+	int prev = -1;
+	int * v;
+	for (TPIE_OS_OFFSET i=0; i < n; ++i) {
+		if (out.read_item(&v) != ami::NO_ERROR) DIE("read_item failed at " << i);
+		if (*v < prev) DIE("not sorted at " << i);
+		prev = *v;
+	}
+	return true;
+}
+
+int main(int argc, char **argv) {
+	if (argc != 2) return 1;
+	std::string test(argv[1]);
+	if (test == "basic")
+		return basic_test() ? EXIT_SUCCESS : EXIT_FAILURE;
+	else if (test == "reopen")
+		return reopen_test() ? EXIT_SUCCESS : EXIT_FAILURE;
+	else if (test == "seek")
+		return seek_test() ? EXIT_SUCCESS : EXIT_FAILURE;
+	else if (test == "truncate")
+		return truncate_test() ? EXIT_SUCCESS : EXIT_FAILURE;
+	else if (test == "substream")
+		return substream_test() ? EXIT_SUCCESS : EXIT_FAILURE;
+	else if (test == "corrupt")
+		return corrupt_test() ? EXIT_SUCCESS : EXIT_FAILURE;
+	else if (test == "sort")
+		return sort_test() ? EXIT_SUCCESS : EXIT_FAILURE;
+	std::cerr << "No such test" << std::endl;
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,124 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2010, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#include "common.h"
+#include <tpie/time_forward.h>
+#include <tpie/progress_indicator_terminal.h>
+#include <vector>
+#include <algorithm>
+#include <boost/random/linear_congruential.hpp>
+
+using namespace tpie;
+using namespace tpie::ami;
+using namespace std;
+
+typedef boost::uint64_t vertex_t;
+typedef pair<vertex_t, vertex_t> edge_t;
+
+// The length of the longest path to each vertex, checked against the
+// sources of the messages.
+struct longest_path {
+	typedef TPIE_OS_OFFSET result_type;
+	typedef tfp_message<vertex_t, result_type> message_t;
+
+	vector<TPIE_OS_OFFSET> length;
+	const vector<vector<vertex_t> > & preds;
+	bool ok;
+
+	longest_path(vertex_t n, const vector<vector<vertex_t> > & p): length(n, -1), preds(p), ok(true) {}
+
+	TPIE_OS_OFFSET operator()(vertex_t v, const vector<message_t> & in) {
+		vector<vertex_t> from;
+		TPIE_OS_OFFSET l = 0;
+		for (size_t i=0; i < in.size(); ++i) {
+			if (in[i].to != v || in[i].value != length[in[i].from]) ok = false;
+			from.push_back(in[i].from);
+			l = max(l, in[i].value + 1);
+		}
+		sort(from.begin(), from.end());
+		if (from != preds[v]) ok = false;
+		length[v] = l;
+		return l;
+	}
+};
+
+class counting_indicator: public progress_indicator_terminal {
+public:
+	int done_calls;
+	counting_indicator(): progress_indicator_terminal("", "", 0, 1, 1), done_calls(0) {}
+	void refresh() {}
+	void done(const std::string&) {++done_calls;}
+	TPIE_OS_OFFSET current() const {return m_current;}
+};
+
+static bool tfp_test(TPIE_OS_SIZE_T memory) {
+	limit_memory(32*1024*1024);
+	boost::rand48 prng(42);
+	const vertex_t n = 20000;
+	vector<vector<vertex_t> > preds(n);
+	vector<TPIE_OS_OFFSET> expect(n, 0);
+	stream<vertex_t> vertices;
+	stream<edge_t> edges;
+	for (vertex_t v=0; v < n; ++v) vertices.write_item(v);
+	for (int i=0; i < 200000; ++i) {
+		vertex_t a = prng() % n, b = prng() % n;
+		if (a == b) continue;
+		if (b < a) swap(a, b);
+		edges.write_item(edge_t(a, b));
+		preds[b].push_back(a);
+	}
+	// Duplicate edges carry one message each.
+	for (vertex_t v=0; v < n; ++v) {
+		sort(preds[v].begin(), preds[v].end());
+		for (size_t i=0; i < preds[v].size(); ++i)
+			expect[v] = max(expect[v], expect[preds[v][i]] + 1);
+	}
+
+	longest_path f(n, preds);
+	counting_indicator indicator;
+	if (time_forward_process(&vertices, &edges, f, memory, &indicator) != NO_ERROR) DIE("time_forward_process failed");
+	if (!f.ok) DIE("wrong messages");
+	for (vertex_t v=0; v < n; ++v)
+		if (f.length[v] != expect[v]) DIE("wrong length of " << v);
+	if (indicator.done_calls != 1 || indicator.current() != 100) DIE("wrong progress " << indicator.current());
+	return true;
+}
+
+static bool order_test() {
+	limit_memory(32*1024*1024);
+	stream<vertex_t> vertices;
+	stream<edge_t> edges;
+	vector<vector<vertex_t> > preds(3);
+	for (vertex_t v=0; v < 3; ++v) vertices.write_item(v);
+	edges.write_item(edge_t(2, 1));
+	longest_path f(3, preds);
+	return time_forward_process(&vertices, &edges, f) == OBJECT_INVALID;
+}
+
+int main(int argc, char **argv) {
+	if(argc != 2) return 1;
+	std::string test(argv[1]);
+	if (test == "memory")
+		return tfp_test(0)?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "external")
+		return tfp_test(1536*1024)?EXIT_SUCCESS:EXIT_FAILURE;
+	else if (test == "order")
+		return order_test()?EXIT_SUCCESS:EXIT_FAILURE;
+	return EXIT_FAILURE;
+}
@@ -201,6 +201,16 @@ public:
 	/////////////////////////////////////////////////////////
 	inline bool empty() const {return m_size == 0;}
 
+	/////////////////////////////////////////////////////////
+	/// \brief Exchange the elements of this array and another
+	///
+	/// \param other the array to swap with
+	/////////////////////////////////////////////////////////
+	inline void swap(array & other) {
+		std::swap(m_elements, other.m_elements);
+		std::swap(m_size, other.m_size);
+	}
+
 	/////////////////////////////////////////////////////////
 	/// \brief Return a const referense to an array entry
 	///
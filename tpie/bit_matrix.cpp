@@ -1,98 +1,162 @@
 // -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
 // vi:set ts=4 sts=4 sw=4 noet :
 // Copyright 2008, The TPIE development team
-// 
+//
 // This file is part of TPIE.
-// 
+//
 // TPIE is free software: you can redistribute it and/or modify it under
 // the terms of the GNU Lesser General Public License as published by the
 // Free Software Foundation, either version 3 of the License, or (at your
 // option) any later version.
-// 
+//
 // TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
 // WARRANTY; without even the implied warranty of MERCHANTABILITY or
 // FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
 // License for more details.
-// 
+//
 // You should have received a copy of the GNU Lesser General Public License
 // along with TPIE.  If not, see <http://www.gnu.org/licenses/>
 
-#include <bit_matrix.h>
+#include <tpie/bit_matrix.h>
 
 using namespace tpie;
 
 bit_matrix::bit_matrix(TPIE_OS_SIZE_T arows, TPIE_OS_SIZE_T acols) :
-        matrix<bit>(arows, acols) {
-
-    //  No code in this constructor.
+        m_rows(arows), m_cols(acols, 0) {
+    tp_assert(arows <= 64, "A bit_matrix has at most 64 rows.");
 }
 
-bit_matrix::bit_matrix(matrix<bit> &mb) :
-        matrix<bit>(mb) {
-    //  No code in this constructor.
+bit_matrix bit_matrix::identity(TPIE_OS_SIZE_T n) {
+    bit_matrix res(n, n);
+    for (TPIE_OS_SIZE_T ii = 0; ii < n; ii++) {
+        res.m_cols[ii] = word_t(1) << ii;
+    }
+    return res;
 }
-    
-bit_matrix::~bit_matrix(void) {
-    //  No code in this destructor.
+
+bit_matrix & bit_matrix::operator=(const TPIE_OS_OFFSET &rhs) {
+    tp_assert(cols() == 1, "Range error.");
+    m_cols[0] = word_t(rhs) & mask();
+    return *this;
 }
 
-bit_matrix bit_matrix::operator=(const bit_matrix &rhs) {
-    return this->matrix<bit>::operator=((matrix<bit> &)rhs);
+bit_matrix::operator TPIE_OS_OFFSET(void) const {
+    tp_assert(cols() == 1, "Range error.");
+    return TPIE_OS_OFFSET(m_cols[0]);
 }
 
-bit_matrix & bit_matrix::operator=(const TPIE_OS_OFFSET &rhs) {
-    TPIE_OS_SIZE_T rows = this->rows();
-    TPIE_OS_SIZE_T ii;
-
-    if (this->cols() != 1) {
-#if HANDLE_EXCEPTIONS
-        throw matrix_base<bit>::range();
-#else
-        tp_assert(0, "Range error.");
-#endif
-    }
-    
-    for (ii = 0; ii < rows; ii++) {
-        (*this)[ii][0] = (long int)(rhs & (1 << ii)) >> ii;
+bool bit_matrix::invert(bit_matrix &inverse) const {
+    TPIE_OS_SIZE_T n = m_rows;
+    TPIE_OS_SIZE_T ii, jj;
+
+    if (cols() != n) {
+        return false;
     }
-    
-    return *this;
-}    
 
-bit_matrix::operator TPIE_OS_OFFSET(void) {
-    TPIE_OS_OFFSET res;
+    // Gauss-Jordan elimination on the columns: reduce the columns to the
+    // identity while applying the same column operations to the identity.
+    std::vector<word_t> a(m_cols);
+    std::vector<word_t> b(n);
+    for (ii = 0; ii < n; ii++) {
+        b[ii] = word_t(1) << ii;
+    }
+    for (ii = 0; ii < n; ii++) {
+        word_t bit = word_t(1) << ii;
+        for (jj = ii; jj < n && !(a[jj] & bit); jj++) ;
+        if (jj == n) {
+            return false;
+        }
+        std::swap(a[ii], a[jj]);
+        std::swap(b[ii], b[jj]);
+        for (jj = 0; jj < n; jj++) {
+            if (jj != ii && (a[jj] & bit)) {
+                a[jj] ^= a[ii];
+                b[jj] ^= b[ii];
+            }
+        }
+    }
 
-    TPIE_OS_SIZE_T rows = this->rows();
-    TPIE_OS_SIZE_T ii;
+    // Now A B = I, where B holds the column operations.
+    inverse = bit_matrix(n, n);
+    inverse.m_cols = b;
+    return true;
+}
 
-    if (this->cols() != 1) {
-#if HANDLE_EXCEPTIONS
-        throw matrix_base<bit>::range();
-#else
-        tp_assert(0, "Range error.");
-#endif
+TPIE_OS_SIZE_T bit_matrix::rank() const {
+    // A basis of the column space, indexed by the highest bit of each
+    // vector.
+    word_t basis[64] = {0};
+    TPIE_OS_SIZE_T res = 0;
+
+    for (TPIE_OS_SIZE_T jj = 0; jj < cols(); jj++) {
+        word_t v = m_cols[jj];
+        for (int ii = 63; ii >= 0 && v; ii--) {
+            if (!((v >> ii) & 1)) {
+                continue;
+            }
+            if (!basis[ii]) {
+                basis[ii] = v;
+                res++;
+                break;
+            }
+            v ^= basis[ii];
+        }
     }
+    return res;
+}
 
-    for (res = 0, ii = 0; ii < rows; ii++) {
-        res |= (long int)((*this)[ii][0]) << ii;
+bit_matrix bit_matrix::submatrix(TPIE_OS_SIZE_T r, TPIE_OS_SIZE_T nr,
+                                 TPIE_OS_SIZE_T c, TPIE_OS_SIZE_T nc) const {
+    tp_assert(r + nr <= m_rows && c + nc <= cols(), "Range error.");
+    bit_matrix res(nr, nc);
+    for (TPIE_OS_SIZE_T jj = 0; jj < nc; jj++) {
+        res.set_column(jj, m_cols[c + jj] >> r);
     }
-    
     return res;
 }
 
-
-bit_matrix operator+(const bit_matrix &op1, const bit_matrix &op2) {
-    matrix<bit> sum = ((matrix<bit> &)op1) + ((matrix<bit> &)op2);
-
+bit_matrix tpie::operator+(const bit_matrix &op1, const bit_matrix &op2) {
+    tp_assert(op1.rows() == op2.rows() && op1.cols() == op2.cols(), "Range error.");
+    bit_matrix sum(op1);
+    for (TPIE_OS_SIZE_T jj = 0; jj < sum.cols(); jj++) {
+        sum.m_cols[jj] ^= op2.m_cols[jj];
+    }
     return sum;
 }
 
-bit_matrix operator*(const bit_matrix &op1, const bit_matrix &op2) {
-    matrix<bit> prod = ((matrix<bit> &)op1) * ((matrix<bit> &)op2);
-
+bit_matrix tpie::operator*(const bit_matrix &op1, const bit_matrix &op2) {
+    tp_assert(op1.cols() == op2.rows(), "Range error.");
+    bit_matrix prod(op1.rows(), op2.cols());
+    for (TPIE_OS_SIZE_T jj = 0; jj < prod.cols(); jj++) {
+        prod.m_cols[jj] = op1.apply(op2.m_cols[jj]);
+    }
     return prod;
 }
 
-std::ostream &operator<<(std::ostream &s, bit_matrix &bm) {
-    return s << (matrix<bit> &)bm;
+std::ostream &tpie::operator<<(std::ostream &s, const bit_matrix &bm) {
+    for (TPIE_OS_SIZE_T ii = 0; ii < bm.rows(); ii++) {
+        for (TPIE_OS_SIZE_T jj = 0; jj < bm.cols(); jj++) {
+            s << (bm.get(ii, jj) ? '1' : '0');
+        }
+        s << '\n';
+    }
+    return s;
+}
+
+bit_matrix_kernel::bit_matrix_kernel(const bit_matrix &m) :
+        m_tables(8 * 256, 0) {
+    // Each table is built from the previous entries: the entry for v is
+    // the entry for v without its lowest bit, plus the column of that
+    // bit.
+    for (TPIE_OS_SIZE_T t = 0; t < 8; t++) {
+        word_t *table = &m_tables[t * 256];
+        for (TPIE_OS_SIZE_T v = 1; v < 256; v++) {
+            TPIE_OS_SIZE_T low = 0;
+            while (!((v >> low) & 1)) {
+                low++;
+            }
+            TPIE_OS_SIZE_T col = t * 8 + low;
+            table[v] = table[v & (v - 1)] ^ (col < m.cols() ? m.column(col) : 0);
+        }
+    }
 }
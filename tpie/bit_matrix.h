@@ -1,63 +1,174 @@
 // -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
 // vi:set ts=4 sts=4 sw=4 noet :
 // Copyright 2008, The TPIE development team
-// 
+//
 // This file is part of TPIE.
-// 
+//
 // TPIE is free software: you can redistribute it and/or modify it under
 // the terms of the GNU Lesser General Public License as published by the
 // Free Software Foundation, either version 3 of the License, or (at your
 // option) any later version.
-// 
+//
 // TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
 // WARRANTY; without even the implied warranty of MERCHANTABILITY or
 // FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
 // License for more details.
-// 
+//
 // You should have received a copy of the GNU Lesser General Public License
 // along with TPIE.  If not, see <http://www.gnu.org/licenses/>
 
 #ifndef _TPIE_BIT_MATRIX_H
 #define _TPIE_BIT_MATRIX_H
 
-// Get definitions for working with Unix and Windows
-#include <portability.h>
-
-#include <bit.h>
-#include <matrix.h>
+///////////////////////////////////////////////////////////////////////////
+/// \file bit_matrix.h
+/// Matrices over GF(2), as used by BMMC permutations.
+///////////////////////////////////////////////////////////////////////////
 
-#include <sys/types.h>
+// Get definitions for working with Unix and Windows
+#include <tpie/portability.h>
+#include <tpie/tpie_assert.h>
 
+#include <vector>
+#include <iostream>
+#include <boost/cstdint.hpp>
 
 namespace tpie {
 
-    class bit_matrix : public matrix<bit> {
+///////////////////////////////////////////////////////////////////////////
+/// A matrix over GF(2) with at most 64 rows, where addition is XOR and
+/// multiplication is AND. Each column is stored as one 64-bit word, with
+/// row i in bit i, so a matrix-vector product is a XOR of the columns
+/// selected by the vector.
+///////////////////////////////////////////////////////////////////////////
+    class bit_matrix {
 
     public:
-	using matrix<bit>::rows;
-	using matrix<bit>::cols;
-	
-	bit_matrix(matrix<bit> &mb);
-	bit_matrix(TPIE_OS_SIZE_T rows, TPIE_OS_SIZE_T cols);
-	virtual ~bit_matrix(void);
-	
-	bit_matrix operator=(const bit_matrix &rhs);
-	
+	typedef boost::uint64_t word_t;
+
+	/** A reference to an entry, as returned by m[i][j]. */
+	class reference {
+	public:
+	    reference(bit_matrix &m, TPIE_OS_SIZE_T i, TPIE_OS_SIZE_T j): m_(m), i_(i), j_(j) {}
+	    operator bool() const {return m_.get(i_, j_);}
+	    reference &operator=(bool v) {m_.set(i_, j_, v); return *this;}
+	    reference &operator=(int v) {m_.set(i_, j_, v != 0); return *this;}
+	    reference &operator=(const reference &other) {m_.set(i_, j_, bool(other)); return *this;}
+	private:
+	    bit_matrix &m_;
+	    TPIE_OS_SIZE_T i_, j_;
+	};
+
+	/** A row, as returned by m[i]. */
+	class row_reference {
+	public:
+	    row_reference(bit_matrix &m, TPIE_OS_SIZE_T i): m_(m), i_(i) {}
+	    reference operator[](TPIE_OS_SIZE_T j) {return reference(m_, i_, j);}
+	private:
+	    bit_matrix &m_;
+	    TPIE_OS_SIZE_T i_;
+	};
+
+	/** An all zero matrix. */
+	bit_matrix(TPIE_OS_SIZE_T rows = 0, TPIE_OS_SIZE_T cols = 0);
+
+	/** The n by n identity matrix. */
+	static bit_matrix identity(TPIE_OS_SIZE_T n);
+
+	TPIE_OS_SIZE_T rows() const {return m_rows;}
+	TPIE_OS_SIZE_T cols() const {return m_cols.size();}
+
+	bool get(TPIE_OS_SIZE_T i, TPIE_OS_SIZE_T j) const {
+	    tp_assert(i < m_rows && j < m_cols.size(), "Range error.");
+	    return (m_cols[j] >> i) & 1;
+	}
+
+	void set(TPIE_OS_SIZE_T i, TPIE_OS_SIZE_T j, bool v) {
+	    tp_assert(i < m_rows && j < m_cols.size(), "Range error.");
+	    if (v)
+		m_cols[j] |= word_t(1) << i;
+	    else
+		m_cols[j] &= ~(word_t(1) << i);
+	}
+
+	row_reference operator[](TPIE_OS_SIZE_T i) {return row_reference(*this, i);}
+
+	/** Column j, with row i in bit i. */
+	word_t column(TPIE_OS_SIZE_T j) const {return m_cols[j];}
+	void set_column(TPIE_OS_SIZE_T j, word_t w) {m_cols[j] = w & mask();}
+
+	/** The product of this matrix and the column vector x, with entry j
+	 * in bit j. */
+	word_t apply(word_t x) const {
+	    word_t y = 0;
+	    for (TPIE_OS_SIZE_T j = 0; x && j < m_cols.size(); j++, x >>= 1)
+		if (x & 1)
+		    y ^= m_cols[j];
+	    return y;
+	}
+
 	// We can assign from an offset, which is typically a source
 	// address for a BMMC permutation.
 	bit_matrix &operator=(const TPIE_OS_OFFSET &rhs);
-	
-	operator TPIE_OS_OFFSET(void);
-	
+
+	operator TPIE_OS_OFFSET(void) const;
+
+	/** Computes the inverse, or returns false if the matrix is
+	 * singular. */
+	bool invert(bit_matrix &inverse) const;
+
+	TPIE_OS_SIZE_T rank() const;
+
+	/** The nr by nc submatrix with top left entry (r, c). */
+	bit_matrix submatrix(TPIE_OS_SIZE_T r, TPIE_OS_SIZE_T nr,
+			     TPIE_OS_SIZE_T c, TPIE_OS_SIZE_T nc) const;
+
+	bool operator==(const bit_matrix &other) const {
+	    return m_rows == other.m_rows && m_cols == other.m_cols;
+	}
+	bool operator!=(const bit_matrix &other) const {return !(*this == other);}
+
 	friend bit_matrix operator+(const bit_matrix &op1, const bit_matrix &op2);
 	friend bit_matrix operator*(const bit_matrix &op1, const bit_matrix &op2);
+
+    private:
+	word_t mask() const {
+	    return m_rows >= 64 ? ~word_t(0): (word_t(1) << m_rows) - 1;
+	}
+
+	TPIE_OS_SIZE_T m_rows;
+	std::vector<word_t> m_cols;
     };
-    
+
     bit_matrix operator+(const bit_matrix &op1, const bit_matrix &op2);
     bit_matrix operator*(const bit_matrix &op1, const bit_matrix &op2);
-    
-    std::ostream &operator<<(std::ostream &s, bit_matrix &bm);
+
+    std::ostream &operator<<(std::ostream &s, const bit_matrix &bm);
+
+///////////////////////////////////////////////////////////////////////////
+/// Multiplies vectors by a fixed bit_matrix a byte at a time: for each
+/// byte of the vector, a table holds the XOR of the columns selected by
+/// each of its 256 values, so a product of a 64-bit vector takes eight
+/// lookups.
+///////////////////////////////////////////////////////////////////////////
+    class bit_matrix_kernel {
+
+    public:
+	typedef bit_matrix::word_t word_t;
+
+	bit_matrix_kernel(const bit_matrix &m);
+
+	word_t operator()(word_t x) const {
+	    word_t y = 0;
+	    for (const word_t *t = &m_tables[0]; x; t += 256, x >>= 8)
+		y ^= t[x & 0xff];
+	    return y;
+	}
+
+    private:
+	std::vector<word_t> m_tables;
+    };
 
 }  //  tpie namespace
 
-#endif // _TPIE_BIT_MATRIX_H 
+#endif // _TPIE_BIT_MATRIX_H
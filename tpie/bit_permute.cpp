@@ -1,27 +1,28 @@
 // -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
 // vi:set ts=4 sts=4 sw=4 noet :
 // Copyright 2008, The TPIE development team
-// 
+//
 // This file is part of TPIE.
-// 
+//
 // TPIE is free software: you can redistribute it and/or modify it under
 // the terms of the GNU Lesser General Public License as published by the
 // Free Software Foundation, either version 3 of the License, or (at your
 // option) any later version.
-// 
+//
 // TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
 // WARRANTY; without even the implied warranty of MERCHANTABILITY or
 // FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
 // License for more details.
-// 
+//
 // You should have received a copy of the GNU Lesser General Public License
 // along with TPIE.  If not, see <http://www.gnu.org/licenses/>
 
 #include <iostream>
 
-#include <bit_permute.h>
+#include <tpie/bit_permute.h>
 
-using tpie::ami;
+using namespace tpie;
+using namespace tpie::ami;
 
 bit_perm_object::bit_perm_object(const bit_matrix &A,
 				 const bit_matrix &c) :
@@ -35,12 +36,213 @@ bit_perm_object::~bit_perm_object(void) {
 
 }
 
-bit_matrix bit_perm_object::A(void) {
+bit_matrix bit_perm_object::A(void) const {
     return mA;
 }
 
-bit_matrix bit_perm_object::c(void) {
+bit_matrix bit_perm_object::c(void) const {
     return mc;
 }
 
+namespace {
 
+    typedef bit_matrix::word_t word_t;
+
+    // A basis of a subspace of GF(2)^64 in echelon form, indexed by the
+    // highest bit of each vector.
+    class echelon_basis {
+
+    public:
+	echelon_basis() {
+	    for (int ii = 0; ii < 64; ii++) {
+		m_basis[ii] = 0;
+	    }
+	}
+
+	// Reduces v by the basis; 0 if v is in the subspace.
+	word_t reduce(word_t v) const {
+	    for (int ii = 63; ii >= 0 && v; ii--) {
+		if (((v >> ii) & 1) && m_basis[ii]) {
+		    v ^= m_basis[ii];
+		}
+	    }
+	    return v;
+	}
+
+	// Adds v to the subspace, unless it is in it already.
+	bool insert(word_t v) {
+	    v = reduce(v);
+	    if (!v) {
+		return false;
+	    }
+	    int ii = 63;
+	    while (!((v >> ii) & 1)) {
+		ii--;
+	    }
+	    m_basis[ii] = v;
+	    return true;
+	}
+
+    private:
+	word_t m_basis[64];
+    };
+
+    // The matrix with the given columns.
+    bit_matrix from_columns(const std::vector<word_t> &cols) {
+	bit_matrix res(cols.size(), cols.size());
+	for (TPIE_OS_SIZE_T jj = 0; jj < cols.size(); jj++) {
+	    res.set_column(jj, cols[jj]);
+	}
+	return res;
+    }
+
+}
+
+bool tpie::ami::bmmc_factor(const bit_matrix &A, TPIE_OS_SIZE_T b, TPIE_OS_SIZE_T m,
+			    std::vector<bit_matrix> &passes) {
+    const TPIE_OS_SIZE_T n = A.rows();
+    const word_t one = 1;
+    const word_t high = (n >= 64 ? ~word_t(0) : (one << n) - 1) &
+	~(m >= 64 ? ~word_t(0) : (one << m) - 1);
+    TPIE_OS_SIZE_T ii, jj;
+    bit_matrix R = A;
+    bit_matrix D(n, n);
+
+    passes.clear();
+    if (A.cols() != n || b > m || !A.invert(D)) {
+	return false;
+    }
+
+    // A pass can gather a memoryload of the target if the target addresses
+    // outside the memoryload, bits m and up, do not depend on the source
+    // offsets within blocks, bits below b. While the remaining matrix R
+    // violates this, peel off a pass P that moves up to m - b of the
+    // offending directions of the low source bits into the middle bits b
+    // to m, so that R P^-1 violates it less.
+    while (true) {
+	// Split the space L of the low bits into its intersection with K,
+	// the preimage under R of the memoryload bits, and pivot unit vectors
+	// completing it. K is spanned by the first m columns of D = R^-1.
+	std::vector<word_t> kernel, pivots;
+	{
+	    std::vector<std::pair<word_t, word_t> > reduced;
+	    for (jj = 0; jj < b; jj++) {
+		word_t v = R.column(jj) & high;
+		word_t comb = one << jj;
+		// Reduce v by the earlier pivots, tracking the combination.
+		bool changed = true;
+		while (v && changed) {
+		    changed = false;
+		    for (ii = 0; ii < reduced.size(); ii++) {
+			word_t top = reduced[ii].first;
+			int bit = 63;
+			while (!((top >> bit) & 1)) {
+			    bit--;
+			}
+			if ((v >> bit) & 1) {
+			    v ^= reduced[ii].first;
+			    comb ^= reduced[ii].second;
+			    changed = true;
+			}
+		    }
+		}
+		if (v) {
+		    reduced.push_back(std::make_pair(v, comb));
+		    pivots.push_back(one << jj);
+		} else {
+		    kernel.push_back(comb);
+		}
+	    }
+	}
+	if (pivots.empty()) {
+	    break;
+	}
+	TPIE_OS_SIZE_T moved = std::min(pivots.size(), m - b);
+	if (moved == 0) {
+	    return false;
+	}
+
+	// Source vectors of K outside L, to be mapped onto the moved
+	// pivots.
+	std::vector<word_t> ks;
+	{
+	    echelon_basis s;
+	    for (jj = 0; jj < b; jj++) {
+		s.insert(one << jj);
+	    }
+	    for (jj = 0; jj < m && ks.size() < moved; jj++) {
+		if (s.insert(D.column(jj))) {
+		    ks.push_back(D.column(jj));
+		}
+	    }
+	    if (ks.size() < moved) {
+		return false;
+	    }
+	}
+
+	std::vector<word_t> src, img;
+	for (ii = 0; ii < kernel.size(); ii++) {
+	    src.push_back(kernel[ii]);
+	    img.push_back(kernel[ii]);
+	}
+	for (ii = 0; ii < pivots.size(); ii++) {
+	    src.push_back(pivots[ii]);
+	    img.push_back(ii < moved ? one << (b + ii) : pivots[ii]);
+	}
+	for (ii = 0; ii < moved; ii++) {
+	    src.push_back(ks[ii]);
+	    img.push_back(pivots[ii]);
+	}
+
+	// Complete both to bases, mapping unit vectors to themselves where
+	// possible.
+	echelon_basis sb, ib;
+	for (ii = 0; ii < src.size(); ii++) {
+	    sb.insert(src[ii]);
+	    ib.insert(img[ii]);
+	}
+	std::vector<word_t> src_rest, img_rest;
+	for (jj = 0; jj < n; jj++) {
+	    word_t e = one << jj;
+	    bool s = sb.reduce(e) != 0;
+	    bool t = ib.reduce(e) != 0;
+	    if (s && t) {
+		sb.insert(e);
+		ib.insert(e);
+		src.push_back(e);
+		img.push_back(e);
+	    }
+	}
+	for (jj = 0; jj < n; jj++) {
+	    word_t e = one << jj;
+	    if (sb.insert(e)) {
+		src_rest.push_back(e);
+	    }
+	    if (ib.insert(e)) {
+		img_rest.push_back(e);
+	    }
+	}
+	for (ii = 0; ii < src_rest.size(); ii++) {
+	    src.push_back(src_rest[ii]);
+	    img.push_back(img_rest[ii]);
+	}
+
+	// P maps src to img.
+	bit_matrix S = from_columns(src);
+	bit_matrix S_inv(n, n);
+	if (!S.invert(S_inv)) {
+	    return false;
+	}
+	bit_matrix P = from_columns(img) * S_inv;
+	bit_matrix P_inv(n, n);
+	if (!P.invert(P_inv)) {
+	    return false;
+	}
+	passes.push_back(P);
+	R = R * P_inv;
+	R.invert(D);
+    }
+
+    passes.push_back(R);
+    return true;
+}
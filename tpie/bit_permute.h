@@ -1,38 +1,47 @@
 // -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
 // vi:set ts=4 sts=4 sw=4 noet :
 // Copyright 2008, The TPIE development team
-// 
+//
 // This file is part of TPIE.
-// 
+//
 // TPIE is free software: you can redistribute it and/or modify it under
 // the terms of the GNU Lesser General Public License as published by the
 // Free Software Foundation, either version 3 of the License, or (at your
 // option) any later version.
-// 
+//
 // TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
 // WARRANTY; without even the implied warranty of MERCHANTABILITY or
 // FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
 // License for more details.
-// 
+//
 // You should have received a copy of the GNU Lesser General Public License
 // along with TPIE.  If not, see <http://www.gnu.org/licenses/>
 
-// For the moment this is done in terms of general permutations.
-// This will obviously change in the future.
-
 #ifndef _TPIE_AMI_BIT_PERMUTE_H
 #define _TPIE_AMI_BIT_PERMUTE_H
 
+///////////////////////////////////////////////////////////////////////////
+/// \file bit_permute.h
+/// BMMC (bit-matrix-multiply/complement) permutations of streams.
+///////////////////////////////////////////////////////////////////////////
+
 // Get definitions for working with Unix and Windows
-#include <portability.h>
+#include <tpie/portability.h>
+
+#include <vector>
+#include <algorithm>
 
 // Get bit_matrix.
-#include <bit_matrix.h>
+#include <tpie/bit_matrix.h>
+
+#include <tpie/stream.h>
+#include <tpie/array.h>
+#include <tpie/mm.h>
 
 // Get AMI_gen_perm_object.
-#include <gen_perm_object.h>
+#include <tpie/gen_perm_object.h>
 // Get the AMI_general_permute().
-#include <gen_perm.h>
+#include <tpie/gen_perm.h>
 
 namespace tpie {
 
@@ -49,20 +58,240 @@ namespace tpie {
 	    bit_perm_object(const bit_matrix &A,
 			    const bit_matrix &c);
 	    ~bit_perm_object(void);
-	    
-	    bit_matrix A(void);
-	    bit_matrix c(void);
+
+	    bit_matrix A(void) const;
+	    bit_matrix c(void) const;
 	};
 
+	///////////////////////////////////////////////////////////////////
+	/// Factors the n by n matrix \p A into passes, A = P_k ... P_1,
+	/// each of which can be done in one pass over a stream with blocks
+	/// of 2^b items and memoryloads of 2^m items: no P_i makes the bits
+	/// m and up of the target address depend on the bits below b of the
+	/// source address. There are ceil(r / (m - b)) + 1 passes, where r
+	/// is the rank of the submatrix of A in rows m and up and columns
+	/// below b, or one if r is 0. Returns false if A is singular or
+	/// m = b < n.
+	///////////////////////////////////////////////////////////////////
+	bool bmmc_factor(const bit_matrix &A, TPIE_OS_SIZE_T b, TPIE_OS_SIZE_T m,
+			 std::vector<bit_matrix> &passes);
+
+	///////////////////////////////////////////////////////////////////
+	/// Performs BMMC permutations; see bmmc_permute().
+	///////////////////////////////////////////////////////////////////
+	template<class T>
+	class bmmc_permute_op {
+
+	public:
+	    typedef bit_matrix::word_t word_t;
+
+	    bmmc_permute_op(const bit_matrix &A, const bit_matrix &c, TPIE_OS_SIZE_T memory) :
+		m_A(A), m_c(c), m_memory(memory), m_passes(0) {}
+
+	    err run(stream<T> *in, stream<T> *out);
+
+	    /** The number of passes over the data of the last run(). */
+	    TPIE_OS_SIZE_T passes(void) const { return m_passes; }
+
+	protected:
+	    err pass(stream<T> *in, stream<T> *out, const bit_matrix &M, word_t c,
+		     TPIE_OS_SIZE_T b, TPIE_OS_SIZE_T m);
+
+	    bit_matrix m_A;
+	    bit_matrix m_c;
+	    TPIE_OS_SIZE_T m_memory;
+	    TPIE_OS_SIZE_T m_passes;
+	};
+
+//// *bmmc_permute_op::run* ////
+	template<class T>
+	err bmmc_permute_op<T>::run(stream<T> *in, stream<T> *out) {
+	    TPIE_OS_OFFSET len = in->stream_len();
+	    TPIE_OS_SIZE_T n, b, m;
+	    TPIE_OS_SIZE_T ii;
+	    err ae = NO_ERROR;
+
+	    m_passes = 0;
+
+	    // Make sure the length of the input stream is a power of two.
+	    for (n = 0; (TPIE_OS_OFFSET(1) << n) < len; n++) ;
+	    if (len == 0 || (TPIE_OS_OFFSET(1) << n) != len) {
+		return NOT_POWER_OF_2;
+	    }
+	    if (m_A.rows() != n || m_A.cols() != n || m_c.rows() != n || m_c.cols() != 1) {
+		return BIT_MATRIX_BOUNDS;
+	    }
+
+	    // Memoryloads of 2^m items, with room for the stream buffers.
+	    TPIE_OS_SIZE_T memory = m_memory ? m_memory : MM_manager.consecutive_memory_available();
+	    TPIE_OS_SIZE_T sz_stream;
+	    in->main_memory_usage(&sz_stream, mem::STREAM_USAGE_MAXIMUM);
+	    memory = memory > 3 * sz_stream ? memory - 3 * sz_stream : 0;
+	    for (m = 0; m < n && (TPIE_OS_SIZE_T(2) << m) * (sizeof(T) + 2 * sizeof(word_t)) <= memory; m++) ;
+	    for (b = 0; (TPIE_OS_SIZE_T(2) << b) <= in->chunk_size(); b++) ;
+	    if (m < n) {
+		if (m == 0) {
+		    return INSUFFICIENT_MAIN_MEMORY;
+		}
+		// Smaller blocks than the stream's cost I/O efficiency only.
+		b = std::min(b, m - 1);
+	    } else {
+		b = std::min(b, n);
+	    }
+
+	    std::vector<bit_matrix> passes;
+	    if (!bmmc_factor(m_A, b, m, passes)) {
+		TP_LOG_WARNING_ID("bmmc_permute: singular bit matrix.");
+		return OBJECT_INVALID;
+	    }
+
+	    stream<T> *cur = in;
+	    for (ii = 0; ii < passes.size() && ae == NO_ERROR; ii++) {
+		bool last = (ii + 1 == passes.size());
+		stream<T> *next = out;
+		if (!last) {
+		    next = new stream<T>;
+		    next->persist(PERSIST_DELETE);
+		}
+		ae = pass(cur, next, passes[ii], last ? m_c.column(0) : 0, b, m);
+		if (cur != in) {
+		    delete cur;
+		}
+		cur = next;
+		m_passes++;
+	    }
+	    if (cur != out) {
+		delete cur;
+	    }
+	    return ae;
+	}
+
+//// *bmmc_permute_op::pass* ////
+	template<class T>
+	err bmmc_permute_op<T>::pass(stream<T> *in, stream<T> *out, const bit_matrix &M, word_t c,
+				     TPIE_OS_SIZE_T b, TPIE_OS_SIZE_T m) {
+	    const TPIE_OS_SIZE_T n = M.rows();
+	    const TPIE_OS_SIZE_T B = TPIE_OS_SIZE_T(1) << b;
+	    const word_t mask = (word_t(1) << m) - 1;
+	    TPIE_OS_SIZE_T ii, jj;
+	    err ae;
+
+	    bit_matrix D(n, n);
+	    M.invert(D);
+	    bit_matrix_kernel Mk(M);
+	    bit_matrix_kernel Dk(D);
+
+	    // The target addresses of the offsets within a block.
+	    array<word_t> low(B);
+	    for (ii = 0; ii < B; ii++) {
+		low[ii] = Mk(ii);
+	    }
+
+	    // The source blocks of a target memoryload are those of its first
+	    // item plus a subspace of block numbers of dimension m - b, spanned
+	    // by the block numbers of the preimages of the memoryload bits.
+	    std::vector<word_t> span;
+	    {
+		std::vector<word_t> basis;
+		for (jj = 0; jj < m; jj++) {
+		    word_t v = D.column(jj) >> b;
+		    for (ii = 0; ii < basis.size(); ii++) {
+			v = std::min(v, v ^ basis[ii]);
+		    }
+		    if (v) {
+			basis.push_back(v);
+			std::sort(basis.rbegin(), basis.rend());
+			span.push_back(D.column(jj) >> b);
+		    }
+		}
+	    }
+	    tp_assert(span.size() == m - b, "Source blocks do not fill a memoryload.");
+
+	    array<T> memoryload(TPIE_OS_SIZE_T(1) << m);
+	    array<T> block(B);
+	    std::vector<TPIE_OS_OFFSET> blocks(TPIE_OS_SIZE_T(1) << span.size());
+	    TPIE_OS_OFFSET loads = TPIE_OS_OFFSET(1) << (n - m);
+
+	    for (TPIE_OS_OFFSET Y = 0; Y < loads; Y++) {
+		// Enumerate the source blocks in Gray code order, and read them
+		// in order of position.
+		word_t v = Dk((word_t(Y) << m) ^ c) >> b;
+		blocks[0] = TPIE_OS_OFFSET(v);
+		for (ii = 1; ii < blocks.size(); ii++) {
+		    TPIE_OS_SIZE_T bit = 0;
+		    while (!((ii >> bit) & 1)) {
+			bit++;
+		    }
+		    v ^= span[bit];
+		    blocks[ii] = TPIE_OS_OFFSET(v);
+		}
+		std::sort(blocks.begin(), blocks.end());
+
+		for (ii = 0; ii < blocks.size(); ii++) {
+		    TPIE_OS_SIZE_T got = B;
+		    if ((ae = in->seek(blocks[ii] << b)) != NO_ERROR ||
+			(ae = in->read_array(&block[0], got)) != NO_ERROR) {
+			return ae;
+		    }
+		    word_t y = Mk(word_t(blocks[ii]) << b) ^ c;
+		    tp_assert((y >> m) == word_t(Y), "Source block outside the memoryload.");
+		    for (jj = 0; jj < B; jj++) {
+			memoryload[(y ^ low[jj]) & mask] = block[jj];
+		    }
+		}
+
+		if ((ae = out->write_array(&memoryload[0], memoryload.size())) != NO_ERROR) {
+		    return ae;
+		}
+	    }
+	    return NO_ERROR;
+	}
+
+	///////////////////////////////////////////////////////////////////
+	/// Permutes the 2^n items of \p in into \p out, moving the item at
+	/// address x to address A x + c, where A is an invertible n by n
+	/// bit_matrix and c an n by 1 bit_matrix, and addresses are vectors
+	/// of bits with the least significant bit first. Transposes of
+	/// matrices with power of two dimensions, bit reversals, Gray code
+	/// orders and their compositions are BMMC permutations.
+	///
+	/// A is factored by bmmc_factor() into the fewest passes of an
+	/// algorithm that gathers each memoryload of the output from whole
+	/// blocks of the input, which is ceil(r / lg(M/B)) + 1 passes, r
+	/// being the rank of the part of A that maps offsets within blocks
+	/// to addresses outside memoryloads [Cormen, Sundquist and
+	/// Wisniewski, 1999]. Each pass reads and writes every block once,
+	/// and maps addresses with table driven bit_matrix_kernel products.
+	///
+	/// Up to \p memory bytes are used (0 means the available memory).
+	/// Returns NOT_POWER_OF_2 if the length of \p in is not a power of
+	/// two, BIT_MATRIX_BOUNDS if the matrices do not match it, and
+	/// OBJECT_INVALID if A is singular.
+	///////////////////////////////////////////////////////////////////
+	template<class T>
+	err bmmc_permute(stream<T> *in, stream<T> *out, const bit_perm_object &bpo,
+			 TPIE_OS_SIZE_T memory = 0) {
+	    if (in == NULL || out == NULL) {
+		TP_LOG_WARNING_ID("bmmc_permute: NULL stream. Aborted.");
+		return NULL_POINTER;
+	    }
+	    bmmc_permute_op<T> op(bpo.A(), bpo.c(), memory);
+	    return op.run(in, out);
+	}
+
     }  //  ami namespace
 
-}  //  tpie namespace 
-    
+}  //  tpie namespace
+
 
 namespace tpie {
 
     namespace ami {
-	
+
+	///////////////////////////////////////////////////////////////////
+	/// A BMMC permutation as a gen_perm_object, for general_permute().
+	/// bmmc_permute() is faster.
+	///////////////////////////////////////////////////////////////////
 	template<class T>
 	class bmmc_as_gen_po : public gen_perm_object {
 
@@ -70,38 +299,27 @@ namespace tpie {
 	    // Prohibit these
 	    bmmc_as_gen_po(const bmmc_as_gen_po<T>& other);
 	    bmmc_as_gen_po<T>& operator=(const bmmc_as_gen_po<T>& other);
-	    
-	    bit_matrix *src_bits;
+
 	    bit_matrix A;
 	    bit_matrix c;
-	    
+
 	public:
-	    bmmc_as_gen_po(AMI_bit_perm_object &bpo) :
-		A(bpo.A()), c(bpo.c()), src_bits(NULL)
+	    bmmc_as_gen_po(const bit_perm_object &bpo) :
+		A(bpo.A()), c(bpo.c())
 		{
 		    tp_assert(A.rows() == A.cols(), "A is not square.");
 		    tp_assert(c.cols() == 1, "c is not a column vector.");
 		    tp_assert(c.rows() == A.cols(), "A and c dimensions do not match.");
-		    src_bits = new bit_matrix(c.rows(),1);
 		};
-	    
-	    //  This destructor was not present before 2005116---why?
-	    virtual ~bmmc_as_gen_po() {
-		delete src_bits;
-	    }
-	    
-	    AMI_err initialize(TPIE_OS_OFFSET /*stream_len*/) {
+
+	    virtual ~bmmc_as_gen_po() {}
+
+	    err initialize(TPIE_OS_OFFSET /*stream_len*/) {
 		return ami::NO_ERROR;
 	    }
-	    
+
 	    TPIE_OS_OFFSET destination(TPIE_OS_OFFSET input_offset) {
-		
-		*src_bits = input_offset;
-		
-		bit_matrix r1 = A * *src_bits;
-		bit_matrix res = r1 + c;
-		
-		return TPIE_OS_OFFSET(res);
+		return TPIE_OS_OFFSET(A.apply(bit_matrix::word_t(input_offset)) ^ c.column(0));
 	    }
 	};
 
@@ -111,56 +329,15 @@ namespace tpie {
 
 #ifndef TPIE_LIBRARY
 
+typedef tpie::ami::bit_perm_object AMI_bit_perm_object;
+
 template<class T>
-AMI_err AMI_BMMC_permute(AMI_STREAM<T> *instream, AMI_STREAM<T> *outstream,
-                         tpie::ami::bit_perm_object *bpo)
+tpie::ami::err AMI_BMMC_permute(tpie::ami::stream<T> *instream, tpie::ami::stream<T> *outstream,
+                                tpie::ami::bit_perm_object *bpo)
 {
-    TPIE_OS_OFFSET sz_len = instream->stream_len();
-
-    TPIE_OS_OFFSET sz_pow2;
-    unsigned int bits;
-    
-    // Make sure the length of the input stream is a power of two.
-
-    for (sz_pow2 = 1, bits = 0; sz_pow2 < sz_len; sz_pow2 += sz_pow2) {
-        bits++;
-    }
-
-    if (sz_pow2 != sz_len) {
-        return ami::NOT_POWER_OF_2;
-    }
-    
-    // Make sure the number of bits in the permutation matrix matches
-    // the log of the number of items in the input stream.
-
-    {
-	tpie::ami::bit_matrix A = bpo->A();
-	tpie::ami::bit_matrix c = bpo->c();
-        
-        if (A.rows() != bits) {
-            return ami::BIT_MATRIX_BOUNDS;
-        }
-    
-        if (A.cols() != bits) {
-            return ami::BIT_MATRIX_BOUNDS;
-        }
-
-        if (c.rows() != bits) {
-            return ami::BIT_MATRIX_BOUNDS;
-        }
-
-        if (c.cols() != 1) {
-            return ami::BIT_MATRIX_BOUNDS;
-        }
-    }
-        
-    // Create the general permutation object.
-    tpie::ami::bmmc_as_gen_po<T> gpo(*bpo);
-    
-    // Do the permutation.
-    return tpie::ami::general_permute(instream, outstream, &gpo);
+    return tpie::ami::bmmc_permute(instream, outstream, *bpo);
 }
 
 #endif // ndef TPIE_LIBRARY
 
-#endif // _TPIE_AMI_BIT_PERMUTE_H 
+#endif // _TPIE_AMI_BIT_PERMUTE_H
@@ -0,0 +1,351 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; eval: (progn (c-set-style "stroustrup") (c-set-offset 'innamespace 0)); -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2010, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+///////////////////////////////////////////////////////////////////////////
+/// \file bkdtree.h
+/// Provides definition and implementation of the Bkd-tree, a dynamic
+/// kd-tree built with the logarithmic method.
+///////////////////////////////////////////////////////////////////////////
+
+#ifndef _TPIE_AMI_BKDTREE_H
+#define _TPIE_AMI_BKDTREE_H
+
+#include <tpie/config.h>
+#include <tpie/portability.h>
+// For min, max, partial_sort.
+#include <algorithm>
+// For vector.
+#include <vector>
+
+// The static kd-trees.
+#include <tpie/kdtree.h>
+
+namespace tpie {
+
+namespace ami {
+
+/** A global object storing the default parameter values. */
+const bkdtree_params _bkdtree_params_default = bkdtree_params();
+
+///////////////////////////////////////////////////////////////////////////
+/// The Bkd-tree: a dynamic structure for points, made of an in-memory
+/// buffer and a set of static kd-trees of geometrically increasing
+/// size. The kd-tree in slot i holds (at most) buffer_size * 2^i points,
+/// and each slot is either empty or full. When the buffer overflows, it
+/// is merged with the kd-trees in the slots before the first empty one,
+/// and the result is bulk loaded into that slot, like incrementing a
+/// binary counter (as in Logmethod2). Every point is thus loaded
+/// O(log(N/buffer_size)) times, always by the bulk loader.
+///
+/// Queries are answered by all the kd-trees and the buffer. Deletions
+/// are done in place, in the buffer or the kd-tree holding the point.
+///
+/// The kd-trees are temporary; the structure is not persistent.
+///////////////////////////////////////////////////////////////////////////
+template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node=kdtree_bin_node_default<coord_t, dim>, class BTECOLL = bte::COLLECTION >
+class bkdtree {
+public:
+
+	typedef kdtree<coord_t, dim, Bin_node, BTECOLL> tree_t;
+	typedef record<coord_t, size_t, dim> point_t;
+	typedef stream<point_t> stream_t;
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Constructor. The parameters (other than buffer_size) are used for
+	/// all the kd-trees.
+	///////////////////////////////////////////////////////////////////////////
+	bkdtree(const bkdtree_params& params = _bkdtree_params_default);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Inserts a point. If this fills the buffer, it is merged into the
+	/// kd-trees. Returns true if successful.
+	///////////////////////////////////////////////////////////////////////////
+	bool insert(const point_t& p);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Deletes a point. Returns true if found and deleted.
+	///////////////////////////////////////////////////////////////////////////
+	bool erase(const point_t& p);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Finds a point; returns true if found, false otherwise.
+	///////////////////////////////////////////////////////////////////////////
+	bool find(const point_t& p);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Reports all points inside the window determined by \p p1 and \p
+	/// p2. If \p stream is \p NULL, only counts the points. Returns the
+	/// number of points inside the window.
+	///////////////////////////////////////////////////////////////////////////
+	TPIE_OS_OFFSET window_query(const point_t& p1, const point_t& p2, stream_t* stream);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Reports the \p k nearest neighbors of point \p p, nearest first.
+	/// The k nearest neighbors in each kd-tree and the buffer are merged.
+	/// Returns the number of points reported (less than \p k only if the
+	/// structure has fewer points).
+	///////////////////////////////////////////////////////////////////////////
+	TPIE_OS_OFFSET k_nn_query(const point_t& p, stream_t* stream, TPIE_OS_OFFSET k);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Writes all points to the given stream. No changes are made to the
+	/// structure.
+	///////////////////////////////////////////////////////////////////////////
+	err unload(stream_t* s);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Returns the number of points stored.
+	///////////////////////////////////////////////////////////////////////////
+	TPIE_OS_OFFSET size() const { return size_; }
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Returns the number of (nonempty) kd-trees.
+	///////////////////////////////////////////////////////////////////////////
+	TPIE_OS_SIZE_T tree_count() const;
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Inquires the parameters.
+	///////////////////////////////////////////////////////////////////////////
+	const bkdtree_params& params() const { return params_; }
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Destructor. Deletes the kd-trees.
+	///////////////////////////////////////////////////////////////////////////
+	~bkdtree();
+
+protected:
+
+	typedef typename tree_t::nn_candidate nn_candidate;
+
+	/** The parameters. */
+	bkdtree_params params_;
+
+	/** The points not yet in a kd-tree. */
+	std::vector<point_t> buffer_;
+
+	/** The kd-trees; trees_[i] is NULL or holds up to buffer_size * 2^i
+	 * points. */
+	std::vector<tree_t*> trees_;
+
+	/** The number of points stored. */
+	TPIE_OS_OFFSET size_;
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Merges the buffer and the kd-trees before the first empty slot
+	/// into a new kd-tree in that slot.
+	///////////////////////////////////////////////////////////////////////////
+	err merge();
+};
+
+#define TPIE_AMI_BKDTREE      bkdtree<coord_t, dim, Bin_node, BTECOLL>
+#define POINT            record<coord_t, TPIE_OS_SIZE_T, dim>
+#define POINT_STREAM     stream< POINT >
+
+//// *bkdtree::bkdtree* ////
+	template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+	TPIE_AMI_BKDTREE::bkdtree(const bkdtree_params& params):
+		params_(params), buffer_(), trees_(), size_(0) {
+		if (params_.buffer_size == 0)
+			params_.buffer_size = 1;
+		buffer_.reserve(params_.buffer_size);
+	}
+
+//// *bkdtree::insert* ////
+	template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+	bool TPIE_AMI_BKDTREE::insert(const POINT& p) {
+		buffer_.push_back(p);
+		size_++;
+		if (buffer_.size() >= params_.buffer_size)
+			return merge() == NO_ERROR;
+		return true;
+	}
+
+//// *bkdtree::merge* ////
+	template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+	err TPIE_AMI_BKDTREE::merge() {
+		TPIE_OS_SIZE_T i, j;
+		err ae = NO_ERROR;
+
+		// Find the first empty slot.
+		for (i = 0; i < trees_.size() && trees_[i] != NULL; i++)
+			;
+		if (i == trees_.size())
+			trees_.push_back(NULL);
+
+		// Collect the buffer and the kd-trees in the slots before it.
+		POINT_STREAM* s = new POINT_STREAM;
+		s->persist(PERSIST_DELETE);
+		for (j = 0; j < buffer_.size() && ae == NO_ERROR; j++)
+			ae = s->write_item(buffer_[j]);
+		for (j = 0; j < i && ae == NO_ERROR; j++)
+			ae = trees_[j]->unload(s);
+		if (ae != NO_ERROR) {
+			TP_LOG_WARNING_ID("  merge: cannot write the points to merge.");
+			delete s;
+			return ae;
+		}
+
+		tree_t* t = new tree_t(params_);
+		if ((ae = t->load(s)) != NO_ERROR) {
+			TP_LOG_WARNING_ID("  merge: cannot load the merged kd-tree.");
+			delete t;
+			delete s;
+			return ae;
+		}
+		delete s;
+
+		for (j = 0; j < i; j++) {
+			delete trees_[j];
+			trees_[j] = NULL;
+		}
+		trees_[i] = t;
+		buffer_.clear();
+		return NO_ERROR;
+	}
+
+//// *bkdtree::erase* ////
+	template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+	bool TPIE_AMI_BKDTREE::erase(const POINT& p) {
+		TPIE_OS_SIZE_T i;
+		for (i = 0; i < buffer_.size(); i++) {
+			if (buffer_[i] == p) {
+				buffer_[i] = buffer_.back();
+				buffer_.pop_back();
+				size_--;
+				return true;
+			}
+		}
+		for (i = 0; i < trees_.size(); i++) {
+			if (trees_[i] != NULL && trees_[i]->erase(p)) {
+				size_--;
+				return true;
+			}
+		}
+		return false;
+	}
+
+//// *bkdtree::find* ////
+	template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+	bool TPIE_AMI_BKDTREE::find(const POINT& p) {
+		TPIE_OS_SIZE_T i;
+		for (i = 0; i < buffer_.size(); i++)
+			if (buffer_[i] == p)
+				return true;
+		for (i = 0; i < trees_.size(); i++)
+			if (trees_[i] != NULL && trees_[i]->find(p))
+				return true;
+		return false;
+	}
+
+//// *bkdtree::window_query* ////
+	template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+	TPIE_OS_OFFSET TPIE_AMI_BKDTREE::window_query(const POINT& p1, const POINT& p2,
+												  POINT_STREAM* stream) {
+		TPIE_OS_OFFSET result = 0;
+		TPIE_OS_SIZE_T i;
+		POINT lop, hip;
+
+		for (i = 0; i < trees_.size(); i++)
+			if (trees_[i] != NULL)
+				result += trees_[i]->window_query(p1, p2, stream);
+
+		// The same (closed) box as in the kd-trees.
+		for (i = 0; i < dim; i++) {
+			lop[i] = std::min(p1[i], p2[i]);
+			hip[i] = std::max(p1[i], p2[i]);
+		}
+		for (i = 0; i < buffer_.size(); i++) {
+			if (lop < buffer_[i] && buffer_[i] < hip) {
+				if (stream != NULL)
+					stream->write_item(buffer_[i]);
+				result++;
+			}
+		}
+		return result;
+	}
+
+//// *bkdtree::k_nn_query* ////
+	template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+	TPIE_OS_OFFSET TPIE_AMI_BKDTREE::k_nn_query(const POINT& p,
+												POINT_STREAM* stream, TPIE_OS_OFFSET k) {
+		TPIE_OS_SIZE_T i, j;
+		double diff, d2;
+
+		if (k <= 0)
+			return 0;
+
+		// The k nearest of each kd-tree, and all the buffer.
+		std::vector<nn_candidate> res;
+		for (i = 0; i < trees_.size(); i++)
+			if (trees_[i] != NULL && trees_[i]->status() == KDTREE_STATUS_VALID)
+				trees_[i]->k_nn_search(p, k, res);
+		for (i = 0; i < buffer_.size(); i++) {
+			d2 = 0.0;
+			for (j = 0; j < dim; j++) {
+				diff = double(buffer_[i][j]) - double(p[j]);
+				d2 += diff * diff;
+			}
+			res.push_back(nn_candidate(d2, buffer_[i]));
+		}
+
+		TPIE_OS_SIZE_T n = std::min(res.size(), TPIE_OS_SIZE_T(k));
+		std::partial_sort(res.begin(), res.begin() + n, res.end());
+		if (stream != NULL)
+			for (i = 0; i < n; i++)
+				stream->write_item(res[i].p);
+		return n;
+	}
+
+//// *bkdtree::unload* ////
+	template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+	err TPIE_AMI_BKDTREE::unload(POINT_STREAM* s) {
+		err ae = NO_ERROR;
+		TPIE_OS_SIZE_T i;
+		for (i = 0; i < trees_.size() && ae == NO_ERROR; i++)
+			if (trees_[i] != NULL)
+				ae = trees_[i]->unload(s);
+		for (i = 0; i < buffer_.size() && ae == NO_ERROR; i++)
+			ae = s->write_item(buffer_[i]);
+		return ae;
+	}
+
+//// *bkdtree::tree_count* ////
+	template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+	TPIE_OS_SIZE_T TPIE_AMI_BKDTREE::tree_count() const {
+		TPIE_OS_SIZE_T i, c = 0;
+		for (i = 0; i < trees_.size(); i++)
+			if (trees_[i] != NULL)
+				c++;
+		return c;
+	}
+
+//// *bkdtree::~bkdtree* ////
+	template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+	TPIE_AMI_BKDTREE::~bkdtree() {
+		for (TPIE_OS_SIZE_T i = 0; i < trees_.size(); i++)
+			delete trees_[i];
+	}
+
+#undef TPIE_AMI_BKDTREE
+#undef POINT
+#undef POINT_STREAM
+
+	} } //end of tpie::ami namespace
+
+#endif //_TPIE_AMI_BKDTREE_H
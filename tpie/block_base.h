@@ -221,7 +221,7 @@ namespace tpie {
 		if (pdata_ != NULL){
 		    if (per_ == PERSIST_PERSISTENT) {
 			// Write back the block.
-			pcoll_->put_block(bid_, pdata_); 
+			pcoll_->put_block(bid_, pdata_, dirty_);
 		    } else {
 			// Delete the block from the collection.
 			pcoll_->delete_block(bid_, pdata_);
@@ -0,0 +1,365 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2010, The TPIE development team
+// 
+// This file is part of TPIE.
+// 
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+// 
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+
+#include <tpie/config.h>
+#include <tpie/bte/block_cache.h>
+// Include the registration based memory manager.
+#define MM_IMP_REGISTER
+#include <tpie/mm.h>
+
+#include <vector>
+#include <algorithm>
+
+using namespace tpie;
+using namespace tpie::bte;
+
+block_cache &block_cache::instance() {
+    static block_cache cache;
+    return cache;
+}
+
+block_cache::block_cache() :
+    shards_(new shard_type_[BTE_BLOCK_CACHE_SHARDS]), capacity_(0),
+    next_collection_(1) {
+    MM_manager.set_reclaim(&reclaim_memory);
+}
+
+block_cache::~block_cache() {
+    MM_manager.set_reclaim(NULL);
+
+    // Release what is left at exit.
+    for (TPIE_OS_SIZE_T ii = 0; ii < BTE_BLOCK_CACHE_SHARDS; ii++) {
+	shard_type_ &s = shards_[ii];
+	std::map<key_type_, entry_type_>::iterator it;
+	for (it = s.items.begin(); it != s.items.end(); ++it) {
+	    it->second.release(it->second.place, it->second.size);
+	}
+    }
+    delete [] shards_;
+}
+
+TPIE_OS_SIZE_T block_cache::new_collection() {
+    boost::mutex::scoped_lock lock(id_mutex_);
+    return next_collection_++;
+}
+
+TPIE_OS_SIZE_T block_cache::capacity() const {
+    if (capacity_) {
+	return capacity_;
+    }
+    return MM_manager.memory_limit() / 100 * BTE_BLOCK_CACHE_PERCENT;
+}
+
+TPIE_OS_SIZE_T block_cache::size() const {
+    TPIE_OS_SIZE_T res = 0;
+    for (TPIE_OS_SIZE_T ii = 0; ii < BTE_BLOCK_CACHE_SHARDS; ii++) {
+	boost::mutex::scoped_lock lock(shards_[ii].mutex);
+	res += shards_[ii].bytes;
+    }
+    return res;
+}
+
+TPIE_OS_OFFSET block_cache::hits() const {
+    TPIE_OS_OFFSET res = 0;
+    for (TPIE_OS_SIZE_T ii = 0; ii < BTE_BLOCK_CACHE_SHARDS; ii++) {
+	boost::mutex::scoped_lock lock(shards_[ii].mutex);
+	res += shards_[ii].hits;
+    }
+    return res;
+}
+
+TPIE_OS_OFFSET block_cache::misses() const {
+    TPIE_OS_OFFSET res = 0;
+    for (TPIE_OS_SIZE_T ii = 0; ii < BTE_BLOCK_CACHE_SHARDS; ii++) {
+	boost::mutex::scoped_lock lock(shards_[ii].mutex);
+	res += shards_[ii].misses;
+    }
+    return res;
+}
+
+bool block_cache::take(TPIE_OS_SIZE_T coll, TPIE_OS_OFFSET bid, void *&place) {
+    key_type_ k(coll, bid);
+    shard_type_ &s = shard(k);
+    boost::mutex::scoped_lock lock(s.mutex);
+
+    // A block being read ahead is here soon.
+    while (s.pending.count(k)) {
+	s.done.wait(lock);
+    }
+    s.out.insert(k);
+
+    std::map<key_type_, entry_type_>::iterator it = s.items.find(k);
+    if (it == s.items.end()) {
+	s.misses++;
+	return false;
+    }
+
+    entry_type_ &e = it->second;
+    if (e.hot) {
+	s.lru.erase(e.pos);
+    } else {
+	s.fifo.erase(e.pos);
+	s.fifo_bytes -= e.size;
+    }
+    s.bytes -= e.size;
+    place = e.place;
+    s.items.erase(it);
+
+    // It is used again, so it is hot when it comes back.
+    s.taken.insert(k);
+    s.hits++;
+    return true;
+}
+
+block_cache::entry_type_ block_cache::evict(shard_type_ &s, bool from_fifo, bool ghost) {
+    std::list<key_type_> &queue = from_fifo ? s.fifo : s.lru;
+    key_type_ k = queue.back();
+    queue.pop_back();
+
+    std::map<key_type_, entry_type_>::iterator it = s.items.find(k);
+    entry_type_ e = it->second;
+    s.items.erase(it);
+    s.bytes -= e.size;
+
+    if (from_fifo) {
+	s.fifo_bytes -= e.size;
+	if (ghost) {
+	    s.ghosts.push_front(k);
+	    s.ghost_pos[k] = s.ghosts.begin();
+	}
+    }
+    return e;
+}
+
+bool block_cache::forget_ghost(shard_type_ &s, const key_type_ &k) {
+    std::map<key_type_, std::list<key_type_>::iterator>::iterator it = s.ghost_pos.find(k);
+    if (it == s.ghost_pos.end()) {
+	return false;
+    }
+    s.ghosts.erase(it->second);
+    s.ghost_pos.erase(it);
+    return true;
+}
+
+void block_cache::insert(shard_type_ &s, const key_type_ &k, entry_type_ e,
+			 TPIE_OS_SIZE_T available, std::vector<entry_type_> &released) {
+
+    // Stay within the share of the budget, and leave at least half of
+    // the free memory to others.
+    TPIE_OS_SIZE_T budget = std::min(capacity() / BTE_BLOCK_CACHE_SHARDS,
+				     s.bytes + available / 2 / BTE_BLOCK_CACHE_SHARDS);
+
+    if (e.size > budget) {
+	released.push_back(e);
+	return;
+    }
+
+    if (e.hot) {
+	s.lru.push_front(k);
+	e.pos = s.lru.begin();
+    } else {
+	s.fifo.push_front(k);
+	e.pos = s.fifo.begin();
+	s.fifo_bytes += e.size;
+    }
+    s.items[k] = e;
+    s.bytes += e.size;
+
+    // The FIFO gets a quarter of the budget, unless the LRU queue is
+    // empty.
+    while (s.bytes > budget) {
+	bool from_fifo = s.lru.empty() || s.fifo_bytes > budget / 4;
+	released.push_back(evict(s, from_fifo));
+    }
+
+    // Remember as many ghosts as blocks fit in half the budget.
+    TPIE_OS_SIZE_T max_ghosts = std::max(TPIE_OS_SIZE_T(1), budget / e.size / 2);
+    while (s.ghosts.size() > max_ghosts) {
+	s.ghost_pos.erase(s.ghosts.back());
+	s.ghosts.pop_back();
+    }
+}
+
+void block_cache::give(TPIE_OS_SIZE_T coll, TPIE_OS_OFFSET bid, void *place,
+		       TPIE_OS_SIZE_T size, release_t release) {
+    key_type_ k(coll, bid);
+    shard_type_ &s = shard(k);
+    std::vector<entry_type_> released;
+    TPIE_OS_SIZE_T available = MM_manager.memory_available();
+    {
+	boost::mutex::scoped_lock lock(s.mutex);
+
+	entry_type_ e;
+	e.place = place;
+	e.size = size;
+	e.release = release;
+	std::multiset<key_type_>::iterator o = s.out.find(k);
+	if (o != s.out.end()) {
+	    s.out.erase(o);
+	}
+	if (s.items.count(k)) {
+	    // Another copy, handed out at the same time, came back first.
+	    released.push_back(e);
+	} else {
+	    e.hot = s.taken.erase(k) > 0;
+	    if (!e.hot && forget_ghost(s, k)) {
+		// Seen again soon after it left the FIFO.
+		e.hot = true;
+	    }
+	    insert(s, k, e, available, released);
+	}
+    }
+
+    // Release outside the lock.
+    for (TPIE_OS_SIZE_T ii = 0; ii < released.size(); ii++) {
+	released[ii].release(released[ii].place, released[ii].size);
+    }
+}
+
+bool block_cache::reserve(TPIE_OS_SIZE_T coll, TPIE_OS_OFFSET bid) {
+    key_type_ k(coll, bid);
+    shard_type_ &s = shard(k);
+    boost::mutex::scoped_lock lock(s.mutex);
+
+    if (s.items.count(k) || s.out.count(k) || s.pending.count(k)) {
+	return false;
+    }
+    s.pending.insert(k);
+    return true;
+}
+
+void block_cache::fill(TPIE_OS_SIZE_T coll, TPIE_OS_OFFSET bid, void *place,
+		       TPIE_OS_SIZE_T size, release_t release) {
+    key_type_ k(coll, bid);
+    shard_type_ &s = shard(k);
+    std::vector<entry_type_> released;
+    TPIE_OS_SIZE_T available = MM_manager.memory_available();
+    {
+	boost::mutex::scoped_lock lock(s.mutex);
+
+	// Whether it is used again decides if it is hot, so the read
+	// ahead alone does not change its history.
+	entry_type_ e;
+	e.place = place;
+	e.size = size;
+	e.release = release;
+	e.hot = false;
+	insert(s, k, e, available, released);
+
+	s.pending.erase(k);
+	s.done.notify_all();
+    }
+
+    for (TPIE_OS_SIZE_T ii = 0; ii < released.size(); ii++) {
+	released[ii].release(released[ii].place, released[ii].size);
+    }
+}
+
+void block_cache::cancel(TPIE_OS_SIZE_T coll, TPIE_OS_OFFSET bid) {
+    key_type_ k(coll, bid);
+    shard_type_ &s = shard(k);
+    boost::mutex::scoped_lock lock(s.mutex);
+
+    s.pending.erase(k);
+    s.done.notify_all();
+}
+
+void block_cache::forget(TPIE_OS_SIZE_T coll, TPIE_OS_OFFSET bid) {
+    key_type_ k(coll, bid);
+    shard_type_ &s = shard(k);
+    boost::mutex::scoped_lock lock(s.mutex);
+
+    s.taken.erase(k);
+    s.out.erase(k);
+    forget_ghost(s, k);
+}
+
+void block_cache::drop(TPIE_OS_SIZE_T coll) {
+    std::vector<entry_type_> released;
+    key_type_ lo(coll, 0);
+    key_type_ hi(coll + 1, 0);
+
+    for (TPIE_OS_SIZE_T ii = 0; ii < BTE_BLOCK_CACHE_SHARDS; ii++) {
+	shard_type_ &s = shards_[ii];
+	boost::mutex::scoped_lock lock(s.mutex);
+
+	// Reads ahead must not complete after the file is closed.
+	while (s.pending.lower_bound(lo) != s.pending.lower_bound(hi)) {
+	    s.done.wait(lock);
+	}
+
+	std::map<key_type_, entry_type_>::iterator it = s.items.lower_bound(lo);
+	while (it != s.items.end() && it->first < hi) {
+	    entry_type_ &e = it->second;
+	    if (e.hot) {
+		s.lru.erase(e.pos);
+	    } else {
+		s.fifo.erase(e.pos);
+		s.fifo_bytes -= e.size;
+	    }
+	    s.bytes -= e.size;
+	    released.push_back(e);
+	    s.items.erase(it++);
+	}
+	s.taken.erase(s.taken.lower_bound(lo), s.taken.lower_bound(hi));
+	s.out.erase(s.out.lower_bound(lo), s.out.lower_bound(hi));
+
+	std::map<key_type_, std::list<key_type_>::iterator>::iterator g =
+	    s.ghost_pos.lower_bound(lo);
+	std::map<key_type_, std::list<key_type_>::iterator>::iterator g_end =
+	    s.ghost_pos.lower_bound(hi);
+	for (; g != g_end; ++g) {
+	    s.ghosts.erase(g->second);
+	}
+	s.ghost_pos.erase(s.ghost_pos.lower_bound(lo), g_end);
+    }
+
+    for (TPIE_OS_SIZE_T ii = 0; ii < released.size(); ii++) {
+	released[ii].release(released[ii].place, released[ii].size);
+    }
+}
+
+TPIE_OS_SIZE_T block_cache::reclaim(TPIE_OS_SIZE_T bytes) {
+    TPIE_OS_SIZE_T res = 0;
+
+    for (TPIE_OS_SIZE_T ii = 0; ii < BTE_BLOCK_CACHE_SHARDS && res < bytes; ii++) {
+	shard_type_ &s = shards_[ii];
+
+	// This thread may hold the lock already, if it allocates while
+	// inserting.
+	boost::mutex::scoped_try_lock lock(s.mutex);
+	if (!lock.owns_lock()) {
+	    continue;
+	}
+
+	// Remembering ghosts would allocate, and releasing does not, so
+	// it is done under the lock.
+	while (res < bytes && !s.items.empty()) {
+	    entry_type_ e = evict(s, !s.fifo.empty(), false);
+	    e.release(e.place, e.size);
+	    res += e.size;
+	}
+    }
+    return res;
+}
+
+TPIE_OS_SIZE_T block_cache::reclaim_memory(TPIE_OS_SIZE_T bytes) {
+    return instance().reclaim(bytes);
+}
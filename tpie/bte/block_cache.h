@@ -0,0 +1,245 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2010, The TPIE development team
+// 
+// This file is part of TPIE.
+// 
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+// 
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+
+// A process-wide cache of collection blocks.
+#ifndef _TPIE_BTE_BLOCK_CACHE_H
+#define _TPIE_BTE_BLOCK_CACHE_H
+
+// Get definitions for working with Unix and Windows
+#include <tpie/portability.h>
+
+#include <list>
+#include <map>
+#include <set>
+#include <vector>
+#include <utility>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition.hpp>
+
+namespace tpie {
+
+    namespace bte {
+
+// The share of the memory limit of MM_manager the cache may use, in
+// percent. The cache also never takes more than half of the memory that
+// is still available, and gives blocks back when an allocation would
+// exceed the limit.
+#ifndef BTE_BLOCK_CACHE_PERCENT
+#define BTE_BLOCK_CACHE_PERCENT 10
+#endif
+
+// The number of independently locked shards.
+#ifndef BTE_BLOCK_CACHE_SHARDS
+#define BTE_BLOCK_CACHE_SHARDS 16
+#endif
+
+    ////////////////////////////////////////////////////////////////////
+    /// A block cache shared by all block collections of the process,
+    /// keyed by collection and block id.
+    ///
+    /// A collection gives a block to the cache with give() instead of
+    /// releasing it when it is put, and takes it back with take() when
+    /// it is got again. A block is therefore either in the cache or
+    /// handed out, never both, and all cached blocks are clean. Blocks
+    /// that do not fit are released with the function given with them.
+    /// Concurrent readers of a collection may each have a copy of the
+    /// same block handed out; only the first copy given back is cached.
+    ///
+    /// Replacement follows 2Q [Johnson and Shasha, 1994]: blocks seen
+    /// once wait in a FIFO queue, and only blocks that are got again
+    /// while cached, or soon after leaving the FIFO, move to an LRU
+    /// queue. A sequential scan of one collection therefore only cycles
+    /// the FIFO and leaves the hot blocks of other collections alone.
+    /// The keys are spread over shards with their own locks and queues.
+    ///
+    /// A block may also be read ahead of time: reserve() marks it as
+    /// pending, and fill() or cancel() completes the read. take() waits
+    /// for a pending block, so it is never read twice.
+    ////////////////////////////////////////////////////////////////////
+	class block_cache {
+
+	public:
+
+	    /** Frees a block that leaves the cache. */
+	    typedef void (*release_t)(void *place, TPIE_OS_SIZE_T size);
+
+	    /** The cache of the process. */
+	    static block_cache &instance();
+
+	    /** A key for a new collection, never given out before. */
+	    TPIE_OS_SIZE_T new_collection();
+
+	    ////////////////////////////////////////////////////////////////
+	    /// Take block bid of collection coll out of the cache, waiting
+	    /// for it if it is being read ahead. Returns false if it is not
+	    /// cached. Either way the block is handed out until it is given
+	    /// back or forgotten.
+	    ////////////////////////////////////////////////////////////////
+	    bool take(TPIE_OS_SIZE_T coll, TPIE_OS_OFFSET bid, void *&place);
+
+	    ////////////////////////////////////////////////////////////////
+	    /// Give a clean block of size bytes to the cache. It, or other
+	    /// blocks, may be released right away to stay within budget. It
+	    /// is released if another copy of the block is cached already.
+	    ////////////////////////////////////////////////////////////////
+	    void give(TPIE_OS_SIZE_T coll, TPIE_OS_OFFSET bid, void *place,
+		      TPIE_OS_SIZE_T size, release_t release);
+
+	    ////////////////////////////////////////////////////////////////
+	    /// Mark block bid of collection coll as being read ahead. Returns
+	    /// false, and marks nothing, if the block is cached, handed out or
+	    /// already being read. Each successful reserve() must be followed
+	    /// by fill() or cancel().
+	    ////////////////////////////////////////////////////////////////
+	    bool reserve(TPIE_OS_SIZE_T coll, TPIE_OS_OFFSET bid);
+
+	    ////////////////////////////////////////////////////////////////
+	    /// Complete a read ahead with the clean block that was read. It
+	    /// enters the cache as a block seen once.
+	    ////////////////////////////////////////////////////////////////
+	    void fill(TPIE_OS_SIZE_T coll, TPIE_OS_OFFSET bid, void *place,
+		      TPIE_OS_SIZE_T size, release_t release);
+
+	    /** Complete a read ahead that failed. */
+	    void cancel(TPIE_OS_SIZE_T coll, TPIE_OS_OFFSET bid);
+
+	    ////////////////////////////////////////////////////////////////
+	    /// Forget everything about block bid of collection coll, which
+	    /// is being deleted. It must not be in the cache.
+	    ////////////////////////////////////////////////////////////////
+	    void forget(TPIE_OS_SIZE_T coll, TPIE_OS_OFFSET bid);
+
+	    ////////////////////////////////////////////////////////////////
+	    /// Release all cached blocks of collection coll, which is being
+	    /// closed, after waiting for its blocks being read ahead.
+	    ////////////////////////////////////////////////////////////////
+	    void drop(TPIE_OS_SIZE_T coll);
+
+	    ////////////////////////////////////////////////////////////////
+	    /// Set the budget to the given number of bytes, or back to
+	    /// BTE_BLOCK_CACHE_PERCENT of the memory limit if 0. Blocks over
+	    /// the budget are released when blocks are given.
+	    ////////////////////////////////////////////////////////////////
+	    void set_capacity(TPIE_OS_SIZE_T bytes) { capacity_ = bytes; }
+
+	    /** The current budget in bytes. */
+	    TPIE_OS_SIZE_T capacity() const;
+
+	    /** The number of bytes in cached blocks. */
+	    TPIE_OS_SIZE_T size() const;
+
+	    /** The number of take() calls that found the block, and that
+		did not. */
+	    TPIE_OS_OFFSET hits() const;
+	    TPIE_OS_OFFSET misses() const;
+
+	    ////////////////////////////////////////////////////////////////
+	    /// Release cached blocks, oldest first, until at least bytes
+	    /// bytes are released or none are left. Shards locked by other
+	    /// threads are skipped. Returns the number of bytes released.
+	    /// Does not allocate, so MM_manager calls it when an allocation
+	    /// would exceed the memory limit.
+	    ////////////////////////////////////////////////////////////////
+	    TPIE_OS_SIZE_T reclaim(TPIE_OS_SIZE_T bytes);
+
+	private:
+
+	    typedef std::pair<TPIE_OS_SIZE_T, TPIE_OS_OFFSET> key_type_;
+
+	    /** A cached block. */
+	    struct entry_type_ {
+		void *place;
+		TPIE_OS_SIZE_T size;
+		release_t release;
+		bool hot;
+		std::list<key_type_>::iterator pos;
+	    };
+
+	    /** One lock-protected part of the cache. */
+	    struct shard_type_ {
+		boost::mutex mutex;
+		std::map<key_type_, entry_type_> items;
+		/** Blocks seen once, newest first, and their bytes. */
+		std::list<key_type_> fifo;
+		TPIE_OS_SIZE_T fifo_bytes;
+		/** Blocks seen again, most recently used first. */
+		std::list<key_type_> lru;
+		/** Bytes in both queues. */
+		TPIE_OS_SIZE_T bytes;
+		/** Keys of blocks that left the FIFO lately, newest first, and
+		    where each is in the list. */
+		std::list<key_type_> ghosts;
+		std::map<key_type_, std::list<key_type_>::iterator> ghost_pos;
+		/** Keys of blocks taken from the cache and not given back. */
+		std::set<key_type_> taken;
+		/** Keys of blocks handed out, whether they were cached or not,
+		    once per copy. */
+		std::multiset<key_type_> out;
+		/** Keys of blocks being read ahead, and a signal when one is
+		    done. */
+		std::set<key_type_> pending;
+		boost::condition done;
+		TPIE_OS_OFFSET hits;
+		TPIE_OS_OFFSET misses;
+
+		shard_type_(): fifo_bytes(0), bytes(0), hits(0), misses(0) {}
+	    };
+
+	    block_cache();
+	    ~block_cache();
+
+	    // Prohibit these.
+	    block_cache(const block_cache &other);
+	    block_cache &operator=(const block_cache &other);
+
+	    shard_type_ &shard(const key_type_ &k) const {
+		return shards_[(k.first * 2654435761u + static_cast<TPIE_OS_SIZE_T>(k.second)) %
+			       BTE_BLOCK_CACHE_SHARDS];
+	    }
+
+	    /** Removes the oldest block of a queue of s, remembering FIFO
+		blocks as ghosts if ghost is true. Must be called with the lock
+		of s held. */
+	    entry_type_ evict(shard_type_ &s, bool from_fifo, bool ghost = true);
+
+	    /** Forgets ghost k of s, if it is one. Returns true if it was.
+		Must be called with the lock of s held. */
+	    bool forget_ghost(shard_type_ &s, const key_type_ &k);
+
+	    /** The reclaim function MM_manager calls. */
+	    static TPIE_OS_SIZE_T reclaim_memory(TPIE_OS_SIZE_T bytes);
+
+	    /** Adds a block to s, hot or seen once, and moves the blocks
+		evicted to stay within budget to released. Must be called with
+		the lock of s held. */
+	    void insert(shard_type_ &s, const key_type_ &k, entry_type_ e,
+			TPIE_OS_SIZE_T available, std::vector<entry_type_> &released);
+
+	    shard_type_ *shards_;
+	    TPIE_OS_SIZE_T capacity_;
+	    boost::mutex id_mutex_;
+	    TPIE_OS_SIZE_T next_collection_;
+	};
+
+    }  //  bte namespace
+
+}  //  tpie namespace
+
+#endif // _TPIE_BTE_BLOCK_CACHE_H
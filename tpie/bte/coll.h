@@ -30,6 +30,9 @@
 // The UFS implementation.
 #include <tpie/bte/coll_ufs.h>
 
+// The implementation with checksummed and compressed blocks.
+#include <tpie/bte/coll_packed.h>
+
 // Get definitions for working with Unix and Windows
 #include <tpie/portability.h>
 
@@ -39,6 +42,7 @@ namespace tpie {
 		
 #define _BTE_COLL_IMP_COUNT (defined(COLLECTION_IMP_UFS) +		\
                              defined(COLLECTION_IMP_MMAP) +		\
+                             defined(COLLECTION_IMP_PACKED) +		\
                              defined(COLLECTION_IMP_USER_DEFINED))
 	
 // Multiple implem. are included, but we have to choose a default one.
@@ -50,11 +54,14 @@ namespace tpie {
 	
 #define COLLECTION_MMAP collection_mmap<TPIE_BLOCK_ID_TYPE>
 #define COLLECTION_UFS  collection_ufs<TPIE_BLOCK_ID_TYPE>
+#define COLLECTION_PACKED collection_packed<TPIE_BLOCK_ID_TYPE>
 	
 #if defined(COLLECTION_IMP_MMAP)
 #  define COLLECTION COLLECTION_MMAP
 #elif defined(COLLECTION_IMP_UFS)
 #  define COLLECTION COLLECTION_UFS
+#elif defined(COLLECTION_IMP_PACKED)
+#  define COLLECTION COLLECTION_PACKED
 #elif defined(COLLECTION_IMP_USER_DEFINED)
    // Do not define BTE_COLLECTION. The user will define it.
 #endif
@@ -33,6 +33,7 @@
 
 #include <tpie/bte/stack_ufs.h>
 #include <tpie/bte/err.h>
+#include <tpie/bte/block_cache.h>
 #include <tpie/stats_coll.h>
 
 namespace tpie {
@@ -64,6 +65,12 @@ namespace tpie {
 // (in network byteorder, it spells "TPBC": TPie Block Collection)
 #define COLLECTION_HEADER_MAGIC_NUMBER 0x54504243
 
+// The formats of the blocks in the file: raw blocks at offsets given by
+// their ids, or checksummed and possibly compressed blocks in slots found
+// through a table (see coll_packed.h).
+#define COLLECTION_FORMAT_RAW 0
+#define COLLECTION_FORMAT_PACKED 1
+
 // Default file name suffixes
 #define COLLECTION_BLK_SUFFIX ".blk"
 #define COLLECTION_STK_SUFFIX ".stk"
@@ -92,7 +99,8 @@ namespace tpie {
 	    // Unique header identifier. Set to COLLECTION_HEADER_MAGIC_NUMBER
 	    unsigned int magic_number;
 
-	    // Should be 1 for current version.
+	    // Should be 2 for current version. Version 1 headers have no
+	    // block_format and table fields.
 	    unsigned int version;
 
 	    // The type of COLLECTION that created this header. Setting this
@@ -125,18 +133,30 @@ namespace tpie {
 
 	    // Some data to be filled by the user of the collection.
 		char user_data[COLLECTION_USER_DATA_LEN];
+
+	    // The format of the blocks; COLLECTION_FORMAT_RAW or
+	    // COLLECTION_FORMAT_PACKED.
+	    unsigned int block_format;
+
+	    // The offset and CRC-32C of the slot table of a packed collection,
+	    // written when it is closed (0 if there is none yet).
+	    TPIE_OS_OFFSET table_offset;
+	    unsigned int table_crc;
   
 	    // Default constructor.
 	    collection_header():
 		magic_number(COLLECTION_HEADER_MAGIC_NUMBER), 
-		version(1), 
+		version(2), 
 		type(0),
 		header_length(sizeof(collection_header)), 
 		total_blocks(1), 
 		last_block(1), 
 		used_blocks(0),
 		os_block_size(TPIE_OS_BLOCKSIZE()),
-		block_size(0)
+		block_size(0),
+		block_format(COLLECTION_FORMAT_RAW),
+		table_offset(0),
+		table_crc(0)
 		{
 		    //  No code inside this constructor.
 		}
@@ -176,6 +196,9 @@ namespace tpie {
 	
 	    // File pointer position. A value of -1 signals unknown position.
 	    TPIE_OS_OFFSET file_pointer;
+
+	    // The key of this collection in the block cache.
+	    TPIE_OS_SIZE_T cache_id_;
 	
 	    // Statistics for this object.
 	    stats_collection stats_;
@@ -189,17 +212,19 @@ namespace tpie {
 	    // Initialization common to all constructors.
 	    void shared_init(collection_type      type, 
 			     TPIE_OS_SIZE_T       logical_block_factor, 
-			     TPIE_OS_MAPPING_FLAG mapping);
+			     TPIE_OS_MAPPING_FLAG mapping,
+			     unsigned int         format);
 	
-	    // Read header from disk.
-	    err read_header(std::string& bcc_name);
-
-	    // Write header to disk.
-	    err write_header(std::string& bcc_name);
+	    // Read header from disk, and check that its blocks have the given
+	    // format.
+	    err read_header(std::string& bcc_name, unsigned int format);
 
 	    void remove_stack_file();
 
 	protected:
+
+	    // Write header to disk.
+	    err write_header(std::string& bcc_name);
 	
 	    // Needs to be inlined!
 	    err register_memory_allocation(TPIE_OS_SIZE_T sz) {
@@ -221,6 +246,30 @@ namespace tpie {
 		return NO_ERROR;
 	    }
 
+	    // Take block bid back from the block cache, if it is there.
+	    bool cache_take(BIDT bid, void *&place) {
+		return block_cache::instance().take(cache_id_, bid, place);
+	    }
+
+	    // Give a clean block that is put to the block cache.
+	    void cache_give(BIDT bid, void *place, block_cache::release_t release) {
+		block_cache::instance().give(cache_id_, bid, place, header_.block_size, release);
+	    }
+
+	    // Mark block bid as being read ahead, unless it is cached, in
+	    // memory or being read already.
+	    bool cache_reserve(BIDT bid) {
+		return block_cache::instance().reserve(cache_id_, bid);
+	    }
+
+	    // Complete a read ahead of block bid, or give it up.
+	    void cache_fill(BIDT bid, void *place, block_cache::release_t release) {
+		block_cache::instance().fill(cache_id_, bid, place, header_.block_size, release);
+	    }
+	    void cache_cancel(BIDT bid) {
+		block_cache::instance().cancel(cache_id_, bid);
+	    }
+
 	    TPIE_OS_OFFSET bid_to_file_offset(BIDT bid) const { 
 		return header_.os_block_size + header_.block_size * (bid-1); 
 	    }
@@ -254,6 +303,15 @@ namespace tpie {
 		else {
 		    tp_assert(header_.last_block <= header_.total_blocks, 
 			      "BTE_collection_ufs internal error: last_block>total_blocks");
+
+		    // Packed blocks have slots of their own, so the file does
+		    // not grow with the ids.
+		    if (header_.block_format != COLLECTION_FORMAT_RAW) {
+			bid = header_.last_block++;
+			header_.total_blocks = header_.last_block;
+			return NO_ERROR;
+		    }
+
 		    if (header_.last_block == header_.total_blocks) {
 			// Increase the capacity for storing blocks in the stream by
 			// 16 (only by 2 the first time around to be gentle with very
@@ -307,6 +365,7 @@ namespace tpie {
 	
 	    // Common code for all delete_block implementations. Inlined.
 	    err delete_block_shared(BIDT bid) {
+		block_cache::instance().forget(cache_id_, bid);
 		if (bid == header_.last_block - 1) {
 		    header_.last_block--;
 		}
@@ -329,7 +388,8 @@ namespace tpie {
 	    collection_base(const std::string& base_name, 
 			    collection_type      ct, 
 			    TPIE_OS_SIZE_T       logical_block_factor, 
-			    TPIE_OS_MAPPING_FLAG mapping = TPIE_OS_FLAG_USE_MAPPING_FALSE);
+			    TPIE_OS_MAPPING_FLAG mapping = TPIE_OS_FLAG_USE_MAPPING_FALSE,
+			    unsigned int         format = COLLECTION_FORMAT_RAW);
 
 	    // Return the total number of used blocks.
 	    TPIE_OS_OFFSET size() const { 
@@ -422,9 +482,11 @@ namespace tpie {
 	collection_base<BIDT>::collection_base(const std::string& base_name, 
 					       collection_type type, 
 					       TPIE_OS_SIZE_T logical_block_factor, 
-					       TPIE_OS_MAPPING_FLAG mapping):
+					       TPIE_OS_MAPPING_FLAG mapping,
+					       unsigned int format):
 	    header_(), 
-	    freeblock_stack_(NULL) {
+	    freeblock_stack_(NULL),
+	    cache_id_(block_cache::instance().new_collection()) {
 
 		if (base_name.empty()) 
 		{
@@ -438,14 +500,15 @@ namespace tpie {
 	    // A collection with a given name is not deleted upon destruction.
 	    per_ = PERSIST_PERSISTENT;
 	
-	    shared_init(type, logical_block_factor, mapping);
+	    shared_init(type, logical_block_factor, mapping, format);
 	}
 
 
 	template<class BIDT>
 	void collection_base<BIDT>::shared_init(collection_type type,
 						TPIE_OS_SIZE_T logical_block_factor,
-						TPIE_OS_MAPPING_FLAG mapping) {
+						TPIE_OS_MAPPING_FLAG mapping,
+						unsigned int format) {
 	
 	    read_only_ = (type == READ_COLLECTION);
 	    status_ = COLLECTION_STATUS_VALID;
@@ -468,7 +531,7 @@ namespace tpie {
 		    return;
 		}
 
-		if (read_header(bcc_name) != NO_ERROR) {
+		if (read_header(bcc_name, format) != NO_ERROR) {
 		    status_ = COLLECTION_STATUS_INVALID;
 		    return;
 		}
@@ -511,7 +574,7 @@ namespace tpie {
 			return;
 		    }
       
-		    if (read_header(bcc_name) != NO_ERROR) {
+		    if (read_header(bcc_name, format) != NO_ERROR) {
 
 			status_ = COLLECTION_STATUS_INVALID;
 
@@ -539,6 +602,7 @@ namespace tpie {
 			      "Header os_block_size mismatch.");
 
 		    header_.block_size = logical_block_factor * header_.os_block_size;
+		    header_.block_format = format;
 		
 		    if (write_header(bcc_name) != NO_ERROR) {
 
@@ -573,7 +637,7 @@ namespace tpie {
     
     
 	template<class BIDT>
-	err collection_base<BIDT>::read_header(std::string& bcc_name) {
+	err collection_base<BIDT>::read_header(std::string& bcc_name, unsigned int format) {
 
 		//silence compiler warnings, the name is used in the logging routines
 		//which may be empty depending on the settings of the logging system
@@ -605,6 +669,13 @@ namespace tpie {
 	
 	    delete [] tmp_buffer;
 
+	    // Older headers end with the user data.
+	    if (header_.version < 2) {
+		header_.block_format = COLLECTION_FORMAT_RAW;
+		header_.table_offset = 0;
+		header_.table_crc = 0;
+	    }
+
 	    // Do some error checking on the header, such as to make sure that
 	    // it has the correct header version, block size etc.
 	    if (header_.magic_number != COLLECTION_HEADER_MAGIC_NUMBER || 
@@ -615,12 +686,21 @@ namespace tpie {
 	    
 		return BAD_HEADER;
 	    }
+
+	    if (header_.block_format != format) {
+
+		TP_LOG_FATAL_ID("Block format mismatch in file: ");
+		TP_LOG_FATAL_ID(bcc_name);
+
+		return BAD_HEADER;
+	    }
 	
-	    TPIE_OS_OFFSET lseek_retval;
+	    TPIE_OS_OFFSET lseek_retval = TPIE_OS_LSEEK(bcc_fd_, 0, TPIE_OS_FLAG_SEEK_END);
 
-	    // Some more error checking.
-	    if ((lseek_retval = TPIE_OS_LSEEK(bcc_fd_, 0, TPIE_OS_FLAG_SEEK_END)) != 
-		bid_to_file_offset(header_.total_blocks)) {
+	    // Some more error checking. The length of a packed file depends
+	    // on its contents.
+	    if (header_.block_format == COLLECTION_FORMAT_RAW &&
+		lseek_retval != bid_to_file_offset(header_.total_blocks)) {
 
 		TP_LOG_FATAL_ID("File length mismatch for:");
 		TP_LOG_FATAL_ID(bcc_name);
@@ -685,6 +765,9 @@ namespace tpie {
 		std::string bcc_name =
 			base_file_name_ + COLLECTION_BLK_SUFFIX;
 
+	    // Release the cached blocks while the file is still open.
+	    block_cache::instance().drop(cache_id_);
+
 	    // No block should be in memory at the time of destruction.
 	    if (in_memory_blocks_) {
 
@@ -64,6 +64,11 @@ namespace tpie {
 	    using collection_base<BIDT>::create_stack;
 	    using collection_base<BIDT>::new_block_getid;
 	    using collection_base<BIDT>::delete_block_shared;
+	    using collection_base<BIDT>::cache_take;
+	    using collection_base<BIDT>::cache_give;
+	    using collection_base<BIDT>::cache_reserve;
+	    using collection_base<BIDT>::cache_fill;
+	    using collection_base<BIDT>::cache_cancel;
 	
 
 	public:
@@ -117,7 +122,7 @@ namespace tpie {
 	    
 		err retval = NO_ERROR;
 	    
-		if ((retval = put_block_internals(bid, place, 1)) != NO_ERROR) {
+		if ((retval = put_block_internals(bid, place, 1, false)) != NO_ERROR) {
 		    return retval; 
 		}
 	    
@@ -173,15 +178,39 @@ namespace tpie {
 	    // Synchronize the in-memory block with the on-disk block.
 	    err sync_block(BIDT bid, void* place, char dirty = 1);
 
+	    // Map the block with the indicated bid into the block cache and
+	    // ask the kernel to read it in, so that a later get_block does
+	    // not wait for page faults. A hint only: blocks that are cached
+	    // or in memory are ignored.
+	    err prefetch(BIDT bid);
+
 	protected:
 	    err get_block_internals(BIDT bid, void *&place);
-	    err put_block_internals(BIDT bid, void* place, char dirty);
+	    // Gives the mapped block to the block cache, or unmaps it if cache
+	    // is false.
+	    err put_block_internals(BIDT bid, void* place, char dirty, bool cache = true);
+
+	    // Unmaps a block that leaves the block cache.
+	    static void release_block(void *place, TPIE_OS_SIZE_T size) {
+		if (TPIE_OS_MUNMAP((char*)place, size) == -1) {
+		    TP_LOG_FATAL_ID("Failed to unmap() cached block of file.");
+		    TP_LOG_FATAL_ID(strerror(errno));
+		}
+		MM_manager.register_deallocation(size);
+	    }
 	};
 
 
 	template<class BIDT>
 	err collection_mmap<BIDT>::get_block_internals(BIDT bid, void * &place) {
 
+	    // A cached block is still mapped, and its memory registered.
+	    if (cache_take(bid, place)) {
+		in_memory_blocks_++;
+		return NO_ERROR;
+	    }
+
+
 	    place = TPIE_OS_MMAP(NULL, header_.block_size,
 				 read_only_ ? TPIE_OS_FLAG_PROT_READ : 
 				 TPIE_OS_FLAG_PROT_READ | TPIE_OS_FLAG_PROT_WRITE, 
@@ -213,7 +242,8 @@ namespace tpie {
 
 
 	template<class BIDT>
-	err collection_mmap<BIDT>::put_block_internals(BIDT bid, void* place, char /* dirty */) {
+	err collection_mmap<BIDT>::put_block_internals(BIDT bid, void* place, char /* dirty */,
+							  bool cache) {
 	
 	    // The dirty parameter is not used in this implemetation.
 	
@@ -241,6 +271,13 @@ namespace tpie {
 		}    
 	    }
 #endif
+
+	    // A cached block stays mapped until it leaves the cache.
+	    if (cache) {
+		cache_give(bid, place, &release_block);
+		in_memory_blocks_--;
+		return NO_ERROR;
+	    }
 	
 	    if (TPIE_OS_MUNMAP((char*)place, header_.block_size) == -1) {
 	    
@@ -284,6 +321,45 @@ namespace tpie {
 	    return NO_ERROR;
 	}
 
+
+	template<class BIDT>
+	err collection_mmap<BIDT>::prefetch(BIDT bid) {
+
+	    if ((bid <= 0) || (bid >= header_.last_block)) {
+		return INVALID_PLACEHOLDER;
+	    }
+
+	    if (!cache_reserve(bid)) {
+		return NO_ERROR;
+	    }
+
+	    // Mapping is cheap; the kernel reads the pages in the background.
+	    void *place = TPIE_OS_MMAP(NULL, header_.block_size,
+				       read_only_ ? TPIE_OS_FLAG_PROT_READ : 
+				       TPIE_OS_FLAG_PROT_READ | TPIE_OS_FLAG_PROT_WRITE, 
+#ifdef SYSTYPE_BSD
+				       MAP_FILE | MAP_VARIABLE | MAP_NOSYNC |
+#endif
+				       TPIE_OS_FLAG_MAP_SHARED, 
+				       bcc_fd_, 
+				       bid_to_file_offset(bid));
+
+	    if (place == (void *)(-1)) {
+		cache_cancel(bid);
+		return NO_ERROR;
+	    }
+
+	    TPIE_OS_MADVISE_WILLNEED(place, header_.block_size);
+
+	    register_memory_allocation(header_.block_size);
+	    cache_fill(bid, place, &release_block);
+
+	    stats_.record(BLOCK_PREFETCH);
+	    gstats_.record(BLOCK_PREFETCH);
+
+	    return NO_ERROR;
+	}
+
     }  //  bte namespace
  
 }  //  tpie namespace
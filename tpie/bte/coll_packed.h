@@ -0,0 +1,652 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2010, The TPIE development team
+// 
+// This file is part of TPIE.
+// 
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+// 
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+// BTE_collection_packed class definition.
+#ifndef _TPIE_BTE_COLL_PACKED_H
+#define _TPIE_BTE_COLL_PACKED_H
+
+// Get definitions for working with Unix and Windows
+#include <tpie/portability.h>
+// Get the base class.
+#include <tpie/bte/coll_base.h>
+#include <tpie/crc32c.h>
+#include <tpie/lz_codec.h>
+
+#include <map>
+#include <vector>
+#include <algorithm>
+#include <boost/cstdint.hpp>
+
+// For header's type field (80 == 'P').
+#define COLLECTION_PACKED_ID 80
+
+// Slots are allocated in multiples of this many bytes, so that a block
+// that grows a little still fits its slot. A block is stored compressed
+// only if that saves at least this much.
+#ifndef COLLECTION_PACKED_GRANULE
+#define COLLECTION_PACKED_GRANULE 64
+#endif
+
+namespace tpie {
+
+    namespace bte {
+
+    ////////////////////////////////////////////////////////////////////
+    /// A block collection that stores each block in a slot of its own,
+    /// checksummed with CRC-32C and, if that makes it smaller,
+    /// compressed with lz_compress(). A table maps block ids to slots;
+    /// it is kept in memory and written after the last slot when the
+    /// collection is closed. While the collection is open for writing
+    /// the header marks the table as missing, so that the collection
+    /// cannot be opened again after a crash. Slots that are freed are
+    /// reused best fit, and the gaps between slots are found again when
+    /// the collection is opened.
+    ///
+    /// A slot starts with the CRC-32C of the block id and the rest of
+    /// the slot, and the length of the stored block, whose high bit is
+    /// set if it is compressed. get_block() fails with CHECKSUM_ERROR if
+    /// either does not match, so a slot of another block is not taken
+    /// for this one. Blocks are kept in memory as with collection_ufs;
+    /// packed collections cannot be mapped.
+    ////////////////////////////////////////////////////////////////////
+	template<class BIDT = TPIE_BLOCK_ID_TYPE>
+	class collection_packed: public collection_base<BIDT> {
+
+	protected:
+	    using collection_base<BIDT>::header_;
+	    using collection_base<BIDT>::bcc_fd_;
+	    using collection_base<BIDT>::per_;
+	    using collection_base<BIDT>::base_file_name_;
+	    using collection_base<BIDT>::status_;
+	    using collection_base<BIDT>::read_only_;
+	    using collection_base<BIDT>::in_memory_blocks_;
+	    using collection_base<BIDT>::file_pointer;
+	    using collection_base<BIDT>::stats_;
+	    using collection_base<BIDT>::gstats_;
+	    using collection_base<BIDT>::new_block_getid;
+	    using collection_base<BIDT>::delete_block_shared;
+	    using collection_base<BIDT>::cache_take;
+	    using collection_base<BIDT>::cache_give;
+	    using collection_base<BIDT>::write_header;
+
+	public:
+
+	    // Constructor. Read and verify the header and the slot table of
+	    // the collection. If compress is false, blocks are only
+	    // checksummed.
+	    collection_packed(const std::string& base_file_name,
+			      collection_type type = WRITE_COLLECTION,
+			      TPIE_OS_SIZE_T logical_block_factor = 1,
+			      bool compress = true);
+
+	    // Write the slot table.
+	    ~collection_packed();
+
+	    // Allocate a new block in block collection and return an
+	    // uninitialized placeholder for it. Main memory usage increases.
+	    err new_block(BIDT &bid, void * &place) {
+
+		err retval = NO_ERROR;
+
+		if ((retval = new_block_getid(bid)) != NO_ERROR) {
+		    return retval;
+		}
+
+		if (slots_.size() < static_cast<TPIE_OS_SIZE_T>(header_.last_block)) {
+		    slots_.resize(header_.last_block);
+		}
+
+		// A recycled block may have been read ahead; its memory is
+		// reused.
+		if (!cache_take(bid, place)) {
+		    place = new char[header_.block_size];
+		}
+		in_memory_blocks_++;
+
+		header_.used_blocks++;
+
+		stats_.record(BLOCK_NEW);
+		gstats_.record(BLOCK_NEW);
+
+		return NO_ERROR;
+	    }
+
+	    // Delete a previously created, currently in-memory block, and
+	    // free its slot. Main memory usage goes down.
+	    err delete_block(BIDT bid, void * place) {
+
+		err retval = NO_ERROR;
+
+		if ((bid <= 0) || (bid >= header_.last_block)) {
+
+		    TP_LOG_FATAL_ID("Incorrect block ID in placeholder.");
+
+		    return INVALID_PLACEHOLDER;
+		}
+
+		delete [] (char *) place;
+		in_memory_blocks_--;
+
+		free_slot(slots_[bid]);
+
+		if ((retval = delete_block_shared(bid)) != NO_ERROR) {
+		    return retval;
+		}
+
+		header_.used_blocks--;
+
+		stats_.record(BLOCK_DELETE);
+		gstats_.record(BLOCK_DELETE);
+
+		return NO_ERROR;
+	    }
+
+	    // Read the block with the indicated bid and verify its checksum.
+	    // A block that was never written reads as zeros. Main memory
+	    // usage increases.
+	    err get_block(BIDT bid, void * &place);
+
+	    // Write a currently in-memory block into its slot, or a new one
+	    // if it does not fit. Main memory usage decreases.
+	    err put_block(BIDT bid, void * place, char dirty = 1);
+
+	    // Synchronize the in-memory block with the on-disk block.
+	    err sync_block(BIDT bid, void* place, char dirty = 1);
+
+	    // Ask the operating system to read the slot of the block with
+	    // the indicated bid into its cache. A hint only.
+	    err prefetch(BIDT bid);
+
+	    // The number of bytes in the slots of all blocks, as stored.
+	    TPIE_OS_OFFSET stored_bytes() const {
+		return stored_bytes_;
+	    }
+
+	protected:
+
+	    /** Where a block is stored; length 0 if it has no slot. */
+	    struct slot_type_ {
+		TPIE_OS_OFFSET offset;
+		boost::uint32_t length;
+		boost::uint32_t capacity;
+
+		slot_type_(): offset(0), length(0), capacity(0) {}
+	    };
+
+	    // The slot header: CRC-32C and length word.
+	    static const TPIE_OS_SIZE_T slot_header_size = 8;
+	    static const boost::uint32_t compressed_flag = 0x80000000u;
+
+	    // The table offset in the header while the collection is open
+	    // for writing.
+	    static const TPIE_OS_OFFSET table_open = -1;
+
+	    // The CRC-32C of the block id and n bytes of a slot.
+	    static boost::uint32_t slot_crc(BIDT bid, const char *data, TPIE_OS_SIZE_T n) {
+		TPIE_OS_OFFSET id = static_cast<TPIE_OS_OFFSET>(bid);
+		return crc32c(data, n, crc32c(&id, sizeof(id)));
+	    }
+
+	    // Compress and checksum a block into buffer_, and write it.
+	    err write_slot(BIDT bid, void *place);
+
+	    // Find a slot of at least length bytes.
+	    void allocate_slot(slot_type_ &s, TPIE_OS_SIZE_T length);
+
+	    // Give a slot back.
+	    void free_slot(slot_type_ &s);
+
+	    // Read the table and find the free space, or start an empty one.
+	    err read_table();
+
+	    // Write the table after the last slot.
+	    err write_table();
+
+	    // Frees a block that leaves the block cache.
+	    static void release_block(void *place, TPIE_OS_SIZE_T /* size */) {
+		delete [] (char *) place;
+	    }
+
+	    /** The slot of each block id below header_.last_block. */
+	    std::vector<slot_type_> slots_;
+
+	    /** Free slots by capacity. */
+	    std::multimap<TPIE_OS_SIZE_T, TPIE_OS_OFFSET> free_;
+
+	    /** The end of the last slot. */
+	    TPIE_OS_OFFSET data_end_;
+
+	    TPIE_OS_OFFSET stored_bytes_;
+
+	    /** Room for a slot: header and compressed block. */
+	    char *buffer_;
+
+	    bool compress_;
+	};
+
+
+	template<class BIDT>
+	collection_packed<BIDT>::collection_packed(const std::string& base_file_name,
+						   collection_type type,
+						   TPIE_OS_SIZE_T logical_block_factor,
+						   bool compress):
+	    collection_base<BIDT>(base_file_name,
+				  type,
+				  logical_block_factor,
+				  TPIE_OS_FLAG_USE_MAPPING_FALSE,
+				  COLLECTION_FORMAT_PACKED),
+	    data_end_(0),
+	    stored_bytes_(0),
+	    buffer_(NULL),
+	    compress_(compress) {
+
+	    header_.type = COLLECTION_PACKED_ID;
+
+	    if (status_ != COLLECTION_STATUS_VALID) {
+		return;
+	    }
+
+	    buffer_ = new char[slot_header_size + lz_compress_bound(header_.block_size)];
+
+	    if (read_table() != NO_ERROR) {
+		status_ = COLLECTION_STATUS_INVALID;
+		return;
+	    }
+
+	    // The table on disk goes stale as soon as a slot is written; it
+	    // is written again when the collection is closed.
+	    if (!read_only_) {
+		std::string bcc_name = base_file_name_ + COLLECTION_BLK_SUFFIX;
+		header_.table_offset = table_open;
+		if (write_header(bcc_name) != NO_ERROR) {
+		    status_ = COLLECTION_STATUS_INVALID;
+		}
+	    }
+	}
+
+
+	template<class BIDT>
+	collection_packed<BIDT>::~collection_packed() {
+
+	    // The file of a temporary collection is removed anyway.
+	    if (status_ == COLLECTION_STATUS_VALID && !read_only_ &&
+		per_ == PERSIST_PERSISTENT) {
+		write_table();
+	    }
+
+	    delete [] buffer_;
+	}
+
+
+	template<class BIDT>
+	err collection_packed<BIDT>::read_table() {
+
+	    data_end_ = header_.os_block_size;
+	    slots_.assign(header_.last_block, slot_type_());
+	    free_.clear();
+	    stored_bytes_ = 0;
+
+	    // A new collection.
+	    if (header_.table_offset == 0) {
+		return NO_ERROR;
+	    }
+
+	    if (header_.table_offset == table_open) {
+
+		TP_LOG_FATAL_ID("Slot table not written, the collection was not closed:");
+		TP_LOG_FATAL_ID(base_file_name_);
+
+		return BAD_HEADER;
+	    }
+
+	    TPIE_OS_SIZE_T length = header_.last_block * sizeof(slot_type_);
+
+	    if (TPIE_OS_LSEEK(bcc_fd_, header_.table_offset, TPIE_OS_FLAG_SEEK_SET) !=
+		header_.table_offset ||
+		TPIE_OS_READ(bcc_fd_, (char *) &slots_[0], length) != (TPIE_OS_SSIZE_T)length) {
+
+		TP_LOG_FATAL_ID("Failed to read the slot table of file:");
+		TP_LOG_FATAL_ID(base_file_name_);
+
+		return IO_ERROR;
+	    }
+	    file_pointer = header_.table_offset + length;
+
+	    if (crc32c(&slots_[0], length) != header_.table_crc) {
+
+		TP_LOG_FATAL_ID("Slot table checksum mismatch in file:");
+		TP_LOG_FATAL_ID(base_file_name_);
+
+		return CHECKSUM_ERROR;
+	    }
+
+	    // The gaps between the slots are free. New slots go where the
+	    // table is now.
+	    data_end_ = header_.table_offset;
+
+	    std::vector<std::pair<TPIE_OS_OFFSET, TPIE_OS_OFFSET> > used;
+	    for (TPIE_OS_SIZE_T ii = 0; ii < slots_.size(); ii++) {
+		if (slots_[ii].length) {
+		    used.push_back(std::make_pair(slots_[ii].offset,
+						  slots_[ii].offset + slots_[ii].capacity));
+		    stored_bytes_ += slots_[ii].length;
+		}
+	    }
+	    std::sort(used.begin(), used.end());
+
+	    TPIE_OS_OFFSET end = header_.os_block_size;
+	    for (TPIE_OS_SIZE_T ii = 0; ii < used.size(); ii++) {
+		if (used[ii].first > end) {
+		    free_.insert(std::make_pair(static_cast<TPIE_OS_SIZE_T>(used[ii].first - end), end));
+		}
+		end = used[ii].second;
+	    }
+
+	    return NO_ERROR;
+	}
+
+
+	template<class BIDT>
+	err collection_packed<BIDT>::write_table() {
+
+	    TPIE_OS_SIZE_T length = header_.last_block * sizeof(slot_type_);
+	    slots_.resize(header_.last_block);
+
+	    header_.table_offset = data_end_;
+	    header_.table_crc = length ? crc32c(&slots_[0], length) : crc32c(NULL, 0);
+
+	    if (TPIE_OS_LSEEK(bcc_fd_, data_end_, TPIE_OS_FLAG_SEEK_SET) != data_end_ ||
+		(length && TPIE_OS_WRITE(bcc_fd_, (const char *) &slots_[0], length) !=
+		 (TPIE_OS_SSIZE_T)length)) {
+
+		TP_LOG_FATAL_ID("Failed to write the slot table of file:");
+		TP_LOG_FATAL_ID(base_file_name_);
+
+		return IO_ERROR;
+	    }
+	    file_pointer = -1;
+
+	    // Drop what is left of slots beyond the end.
+	    if (TPIE_OS_FTRUNCATE(bcc_fd_, data_end_ + length)) {
+
+		TP_LOG_FATAL_ID("Failed to truncate file:");
+		TP_LOG_FATAL_ID(base_file_name_);
+
+		return OS_ERROR;
+	    }
+
+	    return NO_ERROR;
+	}
+
+
+	template<class BIDT>
+	void collection_packed<BIDT>::allocate_slot(slot_type_ &s, TPIE_OS_SIZE_T length) {
+
+	    TPIE_OS_SIZE_T capacity = (length + COLLECTION_PACKED_GRANULE - 1) /
+		COLLECTION_PACKED_GRANULE * COLLECTION_PACKED_GRANULE;
+
+	    typename std::multimap<TPIE_OS_SIZE_T, TPIE_OS_OFFSET>::iterator it =
+		free_.lower_bound(capacity);
+
+	    if (it == free_.end()) {
+		s.offset = data_end_;
+		data_end_ += capacity;
+	    } else {
+		// Best fit; the rest of the slot stays free.
+		s.offset = it->second;
+		if (it->first > capacity) {
+		    free_.insert(std::make_pair(it->first - capacity, s.offset + capacity));
+		}
+		free_.erase(it);
+	    }
+	    s.capacity = static_cast<boost::uint32_t>(capacity);
+	}
+
+
+	template<class BIDT>
+	void collection_packed<BIDT>::free_slot(slot_type_ &s) {
+
+	    if (s.capacity) {
+		if (s.offset + s.capacity == data_end_) {
+		    data_end_ = s.offset;
+		} else {
+		    free_.insert(std::make_pair(static_cast<TPIE_OS_SIZE_T>(s.capacity), s.offset));
+		}
+	    }
+	    stored_bytes_ -= s.length;
+	    s = slot_type_();
+	}
+
+
+	template<class BIDT>
+	err collection_packed<BIDT>::write_slot(BIDT bid, void *place) {
+
+	    if ((bid <= 0) || (bid >= header_.last_block)) {
+
+		TP_LOG_FATAL_ID("Incorrect block ID in placeholder.");
+
+		return INVALID_PLACEHOLDER;
+	    }
+
+	    // As with collection_ufs, blocks of read-only collections are
+	    // not written back.
+	    if (read_only_) {
+		return NO_ERROR;
+	    }
+
+	    char *payload = buffer_ + slot_header_size;
+	    TPIE_OS_SIZE_T length = 0;
+	    boost::uint32_t word;
+
+	    if (compress_ && header_.block_size > COLLECTION_PACKED_GRANULE) {
+		length = lz_compress((const char *) place, header_.block_size, payload,
+				     header_.block_size - COLLECTION_PACKED_GRANULE);
+	    }
+	    if (length) {
+		word = static_cast<boost::uint32_t>(length) | compressed_flag;
+	    } else {
+		length = header_.block_size;
+		memcpy(payload, place, length);
+		word = static_cast<boost::uint32_t>(length);
+	    }
+	    memcpy(buffer_ + 4, &word, 4);
+	    boost::uint32_t crc = slot_crc(bid, buffer_ + 4, 4 + length);
+	    memcpy(buffer_, &crc, 4);
+	    length += slot_header_size;
+
+	    slot_type_ &s = slots_[bid];
+	    if (length > s.capacity) {
+		free_slot(s);
+		allocate_slot(s, length);
+	    } else {
+		stored_bytes_ -= s.length;
+	    }
+	    s.length = static_cast<boost::uint32_t>(length);
+	    stored_bytes_ += length;
+
+	    if (file_pointer != s.offset) {
+		if (TPIE_OS_LSEEK(bcc_fd_, s.offset, TPIE_OS_FLAG_SEEK_SET) != s.offset) {
+
+		    TP_LOG_FATAL_ID("lseek failed in file.");
+
+		    return IO_ERROR;
+		}
+	    }
+
+	    if (TPIE_OS_WRITE(bcc_fd_, buffer_, length) != (TPIE_OS_SSIZE_T)length) {
+
+		TP_LOG_FATAL_ID("Failed to write() to file.");
+
+		file_pointer = -1;
+		return IO_ERROR;
+	    }
+
+	    file_pointer = s.offset + length;
+
+	    return NO_ERROR;
+	}
+
+
+	template<class BIDT>
+	err collection_packed<BIDT>::get_block(BIDT bid, void * &place) {
+
+	    if ((bid <= 0) || (bid >= header_.last_block)) {
+
+		TP_LOG_FATAL_ID("Incorrect block ID in placeholder.");
+
+		return INVALID_PLACEHOLDER;
+	    }
+
+	    // A cached block was verified when it was read or written.
+	    if (cache_take(bid, place)) {
+		in_memory_blocks_++;
+		stats_.record(BLOCK_GET);
+		gstats_.record(BLOCK_GET);
+		return NO_ERROR;
+	    }
+
+	    char *block = new char[header_.block_size];
+	    const slot_type_ &s = slots_[bid];
+
+	    if (s.length == 0) {
+		memset(block, 0, header_.block_size);
+	    } else {
+		if (file_pointer != s.offset) {
+		    if (TPIE_OS_LSEEK(bcc_fd_, s.offset, TPIE_OS_FLAG_SEEK_SET) != s.offset) {
+
+			TP_LOG_FATAL_ID("lseek failed in file.");
+
+			delete [] block;
+			return IO_ERROR;
+		    }
+		}
+
+		if (TPIE_OS_READ(bcc_fd_, buffer_, s.length) != (TPIE_OS_SSIZE_T)s.length) {
+
+		    TP_LOG_FATAL_ID("Failed to read() from file.");
+
+		    file_pointer = -1;
+		    delete [] block;
+		    return IO_ERROR;
+		}
+		file_pointer = s.offset + s.length;
+
+		boost::uint32_t crc, word;
+		memcpy(&crc, buffer_, 4);
+		memcpy(&word, buffer_ + 4, 4);
+		TPIE_OS_SIZE_T length = word & ~compressed_flag;
+		const char *payload = buffer_ + slot_header_size;
+
+		bool valid = length + slot_header_size == s.length &&
+		    slot_crc(bid, buffer_ + 4, 4 + length) == crc;
+		if (valid) {
+		    if (word & compressed_flag) {
+			valid = lz_decompress(payload, length, block, header_.block_size);
+		    } else if (length == header_.block_size) {
+			memcpy(block, payload, length);
+		    } else {
+			valid = false;
+		    }
+		}
+
+		if (!valid) {
+
+		    TP_LOG_FATAL_ID("Checksum mismatch in a block of file:");
+		    TP_LOG_FATAL_ID(base_file_name_);
+
+		    delete [] block;
+		    return CHECKSUM_ERROR;
+		}
+	    }
+
+	    place = block;
+	    in_memory_blocks_++;
+
+	    stats_.record(BLOCK_GET);
+	    gstats_.record(BLOCK_GET);
+
+	    return NO_ERROR;
+	}
+
+
+	template<class BIDT>
+	err collection_packed<BIDT>::put_block(BIDT bid, void * place, char dirty) {
+
+	    err retval = NO_ERROR;
+
+	    // Blocks that are got are dirty as a rule, so all are written.
+	    if ((retval = write_slot(bid, place)) != NO_ERROR) {
+		return retval;
+	    }
+
+	    // A block of a read-only collection that was changed is not
+	    // written, so it is not clean.
+	    if (read_only_ && dirty) {
+		delete [] (char *) place;
+	    } else {
+		cache_give(bid, place, &release_block);
+	    }
+	    in_memory_blocks_--;
+
+	    stats_.record(BLOCK_PUT);
+	    gstats_.record(BLOCK_PUT);
+
+	    return NO_ERROR;
+	}
+
+
+	template<class BIDT>
+	err collection_packed<BIDT>::sync_block(BIDT bid, void* place, char /* dirty */) {
+
+	    err retval = NO_ERROR;
+
+	    if ((retval = write_slot(bid, place)) != NO_ERROR) {
+		return retval;
+	    }
+
+	    stats_.record(BLOCK_SYNC);
+	    gstats_.record(BLOCK_SYNC);
+
+	    return NO_ERROR;
+	}
+
+
+	template<class BIDT>
+	err collection_packed<BIDT>::prefetch(BIDT bid) {
+
+	    if ((bid <= 0) || (bid >= header_.last_block)) {
+		return INVALID_PLACEHOLDER;
+	    }
+
+	    const slot_type_ &s = slots_[bid];
+	    if (s.length) {
+		TPIE_OS_FADVISE_WILLNEED(bcc_fd_, s.offset, s.length);
+
+		stats_.record(BLOCK_PREFETCH);
+		gstats_.record(BLOCK_PREFETCH);
+	    }
+
+	    return NO_ERROR;
+	}
+
+    }  //  bte namespace
+
+}  //  tpie namespace
+
+#endif //_TPIE_BTE_COLL_PACKED_H
@@ -25,6 +25,7 @@
 #include <tpie/portability.h>
 // Get the base class.
 #include <tpie/bte/coll_base.h>
+#include <tpie/bte/prefetch.h>
 
 // For header's type field (85 == 'U').
 #define COLLECTION_UFS_ID 85
@@ -55,6 +56,10 @@ namespace tpie {
 	    using collection_base<BIDT>::create_stack;
 	    using collection_base<BIDT>::new_block_getid;
 	    using collection_base<BIDT>::delete_block_shared;
+	    using collection_base<BIDT>::cache_take;
+	    using collection_base<BIDT>::cache_give;
+	    using collection_base<BIDT>::cache_reserve;
+	    using collection_base<BIDT>::cache_id_;
 	
 	public:
 	
@@ -107,7 +112,7 @@ namespace tpie {
 	    
 		err retval = NO_ERROR;
 	    
-		if ((retval = put_block_internals(bid, place, 1)) != NO_ERROR) {
+		if ((retval = put_block_internals(bid, place, 1, false)) != NO_ERROR) {
 		    return retval;
 		}
 
@@ -163,6 +168,13 @@ namespace tpie {
 	
 	    // Synchronize the in-memory block with the on-disk block.
 	    err sync_block(BIDT bid, void* place, char dirty = 1);
+
+	    // Start reading the block with the indicated bid into the block
+	    // cache, so that a later get_block finds it. A hint only: blocks
+	    // that are cached or in memory, and reads beyond what the
+	    // prefetch pool can queue, are ignored. On Windows nothing is
+	    // read ahead.
+	    err prefetch(BIDT bid);
 	
 	protected:
 	
@@ -170,11 +182,25 @@ namespace tpie {
 	    //  CHECK THIS: Do we need this?
 	    //  err new_block_getid_specific(BIDT& bid);
 	    err get_block_internals(BIDT bid, void *&place);
-	    err put_block_internals(BIDT bid, void* place, char dirty);
+	    // Writes the block and gives it to the block cache, or frees it
+	    // if cache is false.
+	    err put_block_internals(BIDT bid, void* place, char dirty, bool cache = true);
+
+	    // Frees a block that leaves the block cache.
+	    static void release_block(void *place, TPIE_OS_SIZE_T /* size */) {
+		delete [] (char *) place;
+	    }
 	};
 
 	template<class BIDT>
-	err collection_ufs<BIDT>::new_block_internals(BIDT /* bid */, void* &place) {
+	err collection_ufs<BIDT>::new_block_internals(BIDT bid, void* &place) {
+
+	    // A recycled block may have been read ahead; its memory is
+	    // reused.
+	    if (cache_take(bid, place)) {
+		in_memory_blocks_++;
+		return NO_ERROR;
+	    }
 	
 	    if ((place = new char[header_.block_size]) == NULL) {    
 
@@ -269,6 +295,12 @@ namespace tpie {
 
 	template<class BIDT>
 	err collection_ufs<BIDT>::get_block_internals(BIDT bid, void * &place) {
+
+	    // A cached block is the same as the one on disk.
+	    if (cache_take(bid, place)) {
+		in_memory_blocks_++;
+		return NO_ERROR;
+	    }
 	
 	    if ((place = new char[header_.block_size]) == NULL) {    
 	    
@@ -304,7 +336,8 @@ namespace tpie {
     
 
 	template<class BIDT>
-	err collection_ufs<BIDT>::put_block_internals(BIDT bid, void * place, char /* dirty */) {
+	err collection_ufs<BIDT>::put_block_internals(BIDT bid, void * place, char dirty,
+							 bool cache) {
 	
 	    if ((bid < 0) || (bid >= header_.last_block)) {
 	    
@@ -343,7 +376,13 @@ namespace tpie {
 		file_pointer = bid_to_file_offset(bid) + header_.block_size;
 	    }
 	
-	    delete [] (char *) place;
+	    // A block of a read-only collection that was changed is not
+	    // written, so it is not clean.
+	    if (cache && !(read_only_ && dirty)) {
+		cache_give(bid, place, &release_block);
+	    } else {
+		delete [] (char *) place;
+	    }
 	
 	    in_memory_blocks_--;
 	
@@ -392,6 +431,36 @@ namespace tpie {
 	
 	    return NO_ERROR;
 	}
+
+
+	template<class BIDT>
+	err collection_ufs<BIDT>::prefetch(BIDT bid) {
+
+	    if ((bid <= 0) || (bid >= header_.last_block)) {
+		return INVALID_PLACEHOLDER;
+	    }
+
+#ifdef _WIN32
+	    // A read of the pool would move the file pointer of the handle
+	    // under the reads and writes of this collection.
+	    return NO_ERROR;
+#else
+	    prefetch_pool &pool = prefetch_pool::instance();
+	    if (pool.busy() || !cache_reserve(bid)) {
+		return NO_ERROR;
+	    }
+
+	    // The pool reads with pread(), which leaves file_pointer valid.
+	    char *place = new char[header_.block_size];
+	    pool.submit(bcc_fd_, bid_to_file_offset(bid), cache_id_, bid,
+			place, header_.block_size, &release_block);
+
+	    stats_.record(BLOCK_PREFETCH);
+	    gstats_.record(BLOCK_PREFETCH);
+
+	    return NO_ERROR;
+#endif
+	}
     
     }  //  bte namespace
 
@@ -59,7 +59,8 @@ namespace tpie {
 	    STREAM_IS_SUBSTREAM,
 	    WRITE_ONLY,
 	    BAD_HEADER,
-	    INVALID_PLACEHOLDER
+	    INVALID_PLACEHOLDER,
+	    CHECKSUM_ERROR
 	};
     
     }  //  bte namespace
@@ -0,0 +1,105 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2010, The TPIE development team
+// 
+// This file is part of TPIE.
+// 
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+// 
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+
+#include <tpie/config.h>
+#include <tpie/bte/prefetch.h>
+
+#include <boost/bind.hpp>
+
+using namespace tpie;
+using namespace tpie::bte;
+
+prefetch_pool &prefetch_pool::instance() {
+    // The block cache must outlive the pool, whose threads fill it.
+    block_cache::instance();
+    static prefetch_pool pool;
+    return pool;
+}
+
+prefetch_pool::prefetch_pool() : started_(false), stopping_(false) {
+    //  No code in this constructor.
+}
+
+prefetch_pool::~prefetch_pool() {
+    // The threads complete the reads left in the queue before they stop.
+    {
+	boost::mutex::scoped_lock lock(mutex_);
+	stopping_ = true;
+	ready_.notify_all();
+    }
+    threads_.join_all();
+}
+
+bool prefetch_pool::busy() {
+    boost::mutex::scoped_lock lock(mutex_);
+    return queue_.size() >= BTE_PREFETCH_QUEUE;
+}
+
+void prefetch_pool::submit(TPIE_OS_FILE_DESCRIPTOR fd, TPIE_OS_OFFSET offset,
+			   TPIE_OS_SIZE_T coll, TPIE_OS_OFFSET bid,
+			   void *place, TPIE_OS_SIZE_T size,
+			   block_cache::release_t release) {
+    read_type_ r;
+    r.fd = fd;
+    r.offset = offset;
+    r.coll = coll;
+    r.bid = bid;
+    r.place = place;
+    r.size = size;
+    r.release = release;
+
+    boost::mutex::scoped_lock lock(mutex_);
+    if (!started_) {
+	for (TPIE_OS_SIZE_T ii = 0; ii < BTE_PREFETCH_THREADS; ii++) {
+	    threads_.create_thread(boost::bind(&prefetch_pool::work, this));
+	}
+	started_ = true;
+    }
+    queue_.push_back(r);
+    ready_.notify_one();
+}
+
+void prefetch_pool::work() {
+    block_cache &cache = block_cache::instance();
+
+    while (true) {
+	read_type_ r;
+	{
+	    boost::mutex::scoped_lock lock(mutex_);
+	    while (queue_.empty() && !stopping_) {
+		ready_.wait(lock);
+	    }
+	    if (queue_.empty()) {
+		return;
+	    }
+	    r = queue_.front();
+	    queue_.pop_front();
+	}
+
+	if (TPIE_OS_PREAD(r.fd, r.place, r.size, r.offset) ==
+	    (TPIE_OS_SSIZE_T)r.size) {
+	    cache.fill(r.coll, r.bid, r.place, r.size, r.release);
+	} else {
+	    // A hint only; the block is read again when it is got.
+	    r.release(r.place, r.size);
+	    cache.cancel(r.coll, r.bid);
+	}
+    }
+}
@@ -0,0 +1,111 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2010, The TPIE development team
+// 
+// This file is part of TPIE.
+// 
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+// 
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+// Reading collection blocks ahead of their use.
+#ifndef _TPIE_BTE_PREFETCH_H
+#define _TPIE_BTE_PREFETCH_H
+
+// Get definitions for working with Unix and Windows
+#include <tpie/portability.h>
+#include <tpie/bte/block_cache.h>
+
+#include <deque>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/thread/thread.hpp>
+
+namespace tpie {
+
+    namespace bte {
+
+// The number of threads reading blocks ahead. Solid state disks serve
+// many reads at once, so this is more than the number of cores.
+#ifndef BTE_PREFETCH_THREADS
+#define BTE_PREFETCH_THREADS 16
+#endif
+
+// The number of reads that may wait for a thread. Further hints are
+// ignored until the queue drains.
+#ifndef BTE_PREFETCH_QUEUE
+#define BTE_PREFETCH_QUEUE 256
+#endif
+
+    ////////////////////////////////////////////////////////////////////
+    /// A pool of threads that read blocks into the block cache. The
+    /// block must have been reserved in the cache, and the read
+    /// completes with block_cache::fill() or, if it fails,
+    /// block_cache::cancel(). The threads start with the first read.
+    ////////////////////////////////////////////////////////////////////
+	class prefetch_pool {
+
+	public:
+
+	    /** The pool of the process. */
+	    static prefetch_pool &instance();
+
+	    /** True if the queue is full, and reads should not be
+		submitted. */
+	    bool busy();
+
+	    ////////////////////////////////////////////////////////////////
+	    /// Read size bytes at offset of fd into place, and fill block
+	    /// bid of collection coll with it. The descriptor must stay open
+	    /// until the read completes, which block_cache::drop() waits
+	    /// for.
+	    ////////////////////////////////////////////////////////////////
+	    void submit(TPIE_OS_FILE_DESCRIPTOR fd, TPIE_OS_OFFSET offset,
+			TPIE_OS_SIZE_T coll, TPIE_OS_OFFSET bid,
+			void *place, TPIE_OS_SIZE_T size,
+			block_cache::release_t release);
+
+	private:
+
+	    struct read_type_ {
+		TPIE_OS_FILE_DESCRIPTOR fd;
+		TPIE_OS_OFFSET offset;
+		TPIE_OS_SIZE_T coll;
+		TPIE_OS_OFFSET bid;
+		void *place;
+		TPIE_OS_SIZE_T size;
+		block_cache::release_t release;
+	    };
+
+	    prefetch_pool();
+	    ~prefetch_pool();
+
+	    // Prohibit these.
+	    prefetch_pool(const prefetch_pool &other);
+	    prefetch_pool &operator=(const prefetch_pool &other);
+
+	    /** The loop of each thread. */
+	    void work();
+
+	    boost::mutex mutex_;
+	    boost::condition ready_;
+	    std::deque<read_type_> queue_;
+	    boost::thread_group threads_;
+	    bool started_;
+	    bool stopping_;
+	};
+
+    }  //  bte namespace
+
+}  //  tpie namespace
+
+#endif // _TPIE_BTE_PREFETCH_H
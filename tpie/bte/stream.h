@@ -44,6 +44,10 @@
 #  define BTE_STREAM_IMP_STDIO
 #endif
     
+#ifdef BTE_IMP_PACKED
+#  define BTE_STREAM_IMP_PACKED
+#endif
+    
 #ifdef BTE_IMP_USER_DEFINED
 #  define BTE_STREAM_IMP_USER_DEFINED
 #endif
@@ -52,7 +56,8 @@
 #define _BTE_STREAM_IMP_COUNT (defined(BTE_STREAM_IMP_USER_DEFINED) + \
 			       defined(BTE_STREAM_IMP_STDIO) +	      \
 			       defined(BTE_STREAM_IMP_MMAP)   +	      \
-			       defined(BTE_STREAM_IMP_UFS) )
+			       defined(BTE_STREAM_IMP_UFS)    +	      \
+			       defined(BTE_STREAM_IMP_PACKED) )
     
 // Multiple implementations are allowed to coexist, with some
 // restrictions.
@@ -119,5 +124,17 @@
 #    define BTE_STREAM tpie::bte::stream_ufs
 #  endif
 #endif
+
+// Compressed implementation.
+#if defined(BTE_STREAM_IMP_PACKED)
+#  include <tpie/bte/stream_packed.h>
+// If this is the only implementation, then make it easier to get to.
+#  ifndef BTE_STREAM_IMP_MULTI_IMP
+#    ifdef BTE_STREAM
+#      undef BTE_STREAM
+#    endif
+#    define BTE_STREAM tpie::bte::stream_packed
+#  endif
+#endif
     
 #endif // _TPIE_BTE_STREAM_H 
@@ -0,0 +1,355 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2008, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+
+#include <tpie/config.h>
+#include <tpie/bte/stream_packed.h>
+#include <tpie/crc32c.h>
+#include <tpie/lz_codec.h>
+
+#include <cerrno>
+
+using namespace tpie;
+using namespace tpie::bte;
+
+const TPIE_OS_SIZE_T stream_packed_file::slot_header_size;
+const boost::uint32_t stream_packed_file::compressed_flag;
+
+stream_packed_file::stream_packed_file(TPIE_OS_FILE_DESCRIPTOR fd,
+				       const std::string& path,
+				       TPIE_OS_OFFSET data_begin) :
+    m_fd(fd), m_path(path), m_blockSize(0), m_filePointer(-1),
+    m_dataBegin(data_begin), m_dataEnd(data_begin), m_storedBytes(0),
+    m_buffer(NULL) {
+    //  No code in this constructor.
+}
+
+stream_packed_file::~stream_packed_file() {
+    if (TPIE_OS_CLOSE(m_fd)) {
+	TP_LOG_FATAL_ID("Failed to close() " << m_path);
+	TP_LOG_FATAL_ID(strerror(errno));
+    }
+    delete [] m_buffer;
+}
+
+TPIE_OS_SIZE_T stream_packed_file::buffer_size() const {
+    return slot_header_size + lz_compress_bound(m_blockSize);
+}
+
+err stream_packed_file::seek(TPIE_OS_OFFSET offset) {
+    if (m_filePointer != offset &&
+	TPIE_OS_LSEEK(m_fd, offset, TPIE_OS_FLAG_SEEK_SET) != offset) {
+
+	TP_LOG_FATAL_ID("Failed to lseek() in " << m_path);
+	TP_LOG_FATAL_ID(strerror(errno));
+
+	m_filePointer = -1;
+	return IO_ERROR;
+    }
+    m_filePointer = offset;
+    return NO_ERROR;
+}
+
+err stream_packed_file::read_header(stream_header *header, index_info &index) {
+    if (seek(0) != NO_ERROR) {
+	return IO_ERROR;
+    }
+    if (TPIE_OS_READ(m_fd, reinterpret_cast<char*>(header), sizeof(stream_header)) !=
+	static_cast<TPIE_OS_SSIZE_T>(sizeof(stream_header)) ||
+	TPIE_OS_READ(m_fd, reinterpret_cast<char*>(&index), sizeof(index_info)) !=
+	static_cast<TPIE_OS_SSIZE_T>(sizeof(index_info))) {
+
+	TP_LOG_FATAL_ID("Failed to read the header of " << m_path);
+
+	m_filePointer = -1;
+	return BAD_HEADER;
+    }
+    m_filePointer = sizeof(stream_header) + sizeof(index_info);
+    return NO_ERROR;
+}
+
+err stream_packed_file::write_header(const stream_header *header, const index_info &index) {
+    if (seek(0) != NO_ERROR) {
+	return IO_ERROR;
+    }
+    if (TPIE_OS_WRITE(m_fd, reinterpret_cast<const char*>(header), sizeof(stream_header)) !=
+	static_cast<TPIE_OS_SSIZE_T>(sizeof(stream_header)) ||
+	TPIE_OS_WRITE(m_fd, reinterpret_cast<const char*>(&index), sizeof(index_info)) !=
+	static_cast<TPIE_OS_SSIZE_T>(sizeof(index_info))) {
+
+	TP_LOG_FATAL_ID("Failed to write the header of " << m_path);
+
+	m_filePointer = -1;
+	return IO_ERROR;
+    }
+    m_filePointer = sizeof(stream_header) + sizeof(index_info);
+    return NO_ERROR;
+}
+
+err stream_packed_file::read_index(const index_info &index) {
+    m_slots.assign(static_cast<TPIE_OS_SIZE_T>(index.blocks), slot_type());
+    m_free.clear();
+    m_dataEnd = m_dataBegin;
+    m_storedBytes = 0;
+
+    if (index.blocks == 0) {
+	return NO_ERROR;
+    }
+
+    TPIE_OS_SIZE_T length = m_slots.size() * sizeof(slot_type);
+
+    if (seek(index.offset) != NO_ERROR ||
+	TPIE_OS_READ(m_fd, reinterpret_cast<char*>(&m_slots[0]), length) !=
+	static_cast<TPIE_OS_SSIZE_T>(length)) {
+
+	TP_LOG_FATAL_ID("Failed to read the index of " << m_path);
+
+	m_filePointer = -1;
+	return IO_ERROR;
+    }
+    m_filePointer = index.offset + length;
+
+    if (crc32c(&m_slots[0], length) != index.crc) {
+
+	TP_LOG_FATAL_ID("Index checksum mismatch in " << m_path);
+
+	return CHECKSUM_ERROR;
+    }
+
+    // The gaps between the slots are free. New slots go where the index
+    // is now.
+    m_dataEnd = index.offset;
+
+    std::vector<std::pair<TPIE_OS_OFFSET, TPIE_OS_OFFSET> > used;
+    for (TPIE_OS_SIZE_T ii = 0; ii < m_slots.size(); ii++) {
+	if (m_slots[ii].length) {
+	    used.push_back(std::make_pair(m_slots[ii].offset,
+					  m_slots[ii].offset + m_slots[ii].capacity));
+	    m_storedBytes += m_slots[ii].length;
+	}
+    }
+    std::sort(used.begin(), used.end());
+
+    TPIE_OS_OFFSET end = m_dataBegin;
+    for (TPIE_OS_SIZE_T ii = 0; ii < used.size(); ii++) {
+	if (used[ii].first > end) {
+	    m_free.insert(std::make_pair(static_cast<TPIE_OS_SIZE_T>(used[ii].first - end), end));
+	}
+	end = used[ii].second;
+    }
+
+    return NO_ERROR;
+}
+
+err stream_packed_file::write_index(index_info &index) {
+    TPIE_OS_SIZE_T length = m_slots.size() * sizeof(slot_type);
+
+    index.offset = m_dataEnd;
+    index.blocks = m_slots.size();
+    index.crc = length ? crc32c(&m_slots[0], length) : crc32c(NULL, 0);
+
+    if (seek(m_dataEnd) != NO_ERROR ||
+	(length && TPIE_OS_WRITE(m_fd, reinterpret_cast<const char*>(&m_slots[0]), length) !=
+	 static_cast<TPIE_OS_SSIZE_T>(length))) {
+
+	TP_LOG_FATAL_ID("Failed to write the index of " << m_path);
+
+	m_filePointer = -1;
+	return IO_ERROR;
+    }
+    m_filePointer = m_dataEnd + length;
+
+    // Drop what is left of slots beyond the end.
+    if (TPIE_OS_FTRUNCATE(m_fd, m_dataEnd + length)) {
+
+	TP_LOG_FATAL_ID("Failed to truncate " << m_path);
+
+	return OS_ERROR;
+    }
+
+    return NO_ERROR;
+}
+
+void stream_packed_file::allocate_slot(slot_type &s, TPIE_OS_SIZE_T length) {
+    TPIE_OS_SIZE_T capacity = (length + STREAM_PACKED_GRANULE - 1) /
+	STREAM_PACKED_GRANULE * STREAM_PACKED_GRANULE;
+
+    std::multimap<TPIE_OS_SIZE_T, TPIE_OS_OFFSET>::iterator it =
+	m_free.lower_bound(capacity);
+
+    if (it == m_free.end()) {
+	s.offset = m_dataEnd;
+	m_dataEnd += capacity;
+    } else {
+	// Best fit; the rest of the slot stays free.
+	s.offset = it->second;
+	if (it->first > capacity) {
+	    m_free.insert(std::make_pair(it->first - capacity, s.offset + capacity));
+	}
+	m_free.erase(it);
+    }
+    s.capacity = static_cast<boost::uint32_t>(capacity);
+}
+
+void stream_packed_file::free_slot(slot_type &s) {
+    if (s.capacity) {
+	if (s.offset + s.capacity == m_dataEnd) {
+	    m_dataEnd = s.offset;
+	} else {
+	    m_free.insert(std::make_pair(static_cast<TPIE_OS_SIZE_T>(s.capacity), s.offset));
+	}
+    }
+    m_storedBytes -= s.length;
+    s = slot_type();
+}
+
+err stream_packed_file::truncate(TPIE_OS_OFFSET blocks) {
+    TPIE_OS_OFFSET end = m_dataEnd;
+
+    // Free the last slots first, so that slots at the end of the data
+    // give their space back to it.
+    while (static_cast<TPIE_OS_OFFSET>(m_slots.size()) > blocks) {
+	free_slot(m_slots.back());
+	m_slots.pop_back();
+    }
+    if (m_slots.empty()) {
+	m_free.clear();
+	m_dataEnd = m_dataBegin;
+    }
+
+    // Give the disk space back.
+    if (m_dataEnd < end && TPIE_OS_FTRUNCATE(m_fd, m_dataEnd)) {
+
+	TP_LOG_FATAL_ID("Failed to truncate " << m_path);
+	TP_LOG_FATAL_ID(strerror(errno));
+
+	return OS_ERROR;
+    }
+
+    return NO_ERROR;
+}
+
+err stream_packed_file::write_block(TPIE_OS_OFFSET k, const char *block, TPIE_OS_SIZE_T bytes) {
+    if (m_buffer == NULL) {
+	m_buffer = new char[buffer_size()];
+    }
+    if (static_cast<TPIE_OS_OFFSET>(m_slots.size()) <= k) {
+	m_slots.resize(static_cast<TPIE_OS_SIZE_T>(k) + 1);
+    }
+
+    char *payload = m_buffer + slot_header_size;
+    TPIE_OS_SIZE_T length = 0;
+    boost::uint32_t word;
+
+    if (bytes > STREAM_PACKED_GRANULE) {
+	length = lz_compress(block, bytes, payload, bytes - STREAM_PACKED_GRANULE);
+    }
+    if (length) {
+	word = static_cast<boost::uint32_t>(length) | compressed_flag;
+    } else {
+	length = bytes;
+	memcpy(payload, block, length);
+	word = static_cast<boost::uint32_t>(length);
+    }
+    boost::uint32_t raw = static_cast<boost::uint32_t>(bytes);
+    memcpy(m_buffer + 4, &word, 4);
+    memcpy(m_buffer + 8, &raw, 4);
+    boost::uint32_t crc = crc32c(m_buffer + 4, slot_header_size - 4 + length);
+    memcpy(m_buffer, &crc, 4);
+    length += slot_header_size;
+
+    slot_type &s = m_slots[static_cast<TPIE_OS_SIZE_T>(k)];
+    if (length > s.capacity) {
+	free_slot(s);
+	allocate_slot(s, length);
+    } else {
+	m_storedBytes -= s.length;
+    }
+    s.length = static_cast<boost::uint32_t>(length);
+    m_storedBytes += length;
+
+    if (seek(s.offset) != NO_ERROR) {
+	return IO_ERROR;
+    }
+    if (TPIE_OS_WRITE(m_fd, m_buffer, length) != static_cast<TPIE_OS_SSIZE_T>(length)) {
+
+	TP_LOG_FATAL_ID("Failed to write() to " << m_path);
+	TP_LOG_FATAL_ID(strerror(errno));
+
+	m_filePointer = -1;
+	return IO_ERROR;
+    }
+    m_filePointer = s.offset + length;
+
+    return NO_ERROR;
+}
+
+err stream_packed_file::read_block(TPIE_OS_OFFSET k, char *block, TPIE_OS_SIZE_T &bytes) {
+    bytes = 0;
+    if (k >= static_cast<TPIE_OS_OFFSET>(m_slots.size()) ||
+	m_slots[static_cast<TPIE_OS_SIZE_T>(k)].length == 0) {
+	return NO_ERROR;
+    }
+    if (m_buffer == NULL) {
+	m_buffer = new char[buffer_size()];
+    }
+
+    const slot_type &s = m_slots[static_cast<TPIE_OS_SIZE_T>(k)];
+
+    if (seek(s.offset) != NO_ERROR) {
+	return IO_ERROR;
+    }
+    if (TPIE_OS_READ(m_fd, m_buffer, s.length) != static_cast<TPIE_OS_SSIZE_T>(s.length)) {
+
+	TP_LOG_FATAL_ID("Failed to read() from " << m_path);
+
+	m_filePointer = -1;
+	return IO_ERROR;
+    }
+    m_filePointer = s.offset + s.length;
+
+    boost::uint32_t crc, word, raw;
+    memcpy(&crc, m_buffer, 4);
+    memcpy(&word, m_buffer + 4, 4);
+    memcpy(&raw, m_buffer + 8, 4);
+    TPIE_OS_SIZE_T length = word & ~compressed_flag;
+    const char *payload = m_buffer + slot_header_size;
+
+    bool valid = length + slot_header_size == s.length && raw <= m_blockSize &&
+	crc32c(m_buffer + 4, slot_header_size - 4 + length) == crc;
+    if (valid) {
+	if (word & compressed_flag) {
+	    valid = lz_decompress(payload, length, block, raw);
+	} else if (length == raw) {
+	    memcpy(block, payload, length);
+	} else {
+	    valid = false;
+	}
+    }
+
+    if (!valid) {
+
+	TP_LOG_FATAL_ID("Checksum mismatch in a block of " << m_path);
+
+	return CHECKSUM_ERROR;
+    }
+
+    bytes = raw;
+    return NO_ERROR;
+}
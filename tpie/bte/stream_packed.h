@@ -0,0 +1,1004 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2008, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+// BTE streams whose logical blocks are stored compressed. Each block is
+// compressed with lz_compress() into a slot of its own, and an index of
+// the slots allows seeking to any block. Since items have no fixed place
+// in the file, the logical offsets of these streams (m_fileOffset,
+// m_logicalBeginOfStream and m_logicalEndOfStream) count items, not
+// bytes.
+
+#ifndef _TPIE_BTE_STREAM_PACKED_H
+#define _TPIE_BTE_STREAM_PACKED_H
+
+// Get definitions for working with Unix and Windows
+#include <tpie/portability.h>
+
+// Get error definitions
+#include <tpie/bte/err.h>
+
+// For memcpy
+#include <cstring>
+#include <algorithm>
+#include <map>
+#include <vector>
+#include <boost/cstdint.hpp>
+
+// For header's type field (80 == 'P').
+#define STREAM_IMPLEMENTATION_PACKED 80
+
+// This code makes assertions and logs errors.
+#include <tpie/tpie_assert.h>
+#include <tpie/tpie_log.h>
+
+// Get the stream_base class and related definitions.
+#include <tpie/bte/stream_base.h>
+
+// Define a sensible logical block factor, if not already defined.
+#ifndef STREAM_PACKED_BLOCK_FACTOR
+#  define STREAM_PACKED_BLOCK_FACTOR 8
+#endif
+
+// Slots are allocated in multiples of this many bytes, so that a block
+// that grows a little when it is rewritten still fits its slot. A block
+// is stored compressed only if that saves at least this much.
+#ifndef STREAM_PACKED_GRANULE
+#  define STREAM_PACKED_GRANULE 64
+#endif
+
+namespace tpie {
+
+    namespace bte {
+
+    ////////////////////////////////////////////////////////////////////
+    /// The file of a stream_packed, shared by a stream and its
+    /// substreams. Block k of the stream is stored in a slot of its own,
+    /// led by a CRC-32C of the slot, the stored length, whose high bit
+    /// is set if the block is compressed, and the length of the block.
+    /// The slot index is kept in memory and written after the last slot
+    /// when the stream is closed; the header block holds the
+    /// stream_header followed by an index_info locating it.
+    ////////////////////////////////////////////////////////////////////
+	class stream_packed_file {
+
+	public:
+	    /** Where the slot index is; follows the stream_header. */
+	    struct index_info {
+		TPIE_OS_OFFSET offset;
+		TPIE_OS_OFFSET blocks;
+		boost::uint32_t crc;
+
+		index_info(): offset(0), blocks(0), crc(0) {}
+	    };
+
+	    // Takes over the open file fd. Slots start at data_begin.
+	    stream_packed_file(TPIE_OS_FILE_DESCRIPTOR fd,
+			       const std::string& path,
+			       TPIE_OS_OFFSET data_begin);
+
+	    // Closes the file.
+	    ~stream_packed_file();
+
+	    // Set the size of the (uncompressed) blocks.
+	    void set_block_size(TPIE_OS_SIZE_T block_size) {
+		m_blockSize = block_size;
+	    }
+
+	    // Read or write the header block.
+	    err read_header(stream_header *header, index_info &index);
+	    err write_header(const stream_header *header, const index_info &index);
+
+	    // Read the slot index and find the free space between the slots.
+	    err read_index(const index_info &index);
+
+	    // Write the slot index after the last slot, and truncate the
+	    // file after it.
+	    err write_index(index_info &index);
+
+	    // Read block k into block, which has room for a block. bytes is
+	    // set to its length, 0 for a block that was never written.
+	    // Returns CHECKSUM_ERROR if the slot is damaged.
+	    err read_block(TPIE_OS_OFFSET k, char *block, TPIE_OS_SIZE_T &bytes);
+
+	    // Write the first bytes bytes of block k.
+	    err write_block(TPIE_OS_OFFSET k, const char *block, TPIE_OS_SIZE_T bytes);
+
+	    // Drop the blocks from the given one on, and cut the file after
+	    // the last slot.
+	    err truncate(TPIE_OS_OFFSET blocks);
+
+	    // The number of bytes in use in slots.
+	    TPIE_OS_OFFSET stored_bytes() const {
+		return m_storedBytes;
+	    }
+
+	    // The number of bytes of buffer used when blocks are read or
+	    // written.
+	    TPIE_OS_SIZE_T buffer_size() const;
+
+	    bool buffer_allocated() const {
+		return m_buffer != NULL;
+	    }
+
+	    TPIE_OS_FILE_DESCRIPTOR fd() const {
+		return m_fd;
+	    }
+
+	private:
+	    // Prohibit these.
+	    stream_packed_file(const stream_packed_file& other);
+	    stream_packed_file& operator=(const stream_packed_file& other);
+
+	    /** Where a block is stored; length 0 if it has no slot. */
+	    struct slot_type {
+		TPIE_OS_OFFSET offset;
+		boost::uint32_t length;
+		boost::uint32_t capacity;
+
+		slot_type(): offset(0), length(0), capacity(0) {}
+	    };
+
+	    // The slot header: CRC-32C, stored length and block length.
+	    static const TPIE_OS_SIZE_T slot_header_size = 12;
+	    static const boost::uint32_t compressed_flag = 0x80000000u;
+
+	    // Position the file at offset.
+	    err seek(TPIE_OS_OFFSET offset);
+
+	    // Find a slot of at least length bytes.
+	    void allocate_slot(slot_type &s, TPIE_OS_SIZE_T length);
+
+	    // Give a slot back.
+	    void free_slot(slot_type &s);
+
+	    TPIE_OS_FILE_DESCRIPTOR m_fd;
+	    std::string m_path;
+
+	    TPIE_OS_SIZE_T m_blockSize;
+
+	    // Where the file is positioned, or -1 if not known.
+	    TPIE_OS_OFFSET m_filePointer;
+
+	    /** The slot of each block. */
+	    std::vector<slot_type> m_slots;
+
+	    /** Free slots by capacity. */
+	    std::multimap<TPIE_OS_SIZE_T, TPIE_OS_OFFSET> m_free;
+
+	    TPIE_OS_OFFSET m_dataBegin;
+
+	    /** The end of the last slot. */
+	    TPIE_OS_OFFSET m_dataEnd;
+
+	    TPIE_OS_OFFSET m_storedBytes;
+
+	    /** Room for a slot: header and compressed block. */
+	    char *m_buffer;
+	};
+
+    ////////////////////////////////////////////////////////////////////
+    /// A BTE stream that stores each logical block compressed with
+    /// lz_compress() and checksummed with CRC-32C, for temporary streams
+    /// that compress well, such as sort runs. Items are read and written
+    /// through a buffer of one block, as in stream_ufs. Seeking is by
+    /// block: the block holding the new position is read and
+    /// decompressed when it is first accessed. A block that outgrows its
+    /// slot when it is rewritten moves to a new one, and the old slot is
+    /// reused. Substreams share the file of their super stream, which
+    /// must outlive them.
+    ////////////////////////////////////////////////////////////////////
+	template <class T>
+	class stream_packed: public stream_base<T, stream_packed<T> > {
+	public:
+		typedef stream_base<T, stream_packed<T> > base_t;
+// These are for gcc-3.4 compatibility
+	protected:
+
+	    using base_t::remaining_streams;
+	    using base_t::m_substreamLevel;
+	    using base_t::m_status;
+	    using base_t::m_persistenceStatus;
+	    using base_t::m_readOnly;
+	    using base_t::m_path;
+	    using base_t::m_osBlockSize;
+	    using base_t::m_fileOffset;
+	    using base_t::m_logicalBeginOfStream;
+	    using base_t::m_logicalEndOfStream;
+	    using base_t::m_fileLength;
+	    using base_t::m_osErrno;
+	    using base_t::m_header;
+
+	    using base_t::check_header;
+	    using base_t::init_header;
+	    using base_t::record_statistics;
+
+	public:
+	    using base_t::name;
+	    using base_t::os_block_size;
+// End: These are for gcc-3.4 compatibility
+
+	public:
+	    // Constructor. A block holds as many items as fit in lbf OS
+	    // blocks.
+	    stream_packed(const std::string& dev_path,
+			  stream_type    st,
+			  TPIE_OS_SIZE_T lbf = STREAM_PACKED_BLOCK_FACTOR);
+
+	    // A substream constructor.
+	    stream_packed(stream_packed  *super_stream,
+			  stream_type    st,
+			  TPIE_OS_OFFSET sub_begin,
+			  TPIE_OS_OFFSET sub_end);
+
+	    // A psuedo-constructor for substreams.
+	    err new_substream(stream_type    st,
+			      TPIE_OS_OFFSET sub_begin,
+			      TPIE_OS_OFFSET sub_end,
+			      base_t **sub_stream);
+
+	    // Destructor
+	    ~stream_packed();
+
+	    inline err read_item(T ** elt);
+	    inline err write_item(const T & elt);
+
+	    // Read or write runs of items a block at a time.
+	    err read_array(T * elms, TPIE_OS_SIZE_T & count);
+	    err write_array(const T * elms, TPIE_OS_SIZE_T count);
+
+	    // Move to a specific position in the stream.
+	    err seek(TPIE_OS_OFFSET offset);
+
+	    // Truncate the stream.
+	    err truncate(TPIE_OS_OFFSET offset);
+
+	    // Return the number of items in the stream.
+	    inline TPIE_OS_OFFSET stream_len() const;
+
+	    // Return the current position in the stream.
+	    inline TPIE_OS_OFFSET tell() const;
+
+	    // Query memory usage
+	    err main_memory_usage(TPIE_OS_SIZE_T  *usage,
+				  mem::stream_usage usage_type);
+
+	    TPIE_OS_SIZE_T chunk_size() const;
+
+	    // The number of bytes the blocks take in the file.
+	    TPIE_OS_OFFSET stored_bytes() const {
+		return m_file ? m_file->stored_bytes() : 0;
+	    }
+
+	private:
+
+	    // Prohibit these.
+	    stream_packed(const stream_packed<T>& other);
+	    stream_packed<T>& operator=(const stream_packed<T>& other);
+
+	    // Open the file and read or create the header.
+	    err open_file(stream_type st, TPIE_OS_SIZE_T lbf);
+
+	    // Make the block holding m_fileOffset current. If write is set,
+	    // a block past the end of the stream is started empty instead of
+	    // read.
+	    err make_current(bool write);
+
+	    // Write the current block back if it is dirty.
+	    err flush_current();
+
+	    // True if m_fileOffset is in the current block.
+	    bool in_current() const {
+		return m_blockBegin >= 0 &&
+		    static_cast<TPIE_OS_SIZE_T>(m_fileOffset - m_blockBegin) < m_itemsPerBlock;
+	    }
+
+	    // The file; owned by the stream at substream level 0.
+	    stream_packed_file *m_file;
+
+	    stream_packed_file::index_info m_index;
+
+	    TPIE_OS_SIZE_T m_itemsPerBlock;
+
+	    // The items of the current block.
+	    T *m_block;
+
+	    // The first item of the current block, or -1 if there is none.
+	    TPIE_OS_OFFSET m_blockBegin;
+
+	    // The number of items of the current block that were read or
+	    // written.
+	    TPIE_OS_SIZE_T m_blockItems;
+
+	    bool m_blockDirty;
+	};
+
+
+// This constructor creates a stream whose contents are taken from the
+// file whose path is given.
+	template <class T>
+	stream_packed<T>::stream_packed (const std::string& dev_path,
+					 stream_type    st,
+					 TPIE_OS_SIZE_T lbf) :
+	    m_file(NULL),
+	    m_index(),
+	    m_itemsPerBlock(0),
+	    m_block(NULL),
+	    m_blockBegin(-1),
+	    m_blockItems(0),
+	    m_blockDirty(false) {
+
+	    // Check if we have available streams. Don't decrease the number
+	    // yet, since we may encounter an error.
+	    if (remaining_streams <= 0) {
+
+		m_status = STREAM_STATUS_INVALID;
+
+		TP_LOG_FATAL_ID ("BTE internal error: cannot open more streams.");
+
+		return;
+	    }
+
+	    m_path = dev_path;
+	    m_osBlockSize = os_block_size();
+	    m_substreamLevel = 0;
+	    m_persistenceStatus = PERSIST_PERSISTENT;
+	    m_fileOffset = m_logicalBeginOfStream = m_logicalEndOfStream = 0;
+
+	    if (open_file(st, lbf) != NO_ERROR) {
+		m_status = STREAM_STATUS_INVALID;
+		return;
+	    }
+
+	    if (st == APPEND_STREAM) {
+		m_fileOffset = m_logicalEndOfStream;
+	    }
+
+	    record_statistics(STREAM_OPEN);
+	}
+
+
+	template <class T>
+	err stream_packed<T>::open_file (stream_type st, TPIE_OS_SIZE_T lbf) {
+
+	    TPIE_OS_FILE_DESCRIPTOR fd;
+	    bool created = false;
+
+	    switch (st) {
+	    case READ_STREAM:
+
+		m_readOnly = true;
+		fd = TPIE_OS_OPEN_ORDONLY(m_path, TPIE_OS_FLAG_USE_MAPPING_FALSE);
+		break;
+
+	    case WRITE_STREAM:
+	    case WRITEONLY_STREAM:
+	    case APPEND_STREAM:
+
+		m_readOnly = false;
+		// Create the file, or open it if it exists.
+		fd = TPIE_OS_OPEN_OEXCL(m_path, TPIE_OS_FLAG_USE_MAPPING_FALSE);
+		if (TPIE_OS_IS_VALID_FILE_DESCRIPTOR(fd)) {
+		    created = true;
+		} else {
+		    fd = TPIE_OS_OPEN_ORDWR(m_path, TPIE_OS_FLAG_USE_MAPPING_FALSE);
+		}
+		break;
+
+	    default:
+
+		TP_LOG_WARNING_ID("Bad or unimplemented case.");
+
+		return PERMISSION_DENIED;
+	    }
+
+	    if (!TPIE_OS_IS_VALID_FILE_DESCRIPTOR(fd)) {
+
+		m_osErrno = errno;
+
+		TP_LOG_FATAL_ID ("open() failed to open " << m_path);
+		TP_LOG_FATAL_ID (strerror (m_osErrno));
+
+		return OS_ERROR;
+	    }
+
+	    // The stream is counted while it has its file.
+	    m_file = new stream_packed_file(fd, m_path, m_osBlockSize);
+	    m_header = new stream_header;
+	    remaining_streams--;
+
+	    if (created) {
+
+		init_header();
+
+		if (lbf == 0) {
+		    lbf = 1;
+		    TP_LOG_WARNING_ID("Block factor 0 requested. Using 1 instead.");
+		}
+
+		// Whole items only.
+		TPIE_OS_SIZE_T items = lbf * m_osBlockSize / sizeof(T);
+		m_header->m_blockSize = (items ? items : 1) * sizeof(T);
+		m_header->m_type = STREAM_IMPLEMENTATION_PACKED;
+
+		record_statistics(STREAM_CREATE);
+	    }
+	    else {
+
+		err ae;
+		if ((ae = m_file->read_header(m_header, m_index)) != NO_ERROR) {
+		    return ae;
+		}
+
+		if (check_header() < 0) {
+		    return BAD_HEADER;
+		}
+
+		// The other implementations cannot be read as packed streams.
+		if (m_header->m_type != STREAM_IMPLEMENTATION_PACKED ||
+		    m_header->m_blockSize == 0 ||
+		    m_header->m_blockSize % sizeof(T) != 0) {
+
+		    TP_LOG_FATAL_ID ("Not a packed stream: " << m_path);
+
+		    return BAD_HEADER;
+		}
+	    }
+
+	    m_itemsPerBlock = m_header->m_blockSize / sizeof(T);
+	    m_file->set_block_size(m_header->m_blockSize);
+
+	    if (!created) {
+		err ae;
+		if ((ae = m_file->read_index(m_index)) != NO_ERROR) {
+		    return ae;
+		}
+		m_logicalEndOfStream = m_header->m_itemLogicalEOF;
+	    }
+
+	    return NO_ERROR;
+	}
+
+
+// A substream constructor.
+// sub_begin is the item offset of the first item in the stream.
+// sub_end is the item offset that of the last item in the stream.
+	template <class T>
+	stream_packed<T>::stream_packed (stream_packed  *super_stream,
+					 stream_type    st,
+					 TPIE_OS_OFFSET sub_begin,
+					 TPIE_OS_OFFSET sub_end) :
+	    m_file(NULL),
+	    m_index(),
+	    m_itemsPerBlock(0),
+	    m_block(NULL),
+	    m_blockBegin(-1),
+	    m_blockItems(0),
+	    m_blockDirty(false) {
+
+	    if (remaining_streams <= 0) {
+
+		m_status = STREAM_STATUS_INVALID;
+
+		TP_LOG_FATAL_ID ("BTE error: cannot open more streams.");
+
+		return;
+	    }
+
+	    if (super_stream->status() == STREAM_STATUS_INVALID) {
+
+		m_status = STREAM_STATUS_INVALID;
+
+		TP_LOG_FATAL_ID ("BTE error: super stream is invalid.");
+
+		return;
+	    }
+
+	    if (super_stream->read_only() && (st != READ_STREAM)) {
+
+		m_status = STREAM_STATUS_INVALID;
+
+		TP_LOG_FATAL_ID ("BTE error: super stream is read only and substream is not.");
+
+		return;
+	    }
+
+	    // The substream reads the blocks from the file, so the super
+	    // stream's current block must be there, and it must read it
+	    // again in case the substream writes to it.
+	    if (super_stream->flush_current() != NO_ERROR) {
+
+		m_status = STREAM_STATUS_INVALID;
+
+		TP_LOG_FATAL_ID ("BTE internal error: super stream is invalid.");
+
+		return;
+	    }
+	    super_stream->m_blockBegin = -1;
+
+	    m_path          = super_stream->m_path;
+	    m_readOnly      = (st == READ_STREAM);
+	    m_osBlockSize   = super_stream->m_osBlockSize;
+	    m_itemsPerBlock = super_stream->m_itemsPerBlock;
+	    m_header        = super_stream->m_header;
+	    m_file          = super_stream->m_file;
+	    remaining_streams--;
+
+	    m_substreamLevel = super_stream->m_substreamLevel + 1;
+	    m_persistenceStatus = PERSIST_PERSISTENT;
+
+	    m_logicalBeginOfStream = super_stream->m_logicalBeginOfStream + sub_begin;
+	    m_logicalEndOfStream   = super_stream->m_logicalBeginOfStream + sub_end + 1;
+	    m_fileOffset           = m_logicalBeginOfStream;
+
+	    if (m_logicalBeginOfStream > m_logicalEndOfStream ||
+		m_logicalEndOfStream > super_stream->m_logicalEndOfStream) {
+
+		m_status = STREAM_STATUS_INVALID;
+
+		TP_LOG_FATAL_ID ("BTE internal error: reached beyond super stream eof.");
+
+		return;
+	    }
+
+	    record_statistics(STREAM_OPEN);
+	    record_statistics(SUBSTREAM_CREATE);
+	}
+
+
+// A psuedo-constructor for substreams.
+	template <class T>
+	err stream_packed<T>::new_substream (stream_type    st,
+					     TPIE_OS_OFFSET sub_begin,
+					     TPIE_OS_OFFSET sub_end,
+					     base_t **sub_stream) {
+	    // Check permissions.
+	    if ((st != READ_STREAM) &&
+		((st != WRITE_STREAM) || m_readOnly)) {
+
+		*sub_stream = NULL;
+
+		return PERMISSION_DENIED;
+	    }
+
+	    stream_packed<T> *sub =
+		new stream_packed<T>(this, st, sub_begin, sub_end);
+
+	    *sub_stream = dynamic_cast<base_t *>(sub);
+
+	    return NO_ERROR;
+	}
+
+
+	template <class T>
+	stream_packed<T>::~stream_packed () {
+
+	    // Streams that failed to open have no file.
+	    const bool opened = (m_file != NULL);
+
+	    if (m_status != STREAM_STATUS_INVALID && !m_readOnly) {
+		flush_current();
+	    }
+
+	    if (!m_substreamLevel) {
+		// Write back the index and the header, unless the file is
+		// about to be removed anyway.
+		if (m_status != STREAM_STATUS_INVALID && !m_readOnly &&
+		    m_persistenceStatus != PERSIST_DELETE) {
+
+		    m_header->m_itemLogicalEOF = m_logicalEndOfStream;
+
+		    if (m_file->write_index(m_index) != NO_ERROR ||
+			m_file->write_header(m_header, m_index) != NO_ERROR) {
+
+			m_status = STREAM_STATUS_INVALID;
+
+			TP_LOG_FATAL_ID ("Failed to write the index of " << m_path);
+		    }
+		}
+
+		// Closes the file.
+		delete m_file;
+		delete m_header;
+
+		// If it should not persist, unlink the file.
+		if (opened && m_persistenceStatus == PERSIST_DELETE) {
+		    if (m_readOnly) {
+			TP_LOG_WARNING_ID("PERSIST_DELETE for read-only stream in " << m_path);
+		    }
+		    else if (TPIE_OS_UNLINK (m_path)) {
+
+			m_osErrno = errno;
+
+			TP_LOG_WARNING_ID ("unlink failed during destruction of:");
+			TP_LOG_WARNING_ID (m_path);
+			TP_LOG_WARNING_ID (strerror (m_osErrno));
+		    }
+		    else {
+			record_statistics(STREAM_DELETE);
+		    }
+		}
+	    }
+	    else {
+		record_statistics(SUBSTREAM_DELETE);
+	    }
+
+	    delete [] reinterpret_cast<char*>(m_block);
+
+	    if (opened && remaining_streams >= 0) {
+		remaining_streams++;
+	    }
+
+	    record_statistics(STREAM_CLOSE);
+	}
+
+
+	template <class T>
+	err stream_packed<T>::flush_current () {
+
+	    if (m_blockBegin < 0 || !m_blockDirty) {
+		return NO_ERROR;
+	    }
+
+	    TPIE_OS_SIZE_T items = m_blockItems;
+
+	    // Items truncated away are not kept.
+	    if (!m_substreamLevel &&
+		m_logicalEndOfStream - m_blockBegin < static_cast<TPIE_OS_OFFSET>(items)) {
+		items = static_cast<TPIE_OS_SIZE_T>(m_logicalEndOfStream - m_blockBegin);
+	    }
+
+	    err ae = m_file->write_block(m_blockBegin / m_itemsPerBlock,
+					 reinterpret_cast<char*>(m_block),
+					 items * sizeof(T));
+	    if (ae != NO_ERROR) {
+		m_status = STREAM_STATUS_INVALID;
+		return ae;
+	    }
+
+	    m_blockDirty = false;
+
+	    record_statistics(BLOCK_WRITE);
+
+	    return NO_ERROR;
+	}
+
+
+	template <class T>
+	err stream_packed<T>::make_current (bool write) {
+
+	    err ae;
+
+	    if ((ae = flush_current()) != NO_ERROR) {
+		return ae;
+	    }
+
+	    if (m_block == NULL) {
+		m_block = reinterpret_cast<T*>(new char[m_header->m_blockSize]);
+	    }
+
+	    TPIE_OS_OFFSET k = m_fileOffset / m_itemsPerBlock;
+	    m_blockBegin = k * m_itemsPerBlock;
+	    m_blockItems = 0;
+
+	    // A block that is being appended has nothing to read. A
+	    // substream never reaches past the items of its super stream.
+	    if (write && !m_substreamLevel && m_blockBegin >= m_logicalEndOfStream) {
+		return NO_ERROR;
+	    }
+
+	    TPIE_OS_SIZE_T bytes = 0;
+	    if ((ae = m_file->read_block(k, reinterpret_cast<char*>(m_block), bytes)) != NO_ERROR) {
+		m_blockBegin = -1;
+		if (ae != CHECKSUM_ERROR) {
+		    m_status = STREAM_STATUS_INVALID;
+		}
+		return ae;
+	    }
+
+	    // Items past the stored ones, after truncate() extended the
+	    // stream, read as zeros.
+	    if (bytes < m_header->m_blockSize) {
+		memset(reinterpret_cast<char*>(m_block) + bytes, 0, m_header->m_blockSize - bytes);
+	    }
+	    m_blockItems = bytes / sizeof(T);
+
+	    record_statistics(BLOCK_READ);
+
+	    return NO_ERROR;
+	}
+
+
+	template <class T>
+	inline err stream_packed<T>::read_item (T ** elt) {
+
+	    // Make sure we are not currently at the EOS.
+	    if (m_fileOffset >= m_logicalEndOfStream) {
+		tp_assert (m_logicalEndOfStream == m_fileOffset, "Can't read past eos.");
+		return END_OF_STREAM;
+	    }
+
+	    if (!in_current()) {
+		err ae;
+		if ((ae = make_current(false)) != NO_ERROR) {
+		    return ae;
+		}
+	    }
+
+	    record_statistics(ITEM_READ);
+
+	    *elt = m_block + (m_fileOffset - m_blockBegin);
+	    m_fileOffset++;
+
+	    return NO_ERROR;
+	}
+
+
+	template <class T>
+	inline err stream_packed<T>::write_item (const T & elt) {
+
+	    // This better be a writable stream.
+	    if (m_readOnly) {
+		return READ_ONLY;
+	    }
+
+	    // Make sure we are not currently at the EOS of a substream.
+	    if (m_substreamLevel && (m_logicalEndOfStream <= m_fileOffset)) {
+		return END_OF_STREAM;
+	    }
+
+	    if (!in_current()) {
+		err ae;
+		if ((ae = make_current(true)) != NO_ERROR) {
+		    return ae;
+		}
+	    }
+	    TPIE_OS_OFFSET i = m_fileOffset - m_blockBegin;
+
+	    record_statistics(ITEM_WRITE);
+
+	    m_block[i] = elt;
+	    m_blockDirty = true;
+	    if (static_cast<TPIE_OS_SIZE_T>(i) >= m_blockItems) {
+		m_blockItems = static_cast<TPIE_OS_SIZE_T>(i) + 1;
+	    }
+
+	    m_fileOffset++;
+	    if (m_fileOffset > m_logicalEndOfStream) {
+		m_logicalEndOfStream = m_fileOffset;
+	    }
+
+	    return NO_ERROR;
+	}
+
+
+	template <class T>
+	err stream_packed<T>::read_array (T * elms, TPIE_OS_SIZE_T & count) {
+
+	    TPIE_OS_SIZE_T wanted = count;
+	    err ae;
+
+	    for (count = 0; count < wanted; ) {
+		if (m_fileOffset >= m_logicalEndOfStream) {
+		    return END_OF_STREAM;
+		}
+
+		if (!in_current() && (ae = make_current(false)) != NO_ERROR) {
+		    return ae;
+		}
+		TPIE_OS_OFFSET i = m_fileOffset - m_blockBegin;
+
+		// The rest of the block, up to the end of the stream.
+		TPIE_OS_OFFSET n = std::min(static_cast<TPIE_OS_OFFSET>(m_itemsPerBlock) - i,
+					    m_logicalEndOfStream - m_fileOffset);
+		n = std::min(n, static_cast<TPIE_OS_OFFSET>(wanted - count));
+
+		memcpy(elms + count, m_block + i, static_cast<TPIE_OS_SIZE_T>(n) * sizeof(T));
+		count += static_cast<TPIE_OS_SIZE_T>(n);
+		m_fileOffset += n;
+	    }
+
+	    return NO_ERROR;
+	}
+
+
+	template <class T>
+	err stream_packed<T>::write_array (const T * elms, TPIE_OS_SIZE_T count) {
+
+	    if (m_readOnly) {
+		return READ_ONLY;
+	    }
+
+	    err ae;
+
+	    for (TPIE_OS_SIZE_T done = 0; done < count; ) {
+		if (m_substreamLevel && (m_logicalEndOfStream <= m_fileOffset)) {
+		    return END_OF_STREAM;
+		}
+
+		if (!in_current() && (ae = make_current(true)) != NO_ERROR) {
+		    return ae;
+		}
+		TPIE_OS_OFFSET i = m_fileOffset - m_blockBegin;
+
+		TPIE_OS_OFFSET n = std::min(static_cast<TPIE_OS_OFFSET>(m_itemsPerBlock) - i,
+					    static_cast<TPIE_OS_OFFSET>(count - done));
+		if (m_substreamLevel) {
+		    n = std::min(n, m_logicalEndOfStream - m_fileOffset);
+		}
+
+		memcpy(m_block + i, elms + done, static_cast<TPIE_OS_SIZE_T>(n) * sizeof(T));
+		m_blockDirty = true;
+		if (static_cast<TPIE_OS_SIZE_T>(i + n) > m_blockItems) {
+		    m_blockItems = static_cast<TPIE_OS_SIZE_T>(i + n);
+		}
+
+		done += static_cast<TPIE_OS_SIZE_T>(n);
+		m_fileOffset += n;
+		if (m_fileOffset > m_logicalEndOfStream) {
+		    m_logicalEndOfStream = m_fileOffset;
+		}
+	    }
+
+	    return NO_ERROR;
+	}
+
+
+// Query memory usage
+// The buffer for compressed slots is shared with the substreams, but
+// charged to each of them.
+	template <class T>
+	err stream_packed<T>::main_memory_usage (TPIE_OS_SIZE_T  *usage,
+						 mem::stream_usage usage_type) {
+
+	    const TPIE_OS_SIZE_T overhead = sizeof(*this) + sizeof(stream_header) +
+		sizeof(stream_packed_file) + 4*MM_manager.space_overhead();
+	    const TPIE_OS_SIZE_T buffers = m_header->m_blockSize + m_file->buffer_size() +
+		2*MM_manager.space_overhead();
+
+	    switch (usage_type) {
+
+	    case mem::STREAM_USAGE_OVERHEAD:
+		*usage = overhead;
+		break;
+
+	    case mem::STREAM_USAGE_BUFFER:
+		*usage = buffers;
+		break;
+
+	    case mem::STREAM_USAGE_CURRENT:
+		*usage = overhead +
+		    ((m_block == NULL) ? 0 : m_header->m_blockSize + MM_manager.space_overhead()) +
+		    (m_file->buffer_allocated() ? m_file->buffer_size() + MM_manager.space_overhead() : 0);
+		break;
+
+	    case mem::STREAM_USAGE_MAXIMUM:
+	    case mem::STREAM_USAGE_SUBSTREAM:
+		*usage = overhead + buffers;
+		break;
+	    }
+
+	    return NO_ERROR;
+	}
+
+
+// Return the number of items in the stream.
+	template <class T>
+	TPIE_OS_OFFSET stream_packed<T>::stream_len () const {
+	    return m_logicalEndOfStream - m_logicalBeginOfStream;
+	}
+
+	template <class T>
+	TPIE_OS_OFFSET stream_packed<T>::tell () const {
+	    return m_fileOffset - m_logicalBeginOfStream;
+	}
+
+
+// Move to a specific position. The block is read when it is accessed.
+	template <class T>
+	err stream_packed<T>::seek (TPIE_OS_OFFSET offset) {
+
+	    if ((offset < 0) || (offset > stream_len())) {
+
+		TP_LOG_WARNING_ID ("seek() out of range (off/bos/eos)");
+		TP_LOG_WARNING_ID (offset);
+		TP_LOG_WARNING_ID (m_logicalBeginOfStream);
+		TP_LOG_WARNING_ID (m_logicalEndOfStream);
+
+		return OFFSET_OUT_OF_RANGE;
+	    }
+
+	    m_fileOffset = m_logicalBeginOfStream + offset;
+
+	    record_statistics(ITEM_SEEK);
+
+	    return NO_ERROR;
+	}
+
+
+// Truncate the stream. The slots of the blocks past the new end are
+// freed, and the file is cut after the last slot that is left.
+	template <class T>
+	err stream_packed<T>::truncate (TPIE_OS_OFFSET offset) {
+
+	    // Sorry, we can't truncate a substream.
+	    if (m_substreamLevel) {
+		return STREAM_IS_SUBSTREAM;
+	    }
+
+	    if (offset < 0) {
+		return OFFSET_OUT_OF_RANGE;
+	    }
+
+	    if (m_readOnly) {
+		return READ_ONLY;
+	    }
+
+	    if (offset < m_logicalEndOfStream) {
+		TPIE_OS_OFFSET blocks = (offset + m_itemsPerBlock - 1) / m_itemsPerBlock;
+		TPIE_OS_OFFSET last = offset - offset % m_itemsPerBlock;
+		err ae;
+
+		if (m_blockBegin >= offset) {
+		    // The current block is gone.
+		    m_blockBegin = -1;
+		    m_blockDirty = false;
+		}
+
+		// A block that is cut in the middle is written back without
+		// the items past the new end, so that they do not reappear
+		// if the stream is extended again.
+		if (offset > last) {
+		    if (m_blockBegin != last) {
+			m_fileOffset = offset;
+			if ((ae = make_current(false)) != NO_ERROR) {
+			    return ae;
+			}
+		    }
+		    if (offset - last < static_cast<TPIE_OS_OFFSET>(m_blockItems)) {
+			m_blockItems = static_cast<TPIE_OS_SIZE_T>(offset - last);
+		    }
+		    m_blockDirty = true;
+		}
+
+		if ((ae = m_file->truncate(blocks)) != NO_ERROR) {
+		    return ae;
+		}
+	    }
+	    else if (m_blockBegin >= 0 && m_blockItems < m_itemsPerBlock) {
+		// The new items read as zeros.
+		memset(m_block + m_blockItems, 0, (m_itemsPerBlock - m_blockItems) * sizeof(T));
+	    }
+
+	    // Reset the current position to the end.
+	    m_fileOffset = m_logicalEndOfStream = offset;
+
+	    return NO_ERROR;
+	}
+
+
+	template <class T>
+	TPIE_OS_SIZE_T stream_packed<T>::chunk_size (void) const {
+	    return m_itemsPerBlock;
+	}
+
+    }  //  bte namespace
+
+}  //  tpie namespace
+
+#endif // _TPIE_BTE_STREAM_PACKED_H
@@ -45,8 +45,16 @@
 #include <tpie/cache.h>
 // The stats_tree class for tree statistics.
 #include <tpie/stats_tree.h>
+// Compressed storage of node keys.
+#include <tpie/btree_key_codec.h>
+// Search in node key arrays.
+#include <tpie/btree_key_search.h>
 // The tpie_tempnam() function
 #include <tpie/tempname.h>
+// tpie::unused()
+#include <tpie/util.h>
+// The mutex guarding block I/O in concurrent read mode.
+#include <boost/thread/mutex.hpp>
 
 namespace tpie {
 
@@ -74,6 +82,13 @@ namespace tpie {
 /// proves costly, we keep them.
 #ifndef BTREE_LEAF_PREV_POINTER
 #  define BTREE_LEAF_PREV_POINTER 1
+#endif
+
+/// The number of leaves range_query() reads ahead from the parent of the
+/// first leaf of the range. Set to 0 to read leaves only when they are
+/// visited.
+#ifndef BTREE_PREFETCH_LEAVES
+#  define BTREE_PREFETCH_LEAVES 32
 #endif
 
     }  //  ami namespace
@@ -130,6 +145,22 @@ namespace tpie {
 	    TPIE_OS_SIZE_T leaf_cache_size;
 	    /** The max number of nodes cached. */
 	    TPIE_OS_SIZE_T node_cache_size;
+	    /** The number of independently locked parts of each cache in
+		concurrent read mode. */
+	    TPIE_OS_SIZE_T cache_shards;
+	    /** The max number of updates kept in the update buffer before
+		it is flushed. 0 means flush only when needed. */
+	    TPIE_OS_SIZE_T update_buffer_size;
+	    /** Store the keys of nodes compressed, allowing up to this many
+		times more keys per node. 0 or 1 means no compression. Only
+		keys supported by btree_key_codec can be compressed: integral
+		keys, std::pair keys of these (front coded) and keys with a
+		btree_key_bytes specialization. The value is recorded in a
+		persistent tree; when it is opened again, the recorded value
+		is used. Nodes in memory are decoded, so node_cache_size is
+		divided by this value to keep the memory of the cache the
+		same. */
+	    TPIE_OS_SIZE_T node_compression;
 
 	    
 	    ///////////////////////////////////////////////////////////////////////////
@@ -143,12 +174,16 @@ namespace tpie {
 	    /// \par node_block_factor 1 
 	    /// \par leaf_cache_size 5 
 	    /// \par node_cache_size 10 
+	    /// \par cache_shards 8 
+	    /// \par update_buffer_size 0 
+	    /// \par node_compression 0 
 	    ///////////////////////////////////////////////////////////////////////////
 	    btree_params(): 
 		leaf_size_min(0), node_size_min(0), 
 		leaf_size_max(0), node_size_max(0),
 		leaf_block_factor(1), node_block_factor(1), 
-		leaf_cache_size(32), node_cache_size(64) {
+		leaf_cache_size(32), node_cache_size(64), cache_shards(8),
+		update_buffer_size(0), node_compression(0) {
 		//  No code in this constructor.
 	    }
 	};
@@ -348,11 +383,18 @@ namespace tpie {
 		{
 	      // This method is inlined such as to comply with MSVC++ "requirements".
   
+		    if (concurrent_reads())
+			return range_query_shared(k1, k2, s, filter_through);
+
+		    // Apply pending updates first.
+		    flush();
+
 		    Key kmin = comp_(k1, k2) ? k1: k2;
 		    Key kmax = comp_(k1, k2) ? k2: k1;
 
 		    // Find the leaf that might contain kmin.
 		    bid_t bid = find_leaf(kmin);
+		    prefetch_leaves(kmax);
 		    btree_leaf<Key, Value, Compare, KeyOfValue, BTECOLL> *p = fetch_leaf(bid);
 		    bool done = false;
 		    size_t result = 0;
@@ -376,8 +418,14 @@ namespace tpie {
 			}
 			bid = p->next();
 			release_leaf(p);
-			if (bid != 0 && !done)
+			if (bid != 0 && !done) {
 			    p = fetch_leaf(bid);
+			    // Read the leaf after p while p is scanned, if the
+			    // range goes on past p.
+			    if (p->next() != 0 && p->size() > 0 &&
+				comp_(kov_(p->el[p->size() - 1]), kmax))
+				pcoll_leaves_->prefetch(p->next());
+			}
 			j = 0;
 		    }
 
@@ -469,6 +517,119 @@ namespace tpie {
 		{ return range_query(k1, k2, s, dummy_filter_t()); }
 
 
+      //////////////////////////////////////////////////////////////////////////
+	    /// Find the elements with the keys read from stream <em>keys</em>.
+	    /// The keys are sorted first (unless <em>keys_sorted</em> is true)
+	    /// and then looked up in a single left-to-right sweep of the tree,
+	    /// keeping the current root-to-leaf path in memory, so that every
+	    /// node and leaf is read at most once per batch rather than once
+	    /// per key. If <em>s</em> is not <em>NULL</em>, the elements found
+	    /// are written to it in key order. Returns the number of keys found.
+      //////////////////////////////////////////////////////////////////////////
+	    size_t find_batch(stream<Key>* keys, stream<Value>* s,
+			      bool keys_sorted = false);
+
+
+      //////////////////////////////////////////////////////////////////////////
+	    /// Same as above, for <em>n</em> keys held in memory. For each i,
+	    /// <em>found[i]</em> tells whether there is an element with key
+	    /// <em>keys[i]</em>, and if so, the element is stored in
+	    /// <em>values[i]</em>. Returns the number of keys found.
+      //////////////////////////////////////////////////////////////////////////
+	    size_t find_batch(const Key* keys, TPIE_OS_SIZE_T n,
+			      Value* values, bool* found);
+
+
+      //////////////////////////////////////////////////////////////////////////
+	    /// Answer a batch of range queries, read as key pairs from stream
+	    /// <em>ranges</em>. The ranges are sorted by their lower ends first
+	    /// (unless <em>ranges_sorted</em> is true) and answered in that order,
+	    /// sharing one sweep of the tree as in find_batch(). If <em>s</em> is
+	    /// not <em>NULL</em>, the elements found are written to it, range after
+	    /// range. Returns the total number of elements found.
+      //////////////////////////////////////////////////////////////////////////
+	    template<class Filter>
+	    size_t range_query_batch(stream<std::pair<Key, Key> >* ranges,
+				     stream<Value>* s, const Filter& filter_through,
+				     bool ranges_sorted = false)
+		{
+	      // This method is inlined such as to comply with MSVC++ "requirements".
+
+		    size_t result = 0;
+
+		    flush();
+		    if (ranges == NULL || header_.height == 0)
+			return result;
+
+		    stream<std::pair<Key, Key> >* sorted = ranges;
+		    if (!ranges_sorted) {
+			sorted = new stream<std::pair<Key, Key> >;
+			sorted->persist(PERSIST_DELETE);
+			comp_range_for_sort cmp;
+			if (tpie::ami::sort_or_copy(ranges, sorted, &cmp) != NO_ERROR) {
+			    TP_LOG_WARNING_ID("range_query_batch: sorting the ranges failed.");
+			    delete sorted;
+			    return result;
+			}
+		    }
+		    sorted->seek(0);
+
+		    batch_cursor_t c;
+		    std::pair<Key, Key>* r;
+		    while (sorted->read_item(&r) == NO_ERROR) {
+			Key kmin = comp_(r->first, r->second) ? r->first: r->second;
+			Key kmax = comp_(r->first, r->second) ? r->second: r->first;
+
+			// The cursor leaf stays in memory for the next range;
+			// leaves further right are read as in range_query().
+			leaf_t* p = batch_seek(c, kmin);
+			bool done = false;
+#if BTREE_LEAF_ELEMENTS_SORTED
+			size_t j = p->find(kmin);
+#else
+			size_t j = 0;
+#endif
+			while (!done) {
+			    for (; j < p->size(); j++) {
+				if (comp_(kmax, kov_(p->el[j]))) {
+				    done = true;
+#if BTREE_LEAF_ELEMENTS_SORTED
+				    break;
+#endif
+				} else if (!comp_(kov_(p->el[j]), kmin)) {
+				    if (filter_through(p->el[j])) {
+					if (s != NULL)
+					    s->write_item(p->el[j]);
+					result++;
+				    }
+				}
+			    }
+			    bid_t bid = p->next();
+			    if (p != c.leaf)
+				drop_leaf(p);
+			    if (bid == 0)
+				break;
+			    if (!done)
+				p = acquire_leaf(bid);
+			    j = 0;
+			}
+		    }
+		    batch_close(c);
+
+		    if (sorted != ranges)
+			delete sorted;
+		    return result;
+		}
+
+
+      //////////////////////////////////////////////////////////////////////////
+	    /// Same as above, without a filter.
+      //////////////////////////////////////////////////////////////////////////
+	    size_t range_query_batch(stream<std::pair<Key, Key> >* ranges,
+				     stream<Value>* s, bool ranges_sorted = false)
+		{ return range_query_batch(ranges, s, dummy_filter_t(), ranges_sorted); }
+
+
       //////////////////////////////////////////////////////////////////////////
       /// Inquire the number of elements stored in the leaves of this tree.
       //////////////////////////////////////////////////////////////////////////
@@ -568,6 +729,58 @@ namespace tpie {
 	    const std::string& name() const { return name_; }
 
 
+      //////////////////////////////////////////////////////////////////////////
+	    /// Enter or leave concurrent read mode.
+	    /// In concurrent read mode, find(), pred(), succ(), range_query() and
+	    /// window_query() may be called from several threads at once. Nodes
+	    /// and leaves are then kept in caches of type \ref cache_manager_sharded
+	    /// (of the sizes given in the \ref btree_params), and reading blocks
+	    /// from the collections is serialized. The tree cannot be modified
+	    /// in this mode: insert(), modify(), erase() and load() fail.
+	    /// The mode must only be changed while no queries are running.
+      //////////////////////////////////////////////////////////////////////////
+	    void concurrent_reads(bool enable);
+
+
+      //////////////////////////////////////////////////////////////////////////
+	    /// Returns <em>true</em> if the tree is in concurrent read mode.
+	    /// @see concurrent_reads(bool)
+      //////////////////////////////////////////////////////////////////////////
+	    bool concurrent_reads() const { return node_shared_cache_ != NULL; }
+
+
+      //////////////////////////////////////////////////////////////////////////
+	    /// Enter or leave buffered update mode.
+	    /// In buffered update mode, insert(), modify() and erase() only append
+	    /// the update to a buffer stream and return <em>true</em>. The buffer
+	    /// is applied by flush(), which sorts it by key (keeping the order of
+	    /// updates to the same key) and applies it in one left-to-right pass,
+	    /// so that each node and leaf is brought into memory about once per
+	    /// flush instead of once per update. Queries, bulk loading, entering
+	    /// concurrent read mode and leaving buffered update mode flush the
+	    /// buffer first. It is also flushed when it holds
+	    /// \ref btree_params::update_buffer_size updates (if not 0), and when
+	    /// the tree is destroyed. size() does not count buffered updates.
+      //////////////////////////////////////////////////////////////////////////
+	    void buffered_updates(bool enable);
+
+
+      //////////////////////////////////////////////////////////////////////////
+	    /// Returns <em>true</em> if the tree is in buffered update mode.
+	    /// @see buffered_updates(bool)
+      //////////////////////////////////////////////////////////////////////////
+	    bool buffered_updates() const { return update_buffer_ != NULL; }
+
+
+      //////////////////////////////////////////////////////////////////////////
+	    /// Apply all updates in the update buffer to the tree.
+	    /// Does nothing if the buffer is empty or the tree is not in
+	    /// buffered update mode.
+	    /// @see buffered_updates(bool)
+      //////////////////////////////////////////////////////////////////////////
+	    err flush();
+
+
       //////////////////////////////////////////////////////////////////////////
 	    /// Close (and potentially destroy) this B-tree.
 	    /// If the persistency flag is \ref PERSIST_DELETE, all files
@@ -598,16 +811,28 @@ namespace tpie {
 	    typedef CACHE_MANAGER<node_t*, remove_node> node_cache_t;
 	    typedef CACHE_MANAGER<leaf_t*, remove_leaf> leaf_cache_t;
 
+	    // The shared caches write blocks out holding the I/O mutex of
+	    // the tree (see remove_shared).
+	    typedef cache_manager_sharded<node_t*, remove_shared<node_t> > node_shared_cache_t;
+	    typedef cache_manager_sharded<leaf_t*, remove_shared<leaf_t> > leaf_shared_cache_t;
+
       //////////////////////////////////////////////////////////////////////////
       /// Holds meta information about a btree.
       //////////////////////////////////////////////////////////////////////////
 	    class header_t {
 	    public:
+		/** Marks headers that record the node format. */
+		static const boost::uint32_t format_magic = 0x42544631;
+
 		bid_t root_bid;
 		TPIE_OS_SIZE_T height;
 		TPIE_OS_OFFSET size;
+		boost::uint32_t magic;
+		/** The node_compression the nodes are stored with. */
+		TPIE_OS_SIZE_T node_compression;
 
-		header_t(): root_bid(0), height(0), size(0) {}
+		header_t(): root_bid(0), height(0), size(0), magic(format_magic),
+			    node_compression(0) {}
 	    };
 
 	    /** Critical information: root bid, height, size (will be stored into
@@ -619,6 +844,36 @@ namespace tpie {
 	    /** The leaf cache. */
 	    leaf_cache_t* leaf_cache_;
 
+	    /** The node cache used in concurrent read mode (NULL otherwise). */
+	    node_shared_cache_t* node_shared_cache_;
+	    /** The leaf cache used in concurrent read mode (NULL otherwise). */
+	    leaf_shared_cache_t* leaf_shared_cache_;
+
+	    /** Serializes block I/O in concurrent read mode. */
+	    boost::mutex io_mutex_;
+
+	    /** Kinds of buffered updates. */
+	    enum update_op_t {
+		UPDATE_INSERT,
+		UPDATE_MODIFY,
+		UPDATE_ERASE
+	    };
+
+	    /** An update waiting in the update buffer. The element is only
+		meaningful for insertions and modifications. */
+	    struct update_t {
+		Key k;
+		Value v;
+		TPIE_OS_OFFSET seq;
+		update_op_t op;
+	    };
+
+	    /** The update buffer; NULL unless in buffered update mode. */
+	    stream<update_t>* update_buffer_;
+
+	    /** Sequence number of the next buffered update. */
+	    TPIE_OS_OFFSET update_seq_;
+
 	    /** Run-time parameters. */
 	    btree_params params_;
 
@@ -642,7 +897,77 @@ namespace tpie {
 		    return (comp_(kov_(v1), kov_(v2)) ? -1: 
 			    (comp_(kov_(v2), kov_(v1)) ? 1: 0));
 		}
-	    }; 
+	    };
+
+      //////////////////////////////////////////////////////////////////////////
+      /// Comparator class for sorting batches of keys.
+      //////////////////////////////////////////////////////////////////////////
+	    class comp_key_for_sort {
+		Compare comp_;
+	    public:
+		int compare(const Key& k1, const Key& k2) {
+		    return (comp_(k1, k2) ? -1: (comp_(k2, k1) ? 1: 0));
+		}
+	    };
+
+      //////////////////////////////////////////////////////////////////////////
+      /// Comparator class for sorting batches of ranges by their lower ends.
+      //////////////////////////////////////////////////////////////////////////
+	    class comp_range_for_sort {
+		Compare comp_;
+		const Key& low(const std::pair<Key, Key>& r) {
+		    return comp_(r.second, r.first) ? r.second: r.first;
+		}
+	    public:
+		int compare(const std::pair<Key, Key>& r1, const std::pair<Key, Key>& r2) {
+		    return (comp_(low(r1), low(r2)) ? -1:
+			    (comp_(low(r2), low(r1)) ? 1: 0));
+		}
+	    };
+
+      //////////////////////////////////////////////////////////////////////////
+      /// Comparator class for sorting buffered updates by key, keeping
+      /// updates to the same key in the order they were made.
+      //////////////////////////////////////////////////////////////////////////
+	    class comp_update_for_sort {
+		Compare comp_;
+	    public:
+		int compare(const update_t& u1, const update_t& u2) {
+		    return (comp_(u1.k, u2.k) ? -1:
+			    (comp_(u2.k, u1.k) ? 1:
+			     (u1.seq < u2.seq ? -1: (u2.seq < u1.seq ? 1: 0))));
+		}
+	    };
+
+      //////////////////////////////////////////////////////////////////////////
+      /// Orders positions in an array of keys by the keys stored there.
+      //////////////////////////////////////////////////////////////////////////
+	    class comp_key_index {
+		Compare comp_;
+		const Key* keys_;
+	    public:
+		comp_key_index(const Key* keys): keys_(keys) {}
+		bool operator()(TPIE_OS_SIZE_T i1, TPIE_OS_SIZE_T i2) const {
+		    return comp_(keys_[i1], keys_[i2]);
+		}
+	    };
+
+	    /** A node on the path of a batched sweep, together with the
+		largest key its subtree may hold (if there is such a bound). */
+	    struct batch_level_t {
+		node_t* node;
+		bool bounded;
+		Key upper;
+	    };
+
+	    /** The in-memory root-to-leaf path of a batched sweep. */
+	    struct batch_cursor_t {
+		std::vector<batch_level_t> path;
+		leaf_t* leaf;
+		bool leaf_bounded;
+		Key leaf_upper;
+		batch_cursor_t(): path(), leaf(NULL), leaf_bounded(false) {}
+	    };
 
 	    /** The status. Set during construction. */
 	    btree_status status_;
@@ -681,6 +1006,18 @@ namespace tpie {
 	    /** Empty the path stack. */
 	    void empty_stack() { while (!path_stack_.empty()) path_stack_.pop(); }
 
+	    /** Read ahead the leaves after the one found by find_leaf() that
+		may hold keys up to kmax, as linked from their parent. */
+	    void prefetch_leaves(const Key& kmax);
+
+	    /** Log a warning and return true if the tree is in concurrent
+		read mode and thus may not be modified. */
+	    bool reject_update(const char* op) const;
+
+	    /** Append an update to the update buffer, flushing the buffer
+		if it is full. */
+	    bool buffer_update(update_op_t op, const Key& k, const Value& v);
+
 	    ///////////////////////////////////////////////////////////////////////////
       /// Find the leaf where an element with key k might be.  Return the
       /// bid of that leaf. The stack contains the path to that leaf (but
@@ -690,6 +1027,140 @@ namespace tpie {
 	    ///////////////////////////////////////////////////////////////////////////
 	    bid_t find_leaf(const Key& k);
 
+      ///////////////////////////////////////////////////////////////////////////
+	    /// Same as find_leaf(), but reentrant: nodes are pinned in the shared
+	    /// cache, and the path stack is not used. For concurrent read mode.
+      ///////////////////////////////////////////////////////////////////////////
+	    bid_t find_leaf_shared(const Key& k);
+
+      ///////////////////////////////////////////////////////////////////////////
+	    /// Pin a node in the shared cache, reading it if necessary.
+	    /// For concurrent read mode.
+      ///////////////////////////////////////////////////////////////////////////
+	    node_t* pin_node(bid_t bid);
+
+      ///////////////////////////////////////////////////////////////////////////
+	    /// Pin a leaf in the shared cache, reading it if necessary.
+	    /// For concurrent read mode.
+      ///////////////////////////////////////////////////////////////////////////
+	    leaf_t* pin_leaf(bid_t bid);
+
+      ///////////////////////////////////////////////////////////////////////////
+	    /// Release a node pinned by pin_node().
+      ///////////////////////////////////////////////////////////////////////////
+	    void unpin_node(node_t* p) { node_shared_cache_->unpin(p->bid()); }
+
+      ///////////////////////////////////////////////////////////////////////////
+	    /// Release a leaf pinned by pin_leaf().
+      ///////////////////////////////////////////////////////////////////////////
+	    void unpin_leaf(leaf_t* p) { leaf_shared_cache_->unpin(p->bid()); }
+
+      ///////////////////////////////////////////////////////////////////////////
+	    /// Concurrent read mode versions of find(), pred() and succ().
+      ///////////////////////////////////////////////////////////////////////////
+	    bool find_shared(const Key& k, Value& v);
+	    bool pred_shared(const Key& k, Value& v);
+	    bool succ_shared(const Key& k, Value& v);
+
+      ///////////////////////////////////////////////////////////////////////////
+	    /// Concurrent read mode version of range_query().
+      ///////////////////////////////////////////////////////////////////////////
+	    template<class Filter>
+	    size_t range_query_shared(const Key& k1, const Key& k2,
+				      stream<Value>* s, const Filter& filter_through)
+		{
+		    Key kmin = comp_(k1, k2) ? k1: k2;
+		    Key kmax = comp_(k1, k2) ? k2: k1;
+		    size_t result = 0;
+
+		    if (header_.height == 0)
+			return result;
+
+		    // Find the leaf that might contain kmin.
+		    bid_t bid = find_leaf_shared(kmin);
+		    leaf_t *p = pin_leaf(bid);
+		    bool done = false;
+
+#if BTREE_LEAF_ELEMENTS_SORTED
+		    size_t j = p->find(kmin);
+		    while (!done) {
+			while (j < p->size() && !done) {
+			    if (!comp_(kmax, kov_(p->el[j]))) {
+				if (filter_through(p->el[j])) {
+				    if (s != NULL)
+					s->write_item(p->el[j]);
+				    result++;
+				}
+			    } else
+				done = true;
+			    j++;
+			}
+			bid = p->next();
+			unpin_leaf(p);
+			if (bid == 0)
+			    break;
+			if (!done)
+			    p = pin_leaf(bid);
+			j = 0;
+		    }
+#else
+		    // Leaves are unsorted; check every element of every leaf
+		    // until a leaf holds an element past kmax.
+		    size_t i;
+		    while (!done) {
+			for (i = 0; i < p->size(); i++) {
+			    if (comp_(kmax, kov_(p->el[i])))
+				done = true;
+			    else if (!comp_(kov_(p->el[i]), kmin)) {
+				if (filter_through(p->el[i])) {
+				    if (s != NULL)
+					s->write_item(p->el[i]);
+				    result++;
+				}
+			    }
+			}
+			bid = p->next();
+			unpin_leaf(p);
+			if (bid == 0)
+			    break;
+			if (!done)
+			    p = pin_leaf(bid);
+		    }
+#endif
+		    return result;
+		}
+
+      ///////////////////////////////////////////////////////////////////////////
+	    /// Read a node or leaf for a batched sweep: pinned in the shared
+	    /// cache in concurrent read mode, fetched otherwise.
+      ///////////////////////////////////////////////////////////////////////////
+	    node_t* acquire_node(bid_t bid)
+		{ return concurrent_reads() ? pin_node(bid): fetch_node(bid); }
+	    leaf_t* acquire_leaf(bid_t bid)
+		{ return concurrent_reads() ? pin_leaf(bid): fetch_leaf(bid); }
+
+      ///////////////////////////////////////////////////////////////////////////
+	    /// Release a node or leaf read by acquire_node() or acquire_leaf().
+      ///////////////////////////////////////////////////////////////////////////
+	    void drop_node(node_t* p)
+		{ if (concurrent_reads()) unpin_node(p); else release_node(p); }
+	    void drop_leaf(leaf_t* p)
+		{ if (concurrent_reads()) unpin_leaf(p); else release_leaf(p); }
+
+      ///////////////////////////////////////////////////////////////////////////
+	    /// Move cursor c to the leaf where an element with key k might be,
+	    /// and return that leaf. Keys passed to successive calls on the same
+	    /// cursor must be nondecreasing; only the part of the path that no
+	    /// longer covers k is released and read again. The tree must not be
+	    /// empty.
+      ///////////////////////////////////////////////////////////////////////////
+	    leaf_t* batch_seek(batch_cursor_t& c, const Key& k);
+
+      ///////////////////////////////////////////////////////////////////////////
+	    /// Release all nodes and the leaf held by cursor c.
+      ///////////////////////////////////////////////////////////////////////////
+	    void batch_close(batch_cursor_t& c);
+
       ///////////////////////////////////////////////////////////////////////////
 	    /// Returns the leaf with the minimum key element. Nothing is pushed
 	    /// on the stack.
@@ -746,8 +1217,10 @@ namespace tpie {
       ///////////////////////////////////////////////////////////////////////////
 	    /// Merges p with a sibling; to call when balancing fails.
 	    /// f is the father of p and pos is the position of the link to p in f.
+	    /// Returns false, changing nothing, if p has no sibling or the
+	    /// result would not fit (which can only happen with compressed nodes).
       ///////////////////////////////////////////////////////////////////////////
-	    void merge_leaf(node_t *f, 
+	    bool merge_leaf(node_t *f, 
 			    leaf_t* &p, size_t pos);
 
       ///////////////////////////////////////////////////////////////////////////
@@ -755,7 +1228,7 @@ namespace tpie {
 	    /// Merges p with a sibling; called when balancing fails.
       /// f is the father of p and pos is the position of the link to p in f.
       ///////////////////////////////////////////////////////////////////////////
-	    void merge_node(node_t *f, 
+	    bool merge_node(node_t *f, 
 			    node_t* &p, size_t pos);
 
 	public:
@@ -962,46 +1435,114 @@ namespace tpie {
 	/// The btree_node class for representing an internal node of a \ref  btree.
 	/// It stores size() keys and size()+1 links representing 
 	/// the following pattern: Link0 Key0 Link1 Key1 ... LinkS KeyS Link(S+1)
+	///
+	/// A node may be stored compressed (see \ref btree_params::node_compression).
+	/// Its block then holds the number of keys, the links as variable-length
+	/// integers, and each key coded relative to the key before it (see
+	/// \ref btree_key_codec). The node is decoded into
+	/// arrays of <em>compression</em> times the uncompressed capacity when it
+	/// is read, and encoded again when it is written back, so lk and el are
+	/// used the same way in both formats. Whether the encoded node still fits
+	/// in its block depends on the keys; see fits().
   //////////////////////////////////////////////////////////////////////////
 	template<class Key, class Value, class Compare, class KeyOfValue, class BTECOLL = tpie::bte::COLLECTION >
 	class btree_node: public block<Key, size_t, BTECOLL> {
 
 	    Compare comp_;
+
+	    typedef btree_key_codec<Key, Compare> codec_t;
+
+	    /** Factor by which compression raises the capacity of this node,
+		or 0 if the node is stored uncompressed. */
+	    TPIE_OS_SIZE_T compression_;
+
+	    /** Memory holding lk and el of a compressed node. */
+	    char* decoded_;
+
+	    /** Number of keys of a compressed node. */
+	    TPIE_OS_SIZE_T decoded_size_;
+
+	    /** Number of bytes taken by the links and keys in the block. */
+	    size_t encoded_size() const;
+
+	    /** Read the links and keys of a compressed node from the block. */
+	    void decode();
+
+	    /** Write the links and keys of a compressed node to the block. */
+	    void encode();
   
 	public:
 	    using block<Key, size_t, BTECOLL>::info;
 	    using block<Key, size_t, BTECOLL>::el;
 	    using block<Key, size_t, BTECOLL>::lk;
 	    using block<Key, size_t, BTECOLL>::dirty;
+	    using block<Key, size_t, BTECOLL>::block_size;
   
       ///////////////////////////////////////////////////////////////////////////
 	    /// Compute the capacity of the lk vector STATICALLY (but you have to
-	    /// give it the correct logical block size!).
+	    /// give it the correct logical block size!). For compressed nodes,
+	    /// this is the capacity of the decoded node.
       ///////////////////////////////////////////////////////////////////////////
-	    static size_t lk_capacity(size_t block_size);
+	    static size_t lk_capacity(size_t block_size, TPIE_OS_SIZE_T compression = 0);
 
       ///////////////////////////////////////////////////////////////////////////
 	    /// Compute the capacity of the el vector STATICALLY.
       ///////////////////////////////////////////////////////////////////////////
-	    static TPIE_OS_SIZE_T el_capacity(size_t block_size);
+	    static TPIE_OS_SIZE_T el_capacity(size_t block_size, TPIE_OS_SIZE_T compression = 0);
 
       ///////////////////////////////////////////////////////////////////////////
 	    /// Find and return the position of key k 
 	    /// (ie, the lowest position in the array of keys where it would be inserted).
+	    /// For integral keys ordered by std::less the search uses SIMD
+	    /// compares where the target supports them (see btree_key_search).
       ///////////////////////////////////////////////////////////////////////////
 	    TPIE_OS_SIZE_T find(const Key& k);
 
       ///////////////////////////////////////////////////////////////////////////
 	    /// Constructor. Calls the block constructor with the 
-	    /// appropriate number of links.
+	    /// appropriate number of links. If <em>compression</em> is greater
+	    /// than 1 and the keys can be compressed, the node is stored
+	    /// compressed.
       ///////////////////////////////////////////////////////////////////////////
-	    btree_node(collection_single<BTECOLL>* pcoll, bid_t bid = 0);
+	    btree_node(collection_single<BTECOLL>* pcoll, bid_t bid = 0,
+		       TPIE_OS_SIZE_T compression = 0);
 
       ///////////////////////////////////////////////////////////////////////////
 	    /// Number of keys stored in this node.
       ///////////////////////////////////////////////////////////////////////////
-	    TPIE_OS_SIZE_T& size() { return (TPIE_OS_SIZE_T&) (*info()); }
-	    const TPIE_OS_SIZE_T& size() const { return (TPIE_OS_SIZE_T&) (*info()); }
+	    TPIE_OS_SIZE_T& size()
+		{ return compression_ ? decoded_size_: (TPIE_OS_SIZE_T&) (*info()); }
+	    const TPIE_OS_SIZE_T& size() const
+		{ return compression_ ? decoded_size_: (TPIE_OS_SIZE_T&) (*info()); }
+
+      ///////////////////////////////////////////////////////////////////////////
+	    /// Returns true if the node is stored compressed.
+      ///////////////////////////////////////////////////////////////////////////
+	    bool compressed() const { return compression_ != 0; }
+
+      ///////////////////////////////////////////////////////////////////////////
+	    /// Returns true if the node in its current state can be written to
+	    /// its block. Always true for uncompressed nodes.
+      ///////////////////////////////////////////////////////////////////////////
+	    bool fits() const { return !compressed() || encoded_size() <= block_size(); }
+
+      ///////////////////////////////////////////////////////////////////////////
+	    /// Returns true if the node would still fit if key k replaced the
+	    /// key at position pos.
+      ///////////////////////////////////////////////////////////////////////////
+	    bool fits_replaced(size_t pos, const Key& k);
+
+      ///////////////////////////////////////////////////////////////////////////
+	    /// Returns true if the result of merge(right, k) would fit.
+      ///////////////////////////////////////////////////////////////////////////
+	    bool fits_merged(const BTREE_NODE &right, const Key& k) const;
+
+      ///////////////////////////////////////////////////////////////////////////
+	    /// Returns true if a compressed node fills at least about half of
+	    /// its block, not counting <em>spare</em> bytes. Always false for
+	    /// uncompressed nodes, whose fill is given by size() alone.
+      ///////////////////////////////////////////////////////////////////////////
+	    bool half_full(size_t spare = 0) const;
 
       ///////////////////////////////////////////////////////////////////////////
 	    /// Maximum number of keys that can be stored in this node.
@@ -1021,7 +1562,8 @@ namespace tpie {
       ///////////////////////////////////////////////////////////////////////////
       /// Split into two leafes containing the same number of elements.
       /// Return the median key (i.e., the key of the last element stored 
-      /// in this leaf, after split).
+      /// in this leaf, after split). Compressed nodes are split such that
+      /// both halves take about the same number of bytes.
       ///////////////////////////////////////////////////////////////////////////
 	    Key split(BTREE_NODE &right);
 
@@ -1309,26 +1851,146 @@ BTREE_LEAF::~btree_leaf() {
 //////////////////////
 
 	template<class Key, class Value, class Compare, class KeyOfValue, class BTECOLL>
-	size_t BTREE_NODE::lk_capacity(size_t block_size) {
-	    return (size_t) ((block_size - sizeof(size_t) - sizeof(bid_t)) /
-			     (sizeof(Key) + sizeof(bid_t)) + 1);
+	size_t BTREE_NODE::lk_capacity(size_t block_size, TPIE_OS_SIZE_T compression) {
+	    size_t links = (size_t) ((block_size - sizeof(size_t) - sizeof(bid_t)) /
+				     (sizeof(Key) + sizeof(bid_t)) + 1);
+	    if (compression > 1 && codec_t::enabled)
+		links = (links - 1) * compression + 1;
+	    return links;
 	}
 
 	template<class Key, class Value, class Compare, class KeyOfValue, class BTECOLL>
-	TPIE_OS_SIZE_T BTREE_NODE::el_capacity(TPIE_OS_SIZE_T block_size) {
+	TPIE_OS_SIZE_T BTREE_NODE::el_capacity(TPIE_OS_SIZE_T block_size, TPIE_OS_SIZE_T compression) {
 	    // Sanity check. Two different methods of computing the el capacity.
 	    // [tavi 01/26/02]: Changed == into >= since I could fit one more
 	    // element, but not one more link.
 	    assert((block<Key, TPIE_OS_SIZE_T>::el_capacity(block_size, lk_capacity(block_size))) >= (TPIE_OS_SIZE_T) (lk_capacity(block_size) - 1));
-	    return (TPIE_OS_SIZE_T) (lk_capacity(block_size) - 1);
+	    return (TPIE_OS_SIZE_T) (lk_capacity(block_size, compression) - 1);
 	}
 
 /// *btree_node::btree_node* ///
 template<class Key, class Value, class Compare, class KeyOfValue, class BTECOLL>
-BTREE_NODE::btree_node(collection_single<BTECOLL>* pcoll, bid_t nbid): 
-    block<Key, size_t, BTECOLL>(pcoll, lk_capacity(pcoll->block_size()), nbid) {
-    if (nbid == 0)
+BTREE_NODE::btree_node(collection_single<BTECOLL>* pcoll, bid_t nbid, TPIE_OS_SIZE_T compression): 
+    block<Key, size_t, BTECOLL>(pcoll, lk_capacity(pcoll->block_size()), nbid),
+    compression_((compression > 1 && codec_t::enabled) ? compression: 0),
+    decoded_(NULL), decoded_size_(0) {
+
+    if (compressed()) {
+	// Keep links and keys in memory of their own; the block only
+	// holds their encoding.
+	size_t links = lk_capacity(pcoll->block_size(), compression_);
+	decoded_ = new char[links * sizeof(bid_t) + (links - 1) * sizeof(Key)];
+	lk = b_vector<bid_t>((bid_t*) decoded_, links);
+	el = b_vector<Key>((Key*) (decoded_ + links * sizeof(bid_t)), links - 1);
+	if (nbid != 0 && this->is_valid())
+	    decode();
+    }
+
+    if (nbid == 0) {
 	size() = 0;
+	if (compressed())
+	    lk[0] = 0;
+    }
+}
+
+/// *btree_node::encoded_size* ///
+template<class Key, class Value, class Compare, class KeyOfValue, class BTECOLL>
+size_t BTREE_NODE::encoded_size() const {
+
+    size_t bytes = sizeof(TPIE_OS_SIZE_T);
+    size_t i;
+
+    for (i = 0; i <= size(); i++)
+	bytes += btree_varint::size((boost::uint64_t) lk[i]);
+
+    for (i = 0; i < size(); i++)
+	bytes += codec_t::size(i ? &el[i - 1]: NULL, el[i]);
+
+    return bytes;
+}
+
+/// *btree_node::encode* ///
+template<class Key, class Value, class Compare, class KeyOfValue, class BTECOLL>
+void BTREE_NODE::encode() {
+
+    assert(fits());
+
+    TPIE_OS_SIZE_T n = size();
+    char* p = (char*) this->pdata_;
+    size_t i;
+
+    memcpy(p, &n, sizeof(TPIE_OS_SIZE_T));
+    p += sizeof(TPIE_OS_SIZE_T);
+
+    for (i = 0; i <= n; i++)
+	btree_varint::put(p, (boost::uint64_t) lk[i]);
+
+    for (i = 0; i < n; i++)
+	codec_t::put(p, i ? &el[i - 1]: NULL, el[i]);
+}
+
+/// *btree_node::decode* ///
+template<class Key, class Value, class Compare, class KeyOfValue, class BTECOLL>
+void BTREE_NODE::decode() {
+
+    const char* p = (const char*) this->pdata_;
+    size_t i;
+
+    memcpy(&decoded_size_, p, sizeof(TPIE_OS_SIZE_T));
+    p += sizeof(TPIE_OS_SIZE_T);
+    assert(decoded_size_ <= el.capacity());
+
+    for (i = 0; i <= decoded_size_; i++)
+	lk[i] = (bid_t) btree_varint::get(p);
+
+    for (i = 0; i < decoded_size_; i++)
+	el[i] = codec_t::get(p, i ? &el[i - 1]: NULL);
+}
+
+/// *btree_node::fits_replaced* ///
+template<class Key, class Value, class Compare, class KeyOfValue, class BTECOLL>
+bool BTREE_NODE::fits_replaced(size_t pos, const Key& k) {
+
+    if (!compressed())
+	return true;
+
+    Key old = el[pos];
+    el[pos] = k;
+    bool ans = fits();
+    el[pos] = old;
+    return ans;
+}
+
+/// *btree_node::fits_merged* ///
+template<class Key, class Value, class Compare, class KeyOfValue, class BTECOLL>
+bool BTREE_NODE::fits_merged(const BTREE_NODE &right, const Key& k) const {
+
+    if (!compressed())
+	return true;
+    if (size() + right.size() + 1 > capacity())
+	return false;
+
+    // Both encodings, minus one count, plus k coded after our last key,
+    // with the first key of right now coded after k.
+    size_t bytes = encoded_size() + right.encoded_size() - sizeof(TPIE_OS_SIZE_T);
+    bytes += codec_t::size(size() == 0 ? NULL: &el[size() - 1], k);
+    if (right.size() > 0) {
+	bytes += codec_t::size(&k, right.el[0]);
+	bytes -= codec_t::size(NULL, right.el[0]);
+    }
+    return bytes <= block_size();
+}
+
+/// *btree_node::half_full* ///
+template<class Key, class Value, class Compare, class KeyOfValue, class BTECOLL>
+bool BTREE_NODE::half_full(size_t spare) const {
+
+    if (!compressed())
+	return false;
+
+    // Leave room for a few entries of the largest size, so that two
+    // nodes below this mark can always be merged.
+    return encoded_size() >= (block_size() - 4 * (codec_t::max_size + btree_varint::max_size)) / 2 + spare;
 }
 
 
@@ -1346,6 +2008,22 @@ Key BTREE_NODE::split(BTREE_NODE &right) {
     // The new node will have half of this node's keys and half of its links.
     right.size() = original_size / 2;
 
+    if (compressed()) {
+	// Split at the middle of the encoding instead, so that either half
+	// has room for the key about to be inserted.
+	size_t half = encoded_size() / 2;
+	size_t bytes = sizeof(TPIE_OS_SIZE_T) + btree_varint::size((boost::uint64_t) lk[0]);
+	size_t left_size = 0;
+	while (left_size < original_size - 2 && bytes < half) {
+	    bytes += codec_t::size(left_size ? &el[left_size - 1]: NULL, el[left_size]) +
+		btree_varint::size((boost::uint64_t) lk[left_size + 1]);
+	    left_size++;
+	}
+	if (left_size == 0)
+	    left_size = 1;
+	right.size() = original_size - left_size - 1;
+    }
+
     // Update this node's size (subtract one to account for the key 
     // that is going up the tree).
     size() = original_size - right.size() - 1;
@@ -1392,8 +2070,9 @@ void BTREE_NODE::insert_pos(const Key& k, bid_t l, size_t k_pos, size_t l_pos) {
 template<class Key, class Value, class Compare, class KeyOfValue, class BTECOLL>
 void BTREE_NODE::insert(const Key& k, bid_t l) {
 
-    // Find the position using STL's binary search.
-    size_t pos = lower_bound(&el[0], &el[size()-1] + 1, k, comp_) - &el[0];
+    // Find the position using binary search (and SIMD compares, for
+    // integral keys).
+    size_t pos = btree_key_search<Key, Compare>::lower_bound(&el[0], size(), k, comp_);
 
     // Insert.
     insert_pos(k, l, pos, pos + 1);
@@ -1443,13 +2122,18 @@ void BTREE_NODE::merge(const BTREE_NODE &right, const Key& k) {
 /// *btree_node::find* ///
 template<class Key, class Value, class Compare, class KeyOfValue, class BTECOLL>
 size_t BTREE_NODE::find(const Key& k) {
-    return (size() == 0) ? 0: (lower_bound(&el[0], &el[size()-1] + 1, k, comp_) - &el[0]);
+    return (size() == 0) ? 0: btree_key_search<Key, Compare>::lower_bound(&el[0], size(), k, comp_);
 }
 
 /// *btree_node::~btree_node* ///
 template<class Key, class Value, class Compare, class KeyOfValue, class BTECOLL>
 BTREE_NODE::~btree_node() {
-    // TODO: is there anything to do here?
+    // The block is written back by the base class destructor.
+    if (compressed()) {
+	if (this->persist() == PERSIST_PERSISTENT && this->is_valid())
+	    encode();
+	delete[] decoded_;
+    }
 }
 
 /////////////////////
@@ -1479,11 +2163,6 @@ btree<Key, Value, Compare, KeyOfValue, BTECOLL>::btree(const std::string& base_f
     shared_init(base_file_name, type);
 
     if (status_ == BTREE_STATUS_VALID) {
-	if (pcoll_leaves_->size() > 0) {
-	    // Read root bid, height and size from header.
-	    header_ = *((header_t *) pcoll_nodes_->user_data());
-	    // TODO: sanity checks.
-	}
 	persist(PERSIST_PERSISTENT);
     }
 }
@@ -1505,6 +2184,10 @@ void btree<Key, Value, Compare, KeyOfValue, BTECOLL>::shared_init(const std::str
     // destructor in case of premature return from this function.
     node_cache_ = NULL;
     leaf_cache_ = NULL;
+    node_shared_cache_ = NULL;
+    leaf_shared_cache_ = NULL;
+    update_buffer_ = NULL;
+    update_seq_ = 0;
     pcoll_leaves_ = NULL;
     pcoll_nodes_ = NULL;
 
@@ -1522,8 +2205,8 @@ void btree<Key, Value, Compare, KeyOfValue, BTECOLL>::shared_init(const std::str
 	return;
     }    
 
-    // Initialize the caches (associativity = 8).
-    node_cache_ = new node_cache_t(params_.node_cache_size, 8);
+    // Initialize the leaf cache (associativity = 8). The node cache
+    // depends on the node format.
     leaf_cache_ = new leaf_cache_t(params_.leaf_cache_size, 8);
 
     // Give meaningful values to parameters, if necessary.
@@ -1536,7 +2219,43 @@ void btree<Key, Value, Compare, KeyOfValue, BTECOLL>::shared_init(const std::str
     if (params_.leaf_size_min == 0)
 	params_.leaf_size_min = params_.leaf_size_max / 2;
 
-    size_t node_capacity = BTREE_NODE::el_capacity(pcoll_nodes_->block_size());
+    if (params_.node_compression > 1 && !btree_key_codec<Key, Compare>::enabled) {
+	TP_LOG_WARNING_ID("btree::btree: keys cannot be compressed. Nodes are stored uncompressed.");
+	params_.node_compression = 0;
+    }
+    if (params_.node_compression == 1)
+	params_.node_compression = 0;
+
+    if (pcoll_leaves_->size() > 0) {
+	// Read root bid, height, size and node format from header.
+	header_ = *((header_t *) pcoll_nodes_->user_data());
+	if (header_.magic != header_t::format_magic) {
+	    // Written before the node format was recorded, with plain nodes.
+	    header_.magic = header_t::format_magic;
+	    header_.node_compression = 0;
+	}
+	if (header_.node_compression > 1 && !btree_key_codec<Key, Compare>::enabled) {
+	    status_ = BTREE_STATUS_INVALID;
+	    TP_LOG_FATAL_ID("btree::btree: nodes are compressed, but the keys cannot be.");
+	    return;
+	}
+	// The nodes must be read in the format they were written in.
+	if (header_.node_compression != params_.node_compression) {
+	    TP_LOG_WARNING_ID("btree::btree: using node_compression " << header_.node_compression
+			      << " of the existing tree instead of " << params_.node_compression << ".");
+	    params_.node_compression = header_.node_compression;
+	}
+    } else {
+	header_.node_compression = params_.node_compression;
+    }
+
+    // A decoded node takes node_compression times the memory of a
+    // plain one, so the cache holds as many fewer.
+    if (params_.node_compression > 1 && params_.node_cache_size > 0)
+	params_.node_cache_size = std::max<TPIE_OS_SIZE_T>(params_.node_cache_size / params_.node_compression, 1);
+    node_cache_ = new node_cache_t(params_.node_cache_size, 8);
+
+    size_t node_capacity = BTREE_NODE::el_capacity(pcoll_nodes_->block_size(), params_.node_compression);
     if (params_.node_size_max == 0 || params_.node_size_max > node_capacity)
 	params_.node_size_max = node_capacity;
     if (params_.node_size_max == 1 || params_.node_size_max == 2)
@@ -1601,6 +2320,12 @@ err btree<Key, Value, Compare, KeyOfValue, BTECOLL>::load_sorted(stream<Value>*
 	TP_LOG_FATAL_ID("load: tree is invalid.");
 	return GENERIC_ERROR;
     }
+    if (reject_update("load")) {
+	return GENERIC_ERROR;
+    }
+    if (flush() != NO_ERROR) {
+	return GENERIC_ERROR;
+    }
     if (s == NULL) {
 	TP_LOG_FATAL_ID("load: attempting to load with NULL stream pointer.");
 	return GENERIC_ERROR;
@@ -1668,6 +2393,9 @@ err btree<Key, Value, Compare, KeyOfValue, BTECOLL>::unload(stream<Value>* s) {
 	TP_LOG_WARNING_ID("unload: NULL stream pointer. unload aborted.");
 	return GENERIC_ERROR;
     }
+    if (flush() != NO_ERROR) {
+	return GENERIC_ERROR;
+    }
 
     bid_t lbid = find_min_leaf();
     BTREE_LEAF* l;
@@ -1694,6 +2422,9 @@ err btree<Key, Value, Compare, KeyOfValue, BTECOLL>::load(BTREE* bt, float leaf_
 	TP_LOG_WARNING_ID("load: tree is invalid.");
 	return GENERIC_ERROR;
     }
+    if (reject_update("load")) {
+	return GENERIC_ERROR;
+    }
     if (bt == NULL) {
 	TP_LOG_WARNING_ID("load: NULL btree pointer.");
 	return GENERIC_ERROR;
@@ -1702,6 +2433,9 @@ err btree<Key, Value, Compare, KeyOfValue, BTECOLL>::load(BTREE* bt, float leaf_
 	TP_LOG_WARNING_ID("load: input tree is invalid.");
 	return GENERIC_ERROR;
     }
+    if (flush() != NO_ERROR || bt->flush() != NO_ERROR) {
+	return GENERIC_ERROR;
+    }
 
     btree_params params_saved = params_;
     err retval = NO_ERROR;
@@ -1744,6 +2478,8 @@ std::pair<bid_t, Key> btree<Key, Value, Compare, KeyOfValue, BTECOLL>::dfs_preor
 
     Key k;
     if (level == -1) {
+	// Apply pending updates before starting a traversal.
+	flush();
 	// Empty the stack. This allows restarts in the middle of a
 	// traversal. All previous state information is lost.
 	while (!dfs_stack_.empty())
@@ -1796,6 +2532,12 @@ bool btree<Key, Value, Compare, KeyOfValue, BTECOLL>::find(const Key& k, Value&
     bool ans;
     size_t idx;
 
+    if (concurrent_reads())
+	return find_shared(k, v);
+
+    // Apply pending updates first.
+    flush();
+
     if (header_.height == 0)
 	return false;
 
@@ -1830,6 +2572,12 @@ bool btree<Key, Value, Compare, KeyOfValue, BTECOLL>::pred(const Key& k, Value&
     bid_t bid;
     size_t idx;
 
+    if (concurrent_reads())
+	return pred_shared(k, v);
+
+    // Apply pending updates first.
+    flush();
+
     assert(header_.height >= 1);
     assert(path_stack_.empty());
 
@@ -1872,6 +2620,12 @@ bool btree<Key, Value, Compare, KeyOfValue, BTECOLL>::succ(const Key& k, Value&
     bid_t bid;
     size_t idx;
 
+    if (concurrent_reads())
+	return succ_shared(k, v);
+
+    // Apply pending updates first.
+    flush();
+
     assert(header_.height >= 1);
     assert(path_stack_.empty());
 
@@ -1881,7 +2635,7 @@ bool btree<Key, Value, Compare, KeyOfValue, BTECOLL>::succ(const Key& k, Value&
     idx = pl->succ(k);
   
     // Check whether we have a match.
-    if (comp_(k,kov_(pl->el[idx]))){
+    if (idx < pl->size() && comp_(k,kov_(pl->el[idx]))){
 	v = pl->el[idx]; 
 	ans = true;
     } else {
@@ -1901,12 +2655,102 @@ bool btree<Key, Value, Compare, KeyOfValue, BTECOLL>::succ(const Key& k, Value&
     return ans;
 }
 
+/// *btree::find_batch* ///
+template <class Key, class Value, class Compare, class KeyOfValue, class BTECOLL>
+size_t btree<Key, Value, Compare, KeyOfValue, BTECOLL>::find_batch(stream<Key>* keys, stream<Value>* s, bool keys_sorted) {
+
+    size_t result = 0;
+    size_t idx;
+    Key* k;
+
+    flush();
+    if (keys == NULL || header_.height == 0)
+	return result;
+
+    // Sort the keys into a temporary stream.
+    stream<Key>* sorted = keys;
+    if (!keys_sorted) {
+	sorted = new stream<Key>;
+	sorted->persist(PERSIST_DELETE);
+	comp_key_for_sort cmp;
+	if (tpie::ami::sort_or_copy(keys, sorted, &cmp) != NO_ERROR) {
+	    TP_LOG_WARNING_ID("find_batch: sorting the keys failed.");
+	    delete sorted;
+	    return result;
+	}
+    }
+    sorted->seek(0);
+
+    batch_cursor_t c;
+    while (sorted->read_item(&k) == NO_ERROR) {
+	BTREE_LEAF* p = batch_seek(c, *k);
+	idx = p->find(*k);
+	if (idx < p->size() &&
+	    !comp_(kov_(p->el[idx]), *k) &&
+	    !comp_(*k, kov_(p->el[idx]))) {
+	    if (s != NULL)
+		s->write_item(p->el[idx]);
+	    result++;
+	}
+    }
+    batch_close(c);
+
+    if (sorted != keys)
+	delete sorted;
+    return result;
+}
+
+/// *btree::find_batch* ///
+template <class Key, class Value, class Compare, class KeyOfValue, class BTECOLL>
+size_t btree<Key, Value, Compare, KeyOfValue, BTECOLL>::find_batch(const Key* keys, TPIE_OS_SIZE_T n, Value* values, bool* found) {
+
+    size_t result = 0;
+    size_t idx;
+    TPIE_OS_SIZE_T i;
+
+    for (i = 0; i < n; i++)
+	found[i] = false;
+
+    flush();
+    if (n == 0 || header_.height == 0)
+	return result;
+
+    // Visit the keys in sorted order, without moving them.
+    std::vector<TPIE_OS_SIZE_T> order(n);
+    for (i = 0; i < n; i++)
+	order[i] = i;
+    std::sort(order.begin(), order.end(), comp_key_index(keys));
+
+    batch_cursor_t c;
+    for (i = 0; i < n; i++) {
+	const Key& k = keys[order[i]];
+	BTREE_LEAF* p = batch_seek(c, k);
+	idx = p->find(k);
+	if (idx < p->size() &&
+	    !comp_(kov_(p->el[idx]), k) &&
+	    !comp_(k, kov_(p->el[idx]))) {
+	    values[order[i]] = p->el[idx];
+	    found[order[i]] = true;
+	    result++;
+	}
+    }
+    batch_close(c);
+
+    return result;
+}
+
 /// *btree::insert* ///
 template <class Key, class Value, class Compare, class KeyOfValue, class BTECOLL>
 bool btree<Key, Value, Compare, KeyOfValue, BTECOLL>::insert(const Value& v) {
 
     bool ans = true;
 
+    if (reject_update("insert"))
+	return false;
+
+    if (update_buffer_ != NULL)
+	return buffer_update(UPDATE_INSERT, kov_(v), v);
+
     // Check for empty tree.
     if (header_.height == 0) {
 	return insert_empty(v);
@@ -1950,6 +2794,12 @@ bool btree<Key, Value, Compare, KeyOfValue, BTECOLL>::modify(const Value& v) {
                                                                                 
     bool ans = true;
                                                                                 
+    if (reject_update("modify"))
+	return false;
+
+    if (update_buffer_ != NULL)
+	return buffer_update(UPDATE_MODIFY, kov_(v), v);
+
     // Check for empty tree.
     if (header_.height == 0) {
 	return insert_empty(v);
@@ -2137,11 +2987,21 @@ bool btree<Key, Value, Compare, KeyOfValue, BTECOLL>::insert_split(const Value&
 	fq = fetch_node(top.first);
     
 	// Check whether we need to go further up the tree.
-	if (!full_node(fq)) {
-      
+	bool room = !full_node(fq);
+	if (room) {
+
 	    // Insert the key and link into position.
 	    fq->insert_pos(mid_key, bid, top.second, top.second + 1);
 
+	    // A compressed node may run out of space before it is full.
+	    if (!fq->fits()) {
+		fq->erase_pos(top.second, top.second + 1);
+		room = false;
+	    }
+	}
+
+	if (room) {
+
 	    // Exit the loop.
 	    bid = 0;
       
@@ -2156,6 +3016,7 @@ bool btree<Key, Value, Compare, KeyOfValue, BTECOLL>::insert_split(const Value&
 		qq->lk[0] = bid; // TODO: this is ugly. qq has no keys now. 
 	    else
 		(comp_(fmid_key, mid_key) ? qq: fq)->insert(mid_key, bid);
+	    assert(fq->fits() && qq->fits());
       
 	    // Prepare for next iteration.
 	    mid_key = fmid_key;
@@ -2221,6 +3082,213 @@ bid_t btree<Key, Value, Compare, KeyOfValue, BTECOLL>::find_leaf(const Key& k) {
     return bid;
 }
 
+/// *btree::prefetch_leaves* ///
+template <class Key, class Value, class Compare, class KeyOfValue, class BTECOLL>
+void btree<Key, Value, Compare, KeyOfValue, BTECOLL>::prefetch_leaves(const Key& kmax) {
+
+    // The path stack is empty if the root is a leaf.
+    if (BTREE_PREFETCH_LEAVES == 0 || path_stack_.empty())
+	return;
+
+    BTREE_NODE *p = fetch_node(path_stack_.top().first);
+    size_t pos = path_stack_.top().second;
+    size_t last = std::min(p->size(), pos + BTREE_PREFETCH_LEAVES);
+
+    // Leaf lk[i] holds the keys after el[i-1].
+    for (size_t i = pos + 1; i <= last && comp_(p->el[i - 1], kmax); i++)
+	pcoll_leaves_->prefetch(p->lk[i]);
+
+    release_node(p);
+}
+
+/// *btree::find_leaf_shared* ///
+template <class Key, class Value, class Compare, class KeyOfValue, class BTECOLL>
+bid_t btree<Key, Value, Compare, KeyOfValue, BTECOLL>::find_leaf_shared(const Key& k) {
+
+    BTREE_NODE * p;
+    bid_t bid = header_.root_bid;
+    size_t pos;
+    TPIE_OS_SIZE_T level;
+
+    assert(header_.height >= 1);
+
+    // Go down the tree, keeping only the current node pinned.
+    for (level = header_.height - 1; level > 0; level--) {
+	p = pin_node(bid);
+	pos = p->find(k);
+	bid = p->lk[pos];
+	unpin_node(p);
+    }
+
+    // This should be the id of a leaf.
+    return bid;
+}
+
+/// *btree::find_shared* ///
+template <class Key, class Value, class Compare, class KeyOfValue, class BTECOLL>
+bool btree<Key, Value, Compare, KeyOfValue, BTECOLL>::find_shared(const Key& k, Value& v) {
+
+    bool ans = false;
+    size_t idx;
+
+    if (header_.height == 0)
+	return false;
+
+    BTREE_LEAF *p = pin_leaf(find_leaf_shared(k));
+
+    idx = p->find(k);
+    if (idx < p->size() && 
+	!comp_(kov_(p->el[idx]), k) && 
+	!comp_(k, kov_(p->el[idx]))) {
+	v = p->el[idx];
+	ans = true;
+    }
+
+    unpin_leaf(p);
+    return ans;
+}
+
+/// *btree::pred_shared* ///
+template <class Key, class Value, class Compare, class KeyOfValue, class BTECOLL>
+bool btree<Key, Value, Compare, KeyOfValue, BTECOLL>::pred_shared(const Key& k, Value& v) {
+
+    bool ans = false;
+    BTREE_LEAF * pl;
+    bid_t bid;
+
+    assert(header_.height >= 1);
+
+    pl = pin_leaf(find_leaf_shared(k));
+    size_t idx = pl->pred(k);
+
+    if (comp_(kov_(pl->el[idx]),k)) {
+	v = pl->el[idx]; 
+	ans = true;
+    } else {
+#if BTREE_LEAF_PREV_POINTER
+	bid = pl->prev();
+#else
+	assert(0);
+#endif
+	if (bid != 0) {
+	    unpin_leaf(pl);
+	    pl = pin_leaf(bid);
+	    v = pl->el[pl->pred(k)];
+	    ans = true;
+	}
+    }
+
+    unpin_leaf(pl);
+    return ans;
+}
+
+/// *btree::succ_shared* ///
+template <class Key, class Value, class Compare, class KeyOfValue, class BTECOLL>
+bool btree<Key, Value, Compare, KeyOfValue, BTECOLL>::succ_shared(const Key& k, Value& v) {
+
+    bool ans = false;
+    BTREE_LEAF * pl;
+    bid_t bid;
+
+    assert(header_.height >= 1);
+
+    pl = pin_leaf(find_leaf_shared(k));
+    size_t idx = pl->succ(k);
+
+    if (idx < pl->size() && comp_(k,kov_(pl->el[idx]))) {
+	v = pl->el[idx]; 
+	ans = true;
+    } else {
+	bid = pl->next();
+	if (bid != 0) {
+	    unpin_leaf(pl);
+	    pl = pin_leaf(bid);
+	    v = pl->el[pl->succ(k)];
+	    ans = true;
+	}
+    }
+
+    unpin_leaf(pl);
+    return ans;
+}
+
+/// *btree::batch_seek* ///
+template <class Key, class Value, class Compare, class KeyOfValue, class BTECOLL>
+BTREE_LEAF* btree<Key, Value, Compare, KeyOfValue, BTECOLL>::batch_seek(batch_cursor_t& c, const Key& k) {
+
+    size_t pos;
+
+    assert(header_.height >= 1);
+
+    // Keep the current leaf if it still covers k.
+    if (c.leaf != NULL) {
+	if (!c.leaf_bounded || !comp_(c.leaf_upper, k))
+	    return c.leaf;
+	drop_leaf(c.leaf);
+	c.leaf = NULL;
+    }
+
+    // Go up until a node covers k.
+    while (!c.path.empty() && c.path.back().bounded &&
+	   comp_(c.path.back().upper, k)) {
+	drop_node(c.path.back().node);
+	c.path.pop_back();
+    }
+
+    if (header_.height == 1) {
+	c.leaf = acquire_leaf(header_.root_bid);
+	c.leaf_bounded = false;
+	return c.leaf;
+    }
+
+    if (c.path.empty()) {
+	batch_level_t root;
+	root.node = acquire_node(header_.root_bid);
+	root.bounded = false;
+	c.path.push_back(root);
+    }
+
+    // Go down to the leaf. The subtree at position pos holds keys up to
+    // and including the key at pos, or up to the father's bound if pos
+    // is the last link.
+    while (true) {
+	batch_level_t next;
+	const batch_level_t& f = c.path.back();
+	pos = f.node->find(k);
+	next.bounded = (pos < f.node->size()) || f.bounded;
+	if (pos < f.node->size())
+	    next.upper = f.node->el[pos];
+	else if (f.bounded)
+	    next.upper = f.upper;
+	bid_t bid = f.node->lk[pos];
+
+	if (c.path.size() + 1 == header_.height) {
+	    c.leaf = acquire_leaf(bid);
+	    c.leaf_bounded = next.bounded;
+	    if (next.bounded)
+		c.leaf_upper = next.upper;
+	    return c.leaf;
+	}
+
+	next.node = acquire_node(bid);
+	c.path.push_back(next);
+    }
+}
+
+/// *btree::batch_close* ///
+template <class Key, class Value, class Compare, class KeyOfValue, class BTECOLL>
+void btree<Key, Value, Compare, KeyOfValue, BTECOLL>::batch_close(batch_cursor_t& c) {
+
+    if (c.leaf != NULL) {
+	drop_leaf(c.leaf);
+	c.leaf = NULL;
+    }
+    while (!c.path.empty()) {
+	drop_node(c.path.back().node);
+	c.path.pop_back();
+    }
+}
+
 /// *btree::find_min_leaf* ///
 template <class Key, class Value, class Compare, class KeyOfValue, class BTECOLL>
 bid_t btree<Key, Value, Compare, KeyOfValue, BTECOLL>::find_min_leaf() {
@@ -2248,7 +3316,8 @@ bool btree<Key, Value, Compare, KeyOfValue, BTECOLL>::underflow_leaf(BTREE_LEAF
 /// *btree::underflow_node* ///
 template <class Key, class Value, class Compare, class KeyOfValue, class BTECOLL>
 bool btree<Key, Value, Compare, KeyOfValue, BTECOLL>::underflow_node(BTREE_NODE *p) const {
-    return p->size() <= cutoff_node(p);
+    // A compressed node with few but large keys may still fill half its block.
+    return p->size() <= cutoff_node(p) && !p->half_full();
 }
 
 /// *btree::cutoff_leaf* ///
@@ -2290,7 +3359,9 @@ bool btree<Key, Value, Compare, KeyOfValue, BTECOLL>::balance_node(BTREE_NODE *f
     if (pos < f->size()) {
 
 	sib = fetch_node(f->lk[pos + 1]);
-	if (sib->size() >= cutoff_node(sib) + 2) {
+	if ((sib->size() >= cutoff_node(sib) + 2 ||
+	     sib->half_full(3 * btree_varint::max_size)) &&
+	    f->fits_replaced(pos, sib->el[0])) {
 
 	    // Rotate left. Insert the key from the father (f) and the link
 	    // from the sibling (sib) to the end of p.
@@ -2308,7 +3379,9 @@ bool btree<Key, Value, Compare, KeyOfValue, BTECOLL>::balance_node(BTREE_NODE *f
     if (pos > 0 && !ans) {
 
 	sib = fetch_node(f->lk[pos - 1]);
-	if (sib->size() >= cutoff_node(sib) + 2) {
+	if ((sib->size() >= cutoff_node(sib) + 2 ||
+	     sib->half_full(3 * btree_varint::max_size)) &&
+	    f->fits_replaced(pos - 1, sib->el[sib->size() - 1])) {
 	    // Rotate right.
 	    p->insert_pos(f->el[pos - 1], sib->lk[sib->size()], 0, 0);
 	    f->el[pos - 1] = sib->el[sib->size() - 1];
@@ -2338,15 +3411,17 @@ bool btree<Key, Value, Compare, KeyOfValue, BTECOLL>::balance_leaf(BTREE_NODE *f
 #if (!BTREE_LEAF_ELEMENTS_SORTED)
 	    sib->sort();
 #endif
-	    // Rotate left.
-	    // Insert the first element from sib to the end of p.
-	    p->insert(sib->el[0]);
-	    // Update the key in the father (f).
-	    f->el[pos] = kov_(sib->el[0]);
-	    // Delete the first element from sib.
-	    sib->erase_pos(0);
-	    ans = true;
-
+	    // The new key must fit into a compressed father.
+	    if (f->fits_replaced(pos, kov_(sib->el[0]))) {
+		// Rotate left.
+		// Insert the first element from sib to the end of p.
+		p->insert(sib->el[0]);
+		// Update the key in the father (f).
+		f->el[pos] = kov_(sib->el[0]);
+		// Delete the first element from sib.
+		sib->erase_pos(0);
+		ans = true;
+	    }
 	}
 	release_leaf(sib);
     }
@@ -2359,15 +3434,17 @@ bool btree<Key, Value, Compare, KeyOfValue, BTECOLL>::balance_leaf(BTREE_NODE *f
 #if (!BTREE_LEAF_ELEMENTS_SORTED)
 	    sib->sort();
 #endif
-	    // Rotate right.
-	    // Insert the last element of sib to the beginning of p.
-	    p->insert(sib->el[sib->size() - 1]);
-	    // Update the key in the father.
-	    f->el[pos - 1] = kov_(sib->el[sib->size() - 2]);
-	    // Delete the last element from sib.
-	    sib->erase_pos(sib->size() - 1); 
-	    ans = true;
-
+	    // The new key must fit into a compressed father.
+	    if (f->fits_replaced(pos - 1, kov_(sib->el[sib->size() - 2]))) {
+		// Rotate right.
+		// Insert the last element of sib to the beginning of p.
+		p->insert(sib->el[sib->size() - 1]);
+		// Update the key in the father.
+		f->el[pos - 1] = kov_(sib->el[sib->size() - 2]);
+		// Delete the last element from sib.
+		sib->erase_pos(sib->size() - 1); 
+		ans = true;
+	    }
 	}
 	release_leaf(sib);
     }
@@ -2377,17 +3454,24 @@ bool btree<Key, Value, Compare, KeyOfValue, BTECOLL>::balance_leaf(BTREE_NODE *f
 
 /// *btree::merge_leaf* ///
 template <class Key, class Value, class Compare, class KeyOfValue, class BTECOLL>
-void btree<Key, Value, Compare, KeyOfValue, BTECOLL>::merge_leaf(BTREE_NODE* f, BTREE_LEAF* &p, size_t pos) {
+bool btree<Key, Value, Compare, KeyOfValue, BTECOLL>::merge_leaf(BTREE_NODE* f, BTREE_LEAF* &p, size_t pos) {
 
     BTREE_LEAF * sib, *r;
 
     // f will be the father of both p and sib.
 
+    if (f->size() == 0)
+	return false;
+
     if (pos < f->size()) {
 
 	// Merge with right sibling.
 	// Fetch the sibling.
 	sib = fetch_leaf(f->lk[pos + 1]);
+	if (p->size() + sib->size() > p->capacity()) {
+	    release_leaf(sib);
+	    return false;
+	}
 	// Update the next pointer.
 	p->next() = sib->next();
 #if BTREE_LEAF_PREV_POINTER
@@ -2410,6 +3494,10 @@ void btree<Key, Value, Compare, KeyOfValue, BTECOLL>::merge_leaf(BTREE_NODE* f,
 
 	// Merge with left sibling.
 	sib = fetch_leaf(f->lk[pos - 1]);
+	if (p->size() + sib->size() > sib->capacity()) {
+	    release_leaf(sib);
+	    return false;
+	}
 	sib->next() = p->next();
 #if BTREE_LEAF_PREV_POINTER
 	if (sib->next() != 0) {
@@ -2424,19 +3512,27 @@ void btree<Key, Value, Compare, KeyOfValue, BTECOLL>::merge_leaf(BTREE_NODE* f,
 	f->erase_pos(pos - 1, pos);
 	p = sib;
     }
-  
+
+    return true;
 }
 
 /// *btree::merge_node* ///
 template <class Key, class Value, class Compare, class KeyOfValue, class BTECOLL>
-void btree<Key, Value, Compare, KeyOfValue, BTECOLL>::merge_node(BTREE_NODE* f, BTREE_NODE* &p, size_t pos) {
+bool btree<Key, Value, Compare, KeyOfValue, BTECOLL>::merge_node(BTREE_NODE* f, BTREE_NODE* &p, size_t pos) {
 
     BTREE_NODE * sib;
 
     // f will be the father of both p and sib.
 
+    if (f->size() == 0)
+	return false;
+
     if (pos < f->size()) {
 	sib = fetch_node(f->lk[pos + 1]);
+	if (!p->fits_merged(*sib, f->el[pos])) {
+	    release_node(sib);
+	    return false;
+	}
 	p->merge(*sib, f->el[pos]);
 	// Delete the sibling.
 	sib->persist(PERSIST_DELETE);
@@ -2444,6 +3540,10 @@ void btree<Key, Value, Compare, KeyOfValue, BTECOLL>::merge_node(BTREE_NODE* f,
 	f->erase_pos(pos, pos + 1);
     } else {
 	sib = fetch_node(f->lk[pos - 1]);
+	if (!sib->fits_merged(*p, f->el[pos - 1])) {
+	    release_node(sib);
+	    return false;
+	}
 	sib->merge(*p, f->el[pos - 1]);
 	p->persist(PERSIST_DELETE);
 	release_node(p);
@@ -2451,6 +3551,7 @@ void btree<Key, Value, Compare, KeyOfValue, BTECOLL>::merge_node(BTREE_NODE* f,
 	p = sib;
     }
 
+    return true;
 }
 
 /// *btree::erase* ///
@@ -2459,6 +3560,12 @@ bool btree<Key, Value, Compare, KeyOfValue, BTECOLL>::erase(const Key& k) {
 
     bool ans;
 
+    if (reject_update("erase"))
+	return false;
+
+    if (update_buffer_ != NULL)
+	return buffer_update(UPDATE_ERASE, k, Value());
+
     if (header_.height == 0) 
 	return false;
 
@@ -2499,13 +3606,15 @@ bool btree<Key, Value, Compare, KeyOfValue, BTECOLL>::erase(const Key& k) {
 	// Can we borrow an element from a sibling?
 	if (balance_leaf(q, p, top.second)) {
 	    bid = 0; // Done.
-	} else {
-
-	    // Merge p with a sibling.
-	    merge_leaf(q, p, top.second);
+	} else if (merge_leaf(q, p, top.second)) {
 
 	    // Check for underflow in the father.
 	    bid = (underflow_node(q) ? q->bid() : 0);
+	} else {
+
+	    // Neither worked (only possible with compressed nodes).
+	    // Leave p underfull.
+	    bid = 0;
 	}
 
 	// Prepare for next iteration (or exit).
@@ -2529,13 +3638,14 @@ bool btree<Key, Value, Compare, KeyOfValue, BTECOLL>::erase(const Key& k) {
 
 	    bid = 0;
 
-	} else {
-      
-	    // Merge p with right sibling.
-	    merge_node(q, pp, top.second);
+	} else if (merge_node(q, pp, top.second)) {
 
 	    // Check for underflow in the father.
 	    bid = (underflow_node(q) ? q->bid() : 0);
+	} else {
+
+	    // Leave pp underfull, as above.
+	    bid = 0;
 	}
 
 	// Prepare for next iteration (or exit).
@@ -2574,10 +3684,16 @@ bool btree<Key, Value, Compare, KeyOfValue, BTECOLL>::erase(const Key& k) {
 
 	template <class Key, class Value, class Compare, class KeyOfValue, class BTECOLL>
 	btree<Key, Value, Compare, KeyOfValue, BTECOLL>::~btree() {
+	    // Apply pending updates before closing the tree.
+	    if (status_ == BTREE_STATUS_VALID)
+		flush();
+	    delete update_buffer_;
 	    if (status_ == BTREE_STATUS_VALID) {
 		// Write initialization info into the pcoll_nodes_ header.
 		*((header_t *) pcoll_nodes_->user_data()) = header_;
 	    }
+	    delete node_shared_cache_;
+	    delete leaf_shared_cache_;
 	    delete node_cache_;
 	    delete leaf_cache_;
 
@@ -2592,7 +3708,7 @@ bool btree<Key, Value, Compare, KeyOfValue, BTECOLL>::erase(const Key& k) {
 	    stats_.record(NODE_FETCH);
 	    // Warning: using short-circuit evaluation. Order is important.
 	    if ((bid == 0) || !node_cache_->read(bid, q)) {
-		q = new BTREE_NODE(pcoll_nodes_, bid);
+		q = new BTREE_NODE(pcoll_nodes_, bid, params_.node_compression);
 	    }
 	    return q;
 	}
@@ -2626,10 +3742,165 @@ bool btree<Key, Value, Compare, KeyOfValue, BTECOLL>::erase(const Key& k) {
 		leaf_cache_->write(p->bid(), p);
 	}
 
+	template <class Key, class Value, class Compare, class KeyOfValue, class BTECOLL>
+	void btree<Key, Value, Compare, KeyOfValue, BTECOLL>::concurrent_reads(bool enable) {
+	    if (enable == concurrent_reads())
+		return;
+	    if (enable) {
+		// Updates are not allowed in concurrent read mode, so pending
+		// ones are applied now.
+		flush();
+		// Write back everything held by the exclusive caches, so that
+		// no block is in memory twice.
+		node_cache_->flush();
+		leaf_cache_->flush();
+		node_shared_cache_ = new node_shared_cache_t(params_.node_cache_size, params_.cache_shards,
+							     remove_shared<BTREE_NODE>(&io_mutex_));
+		leaf_shared_cache_ = new leaf_shared_cache_t(params_.leaf_cache_size, params_.cache_shards,
+							     remove_shared<BTREE_LEAF>(&io_mutex_));
+	    } else {
+		delete node_shared_cache_;
+		delete leaf_shared_cache_;
+		node_shared_cache_ = NULL;
+		leaf_shared_cache_ = NULL;
+	    }
+	}
+
+	template <class Key, class Value, class Compare, class KeyOfValue, class BTECOLL>
+	void btree<Key, Value, Compare, KeyOfValue, BTECOLL>::buffered_updates(bool enable) {
+	    if (enable == buffered_updates())
+		return;
+	    if (enable) {
+		update_buffer_ = new stream<update_t>;
+		update_buffer_->persist(PERSIST_DELETE);
+	    } else {
+		flush();
+		delete update_buffer_;
+		update_buffer_ = NULL;
+	    }
+	}
+
+	template <class Key, class Value, class Compare, class KeyOfValue, class BTECOLL>
+	bool btree<Key, Value, Compare, KeyOfValue, BTECOLL>::buffer_update(update_op_t op, const Key& k, const Value& v) {
+	    update_t u;
+	    u.k = k;
+	    u.v = v;
+	    u.seq = update_seq_++;
+	    u.op = op;
+	    if (update_buffer_->write_item(u) != NO_ERROR) {
+		TP_LOG_WARNING_ID("btree: cannot write to the update buffer.");
+		return false;
+	    }
+	    if (params_.update_buffer_size > 0 &&
+		update_buffer_->stream_len() >= static_cast<TPIE_OS_OFFSET>(params_.update_buffer_size))
+		return flush() == NO_ERROR;
+	    return true;
+	}
+
+	template <class Key, class Value, class Compare, class KeyOfValue, class BTECOLL>
+	err btree<Key, Value, Compare, KeyOfValue, BTECOLL>::flush() {
+	    if (update_buffer_ == NULL || update_buffer_->stream_len() == 0)
+		return NO_ERROR;
+
+	    // Sort the updates by key. Updates to the same key keep their
+	    // order, so the net effect is that of applying them one by one.
+	    stream<update_t>* sorted = new stream<update_t>;
+	    sorted->persist(PERSIST_DELETE);
+	    comp_update_for_sort cmp;
+	    err retval = tpie::ami::sort_or_copy(update_buffer_, sorted, &cmp);
+	    if (retval != NO_ERROR) {
+		TP_LOG_WARNING_ID("flush: sorting the update buffer failed.");
+		delete sorted;
+		return retval;
+	    }
+	    update_buffer_->truncate(0);
+
+	    // Apply the updates directly while the buffer is detached. Since
+	    // they arrive in key order, consecutive updates share most of
+	    // their root-to-leaf path, which stays in the caches.
+	    stream<update_t>* buffer = update_buffer_;
+	    update_buffer_ = NULL;
+	    update_t* u;
+	    sorted->seek(0);
+	    while ((retval = sorted->read_item(&u)) == NO_ERROR) {
+		switch (u->op) {
+		case UPDATE_INSERT:
+		    insert(u->v);
+		    break;
+		case UPDATE_MODIFY:
+		    modify(u->v);
+		    break;
+		case UPDATE_ERASE:
+		    erase(u->k);
+		    break;
+		}
+	    }
+	    update_buffer_ = buffer;
+	    delete sorted;
+
+	    if (retval != END_OF_STREAM) {
+		TP_LOG_WARNING_ID("flush: error reading the sorted update buffer.");
+		return retval;
+	    }
+	    return NO_ERROR;
+	}
+
+	template <class Key, class Value, class Compare, class KeyOfValue, class BTECOLL>
+	bool btree<Key, Value, Compare, KeyOfValue, BTECOLL>::reject_update(const char* op) const {
+	    // op is only used when logging is compiled in.
+	    tpie::unused(op);
+	    if (!concurrent_reads())
+		return false;
+	    TP_LOG_WARNING_ID("btree: cannot " << op << " in concurrent read mode.");
+	    return true;
+	}
+
+	template <class Key, class Value, class Compare, class KeyOfValue, class BTECOLL>
+	BTREE_NODE* btree<Key, Value, Compare, KeyOfValue, BTECOLL>::pin_node(bid_t bid) {
+	    BTREE_NODE* q;
+	    if (node_shared_cache_->pin(bid, q))
+		return q;
+	    BTREE_NODE* r;
+	    {
+		boost::mutex::scoped_lock lock(io_mutex_);
+		r = new BTREE_NODE(pcoll_nodes_, bid, params_.node_compression);
+	    }
+	    q = r;
+	    if (!node_shared_cache_->insert(bid, q)) {
+		// Another thread read the same node meanwhile; use theirs.
+		boost::mutex::scoped_lock lock(io_mutex_);
+		delete r;
+	    }
+	    return q;
+	}
+
+	template <class Key, class Value, class Compare, class KeyOfValue, class BTECOLL>
+	BTREE_LEAF* btree<Key, Value, Compare, KeyOfValue, BTECOLL>::pin_leaf(bid_t bid) {
+	    BTREE_LEAF* q;
+	    if (leaf_shared_cache_->pin(bid, q))
+		return q;
+	    BTREE_LEAF* r;
+	    {
+		boost::mutex::scoped_lock lock(io_mutex_);
+		r = new BTREE_LEAF(pcoll_leaves_, bid);
+	    }
+	    q = r;
+	    if (!leaf_shared_cache_->insert(bid, q)) {
+		// Another thread read the same leaf meanwhile; use theirs.
+		boost::mutex::scoped_lock lock(io_mutex_);
+		delete r;
+	    }
+	    return q;
+	}
+
 	template <class Key, class Value, class Compare, class KeyOfValue, class BTECOLL>
 	const stats_tree& btree<Key, Value, Compare, KeyOfValue, BTECOLL>::stats() {
 	    node_cache_->flush();
 	    leaf_cache_->flush();
+	    if (concurrent_reads()) {
+		node_shared_cache_->flush();
+		leaf_shared_cache_->flush();
+	    }
 	    stats_.set(LEAF_READ, pcoll_leaves_->stats().get(BLOCK_GET));
 	    stats_.set(LEAF_WRITE, pcoll_leaves_->stats().get(BLOCK_PUT));
 	    stats_.set(LEAF_CREATE, pcoll_leaves_->stats().get(BLOCK_NEW));
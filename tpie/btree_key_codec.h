@@ -0,0 +1,279 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2010, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+///////////////////////////////////////////////////////////////////////////
+/// \file btree_key_codec.h
+/// Helpers for storing the keys of B-tree nodes in compressed form.
+///////////////////////////////////////////////////////////////////////////
+
+#ifndef _TPIE_AMI_BTREE_KEY_CODEC_H
+#define _TPIE_AMI_BTREE_KEY_CODEC_H
+
+#include <tpie/portability.h>
+#include <functional>
+#include <utility>
+#include <cstring>
+#include <cassert>
+#include <boost/cstdint.hpp>
+#include <boost/type_traits/is_integral.hpp>
+#include <boost/type_traits/is_signed.hpp>
+
+namespace tpie {
+
+    namespace ami {
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// Variable-length encoding of unsigned 64-bit integers, seven bits per
+    /// byte, least significant group first. The high bit of a byte is set
+    /// if more bytes follow.
+    ///////////////////////////////////////////////////////////////////////////
+	class btree_varint {
+	public:
+	    /** The maximum number of bytes taken by one integer. */
+	    static const size_t max_size = 10;
+
+	    /** Number of bytes taken by x. */
+	    static size_t size(boost::uint64_t x) {
+		size_t n = 1;
+		while (x >= 0x80) {
+		    x >>= 7;
+		    n++;
+		}
+		return n;
+	    }
+
+	    /** Write x at p and advance p past it. */
+	    static void put(char*& p, boost::uint64_t x) {
+		while (x >= 0x80) {
+		    *p++ = (char) ((x & 0x7f) | 0x80);
+		    x >>= 7;
+		}
+		*p++ = (char) x;
+	    }
+
+	    /** Read an integer at p and advance p past it. */
+	    static boost::uint64_t get(const char*& p) {
+		boost::uint64_t x = 0;
+		int shift = 0;
+		unsigned char c;
+		do {
+		    c = (unsigned char) *p++;
+		    x |= (boost::uint64_t) (c & 0x7f) << shift;
+		    shift += 7;
+		} while (c & 0x80);
+		return x;
+	    }
+	};
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// Writes B-tree keys as byte strings of \ref size bytes whose
+    /// lexicographic (unsigned) order is the order of the keys under
+    /// <em>Compare</em>. Keys that share a long prefix under this
+    /// representation, such as composite keys whose first components are
+    /// equal, can then be stored front coded (see \ref btree_key_codec).
+    ///
+    /// Such a representation is provided for integral keys and for
+    /// std::pair of keys that have one, ordered by std::less. It can be
+    /// provided for other key types by specializing this class with
+    /// \ref enabled set to true.
+    ///////////////////////////////////////////////////////////////////////////
+	template<class Key, class Compare,
+		 bool Integral = boost::is_integral<Key>::value>
+	class btree_key_bytes {
+	public:
+	    /** Whether keys of this type have a byte representation. */
+	    static const bool enabled = false;
+
+	    /** The number of bytes of a key. */
+	    static const size_t size = 1;
+
+	    /** Never called. */
+	    static void put(unsigned char* /* p */, const Key& /* k */) { assert(0); }
+
+	    /** Never called. */
+	    static Key get(const unsigned char* /* p */) { assert(0); return Key(); }
+	};
+
+	template<class Key>
+	class btree_key_bytes<Key, std::less<Key>, true> {
+	public:
+	    static const bool enabled = true;
+	    static const size_t size = sizeof(Key);
+
+	    /** Big endian, with the sign bit of signed keys flipped so that
+		negative keys come first. */
+	    static void put(unsigned char* p, const Key& k) {
+		boost::uint64_t c = (boost::uint64_t) k;
+		if (boost::is_signed<Key>::value)
+		    c ^= (boost::uint64_t) 1 << (8 * sizeof(Key) - 1);
+		for (size_t i = sizeof(Key); i-- > 0; c >>= 8)
+		    p[i] = (unsigned char) c;
+	    }
+
+	    static Key get(const unsigned char* p) {
+		boost::uint64_t c = 0;
+		for (size_t i = 0; i < sizeof(Key); i++)
+		    c = (c << 8) | p[i];
+		if (boost::is_signed<Key>::value)
+		    c ^= (boost::uint64_t) 1 << (8 * sizeof(Key) - 1);
+		return (Key) c;
+	    }
+	};
+
+	template<class A, class B>
+	class btree_key_bytes<std::pair<A, B>, std::less<std::pair<A, B> >, false> {
+	    typedef btree_key_bytes<A, std::less<A> > first_t;
+	    typedef btree_key_bytes<B, std::less<B> > second_t;
+	public:
+	    static const bool enabled = first_t::enabled && second_t::enabled;
+	    static const size_t size = first_t::size + second_t::size;
+
+	    /** The first component followed by the second. */
+	    static void put(unsigned char* p, const std::pair<A, B>& k) {
+		first_t::put(p, k.first);
+		second_t::put(p + first_t::size, k.second);
+	    }
+
+	    static std::pair<A, B> get(const unsigned char* p) {
+		return std::pair<A, B>(first_t::get(p), second_t::get(p + first_t::size));
+	    }
+	};
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// Stores the sorted keys of a B-tree node compactly, each key coded
+    /// relative to the key before it (or to nothing, for the first key).
+    ///
+    /// Keys that have a byte representation (see \ref btree_key_bytes) are
+    /// front coded: a key is stored as the length of the prefix it shares
+    /// with the key before it, followed by the rest of its bytes.
+    ///
+    /// Integral keys ordered by std::less are instead mapped to unsigned
+    /// 64-bit codes in key order, and stored as the (mostly small)
+    /// differences between consecutive codes.
+    ///
+    /// \ref enabled is false for keys that can be stored neither way. The
+    /// nodes of a B-tree are then stored uncompressed.
+    ///////////////////////////////////////////////////////////////////////////
+	template<class Key, class Compare,
+		 bool Integral = boost::is_integral<Key>::value>
+	class btree_key_codec {
+	    typedef btree_key_bytes<Key, Compare> bytes_t;
+
+	    /** The length of the prefix shared by a and b. */
+	    static size_t shared(const unsigned char* a, const unsigned char* b) {
+		size_t n = 0;
+		while (n < bytes_t::size && a[n] == b[n])
+		    n++;
+		return n;
+	    }
+
+	public:
+	    /** Whether keys of this type can be compressed. */
+	    static const bool enabled = bytes_t::enabled;
+
+	    /** The maximum number of bytes taken by one key. */
+	    static const size_t max_size = btree_varint::max_size + bytes_t::size;
+
+	    /** Number of bytes taken by k after prev (NULL for the first
+		key). */
+	    static size_t size(const Key* prev, const Key& k) {
+		unsigned char a[bytes_t::size], b[bytes_t::size];
+		size_t n = 0;
+		bytes_t::put(b, k);
+		if (prev != NULL) {
+		    bytes_t::put(a, *prev);
+		    n = shared(a, b);
+		}
+		return btree_varint::size(n) + bytes_t::size - n;
+	    }
+
+	    /** Write k after prev at p and advance p past it. */
+	    static void put(char*& p, const Key* prev, const Key& k) {
+		unsigned char a[bytes_t::size], b[bytes_t::size];
+		size_t n = 0;
+		bytes_t::put(b, k);
+		if (prev != NULL) {
+		    bytes_t::put(a, *prev);
+		    n = shared(a, b);
+		}
+		btree_varint::put(p, n);
+		memcpy(p, b + n, bytes_t::size - n);
+		p += bytes_t::size - n;
+	    }
+
+	    /** Read the key after prev at p and advance p past it. */
+	    static Key get(const char*& p, const Key* prev) {
+		unsigned char b[bytes_t::size];
+		size_t n = (size_t) btree_varint::get(p);
+		assert(n <= bytes_t::size && (n == 0 || prev != NULL));
+		if (n > 0)
+		    bytes_t::put(b, *prev);
+		memcpy(b + n, p, bytes_t::size - n);
+		p += bytes_t::size - n;
+		return bytes_t::get(b);
+	    }
+	};
+
+	template<class Key>
+	class btree_key_codec<Key, std::less<Key>, true> {
+	    static const boost::uint64_t sign_bit = (boost::uint64_t) 1 << 63;
+	public:
+	    /** Whether keys of this type can be compressed. */
+	    static const bool enabled = true;
+
+	    /** The maximum number of bytes taken by one key. */
+	    static const size_t max_size = btree_varint::max_size;
+
+	    /** The code of key k. The sign bit of signed keys is flipped so
+		that negative keys get the smaller codes. */
+	    static boost::uint64_t code(const Key& k) {
+		if (boost::is_signed<Key>::value)
+		    return (boost::uint64_t) (boost::int64_t) k ^ sign_bit;
+		return (boost::uint64_t) k;
+	    }
+
+	    /** The key with code c. */
+	    static Key key(boost::uint64_t c) {
+		if (boost::is_signed<Key>::value)
+		    return (Key) (boost::int64_t) (c ^ sign_bit);
+		return (Key) c;
+	    }
+
+	    /** Number of bytes taken by k after prev (NULL for the first
+		key, which is coded after 0). */
+	    static size_t size(const Key* prev, const Key& k) {
+		return btree_varint::size(code(k) - (prev ? code(*prev): 0));
+	    }
+
+	    /** Write k after prev at p and advance p past it. */
+	    static void put(char*& p, const Key* prev, const Key& k) {
+		btree_varint::put(p, code(k) - (prev ? code(*prev): 0));
+	    }
+
+	    /** Read the key after prev at p and advance p past it. */
+	    static Key get(const char*& p, const Key* prev) {
+		return key(btree_varint::get(p) + (prev ? code(*prev): 0));
+	    }
+	};
+
+    }  //  ami namespace
+
+}  //  tpie namespace
+
+#endif // _TPIE_AMI_BTREE_KEY_CODEC_H
@@ -0,0 +1,201 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2010, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+///////////////////////////////////////////////////////////////////////////
+/// \file btree_key_search.h
+/// Search in the sorted key arrays of B-tree nodes, using SIMD
+/// instructions for integral keys where available.
+///////////////////////////////////////////////////////////////////////////
+
+#ifndef _TPIE_AMI_BTREE_KEY_SEARCH_H
+#define _TPIE_AMI_BTREE_KEY_SEARCH_H
+
+#include <tpie/portability.h>
+#include <algorithm>
+#include <functional>
+#include <boost/cstdint.hpp>
+#include <boost/type_traits/is_integral.hpp>
+#include <boost/type_traits/is_signed.hpp>
+
+#if defined(__AVX2__)
+#  include <immintrin.h>
+#elif defined(__SSE4_2__)
+#  include <nmmintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#  include <emmintrin.h>
+#endif
+
+namespace tpie {
+
+    namespace ami {
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// Counts the elements less than k in an array of n integers of Bytes
+    /// bytes each. This generic version is a plain loop without branches;
+    /// there are SIMD versions for 4 and 8 byte integers. The SIMD compares
+    /// are signed, so unsigned integers get their sign bits flipped first.
+    ///////////////////////////////////////////////////////////////////////////
+	template<size_t Bytes, class T>
+	class btree_count_less {
+	public:
+	    static size_t count(const T* el, size_t n, T k) {
+		size_t c = 0;
+		for (size_t i = 0; i < n; i++)
+		    c += (el[i] < k);
+		return c;
+	    }
+	};
+
+#if defined(__AVX2__)
+
+	template<class T>
+	class btree_count_less<4, T> {
+	public:
+	    static size_t count(const T* el, size_t n, T k) {
+		const __m256i bias = _mm256_set1_epi32(
+		    boost::is_signed<T>::value ? 0 : (int) 0x80000000u);
+		__m256i kv = _mm256_xor_si256(_mm256_set1_epi32((int) k), bias);
+		__m256i acc = _mm256_setzero_si256();
+		size_t i = 0;
+		// Each comparison yields -1 in the lanes holding smaller keys.
+		for (; i + 8 <= n; i += 8)
+		    acc = _mm256_sub_epi32(acc, _mm256_cmpgt_epi32(kv, _mm256_xor_si256(
+			      _mm256_loadu_si256((const __m256i*) (el + i)), bias)));
+		boost::int32_t lanes[8];
+		_mm256_storeu_si256((__m256i*) lanes, acc);
+		size_t c = 0;
+		for (size_t j = 0; j < 8; j++)
+		    c += lanes[j];
+		return c + btree_count_less<0, T>::count(el + i, n - i, k);
+	    }
+	};
+
+	template<class T>
+	class btree_count_less<8, T> {
+	public:
+	    static size_t count(const T* el, size_t n, T k) {
+		const __m256i bias = _mm256_set1_epi64x(
+		    boost::is_signed<T>::value ? 0 : (long long) 0x8000000000000000ull);
+		__m256i kv = _mm256_xor_si256(_mm256_set1_epi64x((long long) k), bias);
+		__m256i acc = _mm256_setzero_si256();
+		size_t i = 0;
+		for (; i + 4 <= n; i += 4)
+		    acc = _mm256_sub_epi64(acc, _mm256_cmpgt_epi64(kv, _mm256_xor_si256(
+			      _mm256_loadu_si256((const __m256i*) (el + i)), bias)));
+		boost::int64_t lanes[4];
+		_mm256_storeu_si256((__m256i*) lanes, acc);
+		size_t c = (size_t) (lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+		return c + btree_count_less<0, T>::count(el + i, n - i, k);
+	    }
+	};
+
+#elif defined(__SSE2__) || defined(__SSE4_2__) || defined(_M_X64)
+
+	template<class T>
+	class btree_count_less<4, T> {
+	public:
+	    static size_t count(const T* el, size_t n, T k) {
+		const __m128i bias = _mm_set1_epi32(
+		    boost::is_signed<T>::value ? 0 : (int) 0x80000000u);
+		__m128i kv = _mm_xor_si128(_mm_set1_epi32((int) k), bias);
+		__m128i acc = _mm_setzero_si128();
+		size_t i = 0;
+		// Each comparison yields -1 in the lanes holding smaller keys.
+		for (; i + 4 <= n; i += 4)
+		    acc = _mm_sub_epi32(acc, _mm_cmpgt_epi32(kv, _mm_xor_si128(
+			      _mm_loadu_si128((const __m128i*) (el + i)), bias)));
+		boost::int32_t lanes[4];
+		_mm_storeu_si128((__m128i*) lanes, acc);
+		size_t c = (size_t) (lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+		return c + btree_count_less<0, T>::count(el + i, n - i, k);
+	    }
+	};
+
+#  if defined(__SSE4_2__)
+	template<class T>
+	class btree_count_less<8, T> {
+	public:
+	    static size_t count(const T* el, size_t n, T k) {
+		const __m128i bias = _mm_set1_epi64x(
+		    boost::is_signed<T>::value ? 0 : (long long) 0x8000000000000000ull);
+		__m128i kv = _mm_xor_si128(_mm_set1_epi64x((long long) k), bias);
+		__m128i acc = _mm_setzero_si128();
+		size_t i = 0;
+		for (; i + 2 <= n; i += 2)
+		    acc = _mm_sub_epi64(acc, _mm_cmpgt_epi64(kv, _mm_xor_si128(
+			      _mm_loadu_si128((const __m128i*) (el + i)), bias)));
+		boost::int64_t lanes[2];
+		_mm_storeu_si128((__m128i*) lanes, acc);
+		size_t c = (size_t) (lanes[0] + lanes[1]);
+		return c + btree_count_less<0, T>::count(el + i, n - i, k);
+	    }
+	};
+#  endif
+
+#endif
+
+    ///////////////////////////////////////////////////////////////////////////
+    /// Finds the position of key k in the sorted array el of n keys, that
+    /// is, the first position holding a key not less than k. This generic
+    /// version is std::lower_bound with the given comparison object.
+    ///
+    /// For integral keys ordered by std::less, the search is chosen at
+    /// compile time: it bisects down to a window of a few cache lines and
+    /// then counts the keys less than k in the window with SIMD compares
+    /// (AVX2, SSE4.2 or SSE2, depending on the target; a branch free loop
+    /// otherwise).
+    ///////////////////////////////////////////////////////////////////////////
+	template<class Key, class Compare,
+		 bool Integral = boost::is_integral<Key>::value>
+	class btree_key_search {
+	public:
+	    static size_t lower_bound(const Key* el, size_t n, const Key& k,
+				      const Compare& comp) {
+		return std::lower_bound(el, el + n, k, comp) - el;
+	    }
+	};
+
+	template<class Key>
+	class btree_key_search<Key, std::less<Key>, true> {
+
+	    /** Size of the window in which keys are counted. */
+	    static const size_t window = 256 / sizeof(Key);
+
+	public:
+	    static size_t lower_bound(const Key* el, size_t n, const Key& k,
+				      const std::less<Key>& /* comp */) {
+		size_t lo = 0;
+		while (n > window) {
+		    size_t half = n / 2;
+		    if (el[lo + half] < k) {
+			lo += half + 1;
+			n -= half + 1;
+		    } else
+			n = half;
+		}
+
+		return lo + btree_count_less<sizeof(Key), Key>::count(el + lo, n, k);
+	    }
+	};
+
+    }  //  ami namespace
+
+}  //  tpie namespace
+
+#endif // _TPIE_AMI_BTREE_KEY_SEARCH_H
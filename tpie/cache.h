@@ -21,8 +21,8 @@
 /// \file cache.h 
 /// Declaration and definition of CACHE_MANAGER implementation(s).
 /// Provides means to choose and set a specific cache manager/
-/// For now the only cache memory manager implemented is 
-///  \ref cache_manager_lru.
+/// The default cache memory manager is \ref cache_manager_lru;
+/// \ref cache_manager_sharded may be shared by several threads.
 ///////////////////////////////////////////////////////////////////////////
 
 #ifndef _TPIE_AMI_CACHE_H
@@ -30,6 +30,7 @@
 
 #include <tpie/cache_base.h>
 #include <tpie/cache_lru.h>
+#include <tpie/cache_sharded.h>
 
 namespace tpie {
     
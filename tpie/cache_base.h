@@ -34,8 +34,7 @@ namespace tpie {
 
     ////////////////////////////////////////////////////////////////////
     /// Base class for all cache manager implementations.
-    /// For now the only cache memory manager implemented is 
-    ///  \ref cache_manager_lru.
+    /// See \ref cache_manager_lru and \ref cache_manager_sharded.
     ////////////////////////////////////////////////////////////////////
     class cache_manager_base {
 
@@ -0,0 +1,293 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2008, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+///////////////////////////////////////////////////////////////////
+/// \file cache_sharded.h
+/// Declaration and definition of a thread-safe cache manager with
+/// lock-sharded Least-Recently-Used (LRU) sets.
+///////////////////////////////////////////////////////////////////
+
+#ifndef _TPIE_AMI_CACHE_SHARDED_H
+#define _TPIE_AMI_CACHE_SHARDED_H
+
+// Get the STL list and map classes.
+#include <list>
+#include <map>
+// Get the logging macros.
+#include <tpie/tpie_log.h>
+// Get the base class.
+#include <tpie/cache_base.h>
+// Get the mutex class.
+#include <boost/thread/mutex.hpp>
+
+namespace tpie {
+
+    namespace ami {
+
+    ////////////////////////////////////////////////////////////////////
+    /// A cache manager that can be shared by several threads.
+    ///
+    /// Unlike \ref cache_manager_lru, items are not handed out to (and
+    /// taken back from) a single user. Instead, a user pins an item with
+    /// pin() or insert(), uses it, and then unpins it with unpin(); any
+    /// number of threads may have the same item pinned at the same time.
+    /// Pinned items are never written out. Items are therefore meant to
+    /// be used read-only while they are in the cache.
+    ///
+    /// The keys are spread over a number of shards, each having its own
+    /// lock and its own LRU list of unpinned items, so threads working
+    /// on different items rarely contend for the same lock. The writeout
+    /// function object is called with the shard lock held; it must not
+    /// call back into the cache.
+    ////////////////////////////////////////////////////////////////////
+	template<class T, class W>
+	class cache_manager_sharded: public cache_manager_base {
+
+	protected:
+
+	    /** A cached item together with its pin count. */
+	    struct entry_type_ {
+		T item;
+		TPIE_OS_SIZE_T pins;
+		std::list<TPIE_OS_OFFSET>::iterator lru_pos;
+	    };
+
+	    /** One lock-protected part of the cache. */
+	    struct shard_type_ {
+		/** Protects the two containers below. */
+		boost::mutex mutex;
+		/** All items in this shard, pinned or not. */
+		std::map<TPIE_OS_OFFSET, entry_type_> items;
+		/** Keys of unpinned items, most recently used first. */
+		std::list<TPIE_OS_OFFSET> lru;
+	    };
+
+	    typedef typename std::map<TPIE_OS_OFFSET, entry_type_>::iterator item_iterator_;
+
+	    /** The array of shards. */
+	    shard_type_ * shards_;
+
+	    /** The number of shards. */
+	    TPIE_OS_SIZE_T shard_count_;
+
+	    /** The writeout function object. */
+	    W writeout_;
+
+	    /** Return the shard responsible for key k. */
+	    shard_type_& shard(TPIE_OS_OFFSET k) {
+		return shards_[k % shard_count_];
+	    }
+
+	    /** Write out unpinned items of s until it is within capacity.
+		Must be called with the lock of s held. */
+	    void evict(shard_type_& s);
+
+	public:
+
+      ////////////////////////////////////////////////////////////////////
+      ///  Construct a cache manager with the given capacity, split evenly
+      ///  over the given number of shards.
+      ////////////////////////////////////////////////////////////////////
+	    cache_manager_sharded(TPIE_OS_SIZE_T capacity,
+				  TPIE_OS_SIZE_T shards = 8,
+				  const W& writeout = W());
+
+      ////////////////////////////////////////////////////////////////////
+	    /// Look up the item with key k. If it is found, it is pinned,
+	    /// copied to item, and true is returned.
+      ////////////////////////////////////////////////////////////////////
+	    bool pin(TPIE_OS_OFFSET k, T& item);
+
+      ////////////////////////////////////////////////////////////////////
+	    /// Insert item with key k and pin it. If another thread inserted
+	    /// an item with the same key in the meantime, that item is pinned
+	    /// and copied to item instead, and false is returned; the caller
+	    /// then owns the item it passed in.
+      ////////////////////////////////////////////////////////////////////
+	    bool insert(TPIE_OS_OFFSET k, T& item);
+
+      ////////////////////////////////////////////////////////////////////
+	    /// Release one pin on the item with key k. Unpinned items may be
+	    /// written out at any time afterwards.
+      ////////////////////////////////////////////////////////////////////
+	    void unpin(TPIE_OS_OFFSET k);
+
+      ////////////////////////////////////////////////////////////////////
+	    /// Writes out all unpinned items in the cache.
+      ////////////////////////////////////////////////////////////////////
+	    void flush();
+
+      ////////////////////////////////////////////////////////////////////
+      /// Destructor writing out all items still in the cache. No item
+      /// should be pinned at this point.
+	    ////////////////////////////////////////////////////////////////////
+	    ~cache_manager_sharded();
+	};
+
+	template<class T, class W>
+	cache_manager_sharded<T,W>::cache_manager_sharded(TPIE_OS_SIZE_T capacity,
+							  TPIE_OS_SIZE_T shards,
+							  const W& writeout):
+	    cache_manager_base(capacity, 0), writeout_(writeout) {
+
+	    if (shards == 0)
+		shards = 1;
+
+	    if (capacity_ < shards) {
+
+		TP_LOG_WARNING_ID("Fewer cache slots than shards.");
+		TP_LOG_WARNING_ID("Number of shards reduced to capacity.");
+
+		shards = (capacity_ == 0) ? 1: capacity_;
+	    }
+
+	    shard_count_ = shards;
+
+	    // Each shard holds an equal share of the items.
+	    assoc_ = (capacity_ + shard_count_ - 1) / shard_count_;
+
+	    shards_ = new shard_type_[shard_count_];
+	}
+
+	template<class T, class W>
+	bool cache_manager_sharded<T,W>::pin(TPIE_OS_OFFSET k, T& item) {
+
+	    assert(k != 0);
+
+	    shard_type_& s = shard(k);
+	    boost::mutex::scoped_lock lock(s.mutex);
+
+	    item_iterator_ it = s.items.find(k);
+	    if (it == s.items.end())
+		return false;
+
+	    // An unpinned item is no longer a candidate for writeout.
+	    if (it->second.pins++ == 0)
+		s.lru.erase(it->second.lru_pos);
+
+	    item = it->second.item;
+	    return true;
+	}
+
+	template<class T, class W>
+	bool cache_manager_sharded<T,W>::insert(TPIE_OS_OFFSET k, T& item) {
+
+	    assert(k != 0);
+
+	    shard_type_& s = shard(k);
+	    boost::mutex::scoped_lock lock(s.mutex);
+
+	    item_iterator_ it = s.items.find(k);
+	    if (it != s.items.end()) {
+		// Somebody else was faster. Hand out their copy.
+		if (it->second.pins++ == 0)
+		    s.lru.erase(it->second.lru_pos);
+		item = it->second.item;
+		return false;
+	    }
+
+	    entry_type_& e = s.items[k];
+	    e.item = item;
+	    e.pins = 1;
+
+	    evict(s);
+
+	    return true;
+	}
+
+	template<class T, class W>
+	void cache_manager_sharded<T,W>::unpin(TPIE_OS_OFFSET k) {
+
+	    assert(k != 0);
+
+	    shard_type_& s = shard(k);
+	    boost::mutex::scoped_lock lock(s.mutex);
+
+	    item_iterator_ it = s.items.find(k);
+	    assert(it != s.items.end() && it->second.pins > 0);
+
+	    if (--it->second.pins == 0) {
+		s.lru.push_front(k);
+		it->second.lru_pos = s.lru.begin();
+		evict(s);
+	    }
+	}
+
+	template<class T, class W>
+	void cache_manager_sharded<T,W>::evict(shard_type_& s) {
+
+	    // Pinned items may temporarily take the shard over capacity.
+	    while (s.items.size() > assoc_ && !s.lru.empty()) {
+		item_iterator_ it = s.items.find(s.lru.back());
+		writeout_(it->second.item);
+		s.items.erase(it);
+		s.lru.pop_back();
+	    }
+	}
+
+	template<class T, class W>
+	void cache_manager_sharded<T,W>::flush() {
+
+	    TPIE_OS_SIZE_T i;
+
+	    for (i = 0; i < shard_count_; i++) {
+		shard_type_& s = shards_[i];
+		boost::mutex::scoped_lock lock(s.mutex);
+		while (!s.lru.empty()) {
+		    item_iterator_ it = s.items.find(s.lru.back());
+		    writeout_(it->second.item);
+		    s.items.erase(it);
+		    s.lru.pop_back();
+		}
+		if (!s.items.empty()) {
+		    TP_LOG_WARNING_ID("Flushing a cache with pinned items.");
+		}
+	    }
+	}
+
+	template<class T, class W>
+	cache_manager_sharded<T,W>::~cache_manager_sharded() {
+
+	    flush();
+
+	    delete [] shards_;
+	}
+
+    ////////////////////////////////////////////////////////////////////
+    /// Write out function object for a \ref cache_manager_sharded of
+    /// blocks (B*) of a structure shared by several threads. Deleting a
+    /// block writes it back to its collection, so this is done while
+    /// holding the I/O mutex given to the constructor.
+    ////////////////////////////////////////////////////////////////////
+	template<class B>
+	class remove_shared {
+	    boost::mutex* io_mutex_;
+	public:
+	    remove_shared(boost::mutex* io_mutex = NULL): io_mutex_(io_mutex) {}
+	    void operator()(B* p) {
+		boost::mutex::scoped_lock lock(*io_mutex_);
+		delete p;
+	    }
+	};
+
+    }  //  ami namespace
+
+}  //  tpie namespace
+
+#endif // _TPIE_AMI_CACHE_SHARDED_H
@@ -148,6 +148,16 @@ namespace tpie {
 		return !is_valid(); 
 	    }
 	    
+      //////////////////////////////////////////////////////////////////////////
+      /// Start reading the block with ID \p bid into the shared block cache,
+	    /// so that it is in memory when it is read later. This is a hint: it
+	    /// returns at once, and blocks that are cached or in memory are
+	    /// ignored. Tree queries call it for the nodes they visit next.
+	    //////////////////////////////////////////////////////////////////////////
+	    void prefetch(TPIE_BLOCK_ID_TYPE bid) {
+		btec_->prefetch(bid);
+	    }
+
       //////////////////////////////////////////////////////////////////////////
       /// Return a pointer to a 512-byte array stored in the header of the 
 	    /// collection. This can be used by the application to store
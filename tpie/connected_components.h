@@ -0,0 +1,356 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; eval: (progn (c-set-style "stroustrup") (c-set-offset 'innamespace 0)); -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2010, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+///////////////////////////////////////////////////////////////////////////
+/// \file connected_components.h
+/// Connected components of a graph given as a stream of edges.
+///////////////////////////////////////////////////////////////////////////
+
+#ifndef _TPIE_AMI_CONNECTED_COMPONENTS_H
+#define _TPIE_AMI_CONNECTED_COMPONENTS_H
+
+#include <tpie/config.h>
+#include <tpie/portability.h>
+// For pair.
+#include <utility>
+// For vector.
+#include <vector>
+// For sort, unique, lower_bound.
+#include <algorithm>
+
+// TPIE stuff.
+#include <tpie/stream.h>
+#include <tpie/sort.h>
+#include <tpie/mm.h>
+#include <tpie/disjoint_sets.h>
+
+namespace tpie {
+
+namespace ami {
+
+///////////////////////////////////////////////////////////////////////////
+/// Computes connected components; see connected_components().
+///////////////////////////////////////////////////////////////////////////
+template <typename vertex_t>
+class connected_components_op {
+public:
+	/** An edge, or a vertex and its component. */
+	typedef std::pair<vertex_t, vertex_t> edge_t;
+	typedef stream<edge_t> stream_t;
+
+	connected_components_op(TPIE_OS_SIZE_T memory):
+		memory_(memory ? memory: MM_manager.consecutive_memory_available()) {}
+
+	err run(stream_t* edges, stream_t* out);
+
+protected:
+	/** Orders pairs by their second vertex. */
+	class second_cmp {
+	public:
+		int compare(const edge_t& a, const edge_t& b) const {
+			if (a.second != b.second)
+				return a.second < b.second ? -1: 1;
+			return a.first < b.first ? -1: (b.first < a.first ? 1: 0);
+		}
+	};
+
+	/** Whether the edges fit in memory for in_memory(). */
+	bool fits(TPIE_OS_OFFSET n) const {
+		return n * TPIE_OS_OFFSET(sizeof(edge_t) + 2 * sizeof(vertex_t) + 2 * sizeof(TPIE_OS_SIZE_T)) <=
+			TPIE_OS_OFFSET(memory_);
+	}
+
+	/** Union by the smaller representative, which is thus the smallest
+	 * vertex of its set. */
+	template <typename T>
+	static void union_min(disjoint_sets<T>& ds, T a, T b) {
+		a = ds.find_set(a);
+		b = ds.find_set(b);
+		if (a < b)
+			ds.link(a, b);
+		else
+			ds.link(b, a);
+	}
+
+	err in_memory(stream_t* edges, stream_t* out);
+	err semi_external(stream_t* edges, vertex_t n, stream_t* out);
+	err contract(stream_t* edges, stream_t* out);
+	err relabel(stream_t* edges, stream_t* labels, stream_t* out);
+	err compose(stream_t* c1, stream_t* c2, stream_t* out);
+
+	static stream_t* temp() {
+		stream_t* s = new stream_t;
+		s->persist(PERSIST_DELETE);
+		return s;
+	}
+
+	TPIE_OS_SIZE_T memory_;
+};
+
+//// *connected_components_op::run* ////
+	template <typename vertex_t>
+	err connected_components_op<vertex_t>::run(stream_t* edges, stream_t* out) {
+		err ae;
+		edge_t* e;
+		vertex_t n = 0;
+
+		if (edges->stream_len() == 0)
+			return NO_ERROR;
+		if (fits(edges->stream_len()))
+			return in_memory(edges, out);
+
+		// If the vertices are a range that fits in memory, a single scan of
+		// the edges does.
+		edges->seek(0);
+		while ((ae = edges->read_item(&e)) == NO_ERROR)
+			n = std::max(n, vertex_t(std::max(e->first, e->second) + 1));
+		if (ae != END_OF_STREAM)
+			return ae;
+		if (TPIE_OS_OFFSET(n) <= TPIE_OS_OFFSET(disjoint_sets<vertex_t>::memory_fits(memory_)))
+			return semi_external(edges, n, out);
+		return contract(edges, out);
+	}
+
+//// *connected_components_op::in_memory* ////
+	template <typename vertex_t>
+	err connected_components_op<vertex_t>::in_memory(stream_t* edges, stream_t* out) {
+		err ae;
+		edge_t* e;
+		std::vector<edge_t> es;
+		std::vector<vertex_t> vs;
+		TPIE_OS_SIZE_T i;
+
+		es.reserve(static_cast<TPIE_OS_SIZE_T>(edges->stream_len()));
+		edges->seek(0);
+		while ((ae = edges->read_item(&e)) == NO_ERROR)
+			es.push_back(*e);
+		if (ae != END_OF_STREAM)
+			return ae;
+
+		// Number the vertices in order, so the smallest number of a set is
+		// also its smallest vertex.
+		vs.reserve(2 * es.size());
+		for (i = 0; i < es.size(); i++) {
+			vs.push_back(es[i].first);
+			vs.push_back(es[i].second);
+		}
+		std::sort(vs.begin(), vs.end());
+		vs.erase(std::unique(vs.begin(), vs.end()), vs.end());
+
+		disjoint_sets<TPIE_OS_SIZE_T> ds(vs.size());
+		for (i = 0; i < vs.size(); i++)
+			ds.make_set(i);
+		for (i = 0; i < es.size(); i++)
+			union_min(ds,
+					  TPIE_OS_SIZE_T(std::lower_bound(vs.begin(), vs.end(), es[i].first) - vs.begin()),
+					  TPIE_OS_SIZE_T(std::lower_bound(vs.begin(), vs.end(), es[i].second) - vs.begin()));
+
+		for (i = 0; i < vs.size(); i++)
+			if ((ae = out->write_item(edge_t(vs[i], vs[ds.find_set(i)]))) != NO_ERROR)
+				return ae;
+		return NO_ERROR;
+	}
+
+//// *connected_components_op::semi_external* ////
+	template <typename vertex_t>
+	err connected_components_op<vertex_t>::semi_external(stream_t* edges, vertex_t n, stream_t* out) {
+		err ae;
+		edge_t* e;
+		disjoint_sets<vertex_t> ds(static_cast<TPIE_OS_SIZE_T>(n));
+
+		edges->seek(0);
+		while ((ae = edges->read_item(&e)) == NO_ERROR) {
+			if (!ds.is_set(e->first))
+				ds.make_set(e->first);
+			if (!ds.is_set(e->second))
+				ds.make_set(e->second);
+			union_min(ds, e->first, e->second);
+		}
+		if (ae != END_OF_STREAM)
+			return ae;
+
+		for (vertex_t v = 0; v < n; v++)
+			if (ds.is_set(v) && (ae = out->write_item(edge_t(v, ds.find_set(v)))) != NO_ERROR)
+				return ae;
+		return NO_ERROR;
+	}
+
+//// *connected_components_op::contract* ////
+	template <typename vertex_t>
+	err connected_components_op<vertex_t>::contract(stream_t* edges, stream_t* out) {
+		err ae = NO_ERROR;
+		edge_t* e;
+
+		if (edges->stream_len() < 2 || fits(edges->stream_len()))
+			return in_memory(edges, out);
+
+		// Split the edges in halves E1 and E2, find the components C1 of E1,
+		// contract E2 by C1, and find the components C2 of what remains.
+		// The components are then C1 relabeled by C2, plus C2.
+		stream_t* e1 = temp();
+		stream_t* e2 = temp();
+		TPIE_OS_OFFSET half = edges->stream_len() / 2;
+		edges->seek(0);
+		for (TPIE_OS_OFFSET i = 0; (ae = edges->read_item(&e)) == NO_ERROR; i++)
+			if ((ae = (i < half ? e1: e2)->write_item(*e)) != NO_ERROR)
+				break;
+		if (ae == END_OF_STREAM)
+			ae = NO_ERROR;
+
+		stream_t* c1 = temp();
+		if (ae == NO_ERROR)
+			ae = contract(e1, c1);
+		delete e1;
+
+		stream_t* e2c = temp();
+		if (ae == NO_ERROR)
+			ae = relabel(e2, c1, e2c);
+		delete e2;
+
+		stream_t* c2 = temp();
+		if (ae == NO_ERROR && e2c->stream_len() > 0)
+			ae = contract(e2c, c2);
+		delete e2c;
+
+		if (ae == NO_ERROR)
+			ae = compose(c1, c2, out);
+		delete c1;
+		delete c2;
+		return ae;
+	}
+
+//// *connected_components_op::relabel* ////
+	template <typename vertex_t>
+	err connected_components_op<vertex_t>::relabel(stream_t* edges, stream_t* labels, stream_t* out) {
+		err ae = NO_ERROR;
+		edge_t *e, *l;
+		int pass;
+
+		// Replace the first vertices by their labels, swapping the vertices
+		// of each edge, then do the same for the second vertices.
+		stream_t* in = edges;
+		for (pass = 0; pass < 2 && ae == NO_ERROR; pass++) {
+			stream_t* sorted = temp();
+			stream_t* next = (pass == 0) ? temp(): out;
+			ae = sort_or_copy(in, sorted);
+			if (in != edges)
+				delete in;
+
+			sorted->seek(0);
+			labels->seek(0);
+			err le = labels->read_item(&l);
+			while (ae == NO_ERROR && (ae = sorted->read_item(&e)) == NO_ERROR) {
+				while (le == NO_ERROR && l->first < e->first)
+					le = labels->read_item(&l);
+				bool found = (le == NO_ERROR && l->first == e->first);
+				vertex_t v = found ? l->second: e->first;
+				if (pass == 0)
+					ae = next->write_item(edge_t(e->second, v));
+				// A loop within C1 adds nothing. Other loops keep isolated
+				// vertices.
+				else if (!(found && v == e->second))
+					ae = next->write_item(edge_t(e->second, v));
+			}
+			if (ae == END_OF_STREAM)
+				ae = NO_ERROR;
+			delete sorted;
+			in = next;
+		}
+		if (in != out)
+			delete in;
+		return ae;
+	}
+
+//// *connected_components_op::compose* ////
+	template <typename vertex_t>
+	err connected_components_op<vertex_t>::compose(stream_t* c1, stream_t* c2, stream_t* out) {
+		err ae = NO_ERROR;
+		edge_t *a, *b;
+		err be;
+		second_cmp cmp;
+		stream_t* by_label = temp();
+		stream_t* res = temp();
+
+		// Map the labels of C1 through C2.
+		ae = sort_or_copy(c1, by_label, &cmp);
+		by_label->seek(0);
+		c2->seek(0);
+		be = c2->read_item(&b);
+		while (ae == NO_ERROR && (ae = by_label->read_item(&a)) == NO_ERROR) {
+			while (be == NO_ERROR && b->first < a->second)
+				be = c2->read_item(&b);
+			bool found = (be == NO_ERROR && b->first == a->second);
+			ae = res->write_item(edge_t(a->first, found ? b->second: a->second));
+		}
+		if (ae == END_OF_STREAM)
+			ae = NO_ERROR;
+		delete by_label;
+
+		// Add the vertices of C2 not in C1.
+		c1->seek(0);
+		c2->seek(0);
+		err a_e = c1->read_item(&a);
+		while (ae == NO_ERROR && (ae = c2->read_item(&b)) == NO_ERROR) {
+			while (a_e == NO_ERROR && a->first < b->first)
+				a_e = c1->read_item(&a);
+			if (!(a_e == NO_ERROR && a->first == b->first))
+				ae = res->write_item(*b);
+		}
+		if (ae == END_OF_STREAM)
+			ae = NO_ERROR;
+
+		if (ae == NO_ERROR)
+			ae = sort_or_copy(res, out);
+		delete res;
+		return ae;
+	}
+
+///////////////////////////////////////////////////////////////////////////
+/// Finds the connected components of the undirected graph with the edges
+/// of \p edges, and writes a (vertex, component) pair to \p out for each
+/// vertex of an edge, in order of vertex. A component is named by its
+/// smallest vertex. A loop (v, v) makes v an isolated vertex.
+///
+/// Up to \p memory bytes of memory are used (0 means the available
+/// memory). Edges that fit in it are processed in memory with
+/// disjoint_sets. Otherwise, if the vertices are integers less than the
+/// number of disjoint_sets entries that fit, the edges are scanned once
+/// into a disjoint_sets over the vertices (semi-external). Otherwise the
+/// edges are halved recursively as in [Abello, Buchsbaum and Westbrook,
+/// 2002]: the components of the first half contract the second half by
+/// sorting, and the components of both are combined, in
+/// O(sort(E) log(E/M)) I/Os.
+///
+/// The largest value of vertex_t may not be used as a vertex.
+///////////////////////////////////////////////////////////////////////////
+template <typename vertex_t>
+err connected_components(stream<std::pair<vertex_t, vertex_t> >* edges,
+						 stream<std::pair<vertex_t, vertex_t> >* out,
+						 TPIE_OS_SIZE_T memory = 0) {
+	if (edges == NULL || out == NULL) {
+		TP_LOG_WARNING_ID("connected_components: NULL stream. Aborted.");
+		return NULL_POINTER;
+	}
+	connected_components_op<vertex_t> op(memory);
+	return op.run(edges, out);
+}
+
+	} } //end of tpie::ami namespace
+
+#endif //_TPIE_AMI_CONNECTED_COMPONENTS_H
@@ -0,0 +1,103 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2010, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#include <tpie/crc32c.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define TPIE_CRC32C_SSE42 1
+#  include <nmmintrin.h>
+#endif
+
+using namespace tpie;
+
+namespace {
+
+    typedef boost::uint32_t word_t;
+
+    // The reflected Castagnoli polynomial.
+    const word_t polynomial = 0x82f63b78;
+
+    class crc_table {
+    public:
+	crc_table() {
+	    for (word_t ii = 0; ii < 256; ii++) {
+		word_t c = ii;
+		for (int jj = 0; jj < 8; jj++) {
+		    c = (c & 1) ? (c >> 1) ^ polynomial : c >> 1;
+		}
+		m_table[ii] = c;
+	    }
+	}
+
+	word_t update(word_t c, const unsigned char *p, TPIE_OS_SIZE_T n) const {
+	    while (n--) {
+		c = m_table[(c ^ *p++) & 0xff] ^ (c >> 8);
+	    }
+	    return c;
+	}
+
+    private:
+	word_t m_table[256];
+    };
+
+    const crc_table table;
+
+#ifdef TPIE_CRC32C_SSE42
+    __attribute__((target("sse4.2")))
+    word_t update_sse42(word_t c, const unsigned char *p, TPIE_OS_SIZE_T n) {
+	while (n && (reinterpret_cast<TPIE_OS_SIZE_T>(p) & 7)) {
+	    c = _mm_crc32_u8(c, *p++);
+	    n--;
+	}
+#ifdef __x86_64__
+	boost::uint64_t c64 = c;
+	for (; n >= 8; n -= 8, p += 8) {
+	    c64 = _mm_crc32_u64(c64, *reinterpret_cast<const boost::uint64_t *>(p));
+	}
+	c = static_cast<word_t>(c64);
+#endif
+	for (; n >= 4; n -= 4, p += 4) {
+	    c = _mm_crc32_u32(c, *reinterpret_cast<const word_t *>(p));
+	}
+	while (n--) {
+	    c = _mm_crc32_u8(c, *p++);
+	}
+	return c;
+    }
+
+    bool detect_sse42() {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse4.2");
+    }
+
+    const bool has_sse42 = detect_sse42();
+#endif
+
+}
+
+boost::uint32_t tpie::crc32c(const void *data, TPIE_OS_SIZE_T n, boost::uint32_t crc) {
+    const unsigned char *p = static_cast<const unsigned char *>(data);
+    word_t c = ~crc;
+#ifdef TPIE_CRC32C_SSE42
+    if (has_sse42) {
+	return ~update_sse42(c, p, n);
+    }
+#endif
+    return ~table.update(c, p, n);
+}
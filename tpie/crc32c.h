@@ -0,0 +1,45 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2010, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#ifndef _TPIE_CRC32C_H
+#define _TPIE_CRC32C_H
+
+///////////////////////////////////////////////////////////////////////////
+/// \file crc32c.h
+/// CRC-32C (Castagnoli) checksums of blocks.
+///////////////////////////////////////////////////////////////////////////
+
+// Get definitions for working with Unix and Windows
+#include <tpie/portability.h>
+
+#include <boost/cstdint.hpp>
+
+namespace tpie {
+
+///////////////////////////////////////////////////////////////////////////
+/// Extends the CRC-32C \p crc, 0 for none yet, with \p n bytes at
+/// \p data. This is the checksum of iSCSI and ext4; on x86 processors
+/// with SSE 4.2 it is computed with the crc32 instruction, eight bytes at
+/// a time, and otherwise with a table.
+///////////////////////////////////////////////////////////////////////////
+    boost::uint32_t crc32c(const void *data, TPIE_OS_SIZE_T n, boost::uint32_t crc = 0);
+
+}  //  tpie namespace
+
+#endif // _TPIE_CRC32C_H
@@ -0,0 +1,425 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; eval: (progn (c-set-style "stroustrup") (c-set-offset 'innamespace 0)); -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2010, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+///////////////////////////////////////////////////////////////////////////
+/// \file external_hash_map.h
+/// Hash based grouping and joining of key/value pairs that need not fit
+/// in memory.
+///////////////////////////////////////////////////////////////////////////
+
+#ifndef _TPIE_AMI_EXTERNAL_HASH_MAP_H
+#define _TPIE_AMI_EXTERNAL_HASH_MAP_H
+
+#include <tpie/config.h>
+#include <tpie/portability.h>
+// For pair.
+#include <utility>
+// For vector.
+#include <vector>
+// For min, max.
+#include <algorithm>
+#include <boost/cstdint.hpp>
+
+// TPIE stuff.
+#include <tpie/stream.h>
+#include <tpie/mm.h>
+#include <tpie/hash_map.h>
+
+/** Partitioning levels after which a bucket is processed in memory
+ * regardless of its size (all its keys then have the same hash value). */
+#ifndef TPIE_AMI_EXTERNAL_HASH_MAP_MAX_DEPTH
+#  define TPIE_AMI_EXTERNAL_HASH_MAP_MAX_DEPTH  8
+#endif
+
+namespace tpie {
+
+namespace ami {
+
+///////////////////////////////////////////////////////////////////////////
+/// The parameters of an external_hash_map.
+///////////////////////////////////////////////////////////////////////////
+class external_hash_params {
+public:
+	/** Memory (in bytes) for an operation. 0 means the available memory
+	 * at the time of the operation. */
+	TPIE_OS_SIZE_T memory;
+	/** The number of buckets a partitioning pass writes. 0 means as many
+	 * as there are stream buffers for in memory. */
+	TPIE_OS_SIZE_T fanout;
+
+	external_hash_params(): memory(0), fanout(0) {}
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// An external memory hash map of key/data pairs. Pairs are inserted
+/// into a stream, and the operations aggregate() and join() partition
+/// them by a hash of the key into streams (buckets) small enough to be
+/// processed by an in-memory hash_map, splitting large buckets again with
+/// a new hash function. Unlike sort based grouping, inputs that are only
+/// a few times larger than memory take a single partitioning pass.
+/// aggregate() only writes out the pairs of keys that do not fit in its
+/// in-memory map, so inputs with few distinct keys are not partitioned.
+///
+/// The key type must be usable in a hash_map: the default_unused value
+/// of the key may not be inserted.
+///////////////////////////////////////////////////////////////////////////
+template <typename key_t,
+		  typename data_t,
+		  typename hash_t=hash<key_t>,
+		  typename equal_t=std::equal_to<key_t> >
+class external_hash_map {
+public:
+	typedef std::pair<key_t, data_t> value_t;
+	typedef stream<value_t> stream_t;
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Creates an empty map, backed by a temporary stream.
+	///////////////////////////////////////////////////////////////////////////
+	external_hash_map(const external_hash_params& params = external_hash_params());
+
+	~external_hash_map();
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Adds a pair. Keys may be inserted any number of times.
+	///////////////////////////////////////////////////////////////////////////
+	err insert(const key_t& key, const data_t& data) {
+		return items_->write_item(value_t(key, data));
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Groups the pairs by key, and pushes one pair per distinct key to \p
+	/// dest (with begin(), push(const value_t&) and end() methods, as in
+	/// streaming.h). Its data is the first data of the key, combined with
+	/// each further data d of the key by agg(data_t& acc, const data_t& d).
+	/// The keys come in no particular order.
+	///////////////////////////////////////////////////////////////////////////
+	template <typename agg_t, typename dest_t>
+	err aggregate(agg_t agg, dest_t& dest);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Pushes a std::pair<value_t, other value_t> to \p dest for each pair
+	/// of pairs with equal keys, one from this map and one from \p other.
+	/// Each bucket is joined by building a hash table on its smaller side.
+	///////////////////////////////////////////////////////////////////////////
+	template <typename data2_t, typename dest_t>
+	err join(external_hash_map<key_t, data2_t, hash_t, equal_t>& other, dest_t& dest);
+
+	/** The number of pairs inserted. */
+	TPIE_OS_OFFSET size() const {
+		return items_->stream_len();
+	}
+
+	/** The stream of inserted pairs. */
+	stream_t* items() {
+		return items_;
+	}
+
+	const external_hash_params& params() const {
+		return params_;
+	}
+
+protected:
+	template <typename, typename, typename, typename> friend class external_hash_map;
+
+	// Pushes joined pairs to dest, left side first.
+	template <typename dest_t, bool swap>
+	class join_output {
+	public:
+		join_output(dest_t& dest): dest_(dest) {}
+
+		template <typename A, typename B>
+		void push(const A& a, const B& b) {
+			if (swap)
+				dest_.push(std::make_pair(b, a));
+			else
+				dest_.push(std::make_pair(a, b));
+		}
+
+	protected:
+		dest_t& dest_;
+	};
+
+	/** The memory (in bytes) for an operation. */
+	TPIE_OS_SIZE_T memory() const {
+		return params_.memory ? params_.memory: MM_manager.consecutive_memory_available();
+	}
+
+	/** The number of buckets for partitioning stream s, with stream
+	 * buffers like its own taking up to mem bytes. */
+	template <typename T>
+	TPIE_OS_SIZE_T fanout(stream<T>* s, TPIE_OS_SIZE_T mem) const;
+
+	/** The bucket of key at the given partitioning level. */
+	TPIE_OS_SIZE_T bucket(const key_t& key, unsigned int level, TPIE_OS_SIZE_T fanout) const {
+		boost::uint64_t x = (static_cast<boost::uint64_t>(h_(key)) + level) * 0x9E3779B97F4A7C15ULL;
+		x ^= x >> 29;
+		x *= 0xBF58476D1CE4E5B9ULL;
+		x ^= x >> 32;
+		return static_cast<TPIE_OS_SIZE_T>(x % fanout);
+	}
+
+	/** Appends fanout new temporary streams to parts. */
+	template <typename T>
+	static void make_parts(TPIE_OS_SIZE_T fanout, std::vector<stream<T>*>& parts) {
+		for (TPIE_OS_SIZE_T i = 0; i < fanout; i++) {
+			parts.push_back(new stream<T>);
+			parts.back()->persist(PERSIST_DELETE);
+		}
+	}
+
+	template <typename T>
+	err partition(stream<std::pair<key_t, T> >* in, unsigned int level, TPIE_OS_SIZE_T fanout,
+				  std::vector<stream<std::pair<key_t, T> >*>& parts) const;
+
+	template <typename agg_t, typename dest_t>
+	err aggregate(stream_t* in, unsigned int level, agg_t& agg, dest_t& dest);
+
+	template <typename data2_t, typename dest_t>
+	err join(stream_t* left, stream<std::pair<key_t, data2_t> >* right,
+			 unsigned int level, dest_t& dest);
+
+	template <typename A, typename B, typename out_t>
+	err join_in_memory(stream<std::pair<key_t, A> >* build, stream<std::pair<key_t, B> >* probe,
+					   out_t& out);
+
+	/** Deletes the streams of parts. */
+	template <typename T>
+	static void free_parts(std::vector<stream<T>*>& parts) {
+		for (TPIE_OS_SIZE_T i = 0; i < parts.size(); i++)
+			delete parts[i];
+		parts.clear();
+	}
+
+	external_hash_params params_;
+	stream_t* items_;
+	hash_t h_;
+};
+
+//// *external_hash_map::external_hash_map* ////
+	template <typename key_t, typename data_t, typename hash_t, typename equal_t>
+	external_hash_map<key_t, data_t, hash_t, equal_t>::external_hash_map(const external_hash_params& params):
+		params_(params) {
+		items_ = new stream_t;
+		items_->persist(PERSIST_DELETE);
+	}
+
+//// *external_hash_map::~external_hash_map* ////
+	template <typename key_t, typename data_t, typename hash_t, typename equal_t>
+	external_hash_map<key_t, data_t, hash_t, equal_t>::~external_hash_map() {
+		delete items_;
+	}
+
+//// *external_hash_map::fanout* ////
+	template <typename key_t, typename data_t, typename hash_t, typename equal_t>
+	template <typename T>
+	TPIE_OS_SIZE_T external_hash_map<key_t, data_t, hash_t, equal_t>::fanout(stream<T>* s, TPIE_OS_SIZE_T mem) const {
+		if (params_.fanout >= 2)
+			return params_.fanout;
+		// One stream buffer for the input, and one per bucket.
+		TPIE_OS_SIZE_T per_stream = 0;
+		s->main_memory_usage(&per_stream, mem::STREAM_USAGE_MAXIMUM);
+		TPIE_OS_SIZE_T f = per_stream ? mem / per_stream: 0;
+		return std::max(f, TPIE_OS_SIZE_T(3)) - 1;
+	}
+
+//// *external_hash_map::partition* ////
+	template <typename key_t, typename data_t, typename hash_t, typename equal_t>
+	template <typename T>
+	err external_hash_map<key_t, data_t, hash_t, equal_t>::partition(stream<std::pair<key_t, T> >* in,
+																	  unsigned int level,
+																	  TPIE_OS_SIZE_T fanout,
+																	  std::vector<stream<std::pair<key_t, T> >*>& parts) const {
+		typedef std::pair<key_t, T> item_t;
+		err ae = NO_ERROR;
+		item_t* item;
+
+		make_parts(fanout, parts);
+		in->seek(0);
+		while ((ae = in->read_item(&item)) == NO_ERROR)
+			if ((ae = parts[bucket(item->first, level, fanout)]->write_item(*item)) != NO_ERROR)
+				return ae;
+		return (ae == END_OF_STREAM) ? NO_ERROR: ae;
+	}
+
+//// *external_hash_map::aggregate* ////
+	template <typename key_t, typename data_t, typename hash_t, typename equal_t>
+	template <typename agg_t, typename dest_t>
+	err external_hash_map<key_t, data_t, hash_t, equal_t>::aggregate(agg_t agg, dest_t& dest) {
+		dest.begin();
+		err ae = aggregate(items_, 0, agg, dest);
+		dest.end();
+		return ae;
+	}
+
+	template <typename key_t, typename data_t, typename hash_t, typename equal_t>
+	template <typename agg_t, typename dest_t>
+	err external_hash_map<key_t, data_t, hash_t, equal_t>::aggregate(stream_t* in, unsigned int level,
+																	  agg_t& agg, dest_t& dest) {
+		typedef hash_map<key_t, data_t, hash_t, equal_t, swiss_hash_table> map_t;
+		err ae = NO_ERROR;
+		value_t* item;
+		TPIE_OS_OFFSET n = in->stream_len();
+		TPIE_OS_SIZE_T fit = map_t::memory_fits(memory());
+		TPIE_OS_SIZE_T f = 0;
+		std::vector<stream_t*> parts;
+
+		// Hybrid hashing: the keys are aggregated in memory as long as they
+		// fit, and the pairs of any further keys are written to buckets,
+		// which are aggregated afterwards. If the pairs may hold too many
+		// keys, the map gets half the memory and the bucket buffers the
+		// rest. Past the last level, the map grows instead.
+		bool spill = n > TPIE_OS_OFFSET(fit) && level < TPIE_AMI_EXTERNAL_HASH_MAP_MAX_DEPTH;
+		if (spill) {
+			fit = std::max(map_t::memory_fits(memory() / 2), TPIE_OS_SIZE_T(1));
+			f = fanout(in, memory() / 2);
+		}
+		{
+			map_t m(static_cast<TPIE_OS_SIZE_T>(std::min(n, TPIE_OS_OFFSET(fit))));
+			in->seek(0);
+			while ((ae = in->read_item(&item)) == NO_ERROR) {
+				typename map_t::iterator i = m.find(item->first);
+				if (i != m.end())
+					agg(i->second, item->second);
+				else if (!spill || m.size() < fit)
+					m.insert(item->first, item->second);
+				else {
+					if (parts.empty())
+						make_parts(f, parts);
+					if ((ae = parts[bucket(item->first, level, f)]->write_item(*item)) != NO_ERROR)
+						break;
+				}
+			}
+			if (ae != END_OF_STREAM) {
+				free_parts(parts);
+				return ae;
+			}
+			for (typename map_t::iterator i = m.begin(); i != m.end(); ++i)
+				dest.push(*i);
+		}
+
+		ae = NO_ERROR;
+		for (TPIE_OS_SIZE_T i = 0; i < parts.size() && ae == NO_ERROR; i++)
+			if (parts[i]->stream_len() > 0)
+				ae = aggregate(parts[i], level + 1, agg, dest);
+		free_parts(parts);
+		return ae;
+	}
+
+//// *external_hash_map::join* ////
+	template <typename key_t, typename data_t, typename hash_t, typename equal_t>
+	template <typename data2_t, typename dest_t>
+	err external_hash_map<key_t, data_t, hash_t, equal_t>::join(external_hash_map<key_t, data2_t, hash_t, equal_t>& other,
+																 dest_t& dest) {
+		dest.begin();
+		err ae = join(items_, other.items_, 0, dest);
+		dest.end();
+		return ae;
+	}
+
+	template <typename key_t, typename data_t, typename hash_t, typename equal_t>
+	template <typename data2_t, typename dest_t>
+	err external_hash_map<key_t, data_t, hash_t, equal_t>::join(stream_t* left,
+																 stream<std::pair<key_t, data2_t> >* right,
+																 unsigned int level, dest_t& dest) {
+		typedef stream<std::pair<key_t, data2_t> > right_t;
+		typedef hash_map<key_t, TPIE_OS_SIZE_T, hash_t, equal_t, swiss_hash_table> map_t;
+		err ae = NO_ERROR;
+
+		// Build on the smaller side, if it fits.
+		bool left_build = left->stream_len() <= right->stream_len();
+		TPIE_OS_OFFSET n = left_build ? left->stream_len(): right->stream_len();
+		double per_item = map_t::memory_coefficient() + sizeof(TPIE_OS_SIZE_T) +
+			(left_build ? sizeof(value_t): sizeof(typename right_t::item_type));
+		TPIE_OS_SIZE_T mem = memory();
+		bool fits = n * per_item + map_t::memory_overhead() <= mem;
+
+		if (n == 0)
+			return NO_ERROR;
+
+		if (fits || level >= TPIE_AMI_EXTERNAL_HASH_MAP_MAX_DEPTH) {
+			if (left_build) {
+				join_output<dest_t, false> out(dest);
+				return join_in_memory(left, right, out);
+			} else {
+				join_output<dest_t, true> out(dest);
+				return join_in_memory(right, left, out);
+			}
+		}
+
+		// Split both sides with the same function and join the buckets.
+		TPIE_OS_SIZE_T f = std::min(fanout(left, mem), fanout(right, mem));
+		std::vector<stream_t*> left_parts;
+		std::vector<right_t*> right_parts;
+		if ((ae = partition(left, level, f, left_parts)) == NO_ERROR)
+			ae = partition(right, level, f, right_parts);
+		for (TPIE_OS_SIZE_T i = 0; i < f && ae == NO_ERROR; i++)
+			ae = join(left_parts[i], right_parts[i], level + 1, dest);
+		free_parts(left_parts);
+		free_parts(right_parts);
+		return ae;
+	}
+
+//// *external_hash_map::join_in_memory* ////
+	template <typename key_t, typename data_t, typename hash_t, typename equal_t>
+	template <typename A, typename B, typename out_t>
+	err external_hash_map<key_t, data_t, hash_t, equal_t>::join_in_memory(stream<std::pair<key_t, A> >* build,
+																		   stream<std::pair<key_t, B> >* probe,
+																		   out_t& out) {
+		typedef hash_map<key_t, TPIE_OS_SIZE_T, hash_t, equal_t, swiss_hash_table> map_t;
+		const TPIE_OS_SIZE_T none = std::numeric_limits<TPIE_OS_SIZE_T>::max();
+		err ae = NO_ERROR;
+		std::pair<key_t, A>* a;
+		std::pair<key_t, B>* b;
+
+		// The build side, with the items of each key chained together.
+		TPIE_OS_SIZE_T n = static_cast<TPIE_OS_SIZE_T>(build->stream_len());
+		std::vector<std::pair<key_t, A> > items;
+		std::vector<TPIE_OS_SIZE_T> next;
+		items.reserve(n);
+		next.reserve(n);
+		map_t heads(n);
+		build->seek(0);
+		while ((ae = build->read_item(&a)) == NO_ERROR) {
+			typename map_t::iterator i = heads.find(a->first);
+			if (i == heads.end()) {
+				next.push_back(none);
+				heads.insert(a->first, items.size());
+			} else {
+				next.push_back(i->second);
+				i->second = items.size();
+			}
+			items.push_back(*a);
+		}
+		if (ae != END_OF_STREAM)
+			return ae;
+
+		probe->seek(0);
+		while ((ae = probe->read_item(&b)) == NO_ERROR) {
+			typename map_t::iterator i = heads.find(b->first);
+			if (i == heads.end())
+				continue;
+			for (TPIE_OS_SIZE_T j = i->second; j != none; j = next[j])
+				out.push(items[j], *b);
+		}
+		return (ae == END_OF_STREAM) ? NO_ERROR: ae;
+	}
+
+	} } //end of tpie::ami namespace
+
+#endif //_TPIE_AMI_EXTERNAL_HASH_MAP_H
@@ -17,199 +17,339 @@
 // You should have received a copy of the GNU Lesser General Public License
 // along with TPIE.  If not, see <http://www.gnu.org/licenses/>
 
+
 // General permutation.
 #ifndef _TPIE_AMI_GEN_PERM_H
 #define _TPIE_AMI_GEN_PERM_H
 
 // Get definitions for working with Unix and Windows
 #include <tpie/portability.h>
-// Get AMI_scan_object.
-#include <tpie/scan.h>
-// Get AMI_sort
-#include <tpie/sort.h>
+// Get the stream.
+#include <tpie/stream.h>
 
 #include <tpie/gen_perm_object.h>
 
+#include <string>
+#include <vector>
+#include <algorithm>
+
 namespace tpie {
 
     namespace ami {
-	
-// (tavi) moved dest_obj definition down due to error in gcc 2.8.1
-	template<class T> class dest_obj;
-	
-// A comparison operator that simply compares destinations (for sorting).
-	template<class T>
-	int operator<(const dest_obj<T> &s, const dest_obj<T> &t) {
-	    return s.dest < t.dest;
-	}
-	
+
+	///////////////////////////////////////////////////////////////////
+	/// An item labelled with its destination, as stored in the bucket
+	/// streams of permute().
+	///////////////////////////////////////////////////////////////////
 	template<class T>
-	int operator>(const dest_obj<T> &s, const dest_obj<T> &t) {
-	    return s.dest > t.dest;
-	}
-	
-    }  //  ami namespace
+	struct permute_item {
+	    TPIE_OS_OFFSET dest;
+	    T item;
 
-}  //  tpie namespace
+	    permute_item() : dest(0), item() {}
+	    permute_item(TPIE_OS_OFFSET d, const T &t) : dest(d), item(t) {}
+	};
 
-namespace tpie {
-    
-    namespace ami {
-	
-	template<class T>
-	class gen_perm_add_dest : scan_object {
+	///////////////////////////////////////////////////////////////////
+	/// Adapts a gen_perm_object to the destination functor of
+	/// permute().
+	///////////////////////////////////////////////////////////////////
+	class gen_perm_destination {
 
-	private:
-	    // Prohibit these
-	    gen_perm_add_dest(const gen_perm_add_dest<T>& other);
-	    gen_perm_add_dest<T> operator=(const gen_perm_add_dest<T>& other);
-	    
-	    gen_perm_object *pgp;
-	    TPIE_OS_OFFSET input_offset;
-	    
 	public:
-	    gen_perm_add_dest(gen_perm_object *gpo) : pgp(gpo), input_offset(0) {
-		//  No code in this constructor.
-	    };
+	    gen_perm_destination(gen_perm_object *gpo) : m_gpo(gpo) {}
 
-	    virtual ~gen_perm_add_dest(void) {
-		//  No code in this destructor.
-	    };
-	    
-	    err initialize(void) {
-		input_offset = 0; 
-		return NO_ERROR; 
-	    };
+	    TPIE_OS_OFFSET operator()(TPIE_OS_OFFSET src) {
+		return m_gpo->destination(src);
+	    }
 
-	    err operate(const T &in, SCAN_FLAG *sfin, dest_obj<T> *out, SCAN_FLAG *sfout) {
-		if ((*sfout = *sfin) == 0) {
-		    return SCAN_DONE;
-		}
+	private:
+	    gen_perm_object *m_gpo;
+	};
 
-		*out = dest_obj<T>(in, pgp->destination(input_offset++));
+	///////////////////////////////////////////////////////////////////
+	/// Moves the items of a stream to the destinations given by a
+	/// functor; see permute().
+	///////////////////////////////////////////////////////////////////
+	template<class T, class F>
+	class permute_op {
 
-		return SCAN_CONTINUE;
-	    }
-	};
+	public:
+	    typedef permute_item<T> item_t;
 
-    }  //  ami namespace
+	    permute_op(F &dest, TPIE_OS_SIZE_T memory) :
+		m_dest(dest), m_memory(memory), m_capacity(0), m_fanout(0),
+		m_passes(0) {}
 
-}  // tpie namespace
-    
+	    err run(stream<T> *instream, stream<T> *outstream);
 
-namespace tpie {
+	    /** The number of passes over the data made by the last run(). */
+	    int passes() const { return m_passes; }
 
-    namespace ami {
-	
-	template<class T>
-	class gen_perm_strip_dest : scan_object {
-	    
-	public:
-	    err initialize(void) { 
-		return NO_ERROR; 
+	private:
+	    // Reads the input, computing the destinations on the fly.
+	    class source {
+	    public:
+		source(stream<T> *s, F &dest) : m_s(s), m_dest(dest), m_offset(0) {}
+		err next(const T *&item, TPIE_OS_OFFSET &dest) {
+		    T *t;
+		    err ae = m_s->read_item(&t);
+		    if (ae == NO_ERROR) {
+			item = t;
+			dest = m_dest(m_offset++);
+		    }
+		    return ae;
+		}
+	    private:
+		stream<T> *m_s;
+		F &m_dest;
+		TPIE_OS_OFFSET m_offset;
 	    };
-	    
-	    err operate(const dest_obj<T> &in, SCAN_FLAG *sfin, T *out, SCAN_FLAG *sfout) {
 
-		if ((*sfout = *sfin)==0) {
-		    return SCAN_DONE;
+	    // Reads a bucket written by distribute().
+	    class bucket_source {
+	    public:
+		bucket_source(stream<item_t> *s) : m_s(s) {}
+		err next(const T *&item, TPIE_OS_OFFSET &dest) {
+		    item_t *t;
+		    err ae = m_s->read_item(&t);
+		    if (ae == NO_ERROR) {
+			item = &t->item;
+			dest = t->dest;
+		    }
+		    return ae;
 		}
+	    private:
+		stream<item_t> *m_s;
+	    };
 
-		*out = in.t;
-		
-		return SCAN_CONTINUE;
-	    }
+	    template<class S>
+	    err permute_range(S &src, TPIE_OS_OFFSET lo, TPIE_OS_OFFSET len,
+			      stream<T> *outstream, int depth);
+
+	    template<class S>
+	    err place(S &src, TPIE_OS_OFFSET lo, TPIE_OS_OFFSET len,
+		      stream<T> *outstream);
+
+	    template<class S>
+	    err distribute(S &src, TPIE_OS_OFFSET lo, TPIE_OS_OFFSET len,
+			   stream<T> *outstream, int depth);
+
+	    F &m_dest;
+	    TPIE_OS_SIZE_T m_memory;
+	    // Items per memoryload, and buckets per distribution.
+	    TPIE_OS_OFFSET m_capacity;
+	    TPIE_OS_OFFSET m_fanout;
+	    int m_passes;
 	};
 
-    }  //  ami namespace
+//// *permute_op::run* ////
+	template<class T, class F>
+	err permute_op<T, F>::run(stream<T> *instream, stream<T> *outstream) {
+	    err ae;
+	    TPIE_OS_SIZE_T sz_avail = m_memory ? m_memory : MM_manager.memory_available();
+	    TPIE_OS_SIZE_T sz_stream, sz_bucket;
 
-}  //  tpie namespace
+	    m_passes = 0;
+	    if ((ae = instream->main_memory_usage(&sz_stream,
+						  mem::STREAM_USAGE_MAXIMUM)) != NO_ERROR) {
+		return ae;
+	    }
+	    {
+		stream<item_t> probe;
+		if ((ae = probe.main_memory_usage(&sz_bucket,
+						  mem::STREAM_USAGE_MAXIMUM)) != NO_ERROR) {
+		    return ae;
+		}
+	    }
 
-namespace tpie {
+	    // A memoryload is placed with the source and the output stream
+	    // open, and needs a bit per item to catch repeated destinations.
+	    // A distribution has the source and one stream per bucket open.
+	    TPIE_OS_SIZE_T sz_fixed = std::max(sz_stream, sz_bucket) + sz_stream;
+	    if (sz_avail <= sz_fixed + sz_bucket) {
+		TP_LOG_WARNING_ID("permute: not enough memory.");
+		return INSUFFICIENT_MAIN_MEMORY;
+	    }
+	    m_capacity = (sz_avail - sz_fixed) / (sizeof(T) + 1);
+	    m_fanout = (sz_avail - std::max(sz_stream, sz_bucket)) /
+		(sz_bucket + sizeof(stream<item_t> *) + sizeof(std::string));
+	    {
+		int available = instream->available_streams();
+		if (available != -1 && m_fanout > TPIE_OS_OFFSET(available - 2)) {
+		    m_fanout = available - 2;
+		}
+	    }
 
-    namespace ami {
+	    TPIE_OS_OFFSET len = instream->stream_len();
+	    if (len > m_capacity && m_fanout < 2) {
+		TP_LOG_WARNING_ID("permute: not enough memory for two buckets.");
+		return INSUFFICIENT_MAIN_MEMORY;
+	    }
 
-	template<class T>
-	class dest_obj {
+	    instream->seek(0);
+	    source src(instream, m_dest);
+	    return permute_range(src, 0, len, outstream, 0);
+	}
 
-	private:
-	    T t;
+//// *permute_op::permute_range* ////
+	template<class T, class F>
+	template<class S>
+	err permute_op<T, F>::permute_range(S &src, TPIE_OS_OFFSET lo, TPIE_OS_OFFSET len,
+					    stream<T> *outstream, int depth) {
+	    m_passes = std::max(m_passes, depth + 1);
+	    if (len <= m_capacity) {
+		return place(src, lo, len, outstream);
+	    }
+	    return distribute(src, lo, len, outstream, depth);
+	}
+
+//// *permute_op::place* ////
+	template<class T, class F>
+	template<class S>
+	err permute_op<T, F>::place(S &src, TPIE_OS_OFFSET lo, TPIE_OS_OFFSET len,
+				    stream<T> *outstream) {
+	    err ae;
+	    const T *item;
 	    TPIE_OS_OFFSET dest;
+	    TPIE_OS_SIZE_T n = static_cast<TPIE_OS_SIZE_T>(len);
+	    std::vector<T> buf(n);
+	    std::vector<bool> filled(n, false);
+	    TPIE_OS_SIZE_T count = 0;
+
+	    while ((ae = src.next(item, dest)) == NO_ERROR) {
+		TPIE_OS_OFFSET ii = dest - lo;
+		if (ii < 0 || ii >= len || filled[ii]) {
+		    TP_LOG_WARNING_ID("permute: destinations are not a permutation.");
+		    return OBJECT_INVALID;
+		}
+		buf[ii] = *item;
+		filled[ii] = true;
+		++count;
+	    }
+	    if (ae != END_OF_STREAM) {
+		return ae;
+	    }
+	    if (count != n) {
+		TP_LOG_WARNING_ID("permute: destinations are not a permutation.");
+		return OBJECT_INVALID;
+	    }
+	    return n ? outstream->write_array(&buf[0], n) : NO_ERROR;
+	}
 
-	public:
-	    dest_obj() : t(), dest(0) {
-		//  No code in this constructor.
-	    };
-	    
-	    dest_obj(T t_in, TPIE_OS_OFFSET d) : t(t_in), dest(d) {
-		//  No code in this constructor
-	    };
-	    
-	    ~dest_obj() {
-		//  No code in this destructor.
-	    };
+//// *permute_op::distribute* ////
+	template<class T, class F>
+	template<class S>
+	err permute_op<T, F>::distribute(S &src, TPIE_OS_OFFSET lo, TPIE_OS_OFFSET len,
+					 stream<T> *outstream, int depth) {
+	    err ae;
+	    const T *item;
+	    TPIE_OS_OFFSET dest;
+	    TPIE_OS_OFFSET ii;
 
-	    
-	    // The second alternative caused problems on Win32 (jv)
-//#if (__GNUC__ > 2) || (__GNUC__ == 2 &&  __GNUC_MINOR__ >= 8)
-	    friend int operator< <> (const dest_obj<T> &s, const dest_obj<T> &t);
-	    friend int operator> <> (const dest_obj<T> &s, const dest_obj<T> &t);
-//#else
-//    friend int operator< (const dest_obj<T> &s, const dest_obj<T> &t);
-//    friend int operator> (const dest_obj<T> &s, const dest_obj<T> &t);
-//#endif
-	    friend err gen_perm_strip_dest<T>::operate(const dest_obj<T> &in,
-						       SCAN_FLAG *sfin, T *out,
-						       SCAN_FLAG *sfout);
-	};
+	    // Bucket ii holds the destinations from lo + ii * width. Use no
+	    // more buckets than needed to get memoryloads.
+	    TPIE_OS_OFFSET buckets = std::min(m_fanout, (len + m_capacity - 1) / m_capacity);
+	    TPIE_OS_OFFSET width = (len + buckets - 1) / buckets;
+	    buckets = (len + width - 1) / width;
 
-    }  //  ami namespace
+	    std::vector<stream<item_t> *> out(static_cast<TPIE_OS_SIZE_T>(buckets));
+	    for (ii = 0; ii < buckets; ii++) {
+		out[ii] = new stream<item_t>;
+	    }
 
-}  //  tpie namespace
+	    while ((ae = src.next(item, dest)) == NO_ERROR) {
+		if (dest < lo || dest >= lo + len) {
+		    TP_LOG_WARNING_ID("permute: destinations are not a permutation.");
+		    ae = OBJECT_INVALID;
+		    break;
+		}
+		if ((ae = out[(dest - lo) / width]->write_item(item_t(dest, *item))) != NO_ERROR) {
+		    break;
+		}
+	    }
+	    if (ae != END_OF_STREAM) {
+		for (ii = 0; ii < buckets; ii++) {
+		    delete out[ii];
+		}
+		return ae;
+	    }
+	    ae = NO_ERROR;
+
+	    // Keep only the names, so that the memory of the buckets is free
+	    // for the recursion.
+	    std::vector<std::string> names(static_cast<TPIE_OS_SIZE_T>(buckets));
+	    for (ii = 0; ii < buckets; ii++) {
+		if (out[ii]->stream_len() != std::min(width, len - ii * width)) {
+		    ae = OBJECT_INVALID;
+		}
+		names[ii] = out[ii]->name();
+		out[ii]->persist(ae == NO_ERROR ? PERSIST_PERSISTENT : PERSIST_DELETE);
+		delete out[ii];
+	    }
+	    if (ae != NO_ERROR) {
+		TP_LOG_WARNING_ID("permute: destinations are not a permutation.");
+		return ae;
+	    }
 
+	    for (ii = 0; ii < buckets; ii++) {
+		stream<item_t> *bucket = new stream<item_t>(names[ii]);
+		bucket->persist(PERSIST_DELETE);
+		if (ae == NO_ERROR) {
+		    bucket->seek(0);
+		    bucket_source bsrc(bucket);
+		    ae = permute_range(bsrc, lo + ii * width,
+				       std::min(width, len - ii * width), outstream, depth + 1);
+		}
+		delete bucket;
+	    }
+	    return ae;
+	}
 
-namespace tpie {
+///////////////////////////////////////////////////////////////////////////
+/// Writes the items of \p instream to \p outstream so that the item at
+/// offset i ends up at offset dest(i). \p dest is a functor from
+/// TPIE_OS_OFFSET to TPIE_OS_OFFSET, and must be a permutation of the
+/// offsets of \p instream.
+///
+/// The destinations are computed while the input is read, and the items
+/// are distributed by destination into as many buckets as \p memory
+/// (0 means all available memory) has room for, recursively, until a
+/// bucket fits in memory and is placed directly. This takes one pass
+/// when the stream fits in memory and two when the buckets of one
+/// distribution do. Returns OBJECT_INVALID if \p dest is not a
+/// permutation.
+///////////////////////////////////////////////////////////////////////////
+	template<class T, class F>
+	err permute(stream<T> *instream, stream<T> *outstream, F &dest,
+		    TPIE_OS_SIZE_T memory = 0) {
+	    if (instream == NULL || outstream == NULL) {
+		TP_LOG_WARNING_ID("permute: NULL stream. Aborted.");
+		return NULL_POINTER;
+	    }
+	    permute_op<T, F> op(dest, memory);
+	    return op.run(instream, outstream);
+	}
 
-    namespace ami {
-	
+///////////////////////////////////////////////////////////////////////////
+/// Permutes \p instream into \p outstream with permute(), taking the
+/// destinations from \p gpo after initializing it with the stream length.
+///////////////////////////////////////////////////////////////////////////
 	template<class T>
 	err general_permute(stream<T> *instream, stream<T> *outstream,
 			    gen_perm_object *gpo) {
-	    
 	    err ae;
-	    gen_perm_add_dest<T> gpad(gpo);
-	    gen_perm_strip_dest<T> gpsd;
-	    stream< dest_obj<T> > sdo_in;
-	    stream< dest_obj<T> > sdo_out;
-	    
+
 	    // Initialize
 	    ae = gpo->initialize(instream->stream_len());
 	    if (ae != NO_ERROR) {
 		return ae;
 	    }
-    
-	    // Scan the stream, producing an output stream that labels each
-	    // item with its destination.
-	    ae = scan(instream, &gpad,&sdo_in);	    
-	    if (ae != NO_ERROR) {
-		return ae;
-	    }
-	    
-	    // Sort by destination.
-	    ae = sort(&sdo_in, &sdo_out);
-	    if (ae != NO_ERROR) {
-		return ae;
-	    }
-	    
-	    // Scan to strip off the destinations.
-	    ae = scan(&sdo_out, &gpsd, outstream);	    
-	    if (ae != NO_ERROR) {
-		return ae;
-	    }
-	    
-	    return NO_ERROR;        
+
+	    gen_perm_destination dest(gpo);
+	    return permute(instream, outstream, dest);
 	}
-	
+
     }  //  ami namespace
 
 }  //  tpie namespace
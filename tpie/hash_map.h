@@ -25,6 +25,10 @@
 #include <algorithm>
 #include <iostream>
 #include <tpie/prime.h>
+#include <boost/cstdint.hpp>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 namespace tpie {
 
@@ -218,11 +222,260 @@ public:
  	}
 };
 
+///////////////////////////////////////////////////////////////////////////
+/// Open addressing hash table in the style of Google's Swiss tables. The
+/// capacity is a power of two, so slots are found by masking rather than
+/// by division. The slots come in groups of 16, each with 16 control
+/// bytes in front of its elements. A control byte holds seven bits of the
+/// hash of its element, or marks the slot as empty or deleted. A probe
+/// matches all control bytes of a group at once (using SSE2 where
+/// available) and only compares the elements whose byte matches, which
+/// are usually on the same or the next cache line.
+///
+/// The table grows by doubling when 7/8 of it is used, so it need not be
+/// sized up front. Deleted slots are cleared out within the table, so as
+/// long as it holds no more elements than it was resized for, it stays
+/// within memory_usage() of that count.
+///////////////////////////////////////////////////////////////////////////
+template <typename value_t, typename hash_t, typename equal_t>
+class swiss_hash_table {
+private:
+	typedef boost::uint8_t ctrl_t;
+	static const float sc;
+	static const size_t group_size = 16;
+	static const ctrl_t ctrl_empty = 0x80;
+	static const ctrl_t ctrl_deleted = 0xFE;
+
+	struct group_t {
+		ctrl_t ctrl[group_size];
+		value_t elements[group_size];
+	};
+
+	// One extra group, whose elements are unused, where iteration stops.
+	array<group_t> groups;
+	size_t mask;
+	size_t growth_left;
+  	hash_t h;
+ 	equal_t e;
+
+	// The bits of the slots in group g whose control byte is b.
+	static inline boost::uint32_t match(const group_t & g, ctrl_t b) {
+#ifdef __SSE2__
+		__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i *>(g.ctrl));
+		return _mm_movemask_epi8(_mm_cmpeq_epi8(c, _mm_set1_epi8(static_cast<char>(b))));
+#else
+		boost::uint32_t m = 0;
+		for (size_t i=0; i < group_size; ++i)
+			if (g.ctrl[i] == b) m |= 1u << i;
+		return m;
+#endif
+	}
+
+	// The bits of the empty and deleted slots in group g.
+	static inline boost::uint32_t match_free(const group_t & g) {
+#ifdef __SSE2__
+		return _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(g.ctrl)));
+#else
+		boost::uint32_t m = 0;
+		for (size_t i=0; i < group_size; ++i)
+			if (g.ctrl[i] & 0x80) m |= 1u << i;
+		return m;
+#endif
+	}
+
+	static inline size_t first_bit(boost::uint32_t m) {
+#ifdef __GNUC__
+		return __builtin_ctz(m);
+#else
+		size_t i=0;
+		while (!(m & 1)) {m >>= 1; ++i;}
+		return i;
+#endif
+	}
+
+	// Spread the user hash over all bits: the low seven bits go in the
+	// control byte, the rest pick the first group to probe.
+	inline boost::uint64_t hash_of(const value_t & v) const {
+		boost::uint64_t x = static_cast<boost::uint64_t>(h(v)) * 0x9E3779B97F4A7C15ULL;
+		return x ^ (x >> 32);
+	}
+
+	inline ctrl_t & ctrl_at(size_t i) {return groups[i / group_size].ctrl[i % group_size];}
+	inline const ctrl_t & ctrl_at(size_t i) const {return groups[i / group_size].ctrl[i % group_size];}
+
+	// The first empty or deleted slot on the probe sequence of hv.
+	inline size_t find_free(boost::uint64_t hv) const {
+		size_t g = (hv >> 7) & mask;
+		for (size_t step = 1; true; ++step) {
+			boost::uint32_t m = match_free(groups[g]);
+			if (m) return g*group_size + first_bit(m);
+			g = (g + step) & mask;
+		}
+	}
+
+	// The slot of val, or end() if it is not in the table. In the latter
+	// case, free is set to the first empty or deleted slot on the way.
+	inline size_t probe(const value_t & val, boost::uint64_t hv, size_t & free) const {
+		ctrl_t h2 = static_cast<ctrl_t>(hv & 0x7F);
+		size_t g = (hv >> 7) & mask;
+		free = end();
+		for (size_t step = 1; true; ++step) {
+			const group_t & grp = groups[g];
+			for (boost::uint32_t m = match(grp, h2); m; m &= m - 1) {
+				size_t i = first_bit(m);
+				if (e(grp.elements[i], val)) return g*group_size + i;
+			}
+			boost::uint32_t f = match_free(grp);
+			if (f && free == end()) free = g*group_size + first_bit(f);
+			if (match(grp, ctrl_empty)) return end();
+			g = (g + step) & mask;
+		}
+	}
+
+	inline void place(size_t i, boost::uint64_t hv, const value_t & val) {
+		ctrl_t & c = ctrl_at(i);
+		if (c == ctrl_empty) --growth_left;
+		c = static_cast<ctrl_t>(hv & 0x7F);
+		get(i) = val;
+	}
+
+	void allocate(size_t capacity) {
+		groups.resize(capacity / group_size + 1);
+		for (size_t g=0; g < groups.size(); ++g)
+			for (size_t i=0; i < group_size; ++i) {
+				groups[g].ctrl[i] = ctrl_empty;
+				groups[g].elements[i] = unused;
+			}
+		mask = capacity / group_size - 1;
+		growth_left = capacity - capacity / 8;
+	}
+
+	static size_t capacity_for(size_t element_count) {
+		size_t c = group_size;
+		while (c - c / 8 < element_count) c *= 2;
+		return c;
+	}
+
+	// Clear out the deleted slots within the table. First every deleted
+	// slot is made empty and every element is marked as deleted. Then each
+	// marked element goes to the first free slot on its probe sequence:
+	// it stays if that is in its own group, moves if that slot is empty,
+	// and otherwise swaps places with the marked element found there,
+	// which is placed next.
+	void drop_deleted() {
+		size_t capacity = end();
+		for (size_t i=0; i < capacity; ++i) {
+			ctrl_t & c = ctrl_at(i);
+			c = (c & 0x80) ? ctrl_empty : ctrl_deleted;
+		}
+		for (size_t i=0; i < capacity; ++i) {
+			if (ctrl_at(i) != ctrl_deleted) continue;
+			boost::uint64_t hv = hash_of(get(i));
+			ctrl_t h2 = static_cast<ctrl_t>(hv & 0x7F);
+			size_t j = find_free(hv);
+			if (j / group_size == i / group_size) {
+				ctrl_at(i) = h2;
+			} else if (ctrl_at(j) == ctrl_empty) {
+				ctrl_at(j) = h2;
+				get(j) = get(i);
+				ctrl_at(i) = ctrl_empty;
+				get(i) = unused;
+			} else {
+				ctrl_at(j) = h2;
+				std::swap(get(i), get(j));
+				--i;
+			}
+		}
+		growth_left = capacity - capacity / 8 - size;
+	}
+
+	// Move the elements to a table of the given capacity.
+	void rehash(size_t capacity) {
+		array<group_t> old;
+		old.swap(groups);
+		allocate(capacity);
+		for (size_t g=0; g+1 < old.size(); ++g)
+			for (size_t i=0; i < group_size; ++i) {
+				if (old[g].ctrl[i] & 0x80) continue;
+				boost::uint64_t hv = hash_of(old[g].elements[i]);
+				place(find_free(hv), hv, old[g].elements[i]);
+			}
+	}
+public:
+ 	size_t size;
+  	value_t unused;
+
+	static double memory_coefficient() {
+		return array<group_t>::memory_coefficient() / group_size * sc;
+	}
+
+	static double memory_overhead() {
+		return array<group_t>::memory_coefficient() * 2
+			+ array<group_t>::memory_overhead() + sizeof(swiss_hash_table) - sizeof(array<group_t>);
+	}
+
+	void resize(size_t element_count) {
+		allocate(capacity_for(element_count));
+		size = 0;
+	}
+
+	swiss_hash_table(size_t e=0, value_t u=default_unused<value_t>::v()):
+		size(0), unused(u) {resize(e);}
+
+ 	inline size_t find(const value_t & value) const {
+		size_t free;
+		return probe(value, hash_of(value), free);
+ 	}
+
+	inline size_t end() const {return (groups.size() - 1) * group_size;}
+	inline size_t begin() const {
+		if (size == 0) return end();
+		for(size_t i=0; true; ++i)
+			if (!(ctrl_at(i) & 0x80)) return i;
+	}
+
+	value_t & get(size_t idx) {return groups[idx / group_size].elements[idx % group_size];}
+	const value_t & get(size_t idx) const {return groups[idx / group_size].elements[idx % group_size];}
+
+	inline std::pair<size_t, bool> insert(const value_t & val) {
+		boost::uint64_t hv = hash_of(val);
+		size_t i;
+		size_t found = probe(val, hv, i);
+		if (found != end()) return std::make_pair(found, false);
+		if (growth_left == 0 && ctrl_at(i) == ctrl_empty) {
+			// Out of empty slots. Clear out the deleted ones in place if
+			// they make up much of the table, and otherwise double it.
+			if (size < (end() - end() / 8) / 2)
+				drop_deleted();
+			else
+				rehash(end() * 2);
+			i = find_free(hv);
+		}
+		place(i, hv, val);
+		++size;
+		return std::make_pair(i, true);
+	}
+
+ 	inline void erase(const value_t & val) {
+		size_t i = find(val);
+		assert(i != end());
+		// A group that has never been full has not sent any probe on to
+		// the next group, so the slot can be made empty again.
+		if (match(groups[i / group_size], ctrl_empty)) {
+			ctrl_at(i) = ctrl_empty;
+			++growth_left;
+		} else
+			ctrl_at(i) = ctrl_deleted;
+		get(i) = unused;
+ 		--size;
+ 	}
+};
+
 template <typename key_t, 
 		  typename data_t, 
 		  typename hash_t=hash<key_t>,
 		  typename equal_t=std::equal_to<key_t>, 
-		  template <typename value_t, typename hash_t, typename equal_t> class table_t = chaining_hash_table
+		  template <typename, typename, typename> class table_t = chaining_hash_table
 		  >
 class hash_map: public linear_memory_base< hash_map<key_t, data_t, hash_t, equal_t, table_t> > {
 public:
@@ -342,7 +595,7 @@ public:
 template <typename key_t,
 		  typename hash_t=hash<key_t>,
 		  typename equal_t=std::equal_to<key_t>,
-		  template <typename value_t, typename hash_t, typename equal_t> class table_t=linear_probing_hash_table>
+		  template <typename, typename, typename> class table_t=linear_probing_hash_table>
 class hash_set {
 private:
 	typedef table_t<key_t, hash_t, equal_t> tbl_t;
@@ -431,5 +684,18 @@ const float linear_probing_hash_table<value_t, hash_t, equal_t>::sc = 2.0f;
 template <typename value_t, typename hash_t, typename equal_t>
 const float chaining_hash_table<value_t, hash_t, equal_t>::sc = 2.f;
 
+// The power of two capacity is less than 2 * 8/7 times the element count.
+template <typename value_t, typename hash_t, typename equal_t>
+const float swiss_hash_table<value_t, hash_t, equal_t>::sc = 16.f/7.f;
+
+template <typename value_t, typename hash_t, typename equal_t>
+const size_t swiss_hash_table<value_t, hash_t, equal_t>::group_size;
+
+template <typename value_t, typename hash_t, typename equal_t>
+const boost::uint8_t swiss_hash_table<value_t, hash_t, equal_t>::ctrl_empty;
+
+template <typename value_t, typename hash_t, typename equal_t>
+const boost::uint8_t swiss_hash_table<value_t, hash_t, equal_t>::ctrl_deleted;
+
 }
 #endif //__TPIE_HASHMAP_H__
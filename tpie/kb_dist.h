@@ -19,257 +19,231 @@
 
 ///////////////////////////////////////////////////////////////////////////
 /// \file kb_dist.h
-/// Radix based distribution for single or striped AMI layers.
+/// Splitter based distribution of a stream into buckets, for kb_sort().
 ///////////////////////////////////////////////////////////////////////////
 
+#ifndef _TPIE_AMI_KB_DIST_H
+#define _TPIE_AMI_KB_DIST_H
 
 // Get definitions for working with Unix and Windows
 #include <tpie/portability.h>
 
-// If we have not already seen this file with KB_KEY undefined or
-// KB_KEY is defined, we will process the file.
+#include <vector>
+#include <algorithm>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/random/linear_congruential.hpp>
 
-namespace tpie {
+#include <tpie/stream.h>
+#include <tpie/key.h>
 
-    namespace ami {
-	
-#if !(defined(_KB_DIST_H)) || defined(KB_KEY)
-	
-#ifdef KB_KEY
-	
-#define _KB_CONCAT(a,b) a ## b
-#define _KB_DIST(kbk) _KB_CONCAT(kb_dist_,kbk)
-	
-#else
-	
-// KB_KEY is not defined, so set the flag so we won't come through
-// this file again with KB_KEY unset, and set KB_KEY to kb_key
-// temporarily.  We also Set the macro for the name of the function
-// defined in this file.
-	
-#define _KB_DIST_H
-#define KB_KEY kb_key
-	
-#ifdef _HAVE_TEMP_KB_KEY_DEFINITION_
-#error _HAVE_TEMP_KB_KEY_DEFINITION_ already defined.
-#else
-#define _HAVE_TEMP_KB_KEY_DEFINITION_
+// The number of keys sampled per bucket to choose the splitters.
+#ifndef KB_SORT_OVERSAMPLING
+#define KB_SORT_OVERSAMPLING 16
 #endif
-	
-#define _KB_DIST(kbk) kb_dist
-	
-#endif
-
-    }  //  ami namespace
 
-}  //  tpie namespace
-	
-#include <tpie/stream.h>
-#include <tpie/key.h>
-	
+// The sample is read as runs of consecutive items from this many
+// places in the stream, to keep the number of seeks down.
+#ifndef KB_SORT_SAMPLE_WINDOWS
+#define KB_SORT_SAMPLE_WINDOWS 64
+#endif
 
 namespace tpie {
 
     namespace ami {
-	
-// This is a hack.  The reason it is here is that if AMI_STREAM<char>
-// is used directly in the template for AMI_kb_dist() a parse error is
-// generated at compile time.  I suspect this may be a bug in the
-// template instantiation code in g++ 2.6.3.
-	
-#ifndef _DEFINED_TYPE_AMISC_
-#define _DEFINED_TYPE_AMISC_
-	typedef stream<char> type_amisc;
-#endif
-	
+
+	///////////////////////////////////////////////////////////////////
+	/// The key extractor used by kb_sort() by default: the conversion of
+	/// an item to kb_key.
+	///////////////////////////////////////////////////////////////////
 	template<class T>
-	err _KB_DIST(KB_KEY)(stream<T> &instream,
-                             type_amisc &name_stream,
-                             const key_range &range, TPIE_OS_OFFSET &max_size) {
-	    err ae;
-	    
-	    TPIE_OS_SIZE_T sz_avail;
-	    TPIE_OS_SIZE_T single_stream_usage;
-	    
-	    // How many ouput streams will there be?
-	    unsigned int output_streams;
-	    
-	    unsigned int ii;
-	    
-	    // How much main memory do we have?
-	    sz_avail = MM_manager.memory_available ();
-	    
-	    // How much memory does a single stream need in the worst case?
-	    if ((ae = instream.main_memory_usage(&single_stream_usage,
-						 mem::STREAM_USAGE_MAXIMUM)) !=
-		NO_ERROR) {
-		return ae;
+	class kb_key_cast {
+
+	public:
+	    typedef kb_key key_type;
+
+	    key_type operator()(const T &t) const {
+		return static_cast<kb_key>(t);
 	    }
-	    
-	    // How many output streams can we buffer in that amount of space?
-	    // Recall that we also need a pointer and a range for each stream.
-	    output_streams = static_cast<unsigned int>((sz_avail - 
-							2 * single_stream_usage) /
-						       (single_stream_usage + 
-							sizeof(stream<T> *) + 
-							sizeof(range)));
-	    
-	    // We need at least two output streams.
-	    if (output_streams < 2) {
-		return INSUFFICIENT_MAIN_MEMORY;
+	};
+
+	///////////////////////////////////////////////////////////////////
+	/// Distributes a stream into buckets by the key given by a key
+	/// extractor. KeyExtract has a key_type, which must have operator<,
+	/// and a const operator() returning the key of an item. The
+	/// splitters are sampled from the stream by sample(), and bucket i
+	/// of distribute() gets the items with keys from splitter i - 1 up
+	/// to, but not including, splitter i.
+	///////////////////////////////////////////////////////////////////
+	template<class T, class KeyExtract>
+	class kb_distribution {
+
+	public:
+	    typedef typename KeyExtract::key_type key_type;
+
+	    kb_distribution(const KeyExtract &key, TPIE_OS_SIZE_T threads) :
+		m_key(key), m_threads(threads ? threads : 1) {}
+
+	    // Chooses the splitters for at most the given number of buckets
+	    // from a sample of instream. Repeated keys in the sample give
+	    // fewer buckets.
+	    err sample(stream<T> &instream, TPIE_OS_SIZE_T buckets);
+
+	    TPIE_OS_SIZE_T buckets() const { return m_splitters.size() + 1; }
+
+	    // Reads instream in chunks of chunk_len items into chunk, and
+	    // writes each item to out[bucket], batch items at a time.
+	    err distribute(stream<T> &instream, stream<T> **out,
+			   T *chunk, TPIE_OS_SIZE_T chunk_len, TPIE_OS_SIZE_T batch);
+
+	    // Whether the items of bucket i, if any, all have the same key.
+	    bool single_key(TPIE_OS_SIZE_T i) const {
+		return !(m_min[i] < m_max[i]);
 	    }
-	    
-	    // Make sure we don't use more streams than are available.
-	    {
-		unsigned available_streams = instream.available_streams();
-
-#ifdef _WIN32
-		// Suppress warning 4146 (unary minus for unsigned type) once.
-		// Is there a better way to do this (w/o using exceptions)?
-#pragma warning(disable : 4146)
-#endif		
-		if ((available_streams != -1u) &&
-		    (available_streams < output_streams)) {
-		    output_streams = available_streams;
+
+	private:
+	    TPIE_OS_SIZE_T bucket(const key_type &k) const {
+		return std::upper_bound(m_splitters.begin(), m_splitters.end(), k) -
+		    m_splitters.begin();
+	    }
+
+	    void classify(const T *items, TPIE_OS_SIZE_T n, TPIE_OS_SIZE_T *idx) const {
+		for (TPIE_OS_SIZE_T ii = 0; ii < n; ii++) {
+		    idx[ii] = bucket(m_key(items[ii]));
 		}
-#ifdef _WIN32
-		//  Reset to the default state.
-#pragma warning(default : 4146)
-#endif
 	    }
-	    
-#ifdef RADIX_POWER_OF_TWO
-	    // Adjust the number of output streams so that it is a power of two.
-	    
-#endif
-	    
-	    // Create the output streams and initialize the ranges they cover to
-	    // be empty.
-	    
-	    stream<T> **out_streams = new stream<T> *[output_streams];
-	    key_range *out_ranges = new key_range[output_streams];
-	    
-	    for (ii = 0; ii < output_streams; ii++) {
-		
-		// This needs to be fixed to eliminate the max size parameter.
-		// This should be done system-wide.
-		out_streams[ii] = new stream<T>;
-		
-		out_ranges[ii].put_min(KEY_MAX);  // Simulate +infty.
-		out_ranges[ii].put_max(KEY_MIN);  // Simulate -infty
+
+	    KeyExtract m_key;
+	    TPIE_OS_SIZE_T m_threads;
+	    std::vector<key_type> m_splitters;
+	    // The least and greatest key in each bucket.
+	    std::vector<key_type> m_min;
+	    std::vector<key_type> m_max;
+	};
+
+//// *kb_distribution::sample* ////
+	template<class T, class KeyExtract>
+	err kb_distribution<T, KeyExtract>::sample(stream<T> &instream,
+						   TPIE_OS_SIZE_T buckets) {
+	    err ae;
+	    T *item;
+	    TPIE_OS_OFFSET len = instream.stream_len();
+	    TPIE_OS_OFFSET size = std::min(len, TPIE_OS_OFFSET(buckets) * KB_SORT_OVERSAMPLING);
+	    TPIE_OS_OFFSET windows = std::min(size, TPIE_OS_OFFSET(KB_SORT_SAMPLE_WINDOWS));
+	    std::vector<key_type> keys;
+	    boost::rand48 prng(len);
+
+	    m_splitters.clear();
+	    if (windows == 0 || buckets < 2) {
+		return NO_ERROR;
 	    }
-	    
-	    // Scan the input putting each item in the right output stream.
-	    
-	    instream.seek(0);
-	    
-	    unsigned int index_denom = (((range.get_max() - range.get_min()) / output_streams)
-					+ 1);
-	    
-	    //  PLEASE FIX THIS
-	    while (1) {
-		T      *in;
-		kb_key k;
-		
-		ae = instream.read_item(&in);
-		if (ae == END_OF_STREAM) {
-		    break;
-		} else if (ae != NO_ERROR) {
+
+	    // Read a run of size / windows items from a random place in each
+	    // of the windows equal parts of the stream.
+	    TPIE_OS_OFFSET run = size / windows;
+	    TPIE_OS_OFFSET stripe = len / windows;
+	    for (TPIE_OS_OFFSET ww = 0; ww < windows; ww++) {
+		TPIE_OS_OFFSET start = ww * stripe + prng() % (stripe - run + 1);
+		if ((ae = instream.seek(start)) != NO_ERROR) {
 		    return ae;
 		}
-		
-		k = KB_KEY(*in);
-		
-#ifdef AMI_RADIX_POWER_OF_TWO
-		// Do it with shifting and masking.
-		
-#else
-		ii = (k - range.get_min()) / index_denom;
-#endif
-		
-		ae = out_streams[ii]->write_item(*in);
-		if (ae != NO_ERROR) {
-		    return ae;
+		for (TPIE_OS_OFFSET ii = 0; ii < run; ii++) {
+		    if ((ae = instream.read_item(&item)) != NO_ERROR) {
+			return ae;
+		    }
+		    keys.push_back(m_key(*item));
 		}
-		
-		if (k < out_ranges[ii].get_min()) {
-		    out_ranges[ii].put_min(k);
+	    }
+
+	    // Split the sorted sample into equal parts, skipping repeated
+	    // keys.
+	    std::sort(keys.begin(), keys.end());
+	    TPIE_OS_SIZE_T step = std::max(TPIE_OS_SIZE_T(1), keys.size() / buckets);
+	    for (TPIE_OS_SIZE_T ii = step; ii < keys.size(); ii += step) {
+		if (m_splitters.empty() || m_splitters.back() < keys[ii]) {
+		    m_splitters.push_back(keys[ii]);
 		}
-		if (k > out_ranges[ii].get_max()) {
-		    out_ranges[ii].put_max(k);
+		if (m_splitters.size() + 1 == buckets) {
+		    break;
 		}
-		
 	    }
+	    return NO_ERROR;
+	}
 
-	    // Write the names and ranges of all non-empty output streams.	    
-	    for (ii = 0, max_size = 0; ii < output_streams; ++ii) {
-		std::string stream_name;
-		TPIE_OS_OFFSET stream_len;
-		
-		if ((stream_len = out_streams[ii]->stream_len()) > 0) {
-		    
-		    // Is it the biggest one so far?		    
-		    if (stream_len > max_size) {
-			max_size = stream_len;
-		    }
-		    
-		    // Get the and write the name of the stream.		    
-		    stream_name = out_streams[ii]->name();
-		    ae = name_stream.write_array(stream_name.c_str(),
-						 stream_name.size());
-		    if (ae != NO_ERROR) {
-			return ae;
-		    }
-		    ae = name_stream.write_item('\0');
-		    if (ae != NO_ERROR) {
-			return ae;
+//// *kb_distribution::distribute* ////
+	template<class T, class KeyExtract>
+	err kb_distribution<T, KeyExtract>::distribute(stream<T> &instream, stream<T> **out,
+						       T *chunk, TPIE_OS_SIZE_T chunk_len,
+						       TPIE_OS_SIZE_T batch) {
+	    err ae;
+	    TPIE_OS_SIZE_T nb = buckets();
+	    TPIE_OS_SIZE_T ii, bb;
+	    std::vector<T> buf(nb * batch);
+	    std::vector<TPIE_OS_SIZE_T> fill(nb, 0);
+	    std::vector<TPIE_OS_SIZE_T> idx(chunk_len);
+	    TPIE_OS_OFFSET remaining = instream.stream_len();
+
+	    m_min.assign(nb, key_type());
+	    m_max.assign(nb, key_type());
+	    std::vector<bool> seen(nb, false);
+
+	    if ((ae = instream.seek(0)) != NO_ERROR) {
+		return ae;
+	    }
+	    while (remaining > 0) {
+		TPIE_OS_SIZE_T n = static_cast<TPIE_OS_SIZE_T>(std::min(remaining, TPIE_OS_OFFSET(chunk_len)));
+		if ((ae = instream.read_array(chunk, n)) != NO_ERROR) {
+		    return ae;
+		}
+		remaining -= n;
+
+		// Classify the chunk, in parallel if it is large enough, and
+		// then move the items to the batches in order.
+		TPIE_OS_SIZE_T k = m_threads;
+		if (k <= 1 || n < 4096 * k) {
+		    classify(chunk, n, &idx[0]);
+		} else {
+		    boost::thread_group threads;
+		    for (ii = 0; ii < k; ii++) {
+			TPIE_OS_SIZE_T lo = n * ii / k, hi = n * (ii + 1) / k;
+			threads.create_thread(boost::bind(&kb_distribution::classify, this,
+							  chunk + lo, hi - lo, &idx[lo]));
 		    }
-		    
-		    // For purposes of efficiency, and to avoid having another
-		    // stream, we are going to cast the new range to an array of
-		    // characters and tack it onto the stream name stream.
-		    // We then do the same thing with the length of the stream.
-		    
-		    ae = name_stream.write_array(reinterpret_cast<const char*>(out_ranges+ii),
-						 sizeof(key_range));
-		    if (ae != NO_ERROR) {
-			return ae;
+		    threads.join_all();
+		}
+
+		for (ii = 0; ii < n; ii++) {
+		    bb = idx[ii];
+		    key_type key = m_key(chunk[ii]);
+		    if (!seen[bb]) {
+			seen[bb] = true;
+			m_min[bb] = m_max[bb] = key;
+		    } else if (key < m_min[bb]) {
+			m_min[bb] = key;
+		    } else if (m_max[bb] < key) {
+			m_max[bb] = key;
 		    }
-		    
-		    ae = name_stream.write_array(reinterpret_cast<const char*>(&stream_len),
-						 sizeof(stream_len));
-		    if (ae != NO_ERROR) {
-			return ae;
+		    buf[bb * batch + fill[bb]++] = chunk[ii];
+		    if (fill[bb] == batch) {
+			if ((ae = out[bb]->write_array(&buf[bb * batch], batch)) != NO_ERROR) {
+			    return ae;
+			}
+			fill[bb] = 0;
 		    }
-		    
-		    // Make this stream persist on disk since it is not empty.
-		    out_streams[ii]->persist(PERSIST_PERSISTENT);
-		    
 		}
+	    }
 
-		// Delete the stream.
-		delete out_streams[ii];
-		
+	    for (bb = 0; bb < nb; bb++) {
+		if (fill[bb] &&
+		    (ae = out[bb]->write_array(&buf[bb * batch], fill[bb])) != NO_ERROR) {
+		    return ae;
+		}
 	    }
-	    
-	    delete [] out_streams;
-    
-	    // We're done.	   
 	    return NO_ERROR;
 	}
-	
-#ifdef _HAVE_TEMP_KB_KEY_DEFINITION_
-#undef _HAVE_TEMP_KB_KEY_DEFINITION_
-#undef KB_KEY
-#endif
-	
-#ifdef _KB_CONCAT
-#undef _KB_CONCAT
-#endif
-#undef _AMI_KB_DIST
 
     }  //  ami namespace
 
 }  //  tpie namespace
 
-#endif // !(defined(_AMI_KB_DIST_H)) || defined(KB_KEY)
+#endif // _TPIE_AMI_KB_DIST_H
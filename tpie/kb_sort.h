@@ -17,565 +17,287 @@
 // You should have received a copy of the GNU Lesser General Public License
 // along with TPIE.  If not, see <http://www.gnu.org/licenses/>
 
-// This header file can be included in one of two ways, either with a
-// KB_KEY macro defined, in which case it is assumed to be the name of
-// a function (typically inline) for extracting a key from an object
-// of type T, or undefined, in which case the conversion operator
-// kb_key() will be used by default.  This file can be included
-// multiple times in the former case, but only once in the latter.
 
-// If we have not already seen this file with KB_KEY undefined or
-// KB_KEY is defined, we will process the file.
-#if !(defined(_AMI_KB_SORT_H)) || defined(KB_KEY)
+///////////////////////////////////////////////////////////////////////////
+/// \file kb_sort.h
+/// Distribution sort on keys given by a key extractor.
+///////////////////////////////////////////////////////////////////////////
 
-#include <iostream>
+#ifndef _TPIE_AMI_KB_SORT_H
+#define _TPIE_AMI_KB_SORT_H
 
 // Get definitions for working with Unix and Windows
 #include <tpie/portability.h>
 
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <tpie/stream.h>
+#include <tpie/sort.h>
 #include <tpie/key.h>
 #include <tpie/kb_dist.h>
 
-namespace tpie {
-
-    namespace ami {
-	
-#ifdef KB_KEY
-	
-#define _KB_CONCAT(a,b) a ## b
-#define _KB_SORT(kbk) _KB_CONCAT(kb_sort_,kbk)
-#define _MM_KB_SORT(kbk) _KB_CONCAT(mm_kb_sort_,kbk)
-#define _KB_DIST(kbk) _KB_CONCAT(kb_dist_,kbk)
-
-#else
-
-// KB_KEY is not defined, so set the flag so we won't come through
-// this file again with KB_KEY unset, and set KB_KEY to kb_key
-// temporarily.  We also Set the macro for the name of the function
-// defined in this file.
-
-#define _KB_SORT_H
-#define KB_KEY kb_key
-
-#ifdef _HAVE_TEMP_KB_KEY_DEFINITION_
-#error _HAVE_TEMP_KB_KEY_DEFINITION_ already defined.
-#else
-#define _HAVE_TEMP_KB_KEY_DEFINITION_
-#endif
-
-#define _KB_SORT(kbk) kb_sort
-#define _MM_KB_SORT(kbk) mm_kb_sort
-#define _KB_DIST(kbk) kb_dist
-
+// The size of the buffer in which items for each bucket are collected
+// before they are written with write_array().
+#ifndef KB_SORT_BATCH_BYTES
+#define KB_SORT_BATCH_BYTES 4096
 #endif
 
-    }  //  ami namespace
-
-}  //  tpie namespace
-
-
 namespace tpie {
 
     namespace ami {
 
-#ifndef _DEFINED_STATIC_KEY_MIN_MAX
-#define _DEFINED_STATIC_KEY_MIN_MAX
-	static key_range min_max(KEY_MIN, KEY_MAX);
-#endif // _DEFINED_STATIC_KEY_MIN_MAX
-	
-    }  //  ami namespace
-
-}  //  tpie namespace
-
-#ifndef _TPIE_AMI_BUCKET_LIST_ELEM
-#define _TPIE_AMI_BUCKET_LIST_ELEM
-
-namespace tpie {
-    
-    namespace ami {
-	
-	template<class T>
-	class bucket_list_elem {
+	///////////////////////////////////////////////////////////////////
+	/// Sorts a stream by distribution; see kb_sort().
+	///////////////////////////////////////////////////////////////////
+	template<class T, class KeyExtract>
+	class kb_sort_op {
 
 	public:
-	    T data;
-	    bucket_list_elem<T> *next;
-
-	    bucket_list_elem() : data(), next(0) {
-		//  No code in this constructor.
+	    kb_sort_op(const KeyExtract &key, TPIE_OS_SIZE_T memory,
+		       TPIE_OS_SIZE_T threads) :
+		m_key(key), m_memory(memory), m_threads(threads),
+		m_capacity(0), m_fanout(0), m_batch(0), m_passes(0) {}
+
+	    err run(stream<T> *instream, stream<T> *outstream);
+
+	    /** The greatest number of passes over any item made by the last
+		run(), not counting merge sorts of buckets that could not be
+		split. */
+	    int passes() const { return m_passes; }
+
+	private:
+	    class key_less {
+	    public:
+		key_less(const KeyExtract &key) : m_key(key) {}
+		bool operator()(const T &a, const T &b) const {
+		    return m_key(a) < m_key(b);
+		}
+	    private:
+		KeyExtract m_key;
 	    };
-	    
-	    bucket_list_elem(const bucket_list_elem<T>& other) {
-		*this = other;
-	    }
 
-	    bucket_list_elem<T>& operator=(const bucket_list_elem<T>& other) {
-		if (this != &other) {
-		    data = other.data;
-		    next = other.next;
+	    // The comparison object for falling back on sort().
+	    class key_compare {
+	    public:
+		key_compare(const KeyExtract &key) : m_key(key) {}
+		int compare(const T &a, const T &b) {
+		    return m_key(a) < m_key(b) ? -1 : (m_key(b) < m_key(a) ? 1 : 0);
 		}
-		return *this;
-	    }
-
-	    ~bucket_list_elem() {
-		//  No code in this destructor.
+	    private:
+		KeyExtract m_key;
 	    };
 
+	    err sort_stream(stream<T> &instream, stream<T> &outstream, int depth);
+	    err sort_internal(stream<T> &instream, stream<T> &outstream);
+	    err sort_merge(stream<T> &instream, stream<T> &outstream);
+	    err copy(stream<T> &instream, stream<T> &outstream);
+
+	    KeyExtract m_key;
+	    TPIE_OS_SIZE_T m_memory;
+	    TPIE_OS_SIZE_T m_threads;
+	    // Items sorted in memory, buckets per distribution, and items
+	    // per write_array() to a bucket.
+	    TPIE_OS_OFFSET m_capacity;
+	    TPIE_OS_SIZE_T m_fanout;
+	    TPIE_OS_SIZE_T m_batch;
+	    // The buffer the distributions read into.
+	    std::vector<T> m_chunk;
+	    int m_passes;
 	};
 
-    }  //  ami namespace
-
-}  //  tpie namespace
-	
-#endif
-
-namespace tpie {
-    
-    namespace ami {
-
-	template<class T>
-	err _MM_KB_SORT(KB_KEY)(stream<T> &instream,
-				stream<T> &outstream,
-				const key_range &range);
-	
-	
-	template<class T>
-	err _KB_SORT(KB_KEY)(stream<T> &instream,
-			     stream<T> &outstream,
-			     const key_range &range)
-	{
+//// *kb_sort_op::run* ////
+	template<class T, class KeyExtract>
+	err kb_sort_op<T, KeyExtract>::run(stream<T> *instream, stream<T> *outstream) {
 	    err ae;
+	    TPIE_OS_SIZE_T sz_avail = m_memory ? m_memory : MM_manager.memory_available();
+	    TPIE_OS_SIZE_T sz_stream;
 
-	    // Memory sizes.
-	    size_t sz_avail, sz_stream;
-	    // Stream sizes.
-	    TPIE_OS_OFFSET max_size, stream_len;
-    
-	    // Check whether the problem fits in main memory.
-
-	    sz_avail = MM_manager.memory_available ();
-
-	    instream.main_memory_usage(&sz_stream, mem::STREAM_USAGE_MAXIMUM);
+	    m_passes = 0;
+	    if ((ae = instream->main_memory_usage(&sz_stream,
+						  mem::STREAM_USAGE_MAXIMUM)) != NO_ERROR) {
+		return ae;
+	    }
 
+	    // The input and output streams are always open.
 	    if (sz_avail < 4 * sz_stream) {
+		TP_LOG_WARNING_ID("kb_sort: not enough memory.");
 		return INSUFFICIENT_MAIN_MEMORY;
 	    }
-
-	    // Account for the two name streams.
-    
-	    sz_avail -= 2*sz_stream;
-    
-	    // If it fits, simply read it, sort it, and write it.
-
-	    stream_len = instream.stream_len();
-
-	    if (sz_avail >= stream_len * (sizeof(T) + 
-					  sizeof(bucket_list_elem<T> *) + 
-					  sizeof(bucket_list_elem<T>))) {
-		return _MM_KB_SORT(KB_KEY)(instream, outstream, range);
-	    }
-
-	    // It did not fit, so we have to distribute it.
-    
-	    // Create streams of temporary file names.
-	    stream<char> *name_stream, *name_stream2 = NULL;
-
-	    name_stream = new stream<char>;
-
-	    // Do the first level distribution.
-
-	    ae = _KB_DIST(KB_KEY)(instream, *name_stream, range, max_size);
-
-	    // Do the rest of the levels of distribution, continuing until all
-	    // streams are small or have a single key and then, in a final
-	    // iteration, sorting the streams internally and concatenating
-	    // them.  In some bad cases we will end up with one or more large
-	    // streams of all the same key, but these are detected and treated
-	    // as small streams.
-    
-	    bool some_stream_is_large = ((max_size * 
-					  (sizeof(T) + 4 +
-					   sizeof(bucket_list_elem<T> *) + 
-					   sizeof(bucket_list_elem<T>))) >
-					 sz_avail);
-    
-	    while (1) {
-
-		// Create a new stream of temporary stream names.
-		tp_assert(name_stream2 == NULL, "Non-null target name stream.");
-		name_stream2 = new stream<char>;       
-
-		// Is this the last (special) iteration.
-		bool last_iteration = !some_stream_is_large;
-        
-		// We have not seen a large stream yet.
-		some_stream_is_large = false;
-        
-		// Iterate over the streams by reading their names out of
-		// stream_name and recursing on each one.
-
-		name_stream->seek(0);
-        
-		while (1) {
-		    // The range of keys in the stream being read.
-		    key_range stream_range;
-		    char *pc_read;
-		    char *pc;
-		    char stream_name[255];
-            
-		    // Read the next stream name.  We start by reading the
-		    // first character and checking for an EOS condition
-		    // indicating there are no more streams.
-            
-		    pc = stream_name;
-		    ae = name_stream->read_item(&pc_read);
-		    if (ae == END_OF_STREAM) {
-			// We hit the end of the stream name stream, so we
-			// should break out of the while loop over the streams
-			// that are named.
-			break;
-		    } else if (ae != NO_ERROR) {
-			return ae;
-		    }
-		    *pc = *pc_read;
-
-		    // Now loop to read the rest of the name.
-
-		    while (*pc != '\0') {
-			ae = name_stream->read_item(&pc_read);
-			if (ae != NO_ERROR) {
-			    return ae;
-			}
-			*(++pc) = *pc_read;
-
-			tp_assert(pc < stream_name+254, "Read too far.");
-		    } 
-            
-		    // Read its range.
-		    {
-			TPIE_OS_OFFSET range_size = sizeof(stream_range);
-			ae = name_stream->read_array(reinterpret_cast<char*>(&stream_range),
-						     &range_size);
-			if (ae != NO_ERROR) {
-			    return ae;
-			}
-		    }
-            
-		    // Read its length.
-		    {
-			TPIE_OS_OFFSET length_size = sizeof(stream_len);
-			ae = name_stream->read_array(reinterpret_cast<char*>(&stream_len),
-						     &length_size);
-			if (ae != NO_ERROR) {
-			    return ae;
-			}            
-		    }
-            
-		    if (!last_iteration) {
-			if ((stream_len * (sizeof(T) + 4 +
-					   sizeof(bucket_list_elem<T> *) + 
-					   sizeof(bucket_list_elem<T>)) >
-			     sz_avail) &&
-			    (stream_range.get_max() > stream_range.get_min() + 1)) {
-
-			    // If it is too big but does not contain all the same key,
-			    // distribute it again.
-                
-			    some_stream_is_large = true;
-                    
-			    stream<T> curr_stream(stream_name);
-                
-			    // We only need to read the intermediate stream once.
-
-			    curr_stream.persist(PERSIST_READ_ONCE);
-                    
-			    ae = _KB_DIST(KB_KEY)(curr_stream, *name_stream2,
-						  stream_range, max_size);
-			    if (ae != NO_ERROR) {
-				return ae;
-			    }
-
-			} else {
-
-			    // It is either small or contains only a single
-			    // key, so just pass it without further
-			    // processing.
-                    
-			    // Write the name.
-			    ae = name_stream2->write_array(stream_name,
-							   strlen(stream_name) + 1);
-			    if (ae != NO_ERROR) {
-				return ae;
-			    }
-
-			    // Write the range.
-                    
-			    ae = name_stream2->write_array(reinterpret_cast<const char*>(&stream_range),
-							   sizeof(stream_range));
-			    if (ae != NO_ERROR) {
-				return ae;
-			    }
-                    
-			    // Write the length.
-                    
-			    ae = name_stream2->write_array(reinterpret_cast<const char*>(&stream_len),
-							   sizeof(stream_len));
-			    if (ae != NO_ERROR) {
-				return ae;
-			    }    
-                    
-			}
-                
-		    } else {
-			// This is the last iteration.
-
-			// Open the stream.
-
-			stream<T> curr_stream(stream_name);
-
-			// We only need to read the intermediate stream once.
-
-			curr_stream.persist(PERSIST_READ_ONCE);
-                    
-			// Check whether it is truly small or just all one key.
-                
-			if (stream_range.get_min() == stream_range.get_max()) {
-
-			    // If it is all one key, simply concatenate it
-			    // onto the output.
-
-			    T *pt;
-
-			    while(1) {
-				ae = curr_stream.read_item(&pt);
-				if (ae == END_OF_STREAM) {
-				    break;
-				} else if (ae != NO_ERROR) {
-				    return ae;
-				}
-				ae = outstream.write_item(*pt);
-				if (ae != NO_ERROR) {
-				    return ae;
-				}
-			    }
-                    
-			} else {
-
-			    // Read the contents into main memory; sort them,
-			    // and write them out.
-                    
-			    ae = _MM_KB_SORT(KB_KEY)(curr_stream, outstream,
-						     stream_range);
-			    if (ae != NO_ERROR) {
-				return ae;
-			    }
-			}                
-		    }
+	    sz_avail -= 2 * sz_stream;
+	    m_capacity = sz_avail / sizeof(T);
+
+	    // A distribution reads chunks of an eighth of the memory, and
+	    // has a stream and a batch for each bucket.
+	    m_batch = std::max(TPIE_OS_SIZE_T(1), TPIE_OS_SIZE_T(KB_SORT_BATCH_BYTES / sizeof(T)));
+	    TPIE_OS_SIZE_T chunk_len = std::max(m_batch, std::min(TPIE_OS_SIZE_T(1) << 16,
+								  sz_avail / 8 / (sizeof(T) + sizeof(TPIE_OS_SIZE_T))));
+	    TPIE_OS_SIZE_T sz_chunk = chunk_len * (sizeof(T) + sizeof(TPIE_OS_SIZE_T));
+	    TPIE_OS_SIZE_T sz_bucket = sz_stream + m_batch * sizeof(T) + sizeof(stream<T> *) +
+		sizeof(std::string) + 2 * sizeof(typename KeyExtract::key_type) + sizeof(TPIE_OS_SIZE_T);
+	    m_fanout = sz_avail > sz_chunk ? (sz_avail - sz_chunk) / sz_bucket : 0;
+	    {
+		int available = instream->available_streams();
+		if (available != -1 && m_fanout > TPIE_OS_SIZE_T(available - 2)) {
+		    m_fanout = available - 2;
 		}
-        
-		// We just finished reading all named streams at the current
-		// level of recursion.  Now we want to set up for the next
-		// level.  To do this, we get rid of the names we just
-		// processed and replace them by the names we need to process
-		// next.  Of course, this is only done if we are not in the last
-		// iteration.
-        
-		delete name_stream;
-
-		if (!last_iteration) {
-		    name_stream = name_stream2;
-		    name_stream2 = NULL;
-		} else {
-		    delete name_stream2;
-		    break;
+	    }
+	    if (instream->stream_len() > m_capacity) {
+		if (m_fanout < 2) {
+		    TP_LOG_WARNING_ID("kb_sort: not enough memory for two buckets.");
+		    return INSUFFICIENT_MAIN_MEMORY;
 		}
+		m_chunk.resize(chunk_len);
 	    }
 
-
-	    return NO_ERROR;
+	    ae = sort_stream(*instream, *outstream, 0);
+	    m_chunk.clear();
+	    return ae;
 	}
 
-
-// Main memory key bucket sorting.
-
-	template<class T>
-	err _MM_KB_SORT(KB_KEY)(stream<T> &instream,
-                                stream<T> &outstream,
-                                const key_range &range)
-	{
+//// *kb_sort_op::sort_stream* ////
+	template<class T, class KeyExtract>
+	err kb_sort_op<T, KeyExtract>::sort_stream(stream<T> &instream, stream<T> &outstream,
+						   int depth) {
 	    err ae;
-    
-	    size_t sz_avail;
-	    TPIE_OS_OFFSET stream_len;
-
-	    TPIE_OS_SIZE_T ii,jj;
-    
-	    // Check available main memory.
-	    sz_avail = MM_manager.memory_available ();
-    
-	    // How long is the input stream?
-	    stream_len = instream.stream_len();
-
-	    // Verify that we have enough memory.
-	    if (sz_avail < stream_len * (sizeof(T) +
-					 sizeof(bucket_list_elem<T> *) + 
-					 sizeof(bucket_list_elem<T>))) {
-		std::cerr << '\n' 
-			  << static_cast<TPIE_OS_LONGLONG>(sz_avail)
-			  << ' ' 
-			  << static_cast<TPIE_OS_LONGLONG>(stream_len)
-			  << '\n';
-		std::cerr << sizeof(T) 
-			  << ' ' 
-			  << sizeof(bucket_list_elem<T> *) 
-			  << ' ' << sizeof(bucket_list_elem<T>);
+	    TPIE_OS_OFFSET len = instream.stream_len();
+	    TPIE_OS_SIZE_T ii;
 
-		return INSUFFICIENT_MAIN_MEMORY;
+	    m_passes = std::max(m_passes, depth + 1);
+	    if (len <= m_capacity) {
+		return sort_internal(instream, outstream);
 	    }
-    
-	    // Allocate the space for the data and for the bucket list elements.
-	    // We know that stream_len items fit in main memory, so it is safe to cast.
-	    T *indata = new T[static_cast<TPIE_OS_SIZE_T>(stream_len)];
-    
-	    bucket_list_elem<T> **buckets =
-		new bucket_list_elem<T>*[static_cast<TPIE_OS_SIZE_T>(stream_len)];
 
-	    bucket_list_elem<T> *list_space =
-		new bucket_list_elem<T>[static_cast<TPIE_OS_SIZE_T>(stream_len)];
-
-	    // Read the input stream.
-
-	    instream.seek(0);
-	    {
-		TPIE_OS_OFFSET sl2 = stream_len;
-		ae = instream.read_array(indata, &sl2);
-		if (ae != NO_ERROR) {
-		    delete[] indata;
-		    delete[] buckets;
-		    delete[] list_space;
-		    return ae;
-		}
+	    kb_distribution<T, KeyExtract> dist(m_key, m_threads);
+	    if ((ae = dist.sample(instream, m_fanout)) != NO_ERROR) {
+		return ae;
 	    }
-    
-	    // Empty out the buckets.
-
-	    for (ii = static_cast<TPIE_OS_SIZE_T>(stream_len); ii--; ) {
-		buckets[ii] = NULL;
+	    TPIE_OS_SIZE_T nb = dist.buckets();
+	    if (nb < 2) {
+		// The sample has a single key.
+		return sort_merge(instream, outstream);
 	    }
-    
-	    // Scan the input, assigning each item to the appropriate bucket.
 
-	    bucket_list_elem<T> *list_elem;
-    
-	    unsigned int bucket_index_denom = static_cast<unsigned int>(((range.get_max() - range.get_min()) /
-									 stream_len) + 1);
-
-	    if (!bucket_index_denom) {
-		bucket_index_denom = 1;
+	    std::vector<stream<T> *> out(nb);
+	    for (ii = 0; ii < nb; ii++) {
+		out[ii] = new stream<T>;
 	    }
-
-	    for (ii = static_cast<TPIE_OS_SIZE_T>(stream_len), list_elem = list_space;
-		 ii--; list_elem++ ) {
-		unsigned int bucket_index;
-
-		bucket_index = (static_cast<unsigned int>(static_cast<KB_KEY>(indata[ii])) - range.get_min()) /
-		    bucket_index_denom; 
-
-		tp_assert(bucket_index < static_cast<unsigned long>(stream_len), "Bucket index too large.");
-        
-		list_elem->data = indata[ii];
-		list_elem->next = buckets[bucket_index];
-		buckets[bucket_index] = list_elem;
+	    ae = dist.distribute(instream, &out[0], &m_chunk[0], m_chunk.size(), m_batch);
+
+	    // Keep only the names, so that the memory of the buckets is free
+	    // for the recursion.
+	    std::vector<std::string> names(nb);
+	    std::vector<TPIE_OS_OFFSET> lens(nb);
+	    for (ii = 0; ii < nb; ii++) {
+		names[ii] = out[ii]->name();
+		lens[ii] = out[ii]->stream_len();
+		out[ii]->persist(ae == NO_ERROR && lens[ii] ? PERSIST_PERSISTENT : PERSIST_DELETE);
+		delete out[ii];
+	    }
+	    if (ae != NO_ERROR) {
+		return ae;
 	    }
 
-	    tp_assert(list_elem == list_space + stream_len,
-		      "Didn't use the right number of list elements.");
-
-    
-	    // Scan the buckets to put the data back in the input array.  In
-	    // order to make the sort stable, we have to be sure to read the
-	    // lists corresponding to the buckets in the correct order.  The
-	    // elements that appeared earlier in the orginal data were written
-	    // later (i.e. towards the front of the lists) so we should
-	    // rebuild the data array from the 0th element upwards.
-    
-#define VERIFY_OCCUPANCY 0
-#if VERIFY_OCCUPANCY
-	    unsigned int max_occupancy = 0;
-	    unsigned int buckets_occupied = 0;
-#endif        
-	    for (ii = 0, jj = 0; ii < static_cast<TPIE_OS_SIZE_T>(stream_len); ii++) {
-#if VERIFY_OCCUPANCY
-		unsigned int cur_occupancy = 0;
-#endif        
-		for (list_elem = buckets[ii]; list_elem != NULL;
-		     list_elem = list_elem->next) {
-#if VERIFY_OCCUPANCY
-		    cur_occupancy++;
-#endif                    
-		    indata[jj++] = list_elem->data; 
-		}
-#if VERIFY_OCCUPANCY
-		if (cur_occupancy > max_occupancy) {
-		    max_occupancy = cur_occupancy;
+	    for (ii = 0; ii < nb; ii++) {
+		if (lens[ii] == 0) {
+		    continue;
 		}
-		if (cur_occupancy != 0) {
-		    buckets_occupied++;
+		stream<T> *bucket = new stream<T>(names[ii]);
+		bucket->persist(PERSIST_DELETE);
+		if (ae != NO_ERROR) {
+		    // Only delete the rest.
+		} else if (dist.single_key(ii)) {
+		    ae = copy(*bucket, outstream);
+		} else if (lens[ii] == len) {
+		    // The splitters did not split the stream.
+		    ae = sort_merge(*bucket, outstream);
+		} else {
+		    ae = sort_stream(*bucket, outstream, depth + 1);
 		}
-#endif                    
+		delete bucket;
 	    }
-    
-#if VERIFY_OCCUPANCY
-	    std::cerr << "Max occupancy = " << max_occupancy << '\n';
-	    std::cerr << "Buckets occupied = " << buckets_occupied << '\n';
-	    std::cerr << "Stream length = " << stream_len << '\n';
-#endif
-    
-	    // Do an insertion sort across the whole data set.
+	    return ae;
+	}
 
-	    {
-		T *p, *q, test;
-
-		for (p = indata + 1; p < indata + stream_len; p++) {
-		    for (q = p - 1, test = *p;
-			 (q >= indata) && (KB_KEY(*q) > KB_KEY(test)); q--) {
-			*(q+1) = *q;
-		    }
-		    *(q+1) = test;
-		}
+//// *kb_sort_op::sort_internal* ////
+	template<class T, class KeyExtract>
+	err kb_sort_op<T, KeyExtract>::sort_internal(stream<T> &instream, stream<T> &outstream) {
+	    err ae;
+	    TPIE_OS_SIZE_T n = static_cast<TPIE_OS_SIZE_T>(instream.stream_len());
+	    if (n == 0) {
+		return NO_ERROR;
+	    }
+	    std::vector<T> items(n);
+	    instream.seek(0);
+	    if ((ae = instream.read_array(&items[0], n)) != NO_ERROR) {
+		return ae;
 	    }
-    
-	    // Write the results.
+	    std::sort(items.begin(), items.end(), key_less(m_key));
+	    return outstream.write_array(&items[0], n);
+	}
 
-	    ae = outstream.write_array(indata, static_cast<TPIE_OS_SIZE_T>(stream_len));
-	    if (ae != NO_ERROR) {
-		delete [] indata;
-		delete [] buckets;
-		delete [] list_space;
+//// *kb_sort_op::sort_merge* ////
+	template<class T, class KeyExtract>
+	err kb_sort_op<T, KeyExtract>::sort_merge(stream<T> &instream, stream<T> &outstream) {
+	    err ae;
+	    key_compare cmp(m_key);
+	    stream<T> sorted;
+	    if ((ae = sort(&instream, &sorted, &cmp)) != NO_ERROR) {
 		return ae;
-	    }    
+	    }
+	    return copy(sorted, outstream);
+	}
 
-	    delete [] indata;
-	    delete [] buckets;
-	    delete [] list_space;
-    
-	    return NO_ERROR;
+//// *kb_sort_op::copy* ////
+	template<class T, class KeyExtract>
+	err kb_sort_op<T, KeyExtract>::copy(stream<T> &instream, stream<T> &outstream) {
+	    err ae;
+	    T *item;
+	    instream.seek(0);
+	    while ((ae = instream.read_item(&item)) == NO_ERROR) {
+		if ((ae = outstream.write_item(*item)) != NO_ERROR) {
+		    return ae;
+		}
+	    }
+	    return ae == END_OF_STREAM ? NO_ERROR : ae;
 	}
 
-#ifdef _HAVE_TEMP_KB_KEY_DEFINITION_
-#undef _HAVE_TEMP_KB_KEY_DEFINITION_
-#undef KB_KEY
-#endif
+///////////////////////////////////////////////////////////////////////////
+/// Sorts \p instream into \p outstream by the keys given by \p key, by
+/// distribution. KeyExtract is as for kb_distribution. Splitters are
+/// sampled from the stream, and one pass distributes the items into as
+/// many buckets as \p memory (0 means all available memory) has room
+/// for. Buckets that fit in memory are sorted there, buckets of a single
+/// key are copied, and only larger buckets are distributed again. The
+/// items are classified with \p threads threads. With keys that sample
+/// well, this takes fewer passes than sort(); buckets that the splitters
+/// fail to split are sorted with sort().
+///////////////////////////////////////////////////////////////////////////
+	template<class T, class KeyExtract>
+	err kb_sort(stream<T> *instream, stream<T> *outstream, const KeyExtract &key,
+		    TPIE_OS_SIZE_T memory = 0, TPIE_OS_SIZE_T threads = 1) {
+	    if (instream == NULL || outstream == NULL) {
+		TP_LOG_WARNING_ID("kb_sort: NULL stream. Aborted.");
+		return NULL_POINTER;
+	    }
+	    kb_sort_op<T, KeyExtract> op(key, memory, threads);
+	    return op.run(instream, outstream);
+	}
 
-#ifdef _KB_CONCAT
-#undef _KB_CONCAT
-#endif
-#undef _KB_SORT
-#undef _KB_MM_SORT
-#undef _KB_MM_DIST
+///////////////////////////////////////////////////////////////////////////
+/// Sorts \p instream into \p outstream by the conversion of the items to
+/// kb_key. The range is not needed anymore, since the buckets are
+/// chosen by sampling.
+///////////////////////////////////////////////////////////////////////////
+	template<class T>
+	err kb_sort(stream<T> &instream, stream<T> &outstream,
+		    const key_range & /*range*/) {
+	    return kb_sort(&instream, &outstream, kb_key_cast<T>());
+	}
 
     }  //   ami namespace
 
 }  //  tpie namespace
 
-#endif // !(defined(_AMI_KB_SORT_H)) || defined(KB_KEY)
+#endif // _TPIE_AMI_KB_SORT_H
@@ -33,6 +33,7 @@
 #include <iostream>
 // For min, max.
 #include <algorithm>
+#include <boost/cstdint.hpp>
 #include <tpie/block_base.h>
 #include <tpie/point.h>
 #include <tpie/tpie_log.h>
@@ -93,6 +94,17 @@ namespace ami {
 #  define TPIE_AMI_KDTREE_GRID_SIZE  256
 #endif
 
+/** The default memory (in bytes) for the in-memory copy of the top
+ * levels of a kd-tree or K-D-B-tree. */
+#ifndef TPIE_AMI_KDTREE_TOP_MEMORY
+#  define TPIE_AMI_KDTREE_TOP_MEMORY  65536
+#endif
+
+/** The default number of points in the in-memory buffer of a Bkd-tree. */
+#ifndef TPIE_AMI_BKDTREE_BUFFER_SIZE
+#  define TPIE_AMI_BKDTREE_BUFFER_SIZE  65536
+#endif
+
 // Loading methods. These bits can be combined, but not all
 // combinations are valid.
 #define TPIE_AMI_KDTREE_LOAD_SORT    0x1
@@ -141,6 +153,15 @@ public:
   TPIE_OS_SIZE_T max_intraroot_height;
   /** The grid size on each dimension, for grid bulk loading. */
   TPIE_OS_SIZE_T grid_size;
+  /** The number of threads used by the bulk loaders. With more than
+   * one thread, the per-dimension sorts run concurrently (when they fit
+   * in memory) and the subtrees below the grid or sample levels are
+   * built in parallel. */
+  TPIE_OS_SIZE_T load_threads;
+  /** The memory (in bytes) for a copy of the top levels of the tree,
+   * kept in memory in breadth-first order. Queries descend these levels
+   * without going through the block caches. 0 disables the copy. */
+  TPIE_OS_SIZE_T top_memory;
 
   ///////////////////////////////////////////////////////////////////////////
   // Setting the default parameter values.
@@ -150,7 +171,8 @@ public:
     leaf_block_factor(1), node_block_factor(1), 
     leaf_cache_size(8), node_cache_size(8),
     max_intranode_height(0), max_intraroot_height(0),
-    grid_size(TPIE_AMI_KDTREE_GRID_SIZE) {}
+    grid_size(TPIE_AMI_KDTREE_GRID_SIZE), load_threads(1),
+    top_memory(TPIE_AMI_KDTREE_TOP_MEMORY) {}
 };
 
 
@@ -410,10 +432,10 @@ public:
   ///////////////////////////////////////////////////////////////////////////
   region_t(const point<coord_t, dim>& p1, const point<coord_t, dim>& p2) {
     for (TPIE_OS_SIZE_T i = 0; i < dim; i++) {
-      lo_[i] = min(p1[i], p2[i]);
+      lo_[i] = std::min(p1[i], p2[i]);
       //      lo_bd_[i] = 1;//true;
       bd_[i] |= LO_BD_MASK; // true on low bd.
-      hi_[i] = max(p1[i], p2[i]);
+      hi_[i] = std::max(p1[i], p2[i]);
       //      hi_bd_[i] = 1;//true;
       bd_[i] |= HI_BD_MASK; // true on high bd.
       if (p1[i] == p2[i])
@@ -421,11 +443,11 @@ public:
     }
   }
 
+  // The class is packed, so there are no accessors returning references
+  // to the bounds; use cutout_lo() and cutout_hi() to change them.
   coord_t lo(TPIE_OS_SIZE_T d) const { return lo_[d]; }
-  coord_t& lo(TPIE_OS_SIZE_T d) { return lo_[d];  }
 
   coord_t hi(TPIE_OS_SIZE_T d) const { return hi_[d]; }
-  coord_t& hi(TPIE_OS_SIZE_T d) { return hi_[d];  }
 
   bool is_bounded_lo(TPIE_OS_SIZE_T d) const { return  (bd_[d] & LO_BD_MASK) != 0; }
   bool is_bounded_hi(TPIE_OS_SIZE_T d) const { return  (bd_[d] & HI_BD_MASK) != 0; }
@@ -479,12 +501,14 @@ public:
   }
 
   ///////////////////////////////////////////////////////////////////////////
-  // Returns true if this box contains point \p p.
+  // Returns true if this box contains point \p p. As in the splits,
+  // the box is open on the low side and closed on the high side, so
+  // that a point on a split plane is contained in the low box only.
   ///////////////////////////////////////////////////////////////////////////
   bool contains(const point<coord_t, dim>& p) const {
     TPIE_OS_SIZE_T i;
     for (i = 0; i < dim; i++) {
-      if ((is_bounded_lo(i) && p[i] <  lo_[i]) || 
+      if ((is_bounded_lo(i) && p[i] <= lo_[i]) || 
 	  (is_bounded_hi(i) && p[i] >  hi_[i]))
 	break;
     }
@@ -492,12 +516,13 @@ public:
   }
 
   ///////////////////////////////////////////////////////////////////////////
-  // Returns true if this box intersects box \p r.
+  // Returns true if this box intersects box \p r, which is closed on
+  // both sides.
   ///////////////////////////////////////////////////////////////////////////
   bool intersects(const region_t<coord_t, dim>& r) const {
     TPIE_OS_SIZE_T i;
     for (i = 0; i < dim; i++) {
-      if ((r.is_bounded_lo(i) && relative_to_plane(r.lo_[i], i) == -1) || 
+      if ((r.is_bounded_lo(i) && is_bounded_hi(i) && hi_[i] < r.lo_[i]) || 
 	  (r.is_bounded_hi(i) && relative_to_plane(r.hi_[i], i) == 1))
 	break;
     }
@@ -592,11 +617,54 @@ enum split_heuristic_t {
 
 class kdbtree_params: public kdtree_params {
 public:
-  kdbtree_params(): kdtree_params(), split_heuristic(LONGEST_SPAN) {}
-  kdbtree_params(kdtree_params p): kdtree_params(p), split_heuristic(LONGEST_SPAN) {}
+  kdbtree_params(): kdtree_params(), split_heuristic(LONGEST_SPAN), insert_buffer_size(0) {}
+  kdbtree_params(kdtree_params p): kdtree_params(p), split_heuristic(LONGEST_SPAN), insert_buffer_size(0) {}
   split_heuristic_t split_heuristic;
+  /** The max number of points kept in the insertion buffer (in buffered
+   * insertion mode) before it is flushed. 0 means flush only when
+   * needed. */
+  TPIE_OS_OFFSET insert_buffer_size;
+};
+
+class bkdtree_params: public kdtree_params {
+public:
+  bkdtree_params(): kdtree_params(), buffer_size(TPIE_AMI_BKDTREE_BUFFER_SIZE) {}
+  bkdtree_params(kdtree_params p): kdtree_params(p), buffer_size(TPIE_AMI_BKDTREE_BUFFER_SIZE) {}
+  /** The max number of points kept in the in-memory buffer. When it
+   * overflows, the buffer is merged with the smallest kd-trees into a
+   * new one. */
+  TPIE_OS_SIZE_T buffer_size;
 };
 
+///////////////////////////////////////////////////////////////////////////
+/// Returns the position of \p p on the Morton (Z-order) curve through the
+/// box [\p lo, \p hi]. Each coordinate is scaled to 64/dim bits (at most
+/// 32) within the box, and the bits are interleaved, most significant
+/// first. Points close on the curve are close in space, so sorting by
+/// this key groups points by region.
+///////////////////////////////////////////////////////////////////////////
+template<class coord_t, TPIE_OS_SIZE_T dim>
+boost::uint64_t kd_morton_key(const point<coord_t, dim>& p, 
+			      const point<coord_t, dim>& lo, const point<coord_t, dim>& hi) {
+  const TPIE_OS_SIZE_T bits = std::min(TPIE_OS_SIZE_T(32), TPIE_OS_SIZE_T(64 / dim));
+  boost::uint64_t c[dim];
+  boost::uint64_t key = 0;
+  double t;
+  TPIE_OS_SIZE_T i;
+  int b;
+
+  for (i = 0; i < dim; i++) {
+    t = (hi[i] > lo[i]) ? (double(p[i]) - double(lo[i])) / (double(hi[i]) - double(lo[i])): 0.0;
+    t = std::max(0.0, std::min(1.0, t));
+    c[i] = (boost::uint64_t) (t * double((boost::uint64_t(1) << bits) - 1));
+  }
+
+  for (b = int(bits) - 1; b >= 0; b--)
+    for (i = 0; i < dim; i++)
+      key = (key << 1) | ((c[i] >> b) & 1);
+  return key;
+}
+
 } }  //end tpie::ami namespace
 
 #endif // _TPIE_AMI_KD_BASE_H
@@ -32,6 +32,8 @@
 #include <tpie/kd_base.h>
 #include <string> // STL string.
 #include <stack>
+#include <queue>
+#include <vector>
 
 #define TPIE_AMI_KDBTREE_HEADER_MAGIC_NUMBER 0xA9542F
 
@@ -89,6 +91,33 @@ public:
   ///////////////////////////////////////////////////////////////////////////
   bool insert(const point_t& p);
 
+  ///////////////////////////////////////////////////////////////////////////
+  /// Enters or leaves buffered insertion mode. In buffered insertion
+  /// mode, insert() only appends the point to a buffer stream and returns
+  /// true. flush() sorts the buffer by region (on the Morton curve through
+  /// the mbr of the tree and the buffer) and inserts the points in that
+  /// order, so that consecutive insertions, and the splits they cause, hit
+  /// the same nodes and leaves while these are cached. Queries, kd2kdb(),
+  /// starting a dfs_preorder() traversal and leaving the mode flush the
+  /// buffer first. It is also flushed when it holds
+  /// kdbtree_params::insert_buffer_size points (if not 0), and when the
+  /// tree is destroyed. size() does not count buffered points, and
+  /// buffered duplicates are dropped by flush().
+  ///////////////////////////////////////////////////////////////////////////
+  void buffered_inserts(bool enable);
+
+  ///////////////////////////////////////////////////////////////////////////
+  /// Returns true if the tree is in buffered insertion mode.
+  ///////////////////////////////////////////////////////////////////////////
+  bool buffered_inserts() const { return insert_buffer_ != NULL; }
+
+  ///////////////////////////////////////////////////////////////////////////
+  /// Inserts all points in the insertion buffer into the tree. Does
+  /// nothing if the buffer is empty or the tree is not in buffered
+  /// insertion mode.
+  ///////////////////////////////////////////////////////////////////////////
+  err flush();
+
   ///////////////////////////////////////////////////////////////////////////
   /// Executes on step in the traversal of the the tree in dfs preorder. 
   /// Returns next node and its level
@@ -226,8 +255,41 @@ protected:
   /** Base path name. */
   std::string name_;
 
+  /** The top levels of the tree: the items of the topmost nodes,
+   * copied in breadth-first order, within params_.top_memory bytes.
+   * The items of a node are contiguous, and the root node comes
+   * first. */
+  std::vector<item_t> top_;
+
+  /** For each item in top_, the position and size in top_ of the
+   * copy of its child node (size 0 if the child is not copied). */
+  std::vector<std::pair<TPIE_OS_SIZE_T, TPIE_OS_SIZE_T> > top_child_;
+
+  /** The number of items of the root node in top_. */
+  TPIE_OS_SIZE_T top_root_size_;
+
+  /** Whether top_ needs to be rebuilt before the next query (set when
+   * the tree gets a new root or a node is split). */
+  bool top_stale_;
+
+  /** A buffered point, with its position on the Morton curve. */
+  struct buffered_point_t {
+    boost::uint64_t key;
+    point_t p;
+    bool operator<(const buffered_point_t& b) const { return key < b.key; }
+  };
+
+  /** The insertion buffer; NULL unless in buffered insertion mode. */
+  stream<point_t>* insert_buffer_;
+
   bool insert_empty(const point_t& p);
 
+  // Copy the top levels of the tree into top_.
+  void build_top();
+
+  TPIE_OS_OFFSET window_query_top(TPIE_OS_SIZE_T first, TPIE_OS_SIZE_T n, 
+				  const region_t<coord_t, dim>& r, stream_t* stream);
+
   TPIE_OS_OFFSET window_query(const item_t& ki, const region_t<coord_t, dim>& r,
 		      stream_t* stream);
 
@@ -526,7 +588,8 @@ TPIE_OS_SIZE_T TPIE_AMI_KDBTREE_NODE::el_capacity(TPIE_OS_SIZE_T block_size) {
 //// *kdbtree::kdbtree* ////
 template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
 TPIE_AMI_KDBTREE::kdbtree(const std::string& base_file_name, collection_type type, 
-			 const kdbtree_params& params): header_(), params_(params), name_(base_file_name) 
+			 const kdbtree_params& params): header_(), params_(params), name_(base_file_name),
+						top_root_size_(0), top_stale_(true), insert_buffer_(NULL) 
 {
   shared_init(base_file_name, type);
 }
@@ -536,7 +599,7 @@ template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
 void TPIE_AMI_KDBTREE::shared_init(const std::string& base_file_name, collection_type type) 
 {
 
-	assert(base_file_name.empty());
+	assert(!base_file_name.empty());
 
 	std::string collname = base_file_name + ".l";
 	pcoll_leaves_ = new collection_t(collname, type, params_.leaf_block_factor);
@@ -552,7 +615,8 @@ void TPIE_AMI_KDBTREE::shared_init(const std::string& base_file_name, collection
 		return;
 	}
 
-	// Read the header info, if relevant.
+	// A new tree is empty and valid. Otherwise, read the header info.
+	status_ = tpie::ami::KDBTREE_STATUS_VALID;
 	if (pcoll_leaves_->size() != 0) {
 		unsigned int magic = *((unsigned int *) pcoll_nodes_->user_data());
 		if (magic == TPIE_AMI_KDTREE_HEADER_MAGIC_NUMBER) {
@@ -601,6 +665,7 @@ bool TPIE_AMI_KDBTREE::kd2kdb() {
    TP_LOG_WARNING_ID("  kd2kdb: status is not tpie::ami::KDBTREE_STATUS_KDTREE. operation aborted.");
     return false;
   }
+  flush();
 
   bool ans = true;
   typename kdtree<coord_t, dim, Bin_node, BTECOLL>::header_t kdheader;
@@ -631,6 +696,7 @@ bool TPIE_AMI_KDBTREE::kd2kdb() {
     status_ = tpie::ami::KDBTREE_STATUS_VALID;
   else
     ans = false;
+  top_stale_ = true;
 
   TPLOG("kdbtree::kd2kdb() Exiting ans=" << ans << "\n");
   return ans;
@@ -652,15 +718,40 @@ TPIE_OS_OFFSET TPIE_AMI_KDBTREE::window_query(const POINT &p1, const POINT& p2,
     return result;
   }
 
+  // Insert the buffered points first.
+  flush();
+
   // TODO...
   REGION r(p1.key, p2.key);
   REGION rr;
   KDB_ITEM ki(rr, header_.root_bid, header_.root_type);
-  result = window_query(ki, r, stream);
+  if (top_stale_)
+    build_top();
+  if (top_.empty())
+    result = window_query(ki, r, stream);
+  else
+    result = window_query_top(0, top_root_size_, r, stream);
 
   return result;
 }
 
+//// *kdbtree::window_query_top* ////
+template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+TPIE_OS_OFFSET TPIE_AMI_KDBTREE::window_query_top(TPIE_OS_SIZE_T first, TPIE_OS_SIZE_T n, 
+						  const REGION& r, POINT_STREAM* stream) {
+  TPIE_OS_OFFSET result = 0;
+  TPIE_OS_SIZE_T i;
+  for (i = first; i < first + n; i++) {
+    if (top_[i].region.intersects(r)) {
+      if (top_child_[i].second > 0)
+	result += window_query_top(top_child_[i].first, top_child_[i].second, r, stream);
+      else
+	result += window_query(top_[i], r, stream);
+    }
+  }
+  return result;
+}
+
 //// *kdbtree::window_query* ////
 template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
 TPIE_OS_OFFSET TPIE_AMI_KDBTREE::window_query(const KDB_ITEM& ki, const REGION& r, POINT_STREAM* stream) {
@@ -774,6 +865,7 @@ bool TPIE_AMI_KDBTREE::insert_empty(const record<coord_t, TPIE_OS_SIZE_T, dim>&
   header_.size = 1;
   header_.root_bid = bl->bid();
   header_.root_type = BLOCK_LEAF;
+  top_stale_ = true;
   header_.mbr_lo = p;
   header_.mbr_lo.id() = 1;
   header_.mbr_hi = p;
@@ -790,6 +882,7 @@ bool TPIE_AMI_KDBTREE::find(const record<coord_t, TPIE_OS_SIZE_T, dim>& p) {
 
   TPLOG("kdbtree::find Entering "<<"\n");
 
+  flush();
   if (header_.size == 0)
     return false;
 
@@ -801,6 +894,24 @@ bool TPIE_AMI_KDBTREE::find(const record<coord_t, TPIE_OS_SIZE_T, dim>& p) {
   KDB_ITEM ki(r, header_.root_bid, header_.root_type);
   STACK_ITEM si(ki, 0);
 
+  // Go down the top levels first, if they are in memory.
+  if (top_stale_)
+    build_top();
+  if (!top_.empty()) {
+    TPIE_OS_SIZE_T first = 0, n = top_root_size_;
+    for (;;) {
+      for (i = first; i < first + n; i++)
+	if (top_[i].region.contains(p.key))
+	  break;
+      assert(i < first + n);
+      si.item = top_[i];
+      if (top_child_[i].second == 0)
+	break;
+      first = top_child_[i].first;
+      n = top_child_[i].second;
+    }
+  }
+
   while (si.item.type == BLOCK_NODE) {
     bn = fetch_node(si.item.bid);
 
@@ -832,14 +943,22 @@ bool TPIE_AMI_KDBTREE::insert(const record<coord_t, TPIE_OS_SIZE_T, dim>& p) {
   TPLOG("kdbtree::insert Entering "<<"\n");
   TPIE_OS_SIZE_T i;
 
+  if (insert_buffer_ != NULL) {
+    insert_buffer_->write_item(p);
+    if (params_.insert_buffer_size > 0 && 
+	insert_buffer_->stream_len() >= params_.insert_buffer_size)
+      flush();
+    return true;
+  }
+
   // The first insertion is treated separately.
   if (header_.size == 0)
     return insert_empty(p);
 
   // Update the MBR.
   for (i = 0; i < dim; i++) {
-    header_.mbr_lo[i] = min(header_.mbr_lo[i], p[i]);
-    header_.mbr_hi[i] = max(header_.mbr_hi[i], p[i]);
+    header_.mbr_lo[i] = std::min(header_.mbr_lo[i], p[i]);
+    header_.mbr_hi[i] = std::max(header_.mbr_hi[i], p[i]);
   }
 
   bool ans;
@@ -889,6 +1008,7 @@ bool TPIE_AMI_KDBTREE::insert(const record<coord_t, TPIE_OS_SIZE_T, dim>& p) {
     // Need to split the leaf. Maybe some nodes, too.
 
     KDB_ITEM ki1, ki2;
+    top_stale_ = true;
     STACK_ITEM top;
 
     // Pop the leaf from the stack. 
@@ -960,6 +1080,134 @@ bool TPIE_AMI_KDBTREE::insert(const record<coord_t, TPIE_OS_SIZE_T, dim>& p) {
   return ans;
 }
 
+//// *kdbtree::build_top* ////
+template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+void TPIE_AMI_KDBTREE::build_top() {
+  TPLOG("kdbtree::build_top Entering "<<"\n");
+  top_.clear();
+  top_child_.clear();
+  top_root_size_ = 0;
+  top_stale_ = false;
+  if (params_.top_memory == 0 || status_ != tpie::ami::KDBTREE_STATUS_VALID ||
+      header_.size == 0 || header_.root_type != BLOCK_NODE)
+    return;
+
+  TPIE_OS_SIZE_T max_items = params_.top_memory / 
+    (sizeof(KDB_ITEM) + sizeof(std::pair<TPIE_OS_SIZE_T, TPIE_OS_SIZE_T>));
+
+  // Nodes are copied whole, in breadth-first order, until one does not
+  // fit. Each node in the queue comes with the item in top_ pointing to
+  // it (0 for the root).
+  std::queue<std::pair<bid_t, TPIE_OS_SIZE_T> > q;
+  TPIE_AMI_KDBTREE_NODE* bn;
+  TPIE_OS_SIZE_T i, first;
+
+  q.push(std::pair<bid_t, TPIE_OS_SIZE_T>(header_.root_bid, 0));
+  while (!q.empty()) {
+    bn = fetch_node(q.front().first);
+    if (top_.size() + bn->size() > max_items) {
+      release_node(bn);
+      break;
+    }
+    first = top_.size();
+    if (first == 0)
+      top_root_size_ = bn->size();
+    else
+      top_child_[q.front().second] = 
+	std::pair<TPIE_OS_SIZE_T, TPIE_OS_SIZE_T>(first, bn->size());
+    q.pop();
+
+    for (i = 0; i < bn->size(); i++) {
+      top_.push_back(bn->el[i]);
+      top_child_.push_back(std::pair<TPIE_OS_SIZE_T, TPIE_OS_SIZE_T>(0, 0));
+      if (bn->el[i].type == BLOCK_NODE) {
+	// The node is packed, so the id is copied out before it is bound.
+	bid_t bid = bn->el[i].bid;
+	q.push(std::pair<bid_t, TPIE_OS_SIZE_T>(bid, first + i));
+      }
+    }
+    release_node(bn);
+  }
+
+  TPLOG("kdbtree::build_top Exiting "<<"\n");
+}
+
+//// *kdbtree::buffered_inserts* ////
+template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+void TPIE_AMI_KDBTREE::buffered_inserts(bool enable) {
+  if (enable && insert_buffer_ == NULL) {
+    insert_buffer_ = new stream<point_t>;
+    insert_buffer_->persist(PERSIST_DELETE);
+  } else if (!enable && insert_buffer_ != NULL) {
+    flush();
+    delete insert_buffer_;
+    insert_buffer_ = NULL;
+  }
+}
+
+//// *kdbtree::flush* ////
+template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+err TPIE_AMI_KDBTREE::flush() {
+  if (insert_buffer_ == NULL || insert_buffer_->stream_len() == 0)
+    return tpie::ami::NO_ERROR;
+  TPLOG("kdbtree::flush Entering "<<"\n");
+
+  // Take the buffer away, so that insert() works directly on the tree.
+  stream<point_t>* buffer = insert_buffer_;
+  insert_buffer_ = NULL;
+  err ae = tpie::ami::NO_ERROR;
+  point_t *p;
+  point_t lo, hi;
+  TPIE_OS_SIZE_T i;
+
+  // The box containing the tree and the buffered points.
+  buffer->seek(0);
+  buffer->read_item(&p);
+  lo = hi = *p;
+  if (header_.size > 0) {
+    lo = header_.mbr_lo;
+    hi = header_.mbr_hi;
+  }
+  buffer->seek(0);
+  while (buffer->read_item(&p) == tpie::ami::NO_ERROR)
+    for (i = 0; i < dim; i++) {
+      lo[i] = std::min(lo[i], (*p)[i]);
+      hi[i] = std::max(hi[i], (*p)[i]);
+    }
+
+  // Sort the points by region.
+  stream<buffered_point_t>* keyed = new stream<buffered_point_t>;
+  keyed->persist(PERSIST_DELETE);
+  buffered_point_t bp;
+  buffer->seek(0);
+  while (buffer->read_item(&p) == tpie::ami::NO_ERROR) {
+    bp.key = kd_morton_key(p->key, lo.key, hi.key);
+    bp.p = *p;
+    keyed->write_item(bp);
+  }
+  stream<buffered_point_t>* sorted = new stream<buffered_point_t>;
+  sorted->persist(PERSIST_DELETE);
+  ae = tpie::ami::sort_or_copy(keyed, sorted);
+  delete keyed;
+
+  if (ae != tpie::ami::NO_ERROR) {
+    TP_LOG_WARNING_ID("  flush: sorting the insertion buffer failed. points not inserted.");
+  } else {
+    buffered_point_t* q;
+    sorted->seek(0);
+    while (sorted->read_item(&q) == tpie::ami::NO_ERROR)
+      insert(q->p);
+    delete buffer;
+    buffer = new stream<point_t>;
+    buffer->persist(PERSIST_DELETE);
+  }
+  delete sorted;
+
+  insert_buffer_ = buffer;
+  TPLOG("kdbtree::flush Exiting "<<"\n");
+  return ae;
+}
+
 //// *kdbtree::dfs_preorder* ////
 template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
 KDB_ITEM TPIE_AMI_KDBTREE::dfs_preorder(int& level) {
@@ -969,6 +1217,8 @@ KDB_ITEM TPIE_AMI_KDBTREE::dfs_preorder(int& level) {
 
   if (level == -1) {
 
+    flush();
+
     // Empty the stack. This allows restarts in the middle of a
     // traversal. All previous state information is lost.
     while (!dfs_stack_.empty())
@@ -1188,25 +1438,34 @@ void TPIE_AMI_KDBTREE::find_split_position(const STACK_ITEM& top, coord_t& sp, T
 #endif
 
   std::vector<coord_t > cv(0);
-  TPIE_OS_SIZE_T unbounded = 0;
-  // Collect all low boundaries from bn and, if they are bounded,
-  // store them in cv. The unbounded ones are counted only.
-  for (TPIE_OS_SIZE_T i = 0; i < bn->size(); i++) {
-    if (bn->el[i].region.is_bounded_lo(d))
-      cv.push_back(bn->el[i].region.lo(d));
-    else
-      unbounded++;
+  TPIE_OS_SIZE_T unbounded, median = 0, k;
+  // If all regions of bn start at the same boundary on dimension d
+  // (which happens when points arrive sorted), try the next dimension.
+  for (k = 0; k < dim; k++, d = (d + 1) % dim) {
+    cv.clear();
+    unbounded = 0;
+    // Collect all low boundaries from bn and, if they are bounded,
+    // store them in cv. The unbounded ones are counted only.
+    for (TPIE_OS_SIZE_T i = 0; i < bn->size(); i++) {
+      if (bn->el[i].region.is_bounded_lo(d))
+	cv.push_back(bn->el[i].region.lo(d));
+      else
+	unbounded++;
+    }
+    if (cv.size() == 0)
+      continue;
+    // Sort.
+    std::sort(cv.begin(), cv.end());
+    // Get median value.
+    median = (bn->size() / 2 > unbounded ? bn->size() / 2 - unbounded: 0);
+    // Make sure we don't return the leftmost boundary.
+    if (unbounded == 0)
+      while (median < cv.size() && cv[median] == cv[0])
+	median++;
+    if (median < cv.size())
+      break;
   }
-  assert(cv.size() > 0);
-  // Sort.
-  std::sort(cv.begin(), cv.end());
-  // Get median value.
-  TPIE_OS_SIZE_T median = (bn->size() / 2 > unbounded ? bn->size() / 2 - unbounded: 0);
-  // Make sure we don't return the leftmost boundary.
-  if (unbounded == 0)
-    while (cv[median] == cv[0])
-      median++;
-  assert(median < cv.size());
+  assert(k < dim && median < cv.size());
   sp = cv[median];
   release_node(bn);
 }
@@ -1220,6 +1479,9 @@ void TPIE_AMI_KDBTREE::split_node(coord_t sp, TPIE_OS_SIZE_T d, const KDB_ITEM&
 
   bn = fetch_node(kis.bid);
   bn_hi = fetch_node();
+  // The new node splits on the same dimension as bn, unless the caller
+  // says otherwise (the node constructor leaves it unset).
+  bn_hi->split_dim() = bn->split_dim();
   KDB_ITEM ki;
   ///  TPIE_OS_SIZE_T d = bn->split_dim();
 
@@ -1348,6 +1610,8 @@ const stats_tree &TPIE_AMI_KDBTREE::stats() {
 //// *kdbtree::~kdbtree* ////
 template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
 TPIE_AMI_KDBTREE::~kdbtree() {
+
+  buffered_inserts(false);
   
   if (status_ == tpie::ami::KDBTREE_STATUS_VALID) {
     // Write initialization info into the pcoll_nodes_ header.
@@ -37,8 +37,12 @@
 #include <algorithm>
 // For vector.
 #include <vector>
+// For map.
+#include <map>
 // For priority_queue.
 #include <queue>
+// For numeric_limits.
+#include <limits>
 // STL string.
 #include <string>
 
@@ -52,10 +56,16 @@
 #include <tpie/stats_tree.h>
 // The cache manager.
 #include <tpie/cache.h>
+// The cache shared by the threads of batched queries.
+#include <tpie/cache_sharded.h>
 // The point/record classes.
 #include <tpie/point.h>
 // Supporting types: kdtree_status, kdtree_params, etc.
 #include <tpie/kd_base.h>
+// Threads for parallel bulk loading and batched queries.
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/cstdint.hpp>
 
 namespace tpie {
 
@@ -64,6 +74,7 @@ namespace ami {
 // Forward references.
 template<class coord_t, TPIE_OS_SIZE_T dim, class BTECOLL> class kdtree_leaf;
 template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL> class kdtree_node;
+template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL> class bkdtree;
 
 /** A global object storing the default parameter values. */
 const kdtree_params _kdtree_params_default = kdtree_params();
@@ -89,6 +100,9 @@ public:
 	typedef kdtree_node<coord_t, dim, Bin_node, BTECOLL> node_t;
 	typedef kdtree_leaf<coord_t, dim, BTECOLL> leaf_t;
 
+	// The Bkd-tree merges the nearest neighbors of its kd-trees.
+	friend class bkdtree<coord_t, dim, Bin_node, BTECOLL>;
+
 	///////////////////////////////////////////////////////////////////////////
 	/// Constructor.
 	///////////////////////////////////////////////////////////////////////////
@@ -136,10 +150,38 @@ public:
 	err unload(stream_t* s);
 
 	///////////////////////////////////////////////////////////////////////////
-	// Reports the \p k nearest neighbors of point \p p.
+	/// Reports the \p k nearest neighbors of point \p p, nearest first.
+	/// Returns the number of points reported (less than \p k only if the
+	/// tree has fewer points).
 	///////////////////////////////////////////////////////////////////////////
 	TPIE_OS_OFFSET k_nn_query(const point_t &p, stream_t* stream, TPIE_OS_OFFSET k);
 
+	///////////////////////////////////////////////////////////////////////////
+	/// One answer of a batched nearest neighbor query: \p neighbor is one of
+	/// the nearest neighbors of the query point with id \p query_id, at
+	/// (Euclidean) distance \p distance.
+	///////////////////////////////////////////////////////////////////////////
+	struct nn_result_t {
+		size_t query_id;
+		point_t neighbor;
+		double distance;
+	};
+	typedef stream<nn_result_t> nn_stream_t;
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Reports the \p k nearest neighbors of every point in \p queries to
+	/// \p out. The queries are answered in Morton (Z-) order of their
+	/// coordinates, so that nearby queries find the blocks they need in the
+	/// caches. With more than one thread, each batch of queries is split into
+	/// ranges answered concurrently, sharing the caches.
+	///
+	/// The answers to a query are written together, nearest first; the
+	/// queries appear in the order they were answered in. Returns the number
+	/// of answers written.
+	///////////////////////////////////////////////////////////////////////////
+	TPIE_OS_OFFSET k_nn_query(stream_t* queries, nn_stream_t* out, 
+							  TPIE_OS_OFFSET k, TPIE_OS_SIZE_T threads = 1);
+
 	///////////////////////////////////////////////////////////////////////////
 	/// Reports all points inside the window determined by \p p1 and \p p2. If
 	/// \p stream is \p NULL, only *count* the points inside the window. NB:
@@ -274,12 +316,21 @@ protected:
 
 	typedef tpie::ami::CACHE_MANAGER<node_t*, remove_node> node_cache_t;
 	typedef tpie::ami::CACHE_MANAGER<leaf_t*, remove_leaf> leaf_cache_t;
+	typedef cache_manager_sharded<node_t*, remove_shared<node_t> > node_shared_cache_t;
+	typedef cache_manager_sharded<leaf_t*, remove_shared<leaf_t> > leaf_shared_cache_t;
 
 	/** The node cache. */
 	node_cache_t* node_cache_;
 	/** The leaf cache. */
 	leaf_cache_t* leaf_cache_;
 
+	/** The top levels of the tree: the bin nodes of the topmost block
+	 * nodes, copied in breadth-first order (empty if not used). The
+	 * root is top_el_[0]. A BIN_NODE child is a position in top_el_;
+	 * a BLOCK_NODE or BLOCK_LEAF child is a position in top_lk_. */
+	std::vector<Bin_node> top_el_;
+	std::vector<bid_t> top_lk_;
+
 	/** The collection storing the leaves. */
 	collection_t* pcoll_leaves_;
 
@@ -315,6 +366,85 @@ protected:
 	/** Base path name. */
 	std::string name_;
 
+	/** The caches shared by the threads of a batched query (NULL
+	 * otherwise). */
+	node_shared_cache_t* node_shared_cache_;
+	leaf_shared_cache_t* leaf_shared_cache_;
+
+	///////////////////////////////////////////////////////////////////////////
+	/// State of the subtree of one context in the parallel bulk loader: the
+	/// chain of leaves built for it, the number of bin nodes it created and,
+	/// if it is deferred, where it is to be linked in.
+	///////////////////////////////////////////////////////////////////////////
+	struct load_state {
+		bid_t first_leaf;
+		bid_t last_leaf;
+		leaf_t* open_leaf;
+		TPIE_OS_OFFSET bin_nodes;
+		/** True if the subtree has blocks of its own and is built apart
+		 * from its parent, by a later task or a job. Its root \ref child,
+		 * of type \ref type, goes in link \ref lk of node \ref node. */
+		bool deferred;
+		bid_t node;
+		TPIE_OS_SIZE_T lk;
+		link_type_t type;
+		bid_t child;
+		/** The in-memory points of a job, split on dimension \ref d first. */
+		TPIE_OS_SIZE_T d;
+		TPIE_OS_SIZE_T sz;
+		point_t* streams[dim];
+		/** The number of points whose memory is reserved. */
+		TPIE_OS_OFFSET reserved;
+		load_state(): first_leaf(0), last_leaf(0), open_leaf(NULL), bin_nodes(0),
+					  deferred(false), node(0), lk(0), type(BLOCK_LEAF), child(0),
+					  d(0), sz(0), reserved(0) {}
+	};
+
+	/** True while worker threads build subtrees. Blocks are then read and
+	 * written directly, bypassing the caches. */
+	bool parallel_load_;
+
+	/** Serializes the block and stream I/O of worker threads, and guards
+	 * the shared state of the parallel bulk loader. */
+	boost::mutex io_mutex_;
+
+	/** Wakes up workers waiting for memory or work. */
+	boost::condition_variable load_cond_;
+
+	/** Memory the workers may use, and the part of it reserved. */
+	TPIE_OS_OFFSET load_budget_;
+	TPIE_OS_OFFSET load_reserved_;
+
+	/** The number of workers and jobs holding a memory reservation. */
+	TPIE_OS_SIZE_T load_active_;
+
+	/** The number of workers running a task or job. */
+	TPIE_OS_SIZE_T load_busy_;
+
+	/** Subtrees whose points are in memory, waiting for a worker. These
+	 * are owned by load_job_states_. */
+	std::queue<load_state*> load_jobs_;
+	std::vector<load_state*> load_job_states_;
+
+	/** The state of the subtree built by the calling worker thread. */
+	boost::thread_specific_ptr<load_state> load_state_;
+
+	/** The tasks own their states; nothing to clean up at thread exit. */
+	static void load_state_cleanup(load_state*) {}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// A lock on io_mutex_, taken only during parallel loading.
+	///////////////////////////////////////////////////////////////////////////
+	class load_lock {
+	public:
+		load_lock(kdtree& t): lock_(t.io_mutex_, boost::defer_lock) {
+			if (t.parallel_load_)
+				lock_.lock();
+		}
+	private:
+		boost::unique_lock<boost::mutex> lock_;
+	};
+
 	/** Various initialization common to all constructors. */
 	void shared_init(const std::string& base_file_name, collection_type type);
 
@@ -1061,6 +1191,55 @@ protected:
 			double p; // the priority (the distance squared)
 			bid_t bid;
 			link_type_t type;
+			// The box of the block, for the distances of its children.
+			double lo[dim];
+			double hi[dim];
+			// The smallest distance first.
+			bool operator<(const nn_pq_elem& e) const { return p > e.p; }
+		};
+
+		///////////////////////////////////////////////////////////////////////////
+		/// A bin node to visit inside a block node, during nearest neighbor
+		/// searching.
+		///////////////////////////////////////////////////////////////////////////
+		struct nn_stack_elem {
+			TPIE_OS_SIZE_T idx;
+			double lo[dim];
+			double hi[dim];
+		};
+
+		///////////////////////////////////////////////////////////////////////////
+		/// A neighbor found so far (the farthest first).
+		///////////////////////////////////////////////////////////////////////////
+		struct nn_candidate {
+			double d2;
+			point_t p;
+			nn_candidate(double _d2, const point_t& _p): d2(_d2), p(_p) {}
+			bool operator<(const nn_candidate& c) const { return d2 < c.d2; }
+		};
+
+		///////////////////////////////////////////////////////////////////////////
+		/// A query point of a batched nearest neighbor query, with its
+		/// position on the Morton curve.
+		///////////////////////////////////////////////////////////////////////////
+		struct nn_query_t {
+			boost::uint64_t key;
+			point_t p;
+			bool operator<(const nn_query_t& q) const { return key < q.key; }
+		};
+
+		///////////////////////////////////////////////////////////////////////////
+		/// Sorts an in-memory array of points. Used by the threads of sort().
+		///////////////////////////////////////////////////////////////////////////
+		class sort_job {
+		public:
+			sort_job(point_t* first, point_t* last, typename point_t::cmp* comp):
+				first_(first), last_(last), comp_(comp) {}
+			void operator()() { std::sort(first_, last_, *comp_); }
+		private:
+			point_t* first_;
+			point_t* last_;
+			typename point_t::cmp* comp_;
 		};
 
 		///////////////////////////////////////////////////////////////////////////
@@ -1122,11 +1301,116 @@ protected:
 		void distribute_s(bid_t bid, TPIE_OS_SIZE_T d, sample* s);
 		void build_lower_tree_s(sample* s);
 
+		///////////////////////////////////////////////////////////////////////////
+		/// Builds the subtree of a grid or sample context, hanging from node
+		/// \p b. While loading in parallel, a subtree in blocks of its own is
+		/// only linked into \p b, and build_deferred_subtree() builds it later.
+		///////////////////////////////////////////////////////////////////////////
+		template<class Context>
+		void build_lower_subtree(Context* c, node_t* b);
+		template<class Context>
+		void build_deferred_subtree(Context* c, load_state& s);
+
+		/** How the subtree of sz points hanging from b is stored. */
+		link_type_t subtree_type(node_t* b, const bn_context& ctx, 
+								 TPIE_OS_OFFSET sz, TPIE_OS_SIZE_T next_free_el);
+
+		///////////////////////////////////////////////////////////////////////////
+		/// The points of a context: open_context() opens its streams and
+		/// returns their length (negative if invalid), close_context() closes
+		/// them again keeping the files, and load_context() reads them into
+		/// \p dim sorted in-memory streams.
+		///////////////////////////////////////////////////////////////////////////
+		TPIE_OS_OFFSET open_context(grid_context* gc);
+		TPIE_OS_OFFSET open_context(sample_context* sc);
+		void close_context(grid_context* gc);
+		void close_context(sample_context* sc);
+		void load_context(grid_context* gc, point_t** mm_streams, TPIE_OS_SIZE_T& sz);
+		void load_context(sample_context* sc, point_t** mm_streams, TPIE_OS_SIZE_T& sz);
+
+		///////////////////////////////////////////////////////////////////////////
+		/// Builds the subtrees of the contexts in \p q with
+		/// params_.load_threads threads.
+		///////////////////////////////////////////////////////////////////////////
+		template<class Context>
+		void build_lower_parallel(std::vector<Context>& q);
+		template<class Context>
+		void run_load_tasks(std::vector<Context>& q, 
+							const std::vector<std::vector<TPIE_OS_SIZE_T> >& tasks,
+							std::vector<load_state>& states, bool deferred);
+		template<class Context>
+		void load_worker(std::vector<Context>* q, 
+						 const std::vector<std::vector<TPIE_OS_SIZE_T> >* tasks,
+						 std::vector<load_state>* states, bool deferred,
+						 TPIE_OS_SIZE_T* next);
+
+		///////////////////////////////////////////////////////////////////////////
+		/// Hands the building of a node from \p sz in-memory points over to
+		/// another worker. Returns false, and does nothing, unless loading in
+		/// parallel a subtree large enough to be worth it.
+		///////////////////////////////////////////////////////////////////////////
+		bool defer_node_mm(node_t* b, TPIE_OS_SIZE_T lk, TPIE_OS_SIZE_T d,
+						   point_t** in_streams, TPIE_OS_SIZE_T sz);
+		void run_load_job(load_state* job);
+
+		/** Ends the chain of leaves of \p s. */
+		void close_leaf_chain(load_state& s);
+
+		///////////////////////////////////////////////////////////////////////////
+		/// Links the subtree of \p s into its node, if it was deferred, and
+		/// appends its chain of leaves to the chain of the tree.
+		///////////////////////////////////////////////////////////////////////////
+		void finish_load_state(load_state& s);
+
+		///////////////////////////////////////////////////////////////////////////
+		/// Waits until the memory for sz points can be reserved for the
+		/// current subtree, and releases it again. Does nothing unless
+		/// loading in parallel.
+		///////////////////////////////////////////////////////////////////////////
+		void load_reserve(TPIE_OS_OFFSET sz);
+		void load_unreserve();
+
+		///////////////////////////////////////////////////////////////////////////
+		/// Appends a new leaf to the chain of leaves of the current task.
+		///////////////////////////////////////////////////////////////////////////
+		void chain_leaf(leaf_t* l);
+
+		///////////////////////////////////////////////////////////////////////////
+		/// Adds to the bin node count of the current task.
+		///////////////////////////////////////////////////////////////////////////
+		void count_bin_nodes(TPIE_OS_SIZE_T n);
+
+		///////////////////////////////////////////////////////////////////////////
+		/// The two halves of \ref copy_to_mm(stream_t*, point_t**, TPIE_OS_SIZE_T&):
+		/// read_to_mm() makes the \p dim in-memory copies, and sort_mm() sorts
+		/// them and updates the mbr.
+		///////////////////////////////////////////////////////////////////////////
+		void read_to_mm(stream_t* in_stream, 
+						point_t** mm_streams, TPIE_OS_SIZE_T& sz);
+		void sort_mm(point_t** mm_streams, TPIE_OS_SIZE_T sz);
+
+		///////////////////////////////////////////////////////////////////////////
+		/// Finds the \p k nearest neighbors of \p p and appends them to \p
+		/// res, nearest first. Reentrant while the shared caches are in use.
+		///////////////////////////////////////////////////////////////////////////
+		void k_nn_search(const point_t& p, TPIE_OS_OFFSET k, std::vector<nn_candidate>& res);
+
+		/** Answers queries [first, last) of a batch, for one thread. */
+		void k_nn_batch(const std::vector<nn_query_t>* queries, 
+						TPIE_OS_SIZE_T first, TPIE_OS_SIZE_T last, TPIE_OS_OFFSET k,
+						std::vector<nn_result_t>* out);
+
 		///////////////////////////////////////////////////////////////////////////
 		/// Finds the leaf where \p p might be.
 		///////////////////////////////////////////////////////////////////////////
 		bid_t find_leaf(const point_t &p);
 
+		///////////////////////////////////////////////////////////////////////////
+		/// Copies the top levels of the tree into top_el_ and top_lk_, within
+		/// params_.top_memory bytes. Called whenever the tree gets a new root.
+		///////////////////////////////////////////////////////////////////////////
+		void build_top();
+
 		///////////////////////////////////////////////////////////////////////////
 		/// Fetches a node from cache or disk. If bid_t is 0, a new node is created.
 		///////////////////////////////////////////////////////////////////////////
@@ -1137,6 +1421,17 @@ protected:
 		///////////////////////////////////////////////////////////////////////////
 		leaf_t* fetch_leaf(bid_t bid = 0);
 
+		///////////////////////////////////////////////////////////////////////////
+		/// Starts reading a node or leaf that a query visits later into the
+		/// block cache.
+		///////////////////////////////////////////////////////////////////////////
+		void prefetch(bid_t bid, link_type_t type) {
+			if (type == BLOCK_LEAF)
+				pcoll_leaves_->prefetch(bid);
+			else
+				pcoll_nodes_->prefetch(bid);
+		}
+
 		///////////////////////////////////////////////////////////////////////////
 		/// Releases a node (put it into the cache).
 		///////////////////////////////////////////////////////////////////////////
@@ -1146,6 +1441,19 @@ protected:
 		/// Releases a leaf.
 		///////////////////////////////////////////////////////////////////////////
 		void release_leaf(leaf_t* q);
+
+		///////////////////////////////////////////////////////////////////////////
+		/// Reads a node or leaf for a query: pinned in the shared caches while
+		/// they are in use, fetched otherwise.
+		///////////////////////////////////////////////////////////////////////////
+		node_t* acquire_node(bid_t bid);
+		leaf_t* acquire_leaf(bid_t bid);
+
+		///////////////////////////////////////////////////////////////////////////
+		/// Releases a node or leaf read by acquire_node() or acquire_leaf().
+		///////////////////////////////////////////////////////////////////////////
+		void drop_node(node_t* q);
+		void drop_leaf(leaf_t* q);
 	};
 
 
@@ -1516,12 +1824,13 @@ protected:
 //// *kdtree::kdtree* ////
 	template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
 	TPIE_AMI_KDTREE::kdtree(const kdtree_params& params) 
-		: header_(), params_(params), points_are_sample(false) {
+		: header_(), params_(params), node_shared_cache_(NULL), leaf_shared_cache_(NULL),
+		  parallel_load_(false), load_state_(&load_state_cleanup), points_are_sample(false) {
 		TPLOG("kdtree::kdtree Entering\n");
 
 		std::string base_file_name = tempname::tpie_name("kdtree");
 		name_ = base_file_name;
-		shared_init(base_file_name, AMI_WRITE_COLLECTION);
+		shared_init(base_file_name, WRITE_COLLECTION);
 		if (status_ == KDTREE_STATUS_VALID) {
 			persist(PERSIST_DELETE);
 		}
@@ -1534,7 +1843,9 @@ protected:
 	template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
 	TPIE_AMI_KDTREE::kdtree(const std::string& base_file_name, collection_type type, 
 							const kdtree_params& params) 
-		: header_(), params_(params), name_(base_file_name), points_are_sample(false) {
+		: header_(), params_(params), name_(base_file_name), 
+		  node_shared_cache_(NULL), leaf_shared_cache_(NULL),
+		  parallel_load_(false), load_state_(&load_state_cleanup), points_are_sample(false) {
 		TPLOG("kdtree::kdtree Entering base_file_name="<<base_file_name<<"\n");
 
 		shared_init(base_file_name, type);
@@ -1646,6 +1957,10 @@ protected:
 
 		bin_node_count_ = 0;
 
+		// An existing tree.
+		if (pcoll_leaves_->size() != 0)
+			build_top();
+
 		TPLOG("kdtree::shared_init Exiting "<<"\n");
 	}
 
@@ -1849,7 +2164,7 @@ protected:
 			create_bin_node(n, ctx, in_streams, next_free_el, next_free_lk);
 
 		n->size() = next_free_el;
-		bin_node_count_ += n->size();
+		count_bin_nodes(n->size());
 		release_node(n);
 
 		TPLOG("kdtree::create_node Exiting bid="<<bid<<"\n");
@@ -1875,13 +2190,7 @@ protected:
 		// little enough points to safely cast.
 		l->size() = (TPIE_OS_SIZE_T)in_streams[d]->stream_len();
 
-		if (previous_leaf_ == NULL) {
-			first_leaf_id_ = l->bid();
-		} else {
-			previous_leaf_->next() = l->bid();
-			release_leaf(previous_leaf_);
-		}
-		previous_leaf_ = l;
+		chain_leaf(l);
 
 		// Copy points from stream to leaf. This should be an array copy,
 		// but we don't have the mechanism...
@@ -2030,8 +2339,9 @@ protected:
 
 			b->el[ctx.i].set_low_child(next_free_lk++, BLOCK_NODE);
 			TPLOG("  b("<<b->bid()<<")->el["<<ctx.i<<"].lo: ("<<next_free_lk-1<<", BLOCK_NODE)\n");
-			create_node_mm(b->lk[next_free_lk - 1], (ctx.d + 1) % dim, 
-						   lo_streams, lo_sz);
+			if (!defer_node_mm(b, next_free_lk - 1, (ctx.d + 1) % dim, lo_streams, lo_sz))
+				create_node_mm(b->lk[next_free_lk - 1], (ctx.d + 1) % dim, 
+							   lo_streams, lo_sz);
 
 		} else {
 
@@ -2070,8 +2380,9 @@ protected:
 
 			b->el[ctx.i].set_high_child(next_free_lk++, BLOCK_NODE);
 			TPLOG("  b("<<b->bid()<<")->el["<<ctx.i<<"].hi: ("<<next_free_lk-1<<", BLOCK_NODE)\n");
-			create_node_mm(b->lk[next_free_lk - 1], (ctx.d + 1) % dim, 
-						   hi_streams, sz - lo_sz);
+			if (!defer_node_mm(b, next_free_lk - 1, (ctx.d + 1) % dim, hi_streams, sz - lo_sz))
+				create_node_mm(b->lk[next_free_lk - 1], (ctx.d + 1) % dim, 
+							   hi_streams, sz - lo_sz);
 
 		} else {
 
@@ -2100,13 +2411,7 @@ protected:
 
 		l->size() = sz;
 
-		if (previous_leaf_ == NULL) {
-			first_leaf_id_ = l->bid();
-		} else {
-			previous_leaf_->next() = l->bid();
-			release_leaf(previous_leaf_);
-		}
-		previous_leaf_ = l;
+		chain_leaf(l);
 
 		size_t i;
 
@@ -2148,7 +2453,7 @@ protected:
 		//..
 		if (n->lk[n->lk.capacity()-1] == 0)
 			n->lk[n->lk.capacity()-1] = next_free_lk;
-		bin_node_count_ += n->size();
+		count_bin_nodes(n->size());
 		release_node(n);
 		TPLOG("kdtree::create_node_mm Exiting bid="<<bid<<"\n");
 	}
@@ -2198,6 +2503,14 @@ protected:
 	template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
 	void TPIE_AMI_KDTREE::copy_to_mm(POINT_STREAM* in_stream, POINT** streams_mm, TPIE_OS_SIZE_T& sz) {
 		TPLOG("kdtree::copy_to_mm Entering "<<"\n");
+		read_to_mm(in_stream, streams_mm, sz);
+		sort_mm(streams_mm, sz);
+		TPLOG("kdtree::copy_to_mm Exiting "<<"\n");
+	}
+
+//// *kdtree::read_to_mm* ////
+	template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+	void TPIE_AMI_KDTREE::read_to_mm(POINT_STREAM* in_stream, POINT** streams_mm, TPIE_OS_SIZE_T& sz) {
 		// This method call should have been preceeded by a call to can_do_mm
 		// so casting should be o.k.
 		sz = (TPIE_OS_SIZE_T)in_stream->stream_len();
@@ -2220,12 +2533,21 @@ protected:
 			for (i = 0; i < sz; i++)
 				streams_mm[j][i] = streams_mm[0][i];
 		}
+	}
 
-		// Sort the dim in-memory streams (and update the mbr).
-		for (j = 0; j < dim; j++) {
+//// *kdtree::sort_mm* ////
+	template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+	void TPIE_AMI_KDTREE::sort_mm(POINT** streams_mm, TPIE_OS_SIZE_T sz) {
+		TPIE_OS_SIZE_T j;
 
+		// Sort the dim in-memory streams.
+		for (j = 0; j < dim; j++)
 			std::sort(streams_mm[j], streams_mm[j]+sz, *comp_obj_[j]);
 
+		// Update the mbr.
+		load_lock lock(*this);
+		for (j = 0; j < dim; j++) {
+
 			if (header_.mbr_lo.id() == 0 || header_.mbr_hi.id() == 0) {
 				header_.mbr_lo[j] = streams_mm[j][0][j];
 				header_.mbr_hi[j] = streams_mm[j][sz-1][j];
@@ -2239,8 +2561,6 @@ protected:
 			header_.mbr_lo.id() = 1;
 			header_.mbr_hi.id() = 1;
 		}  
-
-		TPLOG("kdtree::copy_to_mm Exiting "<<"\n");
 	}
 
 //// *kdtree::create_grid* ////
@@ -2275,84 +2595,428 @@ protected:
 	void TPIE_AMI_KDTREE::build_lower_tree_g(grid* g) {
 		TPLOG("kdtree::build_lower_tree_g Entering "<<"\n");
 
-		grid_context *gc;
-		size_t sz, i, j;
-		//  POINT* p;
-		POINT* streams_mm[dim];
-		//  err err;
-		TPIE_OS_SIZE_T next_free_el;
-		TPIE_OS_SIZE_T next_free_lk;
+		size_t j;
 		TPIE_AMI_KDTREE_NODE* b;
 
-		for (j = 0; j < g->q.size(); j++) {
+		if (params_.load_threads > 1) {
+			build_lower_parallel(g->q);
+			TPLOG("kdtree::build_lower_tree_g Exiting "<<"\n");
+			return;
+		}
 
-			gc = &(g->q[j]);
-			b = fetch_node(gc->bid);
-			next_free_el = b->size();
-			next_free_lk = (TPIE_OS_SIZE_T)b->lk[b->lk.capacity()-1];
-			b->lk[b->lk.capacity()-1] = 0;
+		for (j = 0; j < g->q.size(); j++) {
+			b = fetch_node(g->q[j].bid);
+			build_lower_subtree(&(g->q[j]), b);
+			release_node(b);
+			DBG(" ");
+		}
+		TPLOG("kdtree::build_lower_tree_g Exiting "<<"\n");
+	}
 
-			// Create the streams and load them into memory.
-			DBG("L");
-			for (i = 0; i < dim; i++) {
-				gc->streams[i] = new POINT_STREAM(gc->stream_names[i]);
-				gc->streams[i]->persist(PERSIST_DELETE);
-				if (gc->streams[i]->status() == tpie::ami::STREAM_STATUS_INVALID) {
-					std::cerr << "kdtree bulk loading internal error.\n" 
-							  << "[invalid stream restored from file "
-							  << gc->stream_names[i] << "].\n";
-					std::cerr << "Aborting.\n";
-					delete gc->streams[i];
-					exit(1);
-				}
+//// *kdtree::open_context* ////
+	template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+	TPIE_OS_OFFSET TPIE_AMI_KDTREE::open_context(grid_context* gc) {
+		load_lock lock(*this);
+		for (size_t i = 0; i < dim; i++) {
+			gc->streams[i] = new POINT_STREAM(gc->stream_names[i]);
+			gc->streams[i]->persist(PERSIST_DELETE);
+			if (gc->streams[i]->status() == tpie::ami::STREAM_STATUS_INVALID) {
+				std::cerr << "kdtree bulk loading internal error.\n" 
+						  << "[invalid stream restored from file "
+						  << gc->stream_names[i] << "].\n";
+				std::cerr << "Aborting.\n";
+				delete gc->streams[i];
+				exit(1);
 			}
+		}
+		return gc->streams[0]->stream_len();
+	}
 
-			copy_to_mm(gc->streams, streams_mm, sz);
+//// *kdtree::close_context* ////
+	template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+	void TPIE_AMI_KDTREE::close_context(grid_context* gc) {
+		load_lock lock(*this);
+		for (size_t i = 0; i < dim; i++) {
+			gc->streams[i]->persist(PERSIST_PERSISTENT);
+			delete gc->streams[i];
+			gc->streams[i] = NULL;
+		}
+	}
 
-			// Build the subtree.
-			DBG("B"<<(TPIE_OS_OFFSET)sz);
-			if (sz <= params_.leaf_size_max) {
+//// *kdtree::load_context* ////
+	template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+	void TPIE_AMI_KDTREE::load_context(grid_context* gc, POINT** streams_mm, TPIE_OS_SIZE_T& sz) {
+		load_lock lock(*this);
+		copy_to_mm(gc->streams, streams_mm, sz);
+	}
 
-				if (gc->low)
-					b->el[gc->ctx.i].set_low_child(next_free_lk++, BLOCK_LEAF);
-				else
-					b->el[gc->ctx.i].set_high_child(next_free_lk++, BLOCK_LEAF);
-				TPLOG("  b("<<b->bid()<<")->el["<<gc->ctx.i<<"].?: ("<<next_free_lk-1<<", BLOCK_LEAF)\n");
-				create_leaf_mm(b->lk[next_free_lk - 1], (gc->ctx.d + 1) % dim, streams_mm, sz);
+//// *kdtree::subtree_type* ////
+	template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+	link_type_t TPIE_AMI_KDTREE::subtree_type(TPIE_AMI_KDTREE_NODE* b, const bn_context& ctx, 
+											  TPIE_OS_OFFSET sz, TPIE_OS_SIZE_T next_free_el) {
+		if (sz <= (TPIE_OS_OFFSET)params_.leaf_size_max)
+			return BLOCK_LEAF;
+		else if ((ctx.h + 1 >= max_intranode_height(b->bid())) || 
+				 (next_free_el >= params_.node_size_max))
+			return BLOCK_NODE;
+		else
+			return BIN_NODE;
+	}
 
-			} else if ((gc->ctx.h + 1 >= max_intranode_height(b->bid())) || 
-					   (next_free_el >= params_.node_size_max)) {
+//// *kdtree::build_lower_subtree* ////
+	template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+	template<class Context>
+	void TPIE_AMI_KDTREE::build_lower_subtree(Context* c, TPIE_AMI_KDTREE_NODE* b) {
+		TPIE_OS_SIZE_T next_free_el, next_free_lk, link;
+		TPIE_OS_SIZE_T sz;
+		POINT* streams_mm[dim];
 
-				if (gc->low)
-					b->el[gc->ctx.i].set_low_child(next_free_lk++, BLOCK_NODE);
-				else
-					b->el[gc->ctx.i].set_high_child(next_free_lk++, BLOCK_NODE);
-				TPLOG("  b("<<b->bid()<<")->el["<<gc->ctx.i<<"].?: ("<<next_free_lk-1<<", BLOCK_NODE)\n");
-				create_node_mm(b->lk[next_free_lk - 1], (gc->ctx.d + 1) % dim, streams_mm, sz);
+		if (!parallel_load_)
+			DBG("L");
+		TPIE_OS_OFFSET len = open_context(c);
+		if (len < 0)
+			return;
 
-			} else {
+		next_free_el = b->size();
+		next_free_lk = (TPIE_OS_SIZE_T)b->lk[b->lk.capacity()-1];
+		b->lk[b->lk.capacity()-1] = 0;
 
-				if (gc->low)
-					b->el[gc->ctx.i].set_low_child(next_free_el++, BIN_NODE);
-				else
-					b->el[gc->ctx.i].set_high_child(next_free_el++, BIN_NODE);
-				TPLOG("  b("<<b->bid()<<")->el["<<gc->ctx.i<<"].?: ("<<next_free_el-1<<", BIN_NODE)\n");
-				///DBG("create_grid: sz=" << sz << "\n"); 
-				create_bin_node_mm(b, bn_context(next_free_el - 1, gc->ctx.h + 1, 
-												 (gc->ctx.d + 1) % dim),
+		// Link the subtree into b.
+		link_type_t type = subtree_type(b, c->ctx, len, next_free_el);
+		link = (type == BIN_NODE) ? next_free_el++: next_free_lk++;
+		if (c->low)
+			b->el[c->ctx.i].set_low_child(link, type);
+		else
+			b->el[c->ctx.i].set_high_child(link, type);
+		TPLOG("  b("<<b->bid()<<")->el["<<c->ctx.i<<"].?: ("<<link<<", "<<type<<")\n");
+
+		if (parallel_load_ && type != BIN_NODE) {
+
+			// A subtree in blocks of its own is built later, in parallel
+			// with the others.
+			load_state_->deferred = true;
+			load_state_->node = b->bid();
+			load_state_->lk = link;
+			load_state_->type = type;
+			close_context(c);
+
+		} else {
+
+			// Load the points into memory and build the subtree.
+			load_reserve(len);
+			load_context(c, streams_mm, sz);
+			if (!parallel_load_)
+				DBG("B" << (TPIE_OS_OFFSET)sz);
+			if (type == BLOCK_LEAF)
+				create_leaf_mm(b->lk[link], (c->ctx.d + 1) % dim, streams_mm, sz);
+			else if (type == BLOCK_NODE)
+				create_node_mm(b->lk[link], (c->ctx.d + 1) % dim, streams_mm, sz);
+			else
+				create_bin_node_mm(b, bn_context(link, c->ctx.h + 1, (c->ctx.d + 1) % dim),
 								   streams_mm, sz, next_free_el, next_free_lk);
+			load_unreserve();
+		}
+
+		// save the next_free_* info.
+		if (b->lk[b->lk.capacity()-1] == 0) {
+			b->size() = next_free_el;
+			b->lk[b->lk.capacity()-1] = next_free_lk;
+		}
+	}
+
+//// *kdtree::build_deferred_subtree* ////
+	template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+	template<class Context>
+	void TPIE_AMI_KDTREE::build_deferred_subtree(Context* c, load_state& s) {
+		TPIE_OS_SIZE_T sz;
+		POINT* streams_mm[dim];
+
+		TPIE_OS_OFFSET len = open_context(c);
+		if (len < 0)
+			return;
+		load_reserve(len);
+		load_context(c, streams_mm, sz);
+		if (s.type == BLOCK_LEAF)
+			create_leaf_mm(s.child, (c->ctx.d + 1) % dim, streams_mm, sz);
+		else
+			create_node_mm(s.child, (c->ctx.d + 1) % dim, streams_mm, sz);
+		load_unreserve();
+	}
+
+//// *kdtree::build_lower_parallel* ////
+	template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+	template<class Context>
+	void TPIE_AMI_KDTREE::build_lower_parallel(std::vector<Context>& q) {
+		TPLOG("kdtree::build_lower_parallel Entering "<<"\n");
+
+		TPIE_OS_SIZE_T i;
+
+		// First, the subtrees are linked into the nodes they hang from.
+		// Subtrees in the same node share its free bin nodes, so each node
+		// is one task. Subtrees with blocks of their own are only linked,
+		// and are built by the second round of tasks.
+		std::map<bid_t, TPIE_OS_SIZE_T> task_of;
+		std::vector<std::vector<TPIE_OS_SIZE_T> > tasks;
+		for (i = 0; i < q.size(); i++) {
+			typename std::map<bid_t, TPIE_OS_SIZE_T>::iterator it = task_of.find(q[i].bid);
+			if (it == task_of.end()) {
+				it = task_of.insert(std::make_pair(q[i].bid, tasks.size())).first;
+				tasks.push_back(std::vector<TPIE_OS_SIZE_T>());
 			}
+			tasks[it->second].push_back(i);
+		}
+
+		// The workers bypass the caches, so these must not hold any
+		// blocks the workers will read.
+		node_cache_->flush();
+		leaf_cache_->flush();
+
+		// Each worker holds one node and one leaf besides its points.
+		load_budget_ = (TPIE_OS_OFFSET) MM_manager.memory_available() - 
+			TPIE_OS_OFFSET(params_.load_threads) * 
+			(pcoll_nodes_->block_size() + pcoll_leaves_->block_size()) -
+			TPIE_OS_OFFSET(8192 * 4);
+		load_reserved_ = 0;
+		load_active_ = 0;
+		load_busy_ = 0;
+
+		std::vector<load_state> states(q.size());
+		parallel_load_ = true;
+		run_load_tasks(q, tasks, states, false);
+
+		tasks.clear();
+		for (i = 0; i < q.size(); i++)
+			if (states[i].deferred)
+				tasks.push_back(std::vector<TPIE_OS_SIZE_T>(1, i));
+		run_load_tasks(q, tasks, states, true);
+		parallel_load_ = false;
+		DBG("[" << (TPIE_OS_OFFSET)load_job_states_.size() << " jobs]");
+
+		// Link the subtrees built by other tasks into their nodes, and
+		// thread the chains of leaves together: first those of the contexts,
+		// in the order in which the serial loader creates them, then those
+		// of the jobs.
+		for (i = 0; i < states.size(); i++)
+			finish_load_state(states[i]);
+		for (i = 0; i < load_job_states_.size(); i++) {
+			finish_load_state(*load_job_states_[i]);
+			delete load_job_states_[i];
+		}
+		load_job_states_.clear();
+
+		TPLOG("kdtree::build_lower_parallel Exiting "<<"\n");
+	}
+
+//// *kdtree::run_load_tasks* ////
+	template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+	template<class Context>
+	void TPIE_AMI_KDTREE::run_load_tasks(std::vector<Context>& q, 
+										 const std::vector<std::vector<TPIE_OS_SIZE_T> >& tasks,
+										 std::vector<load_state>& states, bool deferred) {
+		TPIE_OS_SIZE_T next = 0;
+		boost::thread_group workers;
+		for (TPIE_OS_SIZE_T i = 0; i < params_.load_threads; i++)
+			workers.create_thread(boost::bind(&TPIE_AMI_KDTREE::template load_worker<Context>,
+											  this, &q, &tasks, &states, deferred, &next));
+		workers.join_all();
+		assert(load_jobs_.empty());
+	}
 
-			// save the next_free_* info.
-			if (b->lk[b->lk.capacity()-1] == 0) {
-				b->size() = next_free_el;
-				b->lk[b->lk.capacity()-1] = next_free_lk;
+//// *kdtree::load_worker* ////
+	template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+	template<class Context>
+	void TPIE_AMI_KDTREE::load_worker(std::vector<Context>* q, 
+									  const std::vector<std::vector<TPIE_OS_SIZE_T> >* tasks,
+									  std::vector<load_state>* states, bool deferred,
+									  TPIE_OS_SIZE_T* next) {
+		TPIE_OS_SIZE_T t, j, k;
+		TPIE_AMI_KDTREE_NODE* b;
+		load_state* job;
+
+		for (;;) {
+			job = NULL;
+			{
+				// Jobs come first, since they hold memory. The workers are
+				// done when there is nothing left to do, and no busy worker
+				// could add more jobs.
+				boost::mutex::scoped_lock lock(io_mutex_);
+				while (load_jobs_.empty() && *next == tasks->size() && load_busy_ > 0)
+					load_cond_.wait(lock);
+				if (!load_jobs_.empty()) {
+					job = load_jobs_.front();
+					load_jobs_.pop();
+				} else if (*next < tasks->size()) {
+					t = (*next)++;
+				} else
+					break;
+				load_busy_++;
 			}
-    
+
+			if (job != NULL) {
+				run_load_job(job);
+			} else {
+				b = deferred ? NULL: fetch_node((*q)[(*tasks)[t][0]].bid);
+				for (j = 0; j < (*tasks)[t].size(); j++) {
+					k = (*tasks)[t][j];
+					load_state& s = (*states)[k];
+					load_state_.reset(&s);
+					if (deferred)
+						build_deferred_subtree(&(*q)[k], s);
+					else
+						build_lower_subtree(&(*q)[k], b);
+					close_leaf_chain(s);
+				}
+				if (b != NULL)
+					release_node(b);
+				load_state_.reset();
+			}
+
+			boost::mutex::scoped_lock lock(io_mutex_);
+			load_busy_--;
+			load_cond_.notify_all();
+		}
+	}
+
+//// *kdtree::defer_node_mm* ////
+	template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+	bool TPIE_AMI_KDTREE::defer_node_mm(TPIE_AMI_KDTREE_NODE* b, TPIE_OS_SIZE_T lk, TPIE_OS_SIZE_T d, 
+										POINT** in_streams, TPIE_OS_SIZE_T sz) {
+		// Small subtrees are not worth the trouble.
+		if (!parallel_load_ || sz < params_.leaf_size_max * params_.node_size_max)
+			return false;
+
+		load_state* job = new load_state;
+		job->deferred = true;
+		job->node = b->bid();
+		job->lk = lk;
+		job->type = BLOCK_NODE;
+		job->d = d;
+		job->sz = sz;
+		for (TPIE_OS_SIZE_T i = 0; i < dim; i++) {
+			job->streams[i] = in_streams[i];
+			in_streams[i] = NULL;
+		}
+
+		// The job takes over the memory reserved for its points.
+		job->reserved = sz;
+		load_state_->reserved -= sz;
+
+		boost::mutex::scoped_lock lock(io_mutex_);
+		load_active_++;
+		load_jobs_.push(job);
+		load_job_states_.push_back(job);
+		load_cond_.notify_all();
+		return true;
+	}
+
+//// *kdtree::run_load_job* ////
+	template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+	void TPIE_AMI_KDTREE::run_load_job(load_state* job) {
+		// This worker may be in the middle of a task of its own.
+		load_state* s = load_state_.release();
+		load_state_.reset(job);
+		create_node_mm(job->child, job->d, job->streams, job->sz);
+		load_unreserve();
+		close_leaf_chain(*job);
+		load_state_.reset(s);
+	}
+
+//// *kdtree::close_leaf_chain* ////
+	template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+	void TPIE_AMI_KDTREE::close_leaf_chain(load_state& s) {
+		if (s.open_leaf != NULL) {
+			s.open_leaf->next() = 0;
+			s.last_leaf = s.open_leaf->bid();
+			release_leaf(s.open_leaf);
+			s.open_leaf = NULL;
+		}
+	}
+
+//// *kdtree::finish_load_state* ////
+	template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+	void TPIE_AMI_KDTREE::finish_load_state(load_state& s) {
+		TPIE_AMI_KDTREE_NODE* b;
+
+		if (s.deferred) {
+			b = fetch_node(s.node);
+			b->lk[s.lk] = s.child;
 			release_node(b);
-			DBG(" ");
 		}
-		TPLOG("kdtree::build_lower_tree_g Exiting "<<"\n");
+
+		bin_node_count_ += s.bin_nodes;
+		if (s.first_leaf == 0)
+			return;
+		if (previous_leaf_ == NULL) {
+			first_leaf_id_ = s.first_leaf;
+		} else {
+			previous_leaf_->next() = s.first_leaf;
+			release_leaf(previous_leaf_);
+		}
+		previous_leaf_ = fetch_leaf(s.last_leaf);
+	}
+
+//// *kdtree::load_reserve* ////
+	template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+	void TPIE_AMI_KDTREE::load_reserve(TPIE_OS_OFFSET sz) {
+		if (!parallel_load_)
+			return;
+		TPIE_OS_OFFSET need = sz * sizeof(POINT) * TPIE_OS_OFFSET(dim + 1);
+		load_state* job;
+		boost::mutex::scoped_lock lock(io_mutex_);
+		// A worker on its own gets to go ahead, just like the serial loader.
+		// Waiting workers run the pending jobs, which release memory.
+		while (load_active_ > 0 && load_reserved_ + need > load_budget_) {
+			if (load_jobs_.empty()) {
+				load_cond_.wait(lock);
+			} else {
+				job = load_jobs_.front();
+				load_jobs_.pop();
+				lock.unlock();
+				run_load_job(job);
+				lock.lock();
+			}
+		}
+		load_active_++;
+		load_reserved_ += need;
+		load_state_->reserved = sz;
+	}
+
+//// *kdtree::load_unreserve* ////
+	template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+	void TPIE_AMI_KDTREE::load_unreserve() {
+		if (!parallel_load_)
+			return;
+		TPIE_OS_OFFSET need = load_state_->reserved * sizeof(POINT) * TPIE_OS_OFFSET(dim + 1);
+		load_state_->reserved = 0;
+		boost::mutex::scoped_lock lock(io_mutex_);
+		load_active_--;
+		load_reserved_ -= need;
+		load_cond_.notify_all();
+	}
+
+//// *kdtree::chain_leaf* ////
+	template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+	void TPIE_AMI_KDTREE::chain_leaf(TPIE_AMI_KDTREE_LEAF* l) {
+		load_state* s = parallel_load_ ? load_state_.get(): NULL;
+		bid_t& first = (s != NULL) ? s->first_leaf: first_leaf_id_;
+		TPIE_AMI_KDTREE_LEAF*& previous = (s != NULL) ? s->open_leaf: previous_leaf_;
+
+		if (previous == NULL) {
+			first = l->bid();
+		} else {
+			previous->next() = l->bid();
+			release_leaf(previous);
+		}
+		previous = l;
+	}
+
+//// *kdtree::count_bin_nodes* ////
+	template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+	void TPIE_AMI_KDTREE::count_bin_nodes(TPIE_OS_SIZE_T n) {
+		if (parallel_load_)
+			load_state_->bin_nodes += n;
+		else
+			bin_node_count_ += n;
 	}
 
 //// *kdtree::distribute_g* ////
@@ -2469,7 +3133,7 @@ protected:
 		if (n->lk[n->lk.capacity()-1] == 0) {
 			n->lk[n->lk.capacity()-1] = next_free_lk;
 		}
-		bin_node_count_ += n->size();
+		count_bin_nodes(n->size());
 		release_node(n);
 
 		TPLOG("kdtree::create_node_g Exiting bid="<<bid<<"\n");
@@ -2574,8 +3238,38 @@ protected:
 		}
 
 		assert(in_stream->stream_len() > 0);
-		size_t i;
-		err err;
+		size_t i, j;
+		err err = tpie::ami::NO_ERROR;
+
+		if (params_.load_threads > 1 && can_do_mm(in_stream->stream_len())) {
+
+			// All dim copies fit in memory. Sort them concurrently.
+			POINT* streams_mm[dim];
+			TPIE_OS_SIZE_T sz;
+			read_to_mm(in_stream, streams_mm, sz);
+			for (i = 0; i < dim; i += params_.load_threads) {
+				boost::thread_group sorters;
+				for (j = i; j < std::min(i + params_.load_threads, (size_t) dim); j++)
+					sorters.create_thread(sort_job(streams_mm[j], streams_mm[j] + sz, comp_obj_[j]));
+				sorters.join_all();
+			}
+
+			for (i = 0; i < dim; i++) {
+				if (out_streams[i] == NULL) {
+					out_streams[i] = new POINT_STREAM;
+					out_streams[i]->persist(PERSIST_DELETE);
+				}
+				for (j = 0; j < sz && err == tpie::ami::NO_ERROR; j++)
+					err = out_streams[i]->write_item(streams_mm[i][j]);
+				delete [] streams_mm[i];
+			}
+			if (err != tpie::ami::NO_ERROR) {
+				TP_LOG_WARNING_ID("Writing sorted streams returned error.");
+			}
+
+			TPLOG("kdtree::sort Exiting err="<<err<<"\n");
+			return err;
+		}
 
 		for (i = 0; i < dim; i++) {
 			// If necessary, create temporary stream for points sorted on the
@@ -2718,6 +3412,8 @@ protected:
 		// Restore params_.
 		params_ = params_saved;
 
+		build_top();
+
 		TPLOG("kdtree::load_sorted Exiting err="<<err<<"\n");
 		return err;
 	}
@@ -2798,6 +3494,8 @@ protected:
 		node_cache_->flush();
 		leaf_cache_->flush();
 
+		build_top();
+
 		MEMDISPLAY_DONE;
 		HEIGHTDISPLAY_DONE
 
@@ -2849,17 +3547,283 @@ protected:
 			return result;
 		}
 
-		std::cerr << "k_nn_query: NOT IMPLEMENTED YET!\n";
-		TP_LOG_WARNING_ID("  k_nn_query: NOT IMPLEMENTED YET!");
-		//  priority_std::queue<nn_pq_elem> q;
-		//  nn_pq_elem cur((coord_t) 0, header_.root_bid, header_.root_type);
-		//  while (cur.type != BLOCK_LEAF) {
-		//  }  
+		std::vector<nn_candidate> res;
+		k_nn_search(p, k, res);
+		for (size_t i = 0; i < res.size(); i++) {
+			if (stream != NULL)
+				stream->write_item(res[i].p);
+			result++;
+		}
+
+		TPLOG("kdtree::k_nn_query Exiting "<<"\n");
+		return result;
+	}
+
+//// *kdtree::k_nn_query* ////
+	template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+	TPIE_OS_OFFSET TPIE_AMI_KDTREE::k_nn_query(POINT_STREAM* queries, nn_stream_t* out, 
+											   TPIE_OS_OFFSET k, TPIE_OS_SIZE_T threads) {
+		TPLOG("kdtree::k_nn_query Entering "<<"\n");
+		TPIE_OS_OFFSET result = 0;
+		TPIE_OS_SIZE_T i, j, n;
+		POINT* p;
+		nn_query_t q;
+
+		// Do some error checking.
+		if (status_ != KDTREE_STATUS_VALID) {
+			TP_LOG_WARNING_ID("  k_nn_query: tree is invalid or not loaded. query aborted.");
+			return result;
+		}
+		if (queries == NULL || out == NULL) {
+			TP_LOG_WARNING_ID("  k_nn_query: null stream pointer. query aborted.");
+			return result;
+		}
+		if (threads == 0)
+			threads = 1;
+
+		// Put the queries in Morton order.
+		stream<nn_query_t>* keyed = new stream<nn_query_t>;
+		keyed->persist(PERSIST_DELETE);
+		queries->seek(0);
+		while (queries->read_item(&p) == tpie::ami::NO_ERROR) {
+			q.key = kd_morton_key(p->key, header_.mbr_lo.key, header_.mbr_hi.key);
+			q.p = *p;
+			keyed->write_item(q);
+		}
+		stream<nn_query_t>* sorted = new stream<nn_query_t>;
+		sorted->persist(PERSIST_DELETE);
+		if (tpie::ami::sort_or_copy(keyed, sorted) != tpie::ami::NO_ERROR) {
+			TP_LOG_WARNING_ID("  k_nn_query: sorting the queries failed. query aborted.");
+			delete keyed;
+			delete sorted;
+			return result;
+		}
+		delete keyed;
+
+		// The number of queries answered in one round, and held in memory
+		// together with their answers.
+		TPIE_OS_SIZE_T batch = 65536;
+		TPIE_OS_SIZE_T avail = MM_manager.memory_available();
+		if (avail > 0)
+			batch = std::max(TPIE_OS_SIZE_T(1), 
+							 std::min(batch, avail / 4 / 
+									  (sizeof(nn_query_t) + (TPIE_OS_SIZE_T)k * sizeof(nn_result_t))));
+
+		// The threads share the blocks they read. Write back everything held
+		// by the exclusive caches, so that no block is in memory twice.
+		if (threads > 1) {
+			node_cache_->flush();
+			leaf_cache_->flush();
+			node_shared_cache_ = new node_shared_cache_t(std::max(params_.node_cache_size, 4 * threads), 
+														 threads, remove_shared<TPIE_AMI_KDTREE_NODE>(&io_mutex_));
+			leaf_shared_cache_ = new leaf_shared_cache_t(std::max(params_.leaf_cache_size, 4 * threads), 
+														 threads, remove_shared<TPIE_AMI_KDTREE_LEAF>(&io_mutex_));
+		}
+
+		std::vector<nn_query_t> qs;
+		std::vector<std::vector<nn_result_t> > res(threads);
+		nn_query_t* qp;
+		sorted->seek(0);
+		for (;;) {
+			qs.clear();
+			while (qs.size() < batch && sorted->read_item(&qp) == tpie::ami::NO_ERROR)
+				qs.push_back(*qp);
+			if (qs.empty())
+				break;
+
+			// Each thread answers a range of neighboring queries.
+			n = std::min(threads, qs.size());
+			if (n == 1) {
+				k_nn_batch(&qs, 0, qs.size(), k, &res[0]);
+			} else {
+				boost::thread_group workers;
+				for (i = 0; i < n; i++)
+					workers.create_thread(boost::bind(&TPIE_AMI_KDTREE::k_nn_batch, this, &qs,
+													  qs.size() * i / n, qs.size() * (i + 1) / n,
+													  k, &res[i]));
+				workers.join_all();
+			}
+
+			for (i = 0; i < n; i++) {
+				for (j = 0; j < res[i].size(); j++)
+					out->write_item(res[i][j]);
+				result += res[i].size();
+				res[i].clear();
+			}
+		}
+		delete sorted;
+
+		if (threads > 1) {
+			delete node_shared_cache_;
+			delete leaf_shared_cache_;
+			node_shared_cache_ = NULL;
+			leaf_shared_cache_ = NULL;
+		}
 
 		TPLOG("kdtree::k_nn_query Exiting "<<"\n");
 		return result;
 	}
 
+//// *kdtree::k_nn_batch* ////
+	template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+	void TPIE_AMI_KDTREE::k_nn_batch(const std::vector<nn_query_t>* queries, 
+									 TPIE_OS_SIZE_T first, TPIE_OS_SIZE_T last, TPIE_OS_OFFSET k,
+									 std::vector<nn_result_t>* out) {
+		std::vector<nn_candidate> res;
+		nn_result_t r;
+		for (TPIE_OS_SIZE_T i = first; i < last; i++) {
+			res.clear();
+			k_nn_search((*queries)[i].p, k, res);
+			r.query_id = (*queries)[i].p.id();
+			for (size_t j = 0; j < res.size(); j++) {
+				r.neighbor = res[j].p;
+				r.distance = sqrt(res[j].d2);
+				out->push_back(r);
+			}
+		}
+	}
+
+//// *kdtree::k_nn_search* ////
+	template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+	void TPIE_AMI_KDTREE::k_nn_search(const POINT& p, TPIE_OS_OFFSET k, 
+									  std::vector<nn_candidate>& res) {
+		TPIE_OS_SIZE_T i, j, idx, d;
+		link_type_t type;
+		double diff, d2, val;
+		TPIE_AMI_KDTREE_NODE* bn;
+		TPIE_AMI_KDTREE_LEAF* bl;
+		Bin_node* el;
+		bid_t* lk;
+
+		if (k <= 0)
+			return;
+
+		// Blocks to visit, nearest first, and the neighbors found so far,
+		// farthest first. Blocks farther away than the k-th neighbor found
+		// so far are not visited.
+		std::priority_queue<nn_pq_elem> pq;
+		std::priority_queue<nn_candidate> best;
+		std::stack<nn_stack_elem> ss;
+
+		nn_pq_elem e;
+		e.p = 0.0;
+		// BIN_NODE stands for the top levels, when they are in memory.
+		e.bid = header_.root_bid;
+		e.type = top_el_.empty() ? header_.root_type: BIN_NODE;
+		for (i = 0; i < dim; i++) {
+			e.lo[i] = -std::numeric_limits<double>::infinity();
+			e.hi[i] = std::numeric_limits<double>::infinity();
+		}
+		pq.push(e);
+
+		while (!pq.empty()) {
+			e = pq.top();
+			pq.pop();
+			if ((TPIE_OS_OFFSET)best.size() == k && e.p > best.top().d2)
+				break;
+
+			if (e.type == BLOCK_LEAF) {
+
+				bl = acquire_leaf(e.bid);
+				for (i = 0; i < bl->size(); i++) {
+					d2 = 0.0;
+					for (j = 0; j < dim; j++) {
+						diff = double(bl->el[i][j]) - double(p[j]);
+						d2 += diff * diff;
+					}
+					if ((TPIE_OS_OFFSET)best.size() < k) {
+						best.push(nn_candidate(d2, bl->el[i]));
+					} else if (d2 < best.top().d2) {
+						best.pop();
+						best.push(nn_candidate(d2, bl->el[i]));
+					}
+				}
+				drop_leaf(bl);
+
+			} else {
+
+				if (e.type == BIN_NODE) {
+					bn = NULL;
+					el = &top_el_[0];
+					lk = &top_lk_[0];
+				} else {
+					assert(e.type == BLOCK_NODE);
+					bn = acquire_node(e.bid);
+					el = &bn->el[0];
+					lk = &bn->lk[0];
+				}
+
+				// Visit the bin nodes of the block. The box of a child is the box of
+				// its parent, cut by the split value (inclusive on both
+				// sides, since equal coordinates may go either way).
+				nn_stack_elem se;
+				se.idx = 0;
+				for (i = 0; i < dim; i++) {
+					se.lo[i] = e.lo[i];
+					se.hi[i] = e.hi[i];
+				}
+				ss.push(se);
+				while (!ss.empty()) {
+					se = ss.top();
+					ss.pop();
+					Bin_node& v = el[se.idx];
+					d = v.get_discriminator_dim();
+					val = double(v.get_discriminator_val());
+
+					for (int side = 0; side < 2; side++) {
+						nn_stack_elem ce = se;
+						if (side == 0) {
+							v.get_low_child(idx, type);
+							ce.hi[d] = std::min(ce.hi[d], val);
+						} else {
+							v.get_high_child(idx, type);
+							ce.lo[d] = std::max(ce.lo[d], val);
+						}
+
+						// The distance from p to the box of the child.
+						d2 = 0.0;
+						for (j = 0; j < dim; j++) {
+							if (double(p[j]) < ce.lo[j])
+								diff = ce.lo[j] - double(p[j]);
+							else if (double(p[j]) > ce.hi[j])
+								diff = double(p[j]) - ce.hi[j];
+							else
+								diff = 0.0;
+							d2 += diff * diff;
+						}
+						if ((TPIE_OS_OFFSET)best.size() == k && d2 > best.top().d2)
+							continue;
+
+						if (type == BIN_NODE) {
+							ce.idx = idx;
+							ss.push(ce);
+						} else {
+							nn_pq_elem ne;
+							ne.p = d2;
+							ne.bid = lk[idx];
+							ne.type = type;
+							for (j = 0; j < dim; j++) {
+								ne.lo[j] = ce.lo[j];
+								ne.hi[j] = ce.hi[j];
+							}
+							pq.push(ne);
+						}
+					}
+				}
+				if (bn != NULL)
+					drop_node(bn);
+			}
+		}
+
+		// Report the neighbors, nearest first.
+		size_t first = res.size();
+		res.resize(first + best.size(), nn_candidate(0.0, p));
+		for (i = res.size(); i > first; i--) {
+			res[i-1] = best.top();
+			best.pop();
+		}
+	}
+
 //// *kdtree::window_query* ////
 	template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
 	TPIE_OS_OFFSET TPIE_AMI_KDTREE::window_query(const POINT &p1, const POINT& p2, 
@@ -2897,8 +3861,13 @@ protected:
 			allfalse.second[i] = false; // ie, high boundary on dim. i is outside the query window.
 		}
 
-		s.push(outer_stack_elem(allfalse,
-								std::pair<bid_t, link_type_t>(header_.root_bid, header_.root_type)));
+		// With the top levels in memory, the search starts there (BIN_NODE
+		// stands for the top levels on the outer stack).
+		if (top_el_.empty())
+			s.push(outer_stack_elem(allfalse,
+									std::pair<bid_t, link_type_t>(header_.root_bid, header_.root_type)));
+		else
+			s.push(outer_stack_elem(allfalse, std::pair<bid_t, link_type_t>(0, BIN_NODE)));
 
 		std::pair<bid_t,link_type_t> top;
 		podf topflags, tempflags;
@@ -2906,6 +3875,8 @@ protected:
 		link_type_t childtype;
 		TPIE_AMI_KDTREE_NODE *bn, *bn2;
 		TPIE_AMI_KDTREE_LEAF *bl;
+		Bin_node* el;
+		bid_t* lk;
 
 		while (!s.empty()) {
 			// Copy the top of the stack.
@@ -2919,10 +3890,18 @@ protected:
 				result += bl->window_query(lop, hip, stream);
 				release_leaf(bl);
 
-			} else { // BLOCK_NODE
+			} else { // BLOCK_NODE or the top levels
 
-				assert(top.second == BLOCK_NODE);
-				bn = fetch_node(top.first);
+				if (top.second == BIN_NODE) {
+					bn = NULL;
+					el = &top_el_[0];
+					lk = &top_lk_[0];
+				} else {
+					assert(top.second == BLOCK_NODE);
+					bn = fetch_node(top.first);
+					el = &bn->el[0];
+					lk = &bn->lk[0];
+				}
 
 				// Inner stack should be empty.
 				assert(ss.empty());
@@ -2932,7 +3911,7 @@ protected:
 
 				// The inner loop. Visit all relevant Bin_node's inside *bn.
 				while (!ss.empty()) {
-					Bin_node &v = bn->el[ss.top().second];
+					Bin_node &v = el[ss.top().second];
 					// Recycle topflags.
 					topflags = ss.top().first;
 					ss.pop();
@@ -2954,13 +3933,14 @@ protected:
 #if TPIE_AMI_KDTREE_STORE_WEIGHTS
 								result += v.low_weight();
 #else
-								bn2 = fetch_node(bn->lk[child]);
+								bn2 = fetch_node(lk[child]);
 								result += bn2->weight();
 								release_node(bn2);
 #endif
 							} else {
+								prefetch(lk[child], childtype);
 								s.push(outer_stack_elem(tempflags,
-														std::pair<bid_t, link_type_t>(bn->lk[child], childtype)));
+														std::pair<bid_t, link_type_t>(lk[child], childtype)));
 							}
 						} else if (childtype == BLOCK_LEAF) {
 							if (tempflags.alltrue() && stream == NULL) {
@@ -2968,13 +3948,14 @@ protected:
 #if TPIE_AMI_KDREE_STORE_WEIGHTS
 								result += v.low_weight();
 #else
-								bl = fetch_leaf(bn->lk[child]);
+								bl = fetch_leaf(lk[child]);
 								result += bl->weight();
 								release_leaf(bl);
 #endif
 							} else {
+								prefetch(lk[child], childtype);
 								s.push(outer_stack_elem(tempflags,
-														std::pair<bid_t, link_type_t>(bn->lk[child], childtype)));
+														std::pair<bid_t, link_type_t>(lk[child], childtype)));
 							}
 						} else { // BIN_NODE
 #if TPIE_AMI_KDTREE_STORE_WEIGHTS
@@ -3013,13 +3994,14 @@ protected:
 #if TPIE_AMI_KDTREE_STORE_WEIGHTS
 									result += v.high_weight();
 #else
-									bn2 = fetch_node(bn->lk[child]);
+									bn2 = fetch_node(lk[child]);
 									result += bn2->weight();
 									release_node(bn2);
 #endif
 								} else {
+									prefetch(lk[child], childtype);
 									s.push(outer_stack_elem(tempflags,
-															std::pair<bid_t, link_type_t>(bn->lk[child], childtype)));
+															std::pair<bid_t, link_type_t>(lk[child], childtype)));
 								}
 							} else if (childtype == BLOCK_LEAF) {
 								if (tempflags.alltrue() && stream == NULL) {
@@ -3027,13 +4009,14 @@ protected:
 #if TPIE_AMI_KDTREE_STORE_WEIGHTS
 									result += v.high_weight();
 #else
-									bl = fetch_leaf(bn->lk[child]);
+									bl = fetch_leaf(lk[child]);
 									result += bl->weight();
 									release_leaf(bl);
 #endif
 								} else {
+									prefetch(lk[child], childtype);
 									s.push(outer_stack_elem(tempflags,
-															std::pair<bid_t, link_type_t>(bn->lk[child], childtype)));
+															std::pair<bid_t, link_type_t>(lk[child], childtype)));
 								}
 							} else { // BIN_NODE
 #if TPIE_AMI_KDTREE_STORE_WEIGHTS
@@ -3050,7 +4033,8 @@ protected:
 					} // while !ss.empty()
       
 					// We are done with this block node.
-					release_node(bn);
+					if (bn != NULL)
+						release_node(bn);
 				}
 
 			} // while !s.empty()
@@ -3068,6 +4052,20 @@ protected:
 			TPIE_AMI_KDTREE_NODE* bn;
 			//  bool ans;
 
+			// Go down the top levels first, if they are in memory.
+			if (!top_el_.empty()) {
+				TPIE_OS_SIZE_T idx1 = 0, idx2;
+				link_type_t idx_type = BIN_NODE;
+				while (idx_type == BIN_NODE) {
+					if (top_el_[idx1].discriminate(p.key) <= 0)
+						top_el_[idx1].get_low_child(idx2, idx_type);
+					else
+						top_el_[idx1].get_high_child(idx2, idx_type);
+					idx1 = idx2;
+				}
+				n = std::pair<bid_t, link_type_t>(top_lk_[idx1], idx_type);
+			}
+
 			// Go down the tree until the appropriate leaf is found.
 			while (n.second == BLOCK_NODE) {
 				bn = fetch_node(n.first);
@@ -3080,6 +4078,89 @@ protected:
 			return n.first;
 		}
 
+//// *kdtree::build_top* ////
+		template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+			void TPIE_AMI_KDTREE::build_top() {
+			TPLOG("kdtree::build_top Entering "<<"\n");
+			top_el_.clear();
+			top_lk_.clear();
+			if (params_.top_memory == 0 || status_ != KDTREE_STATUS_VALID || 
+				header_.size == 0 || header_.root_type != BLOCK_NODE)
+				return;
+
+			// The compact bin node types keep child positions in 14 bits.
+			TPIE_OS_SIZE_T max_el = std::min(TPIE_OS_SIZE_T(16383), 
+											 params_.top_memory / (sizeof(Bin_node) + sizeof(bid_t)));
+
+			// Block nodes are copied whole, in breadth-first order, until one
+			// does not fit. Each block in the queue comes with the top bin node
+			// (and side) linking to it.
+			std::queue<std::pair<bid_t, std::pair<TPIE_OS_SIZE_T, int> > > q;
+			q.push(std::make_pair(header_.root_bid, std::make_pair(TPIE_OS_SIZE_T(0), -1)));
+			std::vector<TPIE_OS_SIZE_T> pos;
+			std::queue<TPIE_OS_SIZE_T> ss;
+			TPIE_AMI_KDTREE_NODE* bn;
+			TPIE_OS_SIZE_T i, idx, first;
+			link_type_t type;
+
+			while (!q.empty()) {
+				bn = fetch_node(q.front().first);
+				if (top_el_.size() + bn->size() > max_el || 
+					top_lk_.size() + bn->size() + 1 > max_el) {
+					release_node(bn);
+					break;
+				}
+
+				// Link the parent to the copy of this block.
+				first = top_el_.size();
+				if (q.front().second.second == 0)
+					top_el_[q.front().second.first].set_low_child(first, BIN_NODE);
+				else if (q.front().second.second == 1)
+					top_el_[q.front().second.first].set_high_child(first, BIN_NODE);
+				q.pop();
+
+				// Copy the bin nodes in breadth-first order, starting with the
+				// root bin node, and renumber their links.
+				pos.assign(bn->size(), 0);
+				ss.push(0);
+				while (!ss.empty()) {
+					i = ss.front();
+					ss.pop();
+					pos[i] = top_el_.size();
+					top_el_.push_back(bn->el[i]);
+					for (int side = 0; side < 2; side++) {
+						if (side == 0)
+							bn->el[i].get_low_child(idx, type);
+						else
+							bn->el[i].get_high_child(idx, type);
+						if (type == BIN_NODE) {
+							// Its position is known once it is copied; see below.
+							ss.push(idx);
+							continue;
+						}
+						if (type == BLOCK_NODE)
+							q.push(std::make_pair(bn->lk[idx], std::make_pair(pos[i], side)));
+						if (side == 0)
+							top_el_[pos[i]].set_low_child(top_lk_.size(), type);
+						else
+							top_el_[pos[i]].set_high_child(top_lk_.size(), type);
+						top_lk_.push_back(bn->lk[idx]);
+					}
+				}
+				for (i = first; i < top_el_.size(); i++) {
+					top_el_[i].get_low_child(idx, type);
+					if (type == BIN_NODE)
+						top_el_[i].set_low_child(pos[idx], BIN_NODE);
+					top_el_[i].get_high_child(idx, type);
+					if (type == BIN_NODE)
+						top_el_[i].set_high_child(pos[idx], BIN_NODE);
+				}
+				release_node(bn);
+			}
+
+			TPLOG("kdtree::build_top Exiting top_el_.size()="<<top_el_.size()<<"\n");
+		}
+
 //// *kdtree::find* ////
 		template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
 			bool TPIE_AMI_KDTREE::find(const POINT &p) {
@@ -3144,6 +4225,11 @@ protected:
 		template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
 			TPIE_AMI_KDTREE_NODE* TPIE_AMI_KDTREE::fetch_node(bid_t bid) {
 			TPIE_AMI_KDTREE_NODE* q;
+			if (parallel_load_) {
+				boost::mutex::scoped_lock lock(io_mutex_);
+				stats_.record(NODE_FETCH);
+				return new TPIE_AMI_KDTREE_NODE(pcoll_nodes_, bid);
+			}
 			stats_.record(NODE_FETCH);
 			// Warning: using short-circuit evaluation. Order is important.
 			if ((bid == 0) || !node_cache_->read(bid, q)) {
@@ -3156,6 +4242,11 @@ protected:
 		template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
 			TPIE_AMI_KDTREE_LEAF* TPIE_AMI_KDTREE::fetch_leaf(bid_t bid) {
 			TPIE_AMI_KDTREE_LEAF* q;
+			if (parallel_load_) {
+				boost::mutex::scoped_lock lock(io_mutex_);
+				stats_.record(LEAF_FETCH);
+				return new TPIE_AMI_KDTREE_LEAF(pcoll_leaves_, bid);
+			}
 			stats_.record(LEAF_FETCH);
 			// Warning: using short-circuit evaluation. Order is important.
 			if ((bid == 0) || !leaf_cache_->read(bid, q)) {
@@ -3167,6 +4258,12 @@ protected:
 //// *kdtree::release_node* ////
 		template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
 			void TPIE_AMI_KDTREE::release_node(TPIE_AMI_KDTREE_NODE* q) {
+			if (parallel_load_) {
+				boost::mutex::scoped_lock lock(io_mutex_);
+				stats_.record(NODE_RELEASE);
+				delete q;
+				return;
+			}
 			stats_.record(NODE_RELEASE);
 			if (q->persist() == PERSIST_DELETE)
 				delete q;
@@ -3177,6 +4274,12 @@ protected:
 //// *kdtree::release_leaf* ////
 		template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
 			void TPIE_AMI_KDTREE::release_leaf(TPIE_AMI_KDTREE_LEAF* q) {
+			if (parallel_load_) {
+				boost::mutex::scoped_lock lock(io_mutex_);
+				stats_.record(LEAF_RELEASE);
+				delete q;
+				return;
+			}
 			stats_.record(LEAF_RELEASE);
 			if (q->persist() == PERSIST_DELETE)
 				delete q;
@@ -3184,6 +4287,70 @@ protected:
 				leaf_cache_->write(q->bid(), q);
 		}
 
+//// *kdtree::acquire_node* ////
+		template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+			TPIE_AMI_KDTREE_NODE* TPIE_AMI_KDTREE::acquire_node(bid_t bid) {
+			if (node_shared_cache_ == NULL)
+				return fetch_node(bid);
+			TPIE_AMI_KDTREE_NODE* q;
+			if (node_shared_cache_->pin(bid, q))
+				return q;
+			TPIE_AMI_KDTREE_NODE* r;
+			{
+				boost::mutex::scoped_lock lock(io_mutex_);
+				stats_.record(NODE_FETCH);
+				r = new TPIE_AMI_KDTREE_NODE(pcoll_nodes_, bid);
+			}
+			q = r;
+			if (!node_shared_cache_->insert(bid, q)) {
+				// Another thread read the same node meanwhile; use theirs.
+				boost::mutex::scoped_lock lock(io_mutex_);
+				delete r;
+			}
+			return q;
+		}
+
+//// *kdtree::acquire_leaf* ////
+		template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+			TPIE_AMI_KDTREE_LEAF* TPIE_AMI_KDTREE::acquire_leaf(bid_t bid) {
+			if (leaf_shared_cache_ == NULL)
+				return fetch_leaf(bid);
+			TPIE_AMI_KDTREE_LEAF* q;
+			if (leaf_shared_cache_->pin(bid, q))
+				return q;
+			TPIE_AMI_KDTREE_LEAF* r;
+			{
+				boost::mutex::scoped_lock lock(io_mutex_);
+				stats_.record(LEAF_FETCH);
+				r = new TPIE_AMI_KDTREE_LEAF(pcoll_leaves_, bid);
+			}
+			q = r;
+			if (!leaf_shared_cache_->insert(bid, q)) {
+				// Another thread read the same leaf meanwhile; use theirs.
+				boost::mutex::scoped_lock lock(io_mutex_);
+				delete r;
+			}
+			return q;
+		}
+
+//// *kdtree::drop_node* ////
+		template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+			void TPIE_AMI_KDTREE::drop_node(TPIE_AMI_KDTREE_NODE* q) {
+			if (node_shared_cache_ == NULL)
+				release_node(q);
+			else
+				node_shared_cache_->unpin(q->bid());
+		}
+
+//// *kdtree::drop_leaf* ////
+		template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+			void TPIE_AMI_KDTREE::drop_leaf(TPIE_AMI_KDTREE_LEAF* q) {
+			if (leaf_shared_cache_ == NULL)
+				release_leaf(q);
+			else
+				leaf_shared_cache_->unpin(q->bid());
+		}
+
 //// *kdtree::stats* ////
 		template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
 			const stats_tree &TPIE_AMI_KDTREE::stats() {
@@ -3470,90 +4637,65 @@ protected:
 //// *kdtree::build_lower_tree_s* ////
 		template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
 			void TPIE_AMI_KDTREE::build_lower_tree_s(sample* s) {
-			sample_context* sc;
 			size_t j;
-			//  POINT* p;
 			TPIE_AMI_KDTREE_NODE* b;
-			TPIE_OS_SIZE_T next_free_el, next_free_lk;
-			TPIE_OS_SIZE_T sz;
-			POINT* streams_mm[dim];
 
-			for (j = 0; j < s->q.size(); j++) {
+			if (params_.load_threads > 1) {
+				build_lower_parallel(s->q);
+				return;
+			}
 
-				sc = &s->q[j];
-
-				b = fetch_node(sc->bid);
-				next_free_el = b->size();
-				next_free_lk = (TPIE_OS_SIZE_T)b->lk[b->lk.capacity()-1];
-				b->lk[b->lk.capacity()-1] = 0;
-
-				DBG("L");
-				sc->stream = new POINT_STREAM(sc->stream_name);
-				sc->stream->persist(PERSIST_DELETE);
-				if (!sc->stream->is_valid()) {
-					std::cerr << "kdtree bulk loading internal error.\n"
-							  << "[invalid stream restored from file]\n";
-					std::cerr << "Skipping.\n";
-					delete sc->stream;
-					sc->stream = NULL;
-					continue;
-				}
+			for (j = 0; j < s->q.size(); j++) {
+				b = fetch_node(s->q[j].bid);
+				build_lower_subtree(&(s->q[j]), b);
+				release_node(b);
+				DBG(" ");
+			}
+		}
 
-				if (!can_do_mm(sc->stream->stream_len())) {
-					std::cerr << "Temp stream too big: " 
-							  << sc->stream->stream_len() << " items.\n";
-					std::cerr << "Aborting.\n";
-					exit(1);
-				}
-				copy_to_mm(sc->stream, streams_mm, sz);
+//// *kdtree::open_context* ////
+		template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+			TPIE_OS_OFFSET TPIE_AMI_KDTREE::open_context(sample_context* sc) {
+			load_lock lock(*this);
+			sc->stream = new POINT_STREAM(sc->stream_name);
+			sc->stream->persist(PERSIST_DELETE);
+			if (!sc->stream->is_valid()) {
+				std::cerr << "kdtree bulk loading internal error.\n"
+						  << "[invalid stream restored from file]\n";
+				std::cerr << "Skipping.\n";
 				delete sc->stream;
 				sc->stream = NULL;
+				return -1;
+			}
+			return sc->stream->stream_len();
+		}
 
-				DBG("B" << (TPIE_OS_OFFSET)sz);
-				// Build the subtree.
-
-				if (sz <= params_.leaf_size_max) {
-
-					if (sc->low)
-						b->el[sc->ctx.i].set_low_child(next_free_lk++, BLOCK_LEAF);
-					else
-						b->el[sc->ctx.i].set_high_child(next_free_lk++, BLOCK_LEAF);
-					TPLOG("  b("<<b->bid()<<")->el["<<sc->ctx.i<<"].?: ("<<next_free_lk-1<<", BLOCK_LEAF)\n");
-					create_leaf_mm(b->lk[next_free_lk - 1], (sc->ctx.d + 1) % dim, streams_mm, sz);
-
-				} else if ((sc->ctx.h + 1 >= max_intranode_height(b->bid())) || 
-						   (next_free_el >= params_.node_size_max)) {
-
-					if (sc->low)
-						b->el[sc->ctx.i].set_low_child(next_free_lk++, BLOCK_NODE);
-					else
-						b->el[sc->ctx.i].set_high_child(next_free_lk++, BLOCK_NODE);
-					TPLOG("  b("<<b->bid()<<")->el["<<sc->ctx.i<<"].?: ("<<next_free_lk-1<<", BLOCK_NODE)\n");
-					create_node_mm(b->lk[next_free_lk - 1], (sc->ctx.d + 1) % dim, streams_mm, sz);
-
-				} else {
-
-					if (sc->low)
-						b->el[sc->ctx.i].set_low_child(next_free_el++, BIN_NODE);
-					else
-						b->el[sc->ctx.i].set_high_child(next_free_el++, BIN_NODE);
-					TPLOG("  b("<<b->bid()<<")->el["<<sc->ctx.i<<"].?: ("<<next_free_el-1<<", BIN_NODE)\n");
-					///DBG("create_grid: sz=" << sz << "\n"); 
-					create_bin_node_mm(b, bn_context(next_free_el - 1, sc->ctx.h + 1, 
-													 (sc->ctx.d + 1) % dim),
-									   streams_mm, sz, next_free_el, next_free_lk);
-				}
-
-				// save the next_free_* info.
-				if (b->lk[b->lk.capacity()-1] == 0) {
-					b->size() = next_free_el;
-					b->lk[b->lk.capacity()-1] = next_free_lk;
-				}
-    
-				release_node(b);
+//// *kdtree::close_context* ////
+		template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+			void TPIE_AMI_KDTREE::close_context(sample_context* sc) {
+			load_lock lock(*this);
+			sc->stream->persist(PERSIST_PERSISTENT);
+			delete sc->stream;
+			sc->stream = NULL;
+		}
 
-				DBG(" ");
+//// *kdtree::load_context* ////
+		template<class coord_t, TPIE_OS_SIZE_T dim, class Bin_node, class BTECOLL>
+			void TPIE_AMI_KDTREE::load_context(sample_context* sc, POINT** streams_mm, TPIE_OS_SIZE_T& sz) {
+			// Parallel workers wait in load_reserve() instead.
+			if (!parallel_load_ && !can_do_mm(sc->stream->stream_len())) {
+				std::cerr << "Temp stream too big: " 
+						  << sc->stream->stream_len() << " items.\n";
+				std::cerr << "Aborting.\n";
+				exit(1);
+			}
+			{
+				load_lock lock(*this);
+				read_to_mm(sc->stream, streams_mm, sz);
+				delete sc->stream;
+				sc->stream = NULL;
 			}
+			sort_mm(streams_mm, sz);
 		}
 
 //// *kdtree::distribute_s* ////
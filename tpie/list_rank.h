@@ -0,0 +1,648 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; eval: (progn (c-set-style "stroustrup") (c-set-offset 'innamespace 0)); -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2010, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+///////////////////////////////////////////////////////////////////////////
+/// \file list_rank.h
+/// List ranking of linked lists given as streams of edges, and rooting of
+/// trees by Euler tours.
+///////////////////////////////////////////////////////////////////////////
+
+#ifndef _TPIE_AMI_LIST_RANK_H
+#define _TPIE_AMI_LIST_RANK_H
+
+#include <tpie/config.h>
+#include <tpie/portability.h>
+// For pair.
+#include <utility>
+// For vector.
+#include <vector>
+// For sort, inplace_merge, lower_bound.
+#include <algorithm>
+#include <boost/cstdint.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+
+// TPIE stuff.
+#include <tpie/stream.h>
+#include <tpie/sort.h>
+#include <tpie/mm.h>
+#include <tpie/hash_map.h>
+
+namespace tpie {
+
+namespace ami {
+
+///////////////////////////////////////////////////////////////////////////
+/// An edge from a node to its successor in a list, for list_rank().
+///////////////////////////////////////////////////////////////////////////
+template <typename node_t, typename weight_t = TPIE_OS_OFFSET>
+struct list_rank_edge {
+	node_t from;
+	node_t to;
+	weight_t weight;
+
+	list_rank_edge() {}
+	list_rank_edge(const node_t& f, const node_t& t, const weight_t& w = weight_t(1)):
+		from(f), to(t), weight(w) {}
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// Ranks lists; see list_rank().
+///////////////////////////////////////////////////////////////////////////
+template <typename node_t, typename weight_t = TPIE_OS_OFFSET>
+class list_rank_op {
+public:
+	typedef list_rank_edge<node_t, weight_t> edge_t;
+	/** A node and its rank. */
+	typedef std::pair<node_t, weight_t> rank_t;
+
+	list_rank_op(TPIE_OS_SIZE_T memory, TPIE_OS_SIZE_T threads):
+		memory_(memory ? memory: MM_manager.consecutive_memory_available()),
+		threads_(threads ? threads: 1) {}
+
+	err run(stream<edge_t>* edges, stream<rank_t>* out);
+
+protected:
+	/** A node that is not a head, its predecessor and the weight of the
+	 * edge between them. */
+	struct link_t {
+		node_t node;
+		node_t pred;
+		weight_t weight;
+
+		link_t() {}
+		link_t(const node_t& n, const node_t& p, const weight_t& w):
+			node(n), pred(p), weight(w) {}
+	};
+	typedef stream<link_t> link_stream_t;
+	typedef stream<rank_t> rank_stream_t;
+
+	class node_cmp {
+	public:
+		int compare(const link_t& a, const link_t& b) const {
+			return a.node < b.node ? -1: (b.node < a.node ? 1: 0);
+		}
+		bool operator()(const link_t& a, const link_t& b) const {
+			return a.node < b.node;
+		}
+	};
+
+	class pred_cmp {
+	public:
+		int compare(const link_t& a, const link_t& b) const {
+			return a.pred < b.pred ? -1: (b.pred < a.pred ? 1: 0);
+		}
+	};
+
+	class from_cmp {
+	public:
+		int compare(const edge_t& a, const edge_t& b) const {
+			return a.from < b.from ? -1: (b.from < a.from ? 1: 0);
+		}
+	};
+
+	/** Whether the links fit in memory for in_memory(). */
+	bool fits(TPIE_OS_OFFSET n) const {
+		return n * TPIE_OS_OFFSET(sizeof(link_t) + 2 * sizeof(TPIE_OS_SIZE_T) + sizeof(weight_t)) <=
+			TPIE_OS_OFFSET(memory_);
+	}
+
+	/** The coin flip of a node at a level of the recursion. */
+	bool coin(const node_t& v, int level) const {
+		boost::uint64_t h = boost::uint64_t(hash_(v)) ^
+			(boost::uint64_t(level + 1) * 0xC2B2AE3D27D4EB4FULL);
+		h *= 0x9E3779B97F4A7C15ULL;
+		return (h >> 63) != 0;
+	}
+
+	err rank(link_stream_t* links, rank_stream_t* out, int level);
+	err in_memory(link_stream_t* links, rank_stream_t* out);
+	void sort_links(std::vector<link_t>& v) const;
+
+	static void sort_range(link_t* first, link_t* last) {
+		std::sort(first, last, node_cmp());
+	}
+
+	template <typename T>
+	static stream<T>* temp() {
+		stream<T>* s = new stream<T>;
+		s->persist(PERSIST_DELETE);
+		return s;
+	}
+
+	TPIE_OS_SIZE_T memory_;
+	TPIE_OS_SIZE_T threads_;
+	tpie::hash<node_t> hash_;
+};
+
+//// *list_rank_op::run* ////
+	template <typename node_t, typename weight_t>
+	err list_rank_op<node_t, weight_t>::run(stream<edge_t>* edges, stream<rank_t>* out) {
+		err ae = NO_ERROR;
+		edge_t* e;
+		rank_t* r;
+
+		if (edges->stream_len() == 0)
+			return NO_ERROR;
+
+		link_stream_t* links = temp<link_t>();
+		edges->seek(0);
+		while ((ae = edges->read_item(&e)) == NO_ERROR)
+			if ((ae = links->write_item(link_t(e->to, e->from, e->weight))) != NO_ERROR)
+				break;
+		if (ae == END_OF_STREAM)
+			ae = NO_ERROR;
+
+		rank_stream_t* ranks = temp<rank_t>();
+		if (ae == NO_ERROR)
+			ae = rank(links, ranks, 0);
+		delete links;
+
+		// The heads are the sources of edges that are not ranked.
+		stream<edge_t>* by_from = temp<edge_t>();
+		rank_stream_t* heads = temp<rank_t>();
+		from_cmp fcmp;
+		if (ae == NO_ERROR)
+			ae = sort_or_copy(edges, by_from, &fcmp);
+		by_from->seek(0);
+		ranks->seek(0);
+		err re = ranks->read_item(&r);
+		while (ae == NO_ERROR && (ae = by_from->read_item(&e)) == NO_ERROR) {
+			while (re == NO_ERROR && r->first < e->from)
+				re = ranks->read_item(&r);
+			if (!(re == NO_ERROR && r->first == e->from))
+				ae = heads->write_item(rank_t(e->from, weight_t(0)));
+		}
+		if (ae == END_OF_STREAM)
+			ae = NO_ERROR;
+		delete by_from;
+
+		// Merge the heads into the ranks.
+		rank_t* h;
+		heads->seek(0);
+		ranks->seek(0);
+		err he = heads->read_item(&h);
+		re = ranks->read_item(&r);
+		while (ae == NO_ERROR && (he == NO_ERROR || re == NO_ERROR)) {
+			if (re != NO_ERROR || (he == NO_ERROR && h->first < r->first)) {
+				ae = out->write_item(*h);
+				he = heads->read_item(&h);
+			} else {
+				ae = out->write_item(*r);
+				re = ranks->read_item(&r);
+			}
+		}
+		delete heads;
+		delete ranks;
+		return ae;
+	}
+
+//// *list_rank_op::rank* ////
+	template <typename node_t, typename weight_t>
+	err list_rank_op<node_t, weight_t>::rank(link_stream_t* links, rank_stream_t* out, int level) {
+		err ae = NO_ERROR;
+		link_t *a, *b;
+		rank_t *r, *c;
+		node_cmp ncmp;
+		pred_cmp pcmp;
+
+		if (links->stream_len() < 2 || fits(links->stream_len()))
+			return in_memory(links, out);
+
+		// Remove the independent set of nodes whose coin is heads and whose
+		// predecessor's coin is tails, bridging each removed node by
+		// linking its successor to its predecessor.
+		link_stream_t* by_pred = temp<link_t>();
+		link_stream_t* by_node = temp<link_t>();
+		ae = sort_or_copy(links, by_pred, &pcmp);
+		if (ae == NO_ERROR)
+			ae = sort_or_copy(links, by_node, &ncmp);
+
+		link_stream_t* active = temp<link_t>();
+		link_stream_t* removed = temp<link_t>();
+		by_pred->seek(0);
+		by_node->seek(0);
+		err be = by_node->read_item(&b);
+		while (ae == NO_ERROR && (ae = by_pred->read_item(&a)) == NO_ERROR) {
+			while (be == NO_ERROR && b->node < a->pred)
+				be = by_node->read_item(&b);
+			bool has_pred = (be == NO_ERROR && b->node == a->pred);
+			if (coin(a->node, level) && !coin(a->pred, level))
+				ae = removed->write_item(*a);
+			else if (has_pred && coin(b->node, level) && !coin(b->pred, level))
+				ae = active->write_item(link_t(a->node, b->pred, b->weight + a->weight));
+			else
+				ae = active->write_item(*a);
+		}
+		if (ae == END_OF_STREAM)
+			ae = NO_ERROR;
+		delete by_pred;
+		delete by_node;
+
+		rank_stream_t* ranks = temp<rank_t>();
+		if (ae == NO_ERROR && active->stream_len() > 0)
+			ae = rank(active, ranks, level + 1);
+		delete active;
+
+		// A removed node is ranked after its predecessor, which is either a
+		// head or ranked.
+		link_stream_t* removed_by_pred = temp<link_t>();
+		rank_stream_t* unsorted = temp<rank_t>();
+		if (ae == NO_ERROR)
+			ae = sort_or_copy(removed, removed_by_pred, &pcmp);
+		delete removed;
+		removed_by_pred->seek(0);
+		ranks->seek(0);
+		err re = ranks->read_item(&r);
+		while (ae == NO_ERROR && (ae = removed_by_pred->read_item(&a)) == NO_ERROR) {
+			while (re == NO_ERROR && r->first < a->pred)
+				re = ranks->read_item(&r);
+			weight_t w = (re == NO_ERROR && r->first == a->pred) ? r->second: weight_t(0);
+			ae = unsorted->write_item(rank_t(a->node, w + a->weight));
+		}
+		if (ae == END_OF_STREAM)
+			ae = NO_ERROR;
+		delete removed_by_pred;
+
+		rank_stream_t* cancelled = temp<rank_t>();
+		if (ae == NO_ERROR)
+			ae = sort_or_copy(unsorted, cancelled);
+		delete unsorted;
+
+		cancelled->seek(0);
+		ranks->seek(0);
+		err ce = cancelled->read_item(&c);
+		re = ranks->read_item(&r);
+		while (ae == NO_ERROR && (ce == NO_ERROR || re == NO_ERROR)) {
+			if (re != NO_ERROR || (ce == NO_ERROR && c->first < r->first)) {
+				ae = out->write_item(*c);
+				ce = cancelled->read_item(&c);
+			} else {
+				ae = out->write_item(*r);
+				re = ranks->read_item(&r);
+			}
+		}
+		delete cancelled;
+		delete ranks;
+		return ae;
+	}
+
+//// *list_rank_op::sort_links* ////
+	template <typename node_t, typename weight_t>
+	void list_rank_op<node_t, weight_t>::sort_links(std::vector<link_t>& v) const {
+		TPIE_OS_SIZE_T k = threads_;
+		if (k <= 1 || v.size() < 4096 * k) {
+			std::sort(v.begin(), v.end(), node_cmp());
+			return;
+		}
+
+		// Sort k ranges in parallel, then merge them pairwise.
+		std::vector<TPIE_OS_SIZE_T> bounds;
+		TPIE_OS_SIZE_T i;
+		for (i = 0; i <= k; i++)
+			bounds.push_back(v.size() * i / k);
+		boost::thread_group threads;
+		for (i = 0; i < k; i++)
+			threads.create_thread(boost::bind(&list_rank_op::sort_range,
+											  &v[0] + bounds[i], &v[0] + bounds[i + 1]));
+		threads.join_all();
+		for (TPIE_OS_SIZE_T step = 1; step < k; step *= 2)
+			for (i = 0; i + step < k; i += 2 * step)
+				std::inplace_merge(v.begin() + bounds[i], v.begin() + bounds[i + step],
+								   v.begin() + bounds[std::min(i + 2 * step, k)], node_cmp());
+	}
+
+//// *list_rank_op::in_memory* ////
+	template <typename node_t, typename weight_t>
+	err list_rank_op<node_t, weight_t>::in_memory(link_stream_t* links, rank_stream_t* out) {
+		err ae;
+		link_t* l;
+		std::vector<link_t> ls;
+		TPIE_OS_SIZE_T i, j, n;
+		const TPIE_OS_SIZE_T none = TPIE_OS_SIZE_T(-1);
+
+		ls.reserve(static_cast<TPIE_OS_SIZE_T>(links->stream_len()));
+		links->seek(0);
+		while ((ae = links->read_item(&l)) == NO_ERROR)
+			ls.push_back(*l);
+		if (ae != END_OF_STREAM)
+			return ae;
+		n = ls.size();
+		sort_links(ls);
+
+		// Find the successor of each node, then walk the lists from the
+		// nodes whose predecessor is a head.
+		std::vector<TPIE_OS_SIZE_T> succ(n, none);
+		std::vector<weight_t> ranks(n);
+		std::vector<bool> first(n, false);
+		std::vector<bool> done(n, false);
+		for (i = 0; i < n; i++) {
+			j = std::lower_bound(ls.begin(), ls.end(), link_t(ls[i].pred, ls[i].pred, weight_t()),
+								 node_cmp()) - ls.begin();
+			if (j < n && ls[j].node == ls[i].pred)
+				succ[j] = i;
+			else
+				first[i] = true;
+		}
+		for (i = 0; i < n; i++) {
+			if (!first[i])
+				continue;
+			weight_t w(0);
+			for (j = i; j != none; j = succ[j]) {
+				w = w + ls[j].weight;
+				ranks[j] = w;
+				done[j] = true;
+			}
+		}
+
+		for (i = 0; i < n; i++)
+			if (!done[i]) {
+				TP_LOG_WARNING_ID("list_rank: the edges contain a cycle.");
+				return OBJECT_INVALID;
+			}
+		for (i = 0; i < n; i++)
+			if ((ae = out->write_item(rank_t(ls[i].node, ranks[i]))) != NO_ERROR)
+				return ae;
+		return NO_ERROR;
+	}
+
+///////////////////////////////////////////////////////////////////////////
+/// Ranks the nodes of the lists whose edges are \p edges, and writes a
+/// (node, rank) pair to \p out for each node, in order of node. The rank
+/// of a node is the sum of the weights of the edges from the head of its
+/// list to it, so the head has rank 0 and, with unit weights, the nodes
+/// are numbered in list order. The edges may form any number of disjoint
+/// lists; a node may have at most one successor and one predecessor.
+///
+/// Up to \p memory bytes of memory are used (0 means the available
+/// memory). Lists that fit in it are ranked by sorting the nodes, with
+/// \p threads threads, and following the successors. Otherwise an
+/// independent set of about a quarter of the nodes is bridged out by
+/// sorting, chosen by random coin flips as in [Chiang et al., 1995], the
+/// remaining lists are ranked recursively, and the removed nodes are
+/// ranked from their predecessors, in O(sort(N)) expected I/Os.
+///
+/// node_t must be less than comparable and hashable by tpie::hash.
+/// Returns OBJECT_INVALID if the edges contain a cycle.
+///////////////////////////////////////////////////////////////////////////
+template <typename node_t, typename weight_t>
+err list_rank(stream<list_rank_edge<node_t, weight_t> >* edges,
+			  stream<std::pair<node_t, weight_t> >* out,
+			  TPIE_OS_SIZE_T memory = 0, TPIE_OS_SIZE_T threads = 1) {
+	if (edges == NULL || out == NULL) {
+		TP_LOG_WARNING_ID("list_rank: NULL stream. Aborted.");
+		return NULL_POINTER;
+	}
+	list_rank_op<node_t, weight_t> op(memory, threads);
+	return op.run(edges, out);
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// A node of a rooted tree, as computed by euler_tour().
+///////////////////////////////////////////////////////////////////////////
+template <typename node_t>
+struct tree_node {
+	node_t node;
+	/** The parent of the node; the root is its own parent. */
+	node_t parent;
+	/** The number of edges from the root to the node. */
+	TPIE_OS_OFFSET depth;
+	/** The number of nodes in the subtree of the node. */
+	TPIE_OS_OFFSET size;
+
+	tree_node() {}
+	tree_node(const node_t& n, const node_t& p, TPIE_OS_OFFSET d, TPIE_OS_OFFSET s):
+		node(n), parent(p), depth(d), size(s) {}
+
+	bool operator<(const tree_node& other) const {
+		return node < other.node;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// Roots trees; see euler_tour().
+///////////////////////////////////////////////////////////////////////////
+template <typename node_t>
+class euler_tour_op {
+public:
+	typedef std::pair<node_t, node_t> arc_t;
+	typedef list_rank_edge<arc_t> link_t;
+	typedef std::pair<arc_t, TPIE_OS_OFFSET> rank_t;
+	typedef tree_node<node_t> tree_node_t;
+	typedef list_rank_op<arc_t> ranker_t;
+
+	euler_tour_op(TPIE_OS_SIZE_T memory, TPIE_OS_SIZE_T threads):
+		memory_(memory), threads_(threads) {}
+
+	err run(stream<arc_t>* edges, const node_t& root, stream<tree_node_t>* out);
+
+protected:
+	class to_cmp {
+	public:
+		int compare(const link_t& a, const link_t& b) const {
+			return a.to < b.to ? -1: (b.to < a.to ? 1: 0);
+		}
+	};
+
+	err links(stream<arc_t>* edges, const node_t& root, stream<link_t>* out);
+
+	template <typename T>
+	static stream<T>* temp() {
+		stream<T>* s = new stream<T>;
+		s->persist(PERSIST_DELETE);
+		return s;
+	}
+
+	TPIE_OS_SIZE_T memory_;
+	TPIE_OS_SIZE_T threads_;
+};
+
+//// *euler_tour_op::links* ////
+	template <typename node_t>
+	err euler_tour_op<node_t>::links(stream<arc_t>* edges, const node_t& root, stream<link_t>* out) {
+		err ae = NO_ERROR;
+		arc_t* a;
+
+		stream<arc_t>* arcs = temp<arc_t>();
+		edges->seek(0);
+		while ((ae = edges->read_item(&a)) == NO_ERROR) {
+			if ((ae = arcs->write_item(*a)) != NO_ERROR ||
+				(ae = arcs->write_item(arc_t(a->second, a->first))) != NO_ERROR)
+				break;
+		}
+		if (ae == END_OF_STREAM)
+			ae = NO_ERROR;
+
+		// The tour leaves v towards the neighbour after the one it came
+		// from, in order of neighbour, and ends when it returns to the root
+		// from its last neighbour.
+		stream<arc_t>* sorted = temp<arc_t>();
+		if (ae == NO_ERROR)
+			ae = sort_or_copy(arcs, sorted);
+		delete arcs;
+		sorted->seek(0);
+		arc_t first, prev;
+		bool any = false;
+		while (ae == NO_ERROR && (ae = sorted->read_item(&a)) == NO_ERROR) {
+			if (any && prev.first == a->first)
+				ae = out->write_item(link_t(arc_t(prev.second, prev.first), *a));
+			else {
+				if (any && !(prev.first == root))
+					ae = out->write_item(link_t(arc_t(prev.second, prev.first), first));
+				first = *a;
+			}
+			prev = *a;
+			any = true;
+		}
+		if (ae == END_OF_STREAM)
+			ae = NO_ERROR;
+		if (ae == NO_ERROR && any && !(prev.first == root))
+			ae = out->write_item(link_t(arc_t(prev.second, prev.first), first));
+		delete sorted;
+		return ae;
+	}
+
+//// *euler_tour_op::run* ////
+	template <typename node_t>
+	err euler_tour_op<node_t>::run(stream<arc_t>* edges, const node_t& root, stream<tree_node_t>* out) {
+		err ae = NO_ERROR;
+		link_t* l;
+		rank_t *r, *s;
+		tree_node_t* t;
+		to_cmp tcmp;
+
+		if (edges->stream_len() == 0)
+			return out->write_item(tree_node_t(root, root, 0, 1));
+
+		// Number the arcs in tour order.
+		stream<link_t>* tour = temp<link_t>();
+		stream<rank_t>* pos = temp<rank_t>();
+		ae = links(edges, root, tour);
+		if (ae == NO_ERROR)
+			ae = list_rank(tour, pos, memory_, threads_);
+
+		// An arc is followed down the tree before its reverse arc. The
+		// subtree below a down arc is toured before the reverse arc.
+		stream<rank_t>* unsorted = temp<rank_t>();
+		stream<rank_t>* rev = temp<rank_t>();
+		pos->seek(0);
+		while (ae == NO_ERROR && (ae = pos->read_item(&r)) == NO_ERROR)
+			ae = unsorted->write_item(rank_t(arc_t(r->first.second, r->first.first), r->second));
+		if (ae == END_OF_STREAM)
+			ae = NO_ERROR;
+		if (ae == NO_ERROR)
+			ae = sort_or_copy(unsorted, rev);
+		delete unsorted;
+
+		stream<tree_node_t>* down = temp<tree_node_t>();
+		pos->seek(0);
+		rev->seek(0);
+		while (ae == NO_ERROR && (ae = pos->read_item(&r)) == NO_ERROR &&
+			   (ae = rev->read_item(&s)) == NO_ERROR)
+			if (r->second < s->second)
+				ae = down->write_item(tree_node_t(r->first.second, r->first.first, 0,
+												  (s->second - r->second + 1) / 2));
+		if (ae == END_OF_STREAM)
+			ae = NO_ERROR;
+		delete rev;
+		delete pos;
+
+		// Rank the tour again with weight 1 on down arcs and -1 on up arcs
+		// for the depths.
+		stream<link_t>* by_to = temp<link_t>();
+		stream<link_t>* weighted = temp<link_t>();
+		if (ae == NO_ERROR)
+			ae = sort_or_copy(tour, by_to, &tcmp);
+		delete tour;
+		by_to->seek(0);
+		down->seek(0);
+		err de = down->read_item(&t);
+		while (ae == NO_ERROR && (ae = by_to->read_item(&l)) == NO_ERROR) {
+			while (de == NO_ERROR && arc_t(t->parent, t->node) < l->to)
+				de = down->read_item(&t);
+			bool is_down = (de == NO_ERROR && arc_t(t->parent, t->node) == l->to);
+			ae = weighted->write_item(link_t(l->from, l->to, is_down ? 1: -1));
+		}
+		if (ae == END_OF_STREAM)
+			ae = NO_ERROR;
+		delete by_to;
+
+		stream<rank_t>* depth = temp<rank_t>();
+		if (ae == NO_ERROR)
+			ae = list_rank(weighted, depth, memory_, threads_);
+		delete weighted;
+
+		// The first arc of the tour is down, and not weighed by the ranks.
+		stream<tree_node_t>* res = temp<tree_node_t>();
+		TPIE_OS_OFFSET n = down->stream_len() + 1;
+		if (ae == NO_ERROR)
+			ae = res->write_item(tree_node_t(root, root, 0, n));
+		down->seek(0);
+		depth->seek(0);
+		err re = depth->read_item(&r);
+		while (ae == NO_ERROR && (ae = down->read_item(&t)) == NO_ERROR) {
+			while (re == NO_ERROR && r->first < arc_t(t->parent, t->node))
+				re = depth->read_item(&r);
+			tree_node_t v = *t;
+			v.depth = r->second + 1;
+			ae = res->write_item(v);
+		}
+		if (ae == END_OF_STREAM)
+			ae = NO_ERROR;
+		delete down;
+		delete depth;
+
+		if (ae == NO_ERROR)
+			ae = sort_or_copy(res, out);
+		delete res;
+		return ae;
+	}
+
+///////////////////////////////////////////////////////////////////////////
+/// Roots the tree with the undirected edges of \p edges at \p root, and
+/// writes a tree_node with the parent, depth and subtree size of each
+/// node to \p out, in order of node. A forest can be rooted by adding an
+/// edge from the root of each tree to a common virtual root.
+///
+/// Each edge is replaced by two arcs, and the Euler tour of the tree
+/// starting at the root is ranked with list_rank(), twice: with unit
+/// weights, an arc before its reverse arc goes down the tree and the
+/// positions of the two bound the subtree below it; with weights of 1 on
+/// down arcs and -1 on up arcs, the ranks are the depths. This takes
+/// O(sort(N)) expected I/Os [Chiang et al., 1995]. \p memory and
+/// \p threads are passed to list_rank().
+///
+/// The edges must form a tree. Returns OBJECT_INVALID if the root is
+/// not in it.
+///////////////////////////////////////////////////////////////////////////
+template <typename node_t>
+err euler_tour(stream<std::pair<node_t, node_t> >* edges, const node_t& root,
+			   stream<tree_node<node_t> >* out,
+			   TPIE_OS_SIZE_T memory = 0, TPIE_OS_SIZE_T threads = 1) {
+	if (edges == NULL || out == NULL) {
+		TP_LOG_WARNING_ID("euler_tour: NULL stream. Aborted.");
+		return NULL_POINTER;
+	}
+	euler_tour_op<node_t> op(memory, threads);
+	return op.run(edges, root, out);
+}
+
+	} } //end of tpie::ami namespace
+
+#endif //_TPIE_AMI_LIST_RANK_H
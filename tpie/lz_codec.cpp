@@ -0,0 +1,201 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2010, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#include <tpie/lz_codec.h>
+
+#include <cstring>
+#include <boost/cstdint.hpp>
+
+using namespace tpie;
+
+namespace {
+
+    typedef unsigned char byte_t;
+
+    const int hash_bits = 12;
+    const TPIE_OS_SIZE_T min_match = 4;
+    const TPIE_OS_SIZE_T max_offset = 65535;
+    // A match ends at least this far from the end, and the last one
+    // starts at least end_literals + 7 from it, as the format requires.
+    const TPIE_OS_SIZE_T end_literals = 5;
+
+    inline boost::uint32_t read32(const byte_t *p) {
+	boost::uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+    }
+
+    inline boost::uint32_t hash(boost::uint32_t v) {
+	return (v * 2654435761u) >> (32 - hash_bits);
+    }
+
+    // Writes a length beyond the 15 of a token as a run of 255 bytes.
+    inline byte_t *put_length(byte_t *op, TPIE_OS_SIZE_T len) {
+	for (; len >= 255; len -= 255) {
+	    *op++ = 255;
+	}
+	*op++ = static_cast<byte_t>(len);
+	return op;
+    }
+
+    // Reads such a length; false if the input ends first.
+    inline bool get_length(const byte_t *&ip, const byte_t *iend, TPIE_OS_SIZE_T &len) {
+	byte_t b;
+	do {
+	    if (ip == iend) {
+		return false;
+	    }
+	    b = *ip++;
+	    len += b;
+	} while (b == 255);
+	return true;
+    }
+
+    // Appends a sequence of literals and, if match_len is not 0, a match;
+    // returns NULL if it does not fit before oend.
+    byte_t *put_sequence(byte_t *op, byte_t *oend,
+			 const byte_t *literals, TPIE_OS_SIZE_T lit_len,
+			 TPIE_OS_SIZE_T offset, TPIE_OS_SIZE_T match_len) {
+	TPIE_OS_SIZE_T need = 1 + lit_len + lit_len / 255 + 1 +
+	    (match_len ? 2 + match_len / 255 + 1 : 0);
+	if (need > static_cast<TPIE_OS_SIZE_T>(oend - op)) {
+	    return NULL;
+	}
+
+	byte_t *token = op++;
+	TPIE_OS_SIZE_T m = match_len ? match_len - min_match : 0;
+	*token = static_cast<byte_t>(((lit_len < 15 ? lit_len : 15) << 4) |
+				     (m < 15 ? m : 15));
+	if (lit_len >= 15) {
+	    op = put_length(op, lit_len - 15);
+	}
+	memcpy(op, literals, lit_len);
+	op += lit_len;
+
+	if (match_len) {
+	    *op++ = static_cast<byte_t>(offset & 0xff);
+	    *op++ = static_cast<byte_t>(offset >> 8);
+	    if (m >= 15) {
+		op = put_length(op, m - 15);
+	    }
+	}
+	return op;
+    }
+
+}
+
+TPIE_OS_SIZE_T tpie::lz_compress(const char *in, TPIE_OS_SIZE_T n,
+				 char *out, TPIE_OS_SIZE_T capacity) {
+    const byte_t *ip = reinterpret_cast<const byte_t *>(in);
+    byte_t *op = reinterpret_cast<byte_t *>(out);
+    byte_t *oend = op + capacity;
+
+    // Positions plus one of the last 4-byte prefixes with each hash.
+    boost::uint32_t table[1 << hash_bits];
+    memset(table, 0, sizeof(table));
+
+    TPIE_OS_SIZE_T anchor = 0;
+    TPIE_OS_SIZE_T ii = 0;
+    const TPIE_OS_SIZE_T limit = n > end_literals + 7 ? n - end_literals - 7 : 0;
+    const TPIE_OS_SIZE_T match_end = n > end_literals ? n - end_literals : 0;
+
+    while (ii < limit) {
+	boost::uint32_t v = read32(ip + ii);
+	boost::uint32_t h = hash(v);
+	TPIE_OS_SIZE_T cand = table[h];
+	table[h] = static_cast<boost::uint32_t>(ii + 1);
+
+	if (cand == 0 || ii + 1 - cand > max_offset || read32(ip + cand - 1) != v) {
+	    ii++;
+	    continue;
+	}
+	cand--;
+
+	TPIE_OS_SIZE_T len = min_match;
+	while (ii + len < match_end && ip[cand + len] == ip[ii + len]) {
+	    len++;
+	}
+
+	op = put_sequence(op, oend, ip + anchor, ii - anchor, ii - cand, len);
+	if (op == NULL) {
+	    return 0;
+	}
+	ii += len;
+	anchor = ii;
+    }
+
+    op = put_sequence(op, oend, ip + anchor, n - anchor, 0, 0);
+    if (op == NULL) {
+	return 0;
+    }
+    return op - reinterpret_cast<byte_t *>(out);
+}
+
+bool tpie::lz_decompress(const char *in, TPIE_OS_SIZE_T n,
+			 char *out, TPIE_OS_SIZE_T size) {
+    const byte_t *ip = reinterpret_cast<const byte_t *>(in);
+    const byte_t *iend = ip + n;
+    byte_t *op = reinterpret_cast<byte_t *>(out);
+    byte_t *ostart = op;
+    byte_t *oend = op + size;
+
+    while (ip < iend) {
+	byte_t token = *ip++;
+
+	TPIE_OS_SIZE_T lit_len = token >> 4;
+	if (lit_len == 15 && !get_length(ip, iend, lit_len)) {
+	    return false;
+	}
+	if (lit_len > static_cast<TPIE_OS_SIZE_T>(iend - ip) ||
+	    lit_len > static_cast<TPIE_OS_SIZE_T>(oend - op)) {
+	    return false;
+	}
+	memcpy(op, ip, lit_len);
+	ip += lit_len;
+	op += lit_len;
+
+	// The last sequence has no match.
+	if (ip == iend) {
+	    break;
+	}
+
+	if (iend - ip < 2) {
+	    return false;
+	}
+	TPIE_OS_SIZE_T offset = ip[0] | (ip[1] << 8);
+	ip += 2;
+	TPIE_OS_SIZE_T match_len = token & 15;
+	if (match_len == 15 && !get_length(ip, iend, match_len)) {
+	    return false;
+	}
+	match_len += min_match;
+	if (offset == 0 || offset > static_cast<TPIE_OS_SIZE_T>(op - ostart) ||
+	    match_len > static_cast<TPIE_OS_SIZE_T>(oend - op)) {
+	    return false;
+	}
+
+	// Byte by byte, as the match may overlap what it produces.
+	const byte_t *match = op - offset;
+	for (TPIE_OS_SIZE_T jj = 0; jj < match_len; jj++) {
+	    op[jj] = match[jj];
+	}
+	op += match_len;
+    }
+    return op == oend;
+}
@@ -0,0 +1,61 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2010, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#ifndef _TPIE_LZ_CODEC_H
+#define _TPIE_LZ_CODEC_H
+
+///////////////////////////////////////////////////////////////////////////
+/// \file lz_codec.h
+/// Fast LZ77 compression of blocks, in the LZ4 block format.
+///////////////////////////////////////////////////////////////////////////
+
+// Get definitions for working with Unix and Windows
+#include <tpie/portability.h>
+
+namespace tpie {
+
+///////////////////////////////////////////////////////////////////////////
+/// The largest compressed size of \p n bytes.
+///////////////////////////////////////////////////////////////////////////
+    inline TPIE_OS_SIZE_T lz_compress_bound(TPIE_OS_SIZE_T n) {
+	return n + n / 255 + 16;
+    }
+
+///////////////////////////////////////////////////////////////////////////
+/// Compresses the \p n bytes at \p in into at most \p capacity bytes at
+/// \p out, and returns the compressed size, or 0 if it does not fit. The
+/// output is an LZ4 block: sequences of literals and matches within the
+/// last 64 KB, found with a hash table of 4-byte prefixes. It favours
+/// speed over ratio; blocks of sorted keys and small integers typically
+/// shrink to a third.
+///////////////////////////////////////////////////////////////////////////
+    TPIE_OS_SIZE_T lz_compress(const char *in, TPIE_OS_SIZE_T n,
+			       char *out, TPIE_OS_SIZE_T capacity);
+
+///////////////////////////////////////////////////////////////////////////
+/// Decompresses the \p n bytes at \p in, which must expand to exactly
+/// \p size bytes, into \p out. Returns false if the input is malformed;
+/// it never reads or writes out of bounds.
+///////////////////////////////////////////////////////////////////////////
+    bool lz_decompress(const char *in, TPIE_OS_SIZE_T n,
+		       char *out, TPIE_OS_SIZE_T size);
+
+}  //  tpie namespace
+
+#endif // _TPIE_LZ_CODEC_H
@@ -39,10 +39,29 @@ extern int register_new;
 
 #include <cstdlib>
 
+#include <new>
+#include <boost/thread/mutex.hpp>
+#include <boost/type_traits/aligned_storage.hpp>
+#include <boost/type_traits/alignment_of.hpp>
+
 using namespace tpie::mem;
 
+// Protects remaining and used. operator new and delete may be called from
+// several threads at once (e.g. by concurrent readers of a btree), and they
+// may be called before any constructor or after any destructor of a static
+// object has run. The lock is therefore constructed on first use, in static
+// storage so that no allocation is needed, and never destroyed. Never log
+// while holding it; logging may allocate.
+static boost::mutex& accounting_lock() {
+    static boost::aligned_storage<sizeof(boost::mutex),
+	boost::alignment_of<boost::mutex>::value>::type storage;
+    static boost::mutex* lock = new (storage.address()) boost::mutex;
+    return *lock;
+}
+
 manager::manager() : 
-    remaining (0), user_limit(0), used(0), pause_allocation_depth (0) {
+    remaining (0), user_limit(0), used(0), pause_allocation_depth (0),
+    reclaim_(NULL) {
     instances++;
 
     tp_assert(instances == 1,
@@ -69,19 +88,39 @@ err manager::register_allocation(TPIE_OS_SIZE_T request)
 	return NO_ERROR;
     }
     
-    used      += request;     
+    bool exceeded = false;
+    reclaim_t reclaim = NULL;
+    TPIE_OS_SIZE_T short_by = 0;
+    {
+	boost::mutex::scoped_lock lock(accounting_lock());
+	if (request > remaining && reclaim_) {
+	    reclaim = reclaim_;
+	    short_by = request - remaining;
+	} else {
+	    used += request;
+	    exceeded = (request > remaining);
+	    remaining = exceeded ? 0 : remaining - request;
+	}
+    }
+
+    // Let caches give memory back before the request is refused.
+    if (reclaim) {
+	reclaim(short_by);
 
-    if (request > remaining) {
+	boost::mutex::scoped_lock lock(accounting_lock());
+	used += request;
+	exceeded = (request > remaining);
+	remaining = exceeded ? 0 : remaining - request;
+    }
+
+    if (exceeded) {
        TP_LOG_WARNING("Memory allocation request: ");
        TP_LOG_WARNING(static_cast<TPIE_OS_OFFSET>(request));
        TP_LOG_WARNING(": User-specified memory limit exceeded.");
        TP_LOG_FLUSH_LOG;
-       remaining = 0;
        return INSUFFICIENT_SPACE;
     }
 
-    remaining -= request; 
-
     TP_LOG_MEM_DEBUG("manager Allocated ");
     TP_LOG_MEM_DEBUG(static_cast<TPIE_OS_OFFSET>(request));
     TP_LOG_MEM_DEBUG("; ");
@@ -105,9 +144,15 @@ err manager::register_allocation(TPIE_OS_SIZE_T request)
 
 err manager::register_deallocation(TPIE_OS_SIZE_T sz)
 {
-    remaining += sz;
+    bool excessive;
+    {
+	boost::mutex::scoped_lock lock(accounting_lock());
+	remaining += sz;
+	excessive = (sz > used);
+	used = excessive ? 0 : used - sz;
+    }
 
-    if (sz > used) {
+    if (excessive) {
        TP_LOG_WARNING("Error in deallocation sz=");
        TP_LOG_WARNING(static_cast<TPIE_OS_LONG>(sz));
        TP_LOG_WARNING(", remaining=");
@@ -116,12 +161,9 @@ err manager::register_deallocation(TPIE_OS_SIZE_T sz)
        TP_LOG_WARNING(static_cast<TPIE_OS_LONG>(user_limit));
        TP_LOG_WARNING("\n");
        TP_LOG_FLUSH_LOG;
-       used = 0;
        return EXCESSIVE_DEALLOCATION;
     }
 
-    used      -= sz;    
-
     TP_LOG_MEM_DEBUG("mm_register De-allocated ");
     TP_LOG_MEM_DEBUG(static_cast<TPIE_OS_LONG>(sz));
     TP_LOG_MEM_DEBUG("; ");
@@ -75,6 +75,11 @@ namespace tpie {
 
 	class manager {
 
+	public:
+	    /** Gives back at least the given number of bytes if it can, and
+		returns the number of bytes it gave back. */
+	    typedef TPIE_OS_SIZE_T (*reclaim_t)(TPIE_OS_SIZE_T bytes);
+
 	private:
 	    /** The number of instances of this class and descendents that exist.*/
 	    static int instances;
@@ -90,6 +95,9 @@ namespace tpie {
 	    
 	    /** The depth of possibly nested "pause"-calls. */
 	    unsigned long pause_allocation_depth;
+
+	    /** Called when an allocation would exceed the limit. */
+	    reclaim_t reclaim_;
 	    
 	public:
 	    // made public since Linux c++ doesn't like the fact that our new
@@ -225,6 +233,16 @@ namespace tpie {
 	    /// \sa \ref alloc_counting "Notes on Allocation Counting"
 	    ///////////////////////////////////////////////////////////////////////////
 	    void resume_allocation_counting(); 
+
+	    ///////////////////////////////////////////////////////////////////////////
+	    /// Set a function that frees memory held for speed only, such as a
+	    /// cache, or NULL for none. It is called, without any lock of the
+	    /// memory manager held, when an allocation request would exceed the
+	    /// limit, before the request is refused. It must not allocate.
+	    ///////////////////////////////////////////////////////////////////////////
+	    void set_reclaim(reclaim_t reclaim) {
+		reclaim_ = reclaim;
+	    }
 	    
 	    friend class manager_init;
 	};
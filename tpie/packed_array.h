@@ -20,6 +20,7 @@
 #define __TPIE_BITARRAY_H__
 
 #include <boost/static_assert.hpp>
+#include <algorithm>
 
 ///////////////////////////////////////////////////////////////////////////
 /// \file bitarray.h
@@ -91,9 +92,62 @@ private:
 	static inline size_t perword() {return sizeof(storage_type) * 8 / B;}
 	static inline size_t high(size_t index) {return index/perword();}
 	static inline size_t low(size_t index) {return index%perword();}
+	static inline size_t shift(size_t index) {return low(index)*B;}
 	static inline size_t words(size_t m){return (perword()-1+m)/perword();}
 	static inline storage_type mask() {return (1 << B)-1;}
 
+	/////////////////////////////////////////////////////////
+	/// \internal
+	/// \brief A word with a 1 in the lowest bit of each element
+	/////////////////////////////////////////////////////////
+	static inline storage_type lows() {return ~storage_type(0) / mask();}
+
+	/////////////////////////////////////////////////////////
+	/// \internal
+	/// \brief A word with value in each element
+	/////////////////////////////////////////////////////////
+	static inline storage_type pattern(T value) {return lows() * ((storage_type)value & mask());}
+
+	/////////////////////////////////////////////////////////
+	/// \internal
+	/// \brief The bits of the first n elements of a word
+	/////////////////////////////////////////////////////////
+	static inline storage_type head_mask(size_t n) {
+		return n >= perword() ? ~storage_type(0) : (storage_type(1) << (n*B)) - 1;
+	}
+
+	static inline size_t popcount(storage_type x) {
+#ifdef __GNUC__
+		return __builtin_popcountll(x);
+#else
+		size_t c=0;
+		for (; x; x &= x-1) ++c;
+		return c;
+#endif
+	}
+
+	/////////////////////////////////////////////////////////
+	/// \internal
+	/// \brief The number of elements of w selected by valid
+	/// that equal the elements of the pattern p
+	/////////////////////////////////////////////////////////
+	static inline size_t count_word(storage_type w, storage_type p, storage_type valid) {
+		storage_type x = w ^ p;
+		// Fold each element onto its lowest bit, which is then 0 iff equal.
+		for (size_t s=1; s < size_t(B); s <<= 1) x |= x >> s;
+		return popcount(~x & lows() & valid);
+	}
+
+	/////////////////////////////////////////////////////////
+	/// \internal
+	/// \brief Masks of the elements of [from, to) in the first
+	/// and in the last word holding the range
+	/////////////////////////////////////////////////////////
+	static inline void range_masks(size_t from, size_t to, storage_type & first, storage_type & last) {
+		first = ~head_mask(low(from));
+		last = head_mask(low(to-1)+1);
+	}
+
 	template <bool forward>
 	class const_iter_base;
 
@@ -113,10 +167,10 @@ private:
 	public:
 		template <bool> friend class packed_array::iter_base;
 		template <bool> friend class packed_array::const_iter_base;
-		operator T() const {return (elms[high(index)] >> low(index))&mask();}
+		operator T() const {return (elms[high(index)] >> shift(index))&mask();}
 	 	inline iter_return_type & operator=(const T b) {
 			storage_type * p = elms+high(index);
-			size_t i = low(index);
+			size_t i = shift(index);
 			*p = (*p & ~(mask()<<i)) | ((b & mask()) << i);
 	 		return *this;
 		}
@@ -174,7 +228,7 @@ private:
 		typedef T * pointer;
 
 		const_iter_base & operator=(const const_iter_base & o) {idx = o.idx; elms=o.elms; return *this;}
-		T operator*() const {return (elms[high(idx)] >> low(idx)) & mask();}
+		T operator*() const {return (elms[high(idx)] >> shift(idx)) & mask();}
 		const_iter_base(const_iter_base const& o): elms(o.elms), idx(o.idx) {}
 		const_iter_base(iter_base<forward> const& o): elms(o.elm.elms), idx(o.elm.index) {}
 	};		
@@ -297,7 +351,7 @@ public:
 	/////////////////////////////////////////////////////////
 	void resize(size_t s) {
 		if (s == m_size) return;
-		delete m_elements;
+		delete[] m_elements;
 		m_size = s;
 		m_elements = m_size?new storage_type[words(m_size)]:0;
 	}
@@ -312,13 +366,159 @@ public:
 	/////////////////////////////////////////////////////////
 	void resize(size_t s, T value) {
 		resize(s);
-		storage_type x=0;
-		for (size_t i=0; i < perword(); ++i) 
-			x = (x << B) + ((storage_type)value & mask());
+		fill(value);
+	}
+
+	/////////////////////////////////////////////////////////
+	/// \brief Set all elements of the array to value, a word
+	/// at a time
+	/// \param value the value to assign
+	/////////////////////////////////////////////////////////
+	void fill(T value) {
+		storage_type x = pattern(value);
 		for (size_t i=0; i < words(m_size); ++i)
 			m_elements[i] = x;
 	}
 
+	/////////////////////////////////////////////////////////
+	/// \brief Set the elements [from, to) to value, a word at
+	/// a time
+	/// \param value the value to assign
+	/// \param from the first index to assign
+	/// \param to one past the last index to assign
+	/////////////////////////////////////////////////////////
+	void fill(T value, size_t from, size_t to) {
+		assert(from <= to && to <= m_size);
+		if (from == to) return;
+		storage_type x = pattern(value), first, last;
+		range_masks(from, to, first, last);
+		size_t hf = high(from), ht = high(to-1);
+		if (hf == ht) first &= last;
+		m_elements[hf] = (m_elements[hf] & ~first) | (x & first);
+		if (hf == ht) return;
+		for (size_t i=hf+1; i < ht; ++i)
+			m_elements[i] = x;
+		m_elements[ht] = (m_elements[ht] & ~last) | (x & last);
+	}
+
+	/////////////////////////////////////////////////////////
+	/// \brief Count the elements of [from, to) equal to value,
+	/// a word at a time
+	/// \param value the value to count
+	/// \param from the first index to look at
+	/// \param to one past the last index to look at
+	/// \return the number of elements equal to value
+	/////////////////////////////////////////////////////////
+	size_t count(T value, size_t from, size_t to) const {
+		assert(from <= to && to <= m_size);
+		if (from == to) return 0;
+		storage_type x = pattern(value), first, last;
+		range_masks(from, to, first, last);
+		size_t hf = high(from), ht = high(to-1);
+		if (hf == ht) return count_word(m_elements[hf], x, first & last);
+		size_t c = count_word(m_elements[hf], x, first);
+		for (size_t i=hf+1; i < ht; ++i)
+			c += count_word(m_elements[i], x, ~storage_type(0));
+		return c + count_word(m_elements[ht], x, last);
+	}
+
+	/////////////////////////////////////////////////////////
+	/// \brief Count the elements equal to value
+	/// \param value the value to count
+	/// \return the number of elements equal to value
+	/////////////////////////////////////////////////////////
+	inline size_t count(T value) const {return count(value, 0, m_size);}
+
+	/////////////////////////////////////////////////////////
+	/// \brief Count the elements before index i equal to
+	/// value. For a bit_array, rank(i) is the number of set
+	/// bits before i.
+	/// \param i the index to count up to
+	/// \param value the value to count
+	/// \return the number of elements equal to value
+	/////////////////////////////////////////////////////////
+	inline size_t rank(size_t i, T value=T(1)) const {return count(value, 0, i);}
+
+	/////////////////////////////////////////////////////////
+	/// \brief Copy the elements [from, to) to a plain array
+	/// \param from the first index to copy
+	/// \param to one past the last index to copy
+	/// \param out the destination, with room for to-from elements
+	/////////////////////////////////////////////////////////
+	void unpack(size_t from, size_t to, T * out) const {
+		assert(from <= to && to <= m_size);
+		while (from < to) {
+			storage_type w = m_elements[high(from)] >> shift(from);
+			size_t n = std::min(perword() - low(from), to - from);
+			for (size_t j=0; j < n; ++j, w >>= B)
+				*out++ = static_cast<T>(w & mask());
+			from += n;
+		}
+	}
+
+	/////////////////////////////////////////////////////////
+	/// \brief Copy n elements of a plain array to the elements
+	/// starting at index from, a word at a time
+	/// \param from the first index to assign
+	/// \param in the elements to copy
+	/// \param n the number of elements to copy
+	/////////////////////////////////////////////////////////
+	void pack(size_t from, const T * in, size_t n) {
+		assert(from + n <= m_size);
+		size_t to = from + n;
+		while (from < to) {
+			size_t l = low(from);
+			size_t k = std::min(perword() - l, to - from);
+			storage_type w = 0;
+			for (size_t j=k; j > 0; --j)
+				w = (w << B) | ((storage_type)in[j-1] & mask());
+			storage_type m = head_mask(l+k) & ~head_mask(l);
+			storage_type & e = m_elements[high(from)];
+			e = (e & ~m) | ((w << (l*B)) & m);
+			in += k;
+			from += k;
+		}
+	}
+
+	/////////////////////////////////////////////////////////
+	/// \brief Bitwise and of the elements of this array with
+	/// those of another array of the same size
+	/// \param o the other array
+	/// \return a reference to this array
+	/////////////////////////////////////////////////////////
+	packed_array & operator&=(const packed_array & o) {
+		assert(m_size == o.m_size);
+		for (size_t i=0; i < words(m_size); ++i)
+			m_elements[i] &= o.m_elements[i];
+		return *this;
+	}
+
+	/////////////////////////////////////////////////////////
+	/// \brief Bitwise or of the elements of this array with
+	/// those of another array of the same size
+	/// \param o the other array
+	/// \return a reference to this array
+	/////////////////////////////////////////////////////////
+	packed_array & operator|=(const packed_array & o) {
+		assert(m_size == o.m_size);
+		for (size_t i=0; i < words(m_size); ++i)
+			m_elements[i] |= o.m_elements[i];
+		return *this;
+	}
+
+	/////////////////////////////////////////////////////////
+	/// \brief Bitwise exclusive or of the elements of this
+	/// array with those of another array of the same size
+	/// \param o the other array
+	/// \return a reference to this array
+	/////////////////////////////////////////////////////////
+	packed_array & operator^=(const packed_array & o) {
+		assert(m_size == o.m_size);
+		for (size_t i=0; i < words(m_size); ++i)
+			m_elements[i] ^= o.m_elements[i];
+		return *this;
+	}
+
 	/////////////////////////////////////////////////////////
 	/// \brief Return the size of the array
 	///
@@ -341,7 +541,7 @@ public:
 	/////////////////////////////////////////////////////////
 	inline T operator[](size_t t)const {
 		assert(t < m_size);
-		return (m_elements[high(t)] >> low(t))&mask();
+		return (m_elements[high(t)] >> shift(t))&mask();
 	}	
 	
 	/////////////////////////////////////////////////////////
@@ -352,7 +552,7 @@ public:
 	/////////////////////////////////////////////////////////
 	inline return_type operator[](size_t t) {
 		assert(t < m_size);
-		return return_type(m_elements+high(t), low(t));
+		return return_type(m_elements+high(t), shift(t));
 	}
 
 	/////////////////////////////////////////////////////////
@@ -674,6 +674,40 @@ inline TPIE_OS_SSIZE_T TPIE_OS_READ(TPIE_OS_FILE_DESCRIPTOR fd, void* buffer, si
 }
 #endif
 
+// Read at an offset without moving the file pointer, so that other
+// threads may read from the same descriptor. On Windows a handle opened
+// for synchronous I/O moves its file pointer all the same, so the read
+// must not race other I/O on the handle.
+#ifdef _WIN32
+inline TPIE_OS_SSIZE_T TPIE_OS_PREAD(TPIE_OS_FILE_DESCRIPTOR fd, void* buffer, TPIE_OS_SIZE_T count, TPIE_OS_OFFSET offset) {
+    DWORD bytesRead = 0;
+    OVERLAPPED ov;
+    memset(&ov, 0, sizeof(ov));
+    ov.Offset = getLowOrderOff(offset);
+    ov.OffsetHigh = getHighOrderOff(offset);
+    if (!ReadFile(fd.FileHandle, buffer, (DWORD)count, &bytesRead, &ov)) {
+	return -1;
+    }
+    return bytesRead;
+}
+#else
+inline TPIE_OS_SSIZE_T TPIE_OS_PREAD(TPIE_OS_FILE_DESCRIPTOR fd, void* buffer, size_t count, TPIE_OS_OFFSET offset) {
+    return ::pread(fd,buffer,count,offset);
+}
+#endif
+
+// Ask for a range of a file to be read into the page cache ahead of its
+// use. A hint only.
+#ifdef _WIN32
+inline int TPIE_OS_FADVISE_WILLNEED(TPIE_OS_FILE_DESCRIPTOR /* fd */, TPIE_OS_OFFSET /* offset */, TPIE_OS_OFFSET /* len */) {
+    return 0;
+}
+#else
+inline int TPIE_OS_FADVISE_WILLNEED(TPIE_OS_FILE_DESCRIPTOR fd, TPIE_OS_OFFSET offset, TPIE_OS_OFFSET len) {
+    return posix_fadvise(fd, offset, len, POSIX_FADV_WILLNEED);
+}
+#endif
+
 #ifdef _WIN32
 // The suggested starting address of the mmap call has to be
 // a multiple of the systems granularity (else the mapping fails)
@@ -718,6 +752,17 @@ inline int TPIE_OS_MSYNC(char* addr, size_t len,int flags) {
 }
 #endif
 
+// Ask for a mapped range to be read in ahead of its use. A hint only.
+#ifdef _WIN32
+inline int TPIE_OS_MADVISE_WILLNEED(LPVOID /* addr */, size_t /* len */) {
+    return 0;
+}
+#else
+inline int TPIE_OS_MADVISE_WILLNEED(void* addr, size_t len) {
+    return posix_madvise(addr, len, POSIX_MADV_WILLNEED);
+}
+#endif
+
 
 #ifdef _WIN32
 inline bool TPIE_OS_EXISTS(const std::string & fileName) {
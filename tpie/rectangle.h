@@ -33,7 +33,7 @@
 #ifndef _TPIE_AMI_RECTANGLE_H_
 #define _TPIE_AMI_RECTANGLE_H_
 
-#include "app_config.h"
+#include <tpie/config.h>
 #include <tpie/portability.h>
 #include <tpie/stream.h>
 
@@ -0,0 +1,860 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; eval: (progn (c-set-style "stroustrup") (c-set-offset 'innamespace 0)); -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2010, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+///////////////////////////////////////////////////////////////////////////
+/// \file rtree.h
+/// Provides definition and implementation of a packed R-tree for
+/// rectangles, bulk loaded in Hilbert or STR (Sort-Tile-Recursive)
+/// order.
+///////////////////////////////////////////////////////////////////////////
+
+#ifndef _TPIE_AMI_RTREE_H
+#define _TPIE_AMI_RTREE_H
+
+#include <tpie/config.h>
+#include <tpie/portability.h>
+// For min, max, swap.
+#include <algorithm>
+// For stack.
+#include <stack>
+// For priority_queue.
+#include <queue>
+// For vector.
+#include <vector>
+// For sqrt, ceil.
+#include <cmath>
+// STL string.
+#include <string>
+
+// TPIE stuff.
+#include <tpie/stream.h>
+#include <tpie/sort.h>
+#include <tpie/coll.h>
+#include <tpie/block.h>
+// The stats_tree class.
+#include <tpie/stats_tree.h>
+// The cache manager.
+#include <tpie/cache.h>
+// The stream_sink class, for reporting to streams.
+#include <tpie/streaming.h>
+// The rectangle class.
+#include <tpie/rectangle.h>
+#include <boost/cstdint.hpp>
+
+namespace tpie {
+
+namespace ami {
+
+///////////////////////////////////////////////////////////////////////////
+/// Returns the position of (\p x, \p y) on the Hilbert curve through the
+/// 2^32 x 2^32 grid.
+///////////////////////////////////////////////////////////////////////////
+inline boost::uint64_t rtree_hilbert_key(boost::uint32_t x, boost::uint32_t y) {
+	boost::uint64_t key = 0;
+	boost::uint32_t rx, ry, t;
+	for (boost::uint32_t s = 0x80000000u; s > 0; s >>= 1) {
+		rx = (x & s) ? 1: 0;
+		ry = (y & s) ? 1: 0;
+		key += boost::uint64_t(s) * s * ((3 * rx) ^ ry);
+		// Rotate the quadrant, so the curve in it starts at the origin.
+		if (ry == 0) {
+			if (rx == 1) {
+				x = ~x;
+				y = ~y;
+			}
+			t = x; x = y; y = t;
+		}
+	}
+	return key;
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Scales \p c, between \p lo and \p hi, to a 32 bit grid coordinate.
+///////////////////////////////////////////////////////////////////////////
+inline boost::uint32_t rtree_grid_coord(double c, double lo, double hi) {
+	double t = (hi > lo) ? (c - lo) / (hi - lo): 0.0;
+	t = std::max(0.0, std::min(1.0, t));
+	return boost::uint32_t(t * 4294967295.0);
+}
+
+/** The bulk loading methods. */
+enum rtree_load_method {
+	RTREE_LOAD_HILBERT = 0,
+	RTREE_LOAD_STR = 1
+};
+
+/** R-tree status type. */
+enum rtree_status {
+	RTREE_STATUS_VALID = 0,
+	RTREE_STATUS_INVALID = 1
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// The parameters of an R-tree.
+///////////////////////////////////////////////////////////////////////////
+class rtree_params {
+public:
+	/** Max number of entries in a node. 0 means use all available
+	 * capacity. */
+	TPIE_OS_SIZE_T node_size_max;
+	/** Block factor of the nodes. */
+	TPIE_OS_SIZE_T node_block_factor;
+	/** Number of nodes in the node cache. */
+	TPIE_OS_SIZE_T node_cache_size;
+
+	rtree_params(): node_size_max(0), node_block_factor(1), node_cache_size(16) {}
+};
+
+/** A global object storing the default parameter values. */
+const rtree_params _rtree_params_default = rtree_params();
+
+///////////////////////////////////////////////////////////////////////////
+/// A destination for queries that discards the results, for counting.
+///////////////////////////////////////////////////////////////////////////
+template<class item_t>
+class rtree_null_sink {
+public:
+	void begin(TPIE_OS_OFFSET /* size */ = 0) {}
+	void push(const item_t& /* item */) {}
+	void end() {}
+};
+
+#define TPIE_AMI_RTREE_HEADER_MAGIC_NUMBER 0xA9421E
+
+///////////////////////////////////////////////////////////////////////////
+/// The info field of an R-tree node.
+///////////////////////////////////////////////////////////////////////////
+class rtree_node_info {
+public:
+	/** The number of entries. */
+	TPIE_OS_SIZE_T size;
+	/** The level of the node; leaves are on level 0. */
+	TPIE_OS_SIZE_T level;
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// A node of an R-tree. An entry is the bounding rectangle of a child
+/// node, with the child's block id as the rectangle id, or, in a leaf,
+/// a data rectangle.
+///////////////////////////////////////////////////////////////////////////
+template<class coord_t, class BTECOLL = bte::COLLECTION>
+class rtree_node: public block<rectangle<coord_t, bid_t>, rtree_node_info, BTECOLL> {
+public:
+	typedef block<rectangle<coord_t, bid_t>, rtree_node_info, BTECOLL> block_t;
+	using block_t::el;
+	using block_t::info;
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Reads the node with id \p bid, or creates a new (empty leaf) node if
+	/// \p bid is 0.
+	///////////////////////////////////////////////////////////////////////////
+	rtree_node(collection_single<BTECOLL>* pcoll, bid_t bid = 0): block_t(pcoll, 0, bid) {
+		if (bid == 0) {
+			info()->size = 0;
+			info()->level = 0;
+		}
+	}
+
+	TPIE_OS_SIZE_T& size() { return info()->size; }
+	TPIE_OS_SIZE_T& level() { return info()->level; }
+
+	///////////////////////////////////////////////////////////////////////////
+	/// The max number of entries in a node of the given block size.
+	///////////////////////////////////////////////////////////////////////////
+	static TPIE_OS_SIZE_T el_capacity(TPIE_OS_SIZE_T block_size) {
+		return block_t::el_capacity(block_size, 0);
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// A packed (static) R-tree for two-dimensional rectangles, stored in a
+/// block collection. The tree is bulk loaded from a stream of rectangles
+/// in one of two orders:
+///
+/// - Hilbert: the rectangles are sorted by the position of their centers
+///   on a Hilbert curve, and the nodes of each level are packed in that
+///   order [Kamel and Faloutsos, 1993].
+/// - STR (Sort-Tile-Recursive): the rectangles are sorted by x into
+///   vertical slices of about sqrt(n / B) nodes each, and each slice by
+///   y; each level is packed this way in turn [Leutenegger et al., 1997].
+///
+/// Both sort with ami::sort on 64 bit keys, so loading takes O(sort(n))
+/// I/Os. Window and nearest neighbor queries report to a stream, or
+/// push the results into any object with begin(), push() and end()
+/// methods, such as the pipeline sinks in streaming.h.
+///////////////////////////////////////////////////////////////////////////
+template<class coord_t, class BTECOLL = bte::COLLECTION>
+class rtree {
+public:
+
+	typedef rectangle<coord_t, bid_t> rect_t;
+	typedef stream<rect_t> stream_t;
+	typedef collection_single<BTECOLL> collection_t;
+	typedef rtree_node<coord_t, BTECOLL> node_t;
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Constructor; creates a temporary R-tree.
+	///////////////////////////////////////////////////////////////////////////
+	rtree(const rtree_params& params = _rtree_params_default);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Constructor; opens/creates an R-tree with the given name, type and
+	/// parameters.
+	///////////////////////////////////////////////////////////////////////////
+	rtree(const std::string& base_file_name,
+		  collection_type type = WRITE_COLLECTION,
+		  const rtree_params& params = _rtree_params_default);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Bulk loads the tree from the rectangles in \p in_stream, with the
+	/// given method. The tree must be empty. The ids of the rectangles are
+	/// reported back by the queries.
+	///////////////////////////////////////////////////////////////////////////
+	err load(stream_t* in_stream, rtree_load_method method = RTREE_LOAD_HILBERT);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Writes all rectangles stored in the tree to the given stream.
+	///////////////////////////////////////////////////////////////////////////
+	err unload(stream_t* s);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Pushes all rectangles intersecting \p q (as closed rectangles) into
+	/// \p dest. Returns the number of rectangles found.
+	///////////////////////////////////////////////////////////////////////////
+	template<class dest_t>
+	TPIE_OS_OFFSET window_query(const rect_t& q, dest_t& dest);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Reports all rectangles intersecting \p q to \p stream. If \p stream
+	/// is \p NULL, only counts them.
+	///////////////////////////////////////////////////////////////////////////
+	TPIE_OS_OFFSET window_query(const rect_t& q, stream_t* stream);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Pushes the \p k rectangles nearest to the point (\p x, \p y) into
+	/// \p dest, nearest first. The distance to a rectangle is the
+	/// (Euclidean) distance to its nearest point. Returns the number of
+	/// rectangles reported (less than \p k only if the tree has fewer).
+	///////////////////////////////////////////////////////////////////////////
+	template<class dest_t>
+	TPIE_OS_OFFSET k_nn_query(coord_t x, coord_t y, TPIE_OS_OFFSET k, dest_t& dest);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Reports the \p k rectangles nearest to (\p x, \p y) to \p stream,
+	/// nearest first.
+	///////////////////////////////////////////////////////////////////////////
+	TPIE_OS_OFFSET k_nn_query(coord_t x, coord_t y, TPIE_OS_OFFSET k, stream_t* stream);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Finds a rectangle (with the same coordinates and id) in the tree.
+	///////////////////////////////////////////////////////////////////////////
+	bool find(const rect_t& r);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Returns the number of rectangles stored in the tree.
+	///////////////////////////////////////////////////////////////////////////
+	TPIE_OS_OFFSET size() const { return header_.size; }
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Returns the height of the tree (1 if the root is a leaf, 0 if the
+	/// tree is empty).
+	///////////////////////////////////////////////////////////////////////////
+	TPIE_OS_SIZE_T height() const { return header_.height; }
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Returns the bounding rectangle of the stored rectangles.
+	///////////////////////////////////////////////////////////////////////////
+	const rect_t& mbr() const { return header_.mbr; }
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Sets the persistence of the block collection.
+	///////////////////////////////////////////////////////////////////////////
+	void persist(persistence per);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Inquires the (real) parameters.
+	///////////////////////////////////////////////////////////////////////////
+	const rtree_params& params() const { return params_; }
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Inquires the status.
+	///////////////////////////////////////////////////////////////////////////
+	rtree_status status() const { return status_; }
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Inquires the base path name.
+	///////////////////////////////////////////////////////////////////////////
+	const std::string& name() const { return name_; }
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Inquires the statistics.
+	///////////////////////////////////////////////////////////////////////////
+	const stats_tree& stats();
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Destructor.
+	///////////////////////////////////////////////////////////////////////////
+	~rtree();
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Metainformation about the tree.
+	///////////////////////////////////////////////////////////////////////////
+	class header_t {
+	public:
+		unsigned int magic_number;
+		bid_t root_bid;
+		TPIE_OS_SIZE_T height;
+		TPIE_OS_OFFSET size;
+		rect_t mbr;
+
+		header_t():
+			magic_number(TPIE_AMI_RTREE_HEADER_MAGIC_NUMBER), root_bid(0),
+			height(0), size(0), mbr() {}
+	};
+
+protected:
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Function object for the node cache write out.
+	///////////////////////////////////////////////////////////////////////////
+	class remove_node {
+	public:
+		void operator()(node_t* p) { delete p; }
+	};
+
+	typedef tpie::ami::CACHE_MANAGER<node_t*, remove_node> node_cache_t;
+
+	///////////////////////////////////////////////////////////////////////////
+	/// A rectangle with its position in the loading order.
+	///////////////////////////////////////////////////////////////////////////
+	struct keyed_rect_t {
+		boost::uint64_t key;
+		rect_t r;
+		bool operator<(const keyed_rect_t& k) const { return key < k.key; }
+	};
+	typedef stream<keyed_rect_t> keyed_stream_t;
+
+	///////////////////////////////////////////////////////////////////////////
+	/// A node or rectangle to visit in a nearest neighbor search, with its
+	/// squared distance to the query point (the nearest on top).
+	///////////////////////////////////////////////////////////////////////////
+	struct nn_pq_elem {
+		double d2;
+		rect_t r;
+		bool is_node;
+		bool operator<(const nn_pq_elem& e) const { return d2 > e.d2; }
+	};
+
+	/** The header. */
+	header_t header_;
+
+	/** The parameters. */
+	rtree_params params_;
+
+	/** The status. */
+	rtree_status status_;
+
+	/** The base file name. */
+	std::string name_;
+
+	/** The nodes. */
+	collection_t* pcoll_;
+
+	/** The node cache. */
+	node_cache_t* node_cache_;
+
+	/** Statistics. */
+	stats_tree stats_;
+
+	void shared_init(const std::string& base_file_name, collection_type type);
+
+	node_t* fetch_node(bid_t bid = 0);
+	void release_node(node_t* n);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Sorts \p in into \p out in the packing order of \p method.
+	///////////////////////////////////////////////////////////////////////////
+	err sort_level(stream_t* in, stream_t* out, rtree_load_method method);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Packs the entries in \p in, in order, into nodes on the given level
+	/// and writes the bounding rectangles of the nodes (with their block
+	/// ids) to \p out. Returns the number of nodes in \p node_count.
+	///////////////////////////////////////////////////////////////////////////
+	err pack_level(stream_t* in, stream_t* out, TPIE_OS_SIZE_T level,
+				   TPIE_OS_OFFSET& node_count);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// The squared distance from (\p x, \p y) to the rectangle \p r.
+	///////////////////////////////////////////////////////////////////////////
+	static double distance2(const rect_t& r, double x, double y) {
+		double dx = 0.0, dy = 0.0;
+		if (x < double(r.get_left())) dx = double(r.get_left()) - x;
+		else if (x > double(r.get_right())) dx = x - double(r.get_right());
+		if (y < double(r.get_lower())) dy = double(r.get_lower()) - y;
+		else if (y > double(r.get_upper())) dy = y - double(r.get_upper());
+		return dx * dx + dy * dy;
+	}
+};
+
+#define TPIE_AMI_RTREE       rtree<coord_t, BTECOLL>
+#define TPIE_AMI_RTREE_NODE  rtree_node<coord_t, BTECOLL>
+#define RECT                 rectangle<coord_t, bid_t>
+#define RECT_STREAM          stream< RECT >
+
+//// *rtree::rtree* ////
+	template<class coord_t, class BTECOLL>
+	TPIE_AMI_RTREE::rtree(const rtree_params& params):
+		header_(), params_(params), name_() {
+		std::string base_file_name = tempname::tpie_name("rtree");
+		name_ = base_file_name;
+		shared_init(base_file_name, WRITE_COLLECTION);
+		if (status_ == RTREE_STATUS_VALID)
+			persist(PERSIST_DELETE);
+	}
+
+//// *rtree::rtree* ////
+	template<class coord_t, class BTECOLL>
+	TPIE_AMI_RTREE::rtree(const std::string& base_file_name, collection_type type,
+						  const rtree_params& params):
+		header_(), params_(params), name_(base_file_name) {
+		shared_init(base_file_name, type);
+	}
+
+//// *rtree::shared_init* ////
+	template<class coord_t, class BTECOLL>
+	void TPIE_AMI_RTREE::shared_init(const std::string& base_file_name, collection_type type) {
+		status_ = RTREE_STATUS_VALID;
+
+		pcoll_ = new collection_t(base_file_name + ".r", type, params_.node_block_factor);
+		if (!pcoll_->is_valid()) {
+			status_ = RTREE_STATUS_INVALID;
+			delete pcoll_;
+			return;
+		}
+
+		// Read the header info, if relevant.
+		if (pcoll_->size() != 0) {
+			memcpy((void *)(&header_), pcoll_->user_data(), sizeof(header_));
+			if (header_.magic_number != TPIE_AMI_RTREE_HEADER_MAGIC_NUMBER) {
+				status_ = RTREE_STATUS_INVALID;
+				TP_LOG_WARNING_ID("Invalid magic number in rtree file.");
+				delete pcoll_;
+				return;
+			}
+		}
+
+		node_cache_ = new node_cache_t(params_.node_cache_size, 8);
+
+		TPIE_OS_SIZE_T capacity = TPIE_AMI_RTREE_NODE::el_capacity(pcoll_->block_size());
+		if (params_.node_size_max == 0 || params_.node_size_max > capacity)
+			params_.node_size_max = capacity;
+		// A node needs at least two entries for the tree to shrink by levels.
+		if (params_.node_size_max < 2)
+			params_.node_size_max = 2;
+		params_.node_block_factor = pcoll_->block_factor();
+	}
+
+//// *rtree::fetch_node* ////
+	template<class coord_t, class BTECOLL>
+	TPIE_AMI_RTREE_NODE* TPIE_AMI_RTREE::fetch_node(bid_t bid) {
+		TPIE_AMI_RTREE_NODE* n;
+		stats_.record(NODE_FETCH);
+		// Warning: using short-circuit evaluation. Order is important.
+		if ((bid == 0) || !node_cache_->read(bid, n))
+			n = new TPIE_AMI_RTREE_NODE(pcoll_, bid);
+		return n;
+	}
+
+//// *rtree::release_node* ////
+	template<class coord_t, class BTECOLL>
+	void TPIE_AMI_RTREE::release_node(TPIE_AMI_RTREE_NODE* n) {
+		stats_.record(NODE_RELEASE);
+		if (n->persist() == PERSIST_DELETE)
+			delete n;
+		else
+			node_cache_->write(n->bid(), n);
+	}
+
+//// *rtree::load* ////
+	template<class coord_t, class BTECOLL>
+	err TPIE_AMI_RTREE::load(RECT_STREAM* in_stream, rtree_load_method method) {
+		err ae = NO_ERROR;
+		RECT* r;
+
+		// Some error checking.
+		if (status_ == RTREE_STATUS_INVALID) {
+			TP_LOG_WARNING_ID("rtree is invalid. Nothing done in load.");
+			return OBJECT_INITIALIZATION;
+		}
+		if (header_.size > 0) {
+			TP_LOG_WARNING_ID("rtree already loaded. Nothing done in load.");
+			return GENERIC_ERROR;
+		}
+		if (in_stream == NULL) {
+			TP_LOG_WARNING_ID("Attempting to load with a NULL stream pointer. Aborted.");
+			return OBJECT_INITIALIZATION;
+		}
+		if (in_stream->stream_len() == 0)
+			return NO_ERROR;
+
+		// The bounding rectangle, for the grid of the sort keys.
+		in_stream->seek(0);
+		if ((ae = in_stream->read_item(&r)) != NO_ERROR)
+			return ae;
+		header_.mbr = *r;
+		while ((ae = in_stream->read_item(&r)) == NO_ERROR)
+			header_.mbr.extend(*r);
+		if (ae != END_OF_STREAM)
+			return ae;
+
+		// Pack the levels bottom up, until one node is left. Hilbert order
+		// is kept by the levels above the leaves; STR order is not.
+		RECT_STREAM* level_in = in_stream;
+		RECT_STREAM* sorted;
+		RECT_STREAM* level_out;
+		TPIE_OS_OFFSET nodes;
+		TPIE_OS_SIZE_T level = 0;
+		do {
+			if (level == 0 || method == RTREE_LOAD_STR) {
+				sorted = new RECT_STREAM;
+				sorted->persist(PERSIST_DELETE);
+				ae = sort_level(level_in, sorted, method);
+				if (level_in != in_stream)
+					delete level_in;
+				level_in = sorted;
+				if (ae != NO_ERROR)
+					break;
+			}
+			level_out = new RECT_STREAM;
+			level_out->persist(PERSIST_DELETE);
+			ae = pack_level(level_in, level_out, level, nodes);
+			if (level_in != in_stream)
+				delete level_in;
+			level_in = level_out;
+			level++;
+		} while (ae == NO_ERROR && nodes > 1);
+
+		if (ae == NO_ERROR) {
+			level_in->seek(0);
+			level_in->read_item(&r);
+			header_.root_bid = r->get_id();
+			header_.height = level;
+			header_.size = in_stream->stream_len();
+		}
+		if (level_in != in_stream)
+			delete level_in;
+		return ae;
+	}
+
+//// *rtree::sort_level* ////
+	template<class coord_t, class BTECOLL>
+	err TPIE_AMI_RTREE::sort_level(RECT_STREAM* in, RECT_STREAM* out,
+								   rtree_load_method method) {
+		err ae = NO_ERROR;
+		RECT* r;
+		keyed_rect_t k;
+		keyed_rect_t* pk;
+		double lox = header_.mbr.get_left(), hix = header_.mbr.get_right();
+		double loy = header_.mbr.get_lower(), hiy = header_.mbr.get_upper();
+
+		keyed_stream_t* keyed = new keyed_stream_t;
+		keyed->persist(PERSIST_DELETE);
+		in->seek(0);
+		while ((ae = in->read_item(&r)) == NO_ERROR) {
+			boost::uint32_t x = rtree_grid_coord((double(r->get_left()) + double(r->get_right())) / 2.0, lox, hix);
+			boost::uint32_t y = rtree_grid_coord((double(r->get_lower()) + double(r->get_upper())) / 2.0, loy, hiy);
+			k.key = (method == RTREE_LOAD_HILBERT) ? rtree_hilbert_key(x, y): ((boost::uint64_t(x) << 32) | y);
+			k.r = *r;
+			if ((ae = keyed->write_item(k)) != NO_ERROR)
+				break;
+		}
+		if (ae != END_OF_STREAM) {
+			delete keyed;
+			return ae;
+		}
+
+		keyed_stream_t* sorted = new keyed_stream_t;
+		sorted->persist(PERSIST_DELETE);
+		ae = sort_or_copy(keyed, sorted);
+		delete keyed;
+		if (ae != NO_ERROR) {
+			delete sorted;
+			return ae;
+		}
+
+		if (method == RTREE_LOAD_STR) {
+			// Cut the x order into slices of about sqrt(n / B) nodes each, and
+			// sort by slice, then y.
+			TPIE_OS_OFFSET n = sorted->stream_len();
+			TPIE_OS_OFFSET b = params_.node_size_max;
+			TPIE_OS_OFFSET nodes = (n + b - 1) / b;
+			TPIE_OS_OFFSET slices = (TPIE_OS_OFFSET) std::ceil(std::sqrt(double(nodes)));
+			TPIE_OS_OFFSET slice_size = (nodes + slices - 1) / slices * b;
+			keyed = new keyed_stream_t;
+			keyed->persist(PERSIST_DELETE);
+			sorted->seek(0);
+			for (TPIE_OS_OFFSET i = 0; (ae = sorted->read_item(&pk)) == NO_ERROR; i++) {
+				k = *pk;
+				k.key = (boost::uint64_t(i / slice_size) << 32) | (k.key & 0xFFFFFFFFu);
+				if ((ae = keyed->write_item(k)) != NO_ERROR)
+					break;
+			}
+			delete sorted;
+			if (ae != END_OF_STREAM) {
+				delete keyed;
+				return ae;
+			}
+			sorted = new keyed_stream_t;
+			sorted->persist(PERSIST_DELETE);
+			ae = sort_or_copy(keyed, sorted);
+			delete keyed;
+			if (ae != NO_ERROR) {
+				delete sorted;
+				return ae;
+			}
+		}
+
+		sorted->seek(0);
+		while ((ae = sorted->read_item(&pk)) == NO_ERROR)
+			if ((ae = out->write_item(pk->r)) != NO_ERROR)
+				break;
+		delete sorted;
+		return (ae == END_OF_STREAM) ? NO_ERROR: ae;
+	}
+
+//// *rtree::pack_level* ////
+	template<class coord_t, class BTECOLL>
+	err TPIE_AMI_RTREE::pack_level(RECT_STREAM* in, RECT_STREAM* out, TPIE_OS_SIZE_T level,
+								   TPIE_OS_OFFSET& node_count) {
+		err ae = NO_ERROR;
+		RECT* r;
+		RECT bb;
+		TPIE_AMI_RTREE_NODE* n = NULL;
+
+		node_count = 0;
+		in->seek(0);
+		while ((ae = in->read_item(&r)) == NO_ERROR) {
+			if (n == NULL) {
+				n = fetch_node();
+				n->level() = level;
+				bb = *r;
+			}
+			n->el[n->size()++] = *r;
+			bb.extend(*r);
+			if (n->size() == params_.node_size_max) {
+				bb.set_id(n->bid());
+				release_node(n);
+				n = NULL;
+				node_count++;
+				if ((ae = out->write_item(bb)) != NO_ERROR)
+					return ae;
+			}
+		}
+		if (ae != END_OF_STREAM)
+			return ae;
+		if (n != NULL) {
+			bb.set_id(n->bid());
+			release_node(n);
+			node_count++;
+			if ((ae = out->write_item(bb)) != NO_ERROR)
+				return ae;
+		}
+		return NO_ERROR;
+	}
+
+//// *rtree::unload* ////
+	template<class coord_t, class BTECOLL>
+	err TPIE_AMI_RTREE::unload(RECT_STREAM* s) {
+		stream_sink<stream_t> sink(s);
+		RECT all(0, header_.mbr.get_left(), header_.mbr.get_lower(),
+				 header_.mbr.get_right(), header_.mbr.get_upper());
+		window_query(all, sink);
+		return NO_ERROR;
+	}
+
+//// *rtree::window_query* ////
+	template<class coord_t, class BTECOLL>
+	template<class dest_t>
+	TPIE_OS_OFFSET TPIE_AMI_RTREE::window_query(const RECT& q, dest_t& dest) {
+		TPIE_OS_OFFSET result = 0;
+		TPIE_OS_SIZE_T i;
+		TPIE_AMI_RTREE_NODE* n;
+
+		dest.begin();
+		if (status_ != RTREE_STATUS_VALID) {
+			TP_LOG_WARNING_ID("  window_query: tree is invalid. query aborted.");
+			dest.end();
+			return result;
+		}
+
+		std::stack<bid_t> s;
+		if (header_.size > 0)
+			s.push(header_.root_bid);
+		while (!s.empty()) {
+			n = fetch_node(s.top());
+			s.pop();
+			for (i = 0; i < n->size(); i++) {
+				if (!n->el[i].intersects(q))
+					continue;
+				if (n->level() == 0) {
+					dest.push(n->el[i]);
+					result++;
+				} else
+					s.push(n->el[i].get_id());
+			}
+			release_node(n);
+		}
+		dest.end();
+		return result;
+	}
+
+//// *rtree::window_query* ////
+	template<class coord_t, class BTECOLL>
+	TPIE_OS_OFFSET TPIE_AMI_RTREE::window_query(const RECT& q, RECT_STREAM* stream) {
+		if (stream == NULL) {
+			rtree_null_sink<RECT> sink;
+			return window_query(q, sink);
+		}
+		stream_sink<stream_t> sink(stream);
+		return window_query(q, sink);
+	}
+
+//// *rtree::k_nn_query* ////
+	template<class coord_t, class BTECOLL>
+	template<class dest_t>
+	TPIE_OS_OFFSET TPIE_AMI_RTREE::k_nn_query(coord_t x, coord_t y, TPIE_OS_OFFSET k,
+											  dest_t& dest) {
+		TPIE_OS_OFFSET result = 0;
+		TPIE_OS_SIZE_T i;
+		TPIE_AMI_RTREE_NODE* n;
+		nn_pq_elem e;
+
+		dest.begin();
+		if (status_ != RTREE_STATUS_VALID) {
+			TP_LOG_WARNING_ID("  k_nn_query: tree is invalid. query aborted.");
+			dest.end();
+			return result;
+		}
+
+		// Best first search: nodes and rectangles by distance, nearest
+		// first. A rectangle at the top is nearer than everything left.
+		std::priority_queue<nn_pq_elem> pq;
+		if (header_.size > 0 && k > 0) {
+			e.d2 = 0.0;
+			e.r = header_.mbr;
+			e.r.set_id(header_.root_bid);
+			e.is_node = true;
+			pq.push(e);
+		}
+		while (!pq.empty() && result < k) {
+			e = pq.top();
+			pq.pop();
+			if (!e.is_node) {
+				dest.push(e.r);
+				result++;
+				continue;
+			}
+			n = fetch_node(e.r.get_id());
+			for (i = 0; i < n->size(); i++) {
+				nn_pq_elem c;
+				c.d2 = distance2(n->el[i], double(x), double(y));
+				c.r = n->el[i];
+				c.is_node = (n->level() > 0);
+				pq.push(c);
+			}
+			release_node(n);
+		}
+		dest.end();
+		return result;
+	}
+
+//// *rtree::k_nn_query* ////
+	template<class coord_t, class BTECOLL>
+	TPIE_OS_OFFSET TPIE_AMI_RTREE::k_nn_query(coord_t x, coord_t y, TPIE_OS_OFFSET k,
+											  RECT_STREAM* stream) {
+		if (stream == NULL) {
+			rtree_null_sink<RECT> sink;
+			return k_nn_query(x, y, k, sink);
+		}
+		stream_sink<stream_t> sink(stream);
+		return k_nn_query(x, y, k, sink);
+	}
+
+//// *rtree::find* ////
+	template<class coord_t, class BTECOLL>
+	bool TPIE_AMI_RTREE::find(const RECT& r) {
+		TPIE_OS_SIZE_T i;
+		TPIE_AMI_RTREE_NODE* n;
+		bool found = false;
+
+		std::stack<bid_t> s;
+		if (status_ == RTREE_STATUS_VALID && header_.size > 0)
+			s.push(header_.root_bid);
+		while (!s.empty() && !found) {
+			n = fetch_node(s.top());
+			s.pop();
+			for (i = 0; i < n->size() && !found; i++) {
+				if (n->level() == 0)
+					found = (n->el[i] == r);
+				else if (n->el[i].intersects(r))
+					s.push(n->el[i].get_id());
+			}
+			release_node(n);
+		}
+		return found;
+	}
+
+//// *rtree::persist* ////
+	template<class coord_t, class BTECOLL>
+	void TPIE_AMI_RTREE::persist(persistence per) {
+		pcoll_->persist(per);
+	}
+
+//// *rtree::stats* ////
+	template<class coord_t, class BTECOLL>
+	const stats_tree& TPIE_AMI_RTREE::stats() {
+		node_cache_->flush();
+		stats_.set(NODE_READ, pcoll_->stats().get(BLOCK_GET));
+		stats_.set(NODE_WRITE, pcoll_->stats().get(BLOCK_PUT));
+		stats_.set(NODE_CREATE, pcoll_->stats().get(BLOCK_NEW));
+		stats_.set(NODE_DELETE, pcoll_->stats().get(BLOCK_DELETE));
+		stats_.set(NODE_COUNT, pcoll_->size());
+		return stats_;
+	}
+
+//// *rtree::~rtree* ////
+	template<class coord_t, class BTECOLL>
+	TPIE_AMI_RTREE::~rtree() {
+		if (status_ == RTREE_STATUS_VALID) {
+			// Write initialization info into the collection header.
+			memcpy(pcoll_->user_data(), (void *)(&header_), sizeof(header_));
+			delete node_cache_;
+			delete pcoll_;
+		}
+	}
+
+#undef TPIE_AMI_RTREE
+#undef TPIE_AMI_RTREE_NODE
+#undef RECT
+#undef RECT_STREAM
+
+	} } //end of tpie::ami namespace
+
+#endif //_TPIE_AMI_RTREE_H
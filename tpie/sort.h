@@ -89,6 +89,8 @@
 #include <tpie/internal_sort.h>
 
 #include <tpie/progress_indicator_base.h>
+// copy_stream(), used by sort_or_copy()
+#include <tpie/scan.h>
 
 namespace tpie {
 
@@ -271,6 +273,33 @@ namespace tpie {
 	    return mySortManager.sort(instream, outstream, indicator);
 	}
 
+  ///////////////////////////////////////////////////////////////////////////
+  /// Like \ref sort(stream<T> *instream, stream<T> *outstream, tpie::progress_indicator_base* indicator=NULL),
+  /// but a stream of fewer than two items, which sort() leaves unwritten
+  /// and reports as SORT_ALREADY_SORTED, is copied to \p outstream, so
+  /// that the output always holds the sorted items.
+  ///////////////////////////////////////////////////////////////////////////
+	template<class T>
+	err sort_or_copy(stream<T> *instream, stream<T> *outstream,
+			 progress_indicator_base* indicator=NULL) {
+	    if (instream->stream_len() < 2) {
+		return copy_stream(instream, outstream);
+	    }
+	    return sort(instream, outstream, indicator);
+	}
+
+  ///////////////////////////////////////////////////////////////////////////
+  /// Comparison object variant of sort_or_copy().
+  ///////////////////////////////////////////////////////////////////////////
+	template<class T, class CMPR>
+	err sort_or_copy(stream<T> *instream, stream<T> *outstream,
+			 CMPR *cmp, progress_indicator_base* indicator=NULL) {
+	    if (instream->stream_len() < 2) {
+		return copy_stream(instream, outstream);
+	    }
+	    return sort(instream, outstream, cmp, indicator);
+	}
+
 // ********************************************************************
 // *                                                                  *
 // * Duplicates of the above versions that only use 2x space and      *
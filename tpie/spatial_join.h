@@ -0,0 +1,537 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; eval: (progn (c-set-style "stroustrup") (c-set-offset 'innamespace 0)); -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2010, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+///////////////////////////////////////////////////////////////////////////
+/// \file spatial_join.h
+/// External memory rectangle intersection join, with partitioning (PBSM)
+/// and sorting (SSSJ) strategies.
+///////////////////////////////////////////////////////////////////////////
+
+#ifndef _TPIE_AMI_SPATIAL_JOIN_H
+#define _TPIE_AMI_SPATIAL_JOIN_H
+
+#include <tpie/config.h>
+#include <tpie/portability.h>
+// For min, max, sort.
+#include <algorithm>
+// For pair.
+#include <utility>
+// For vector.
+#include <vector>
+// For sqrt, ceil.
+#include <cmath>
+
+// TPIE stuff.
+#include <tpie/stream.h>
+#include <tpie/sort.h>
+#include <tpie/mm.h>
+// The stream_sink class, for reporting to streams.
+#include <tpie/streaming.h>
+// The bid_t type.
+#include <tpie/block_base.h>
+// The rectangle class.
+#include <tpie/rectangle.h>
+// Threads for joining partitions in parallel.
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+
+/** The memory (in bytes) used by a join when there is no memory limit. */
+#ifndef TPIE_AMI_SPATIAL_JOIN_DEFAULT_MEMORY
+#  define TPIE_AMI_SPATIAL_JOIN_DEFAULT_MEMORY  (64*1024*1024)
+#endif
+
+namespace tpie {
+
+namespace ami {
+
+/** The join strategies. */
+enum spatial_join_method {
+	/** Partition, and sort the partitions that do not fit in memory. */
+	SPATIAL_JOIN_AUTO = 0,
+	/** Partition Based Spatial Merge: partition the plane into tiles,
+	 * and join each partition in memory. */
+	SPATIAL_JOIN_PBSM,
+	/** Scalable Sweeping-based Spatial Join: sort both inputs on y and
+	 * sweep them together. */
+	SPATIAL_JOIN_SSSJ
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// The parameters of a spatial join.
+///////////////////////////////////////////////////////////////////////////
+class spatial_join_params {
+public:
+	/** The join strategy. */
+	spatial_join_method method;
+	/** Memory (in bytes) for the join. 0 means the available memory. */
+	TPIE_OS_SIZE_T memory;
+	/** Number of threads joining partitions. */
+	TPIE_OS_SIZE_T threads;
+	/** Number of tiles per axis for partitioning. The tiles are assigned
+	 * to partitions round robin, to even out skew. */
+	TPIE_OS_SIZE_T tiles;
+	/** Number of vertical strips of the plane sweep. */
+	TPIE_OS_SIZE_T strips;
+
+	spatial_join_params(): method(SPATIAL_JOIN_AUTO), memory(0), threads(1), tiles(32), strips(64) {}
+};
+
+/** The result of a join: the ids of a red and a blue rectangle that
+ * intersect. */
+typedef std::pair<bid_t, bid_t> spatial_join_pair_t;
+
+///////////////////////////////////////////////////////////////////////////
+/// The plane sweep joining red and blue rectangles that arrive by
+/// increasing lower boundary. The plane is cut into vertical strips, and
+/// each strip keeps the active (not yet passed) rectangles of either
+/// color that overlap it. A new rectangle is tested against the active
+/// rectangles of the other color in its strips, and the expired ones are
+/// dropped on the way. A pair is reported only in the strip holding the
+/// left boundary of its intersection, so it is reported once.
+///////////////////////////////////////////////////////////////////////////
+template<class coord_t>
+class spatial_join_sweep {
+public:
+	typedef rectangle<coord_t, bid_t> rect_t;
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Cuts [\p xlo, \p xhi] into \p strips strips.
+	///////////////////////////////////////////////////////////////////////////
+	spatial_join_sweep(double xlo, double xhi, TPIE_OS_SIZE_T strips):
+		xlo_(xlo), strips_(std::max(strips, TPIE_OS_SIZE_T(1))) {
+		w_ = (xhi > xlo) ? double(strips_) / (xhi - xlo): 0.0;
+		for (int c = 0; c < 2; c++)
+			active_[c].resize(strips_);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Adds rectangle \p r, red if \p red is true, and calls
+	/// out.push(red_rect, blue_rect) for each intersecting pair found.
+	///////////////////////////////////////////////////////////////////////////
+	template<class out_t>
+	void process(const rect_t& r, bool red, out_t& out) {
+		int c = red ? 0: 1;
+		TPIE_OS_SIZE_T b1 = strip(r.get_left());
+		TPIE_OS_SIZE_T b2 = strip(r.get_right());
+		for (TPIE_OS_SIZE_T i = b1; i <= b2; i++) {
+			std::vector<rect_t>& other = active_[1-c][i];
+			TPIE_OS_SIZE_T k = 0;
+			for (TPIE_OS_SIZE_T j = 0; j < other.size(); j++) {
+				if (other[j].get_upper() < r.get_lower())
+					continue;
+				if (k != j)
+					other[k] = other[j];
+				const rect_t& o = other[k++];
+				if (o.get_left() <= r.get_right() && r.get_left() <= o.get_right() &&
+					strip(std::max(o.get_left(), r.get_left())) == i) {
+					if (red)
+						out.push(r, o);
+					else
+						out.push(o, r);
+				}
+			}
+			other.resize(k);
+			active_[c][i].push_back(r);
+		}
+	}
+
+protected:
+	TPIE_OS_SIZE_T strip(coord_t x) const {
+		double s = (double(x) - xlo_) * w_;
+		if (s <= 0.0)
+			return 0;
+		return std::min(TPIE_OS_SIZE_T(s), strips_ - 1);
+	}
+
+	double xlo_;
+	double w_;
+	TPIE_OS_SIZE_T strips_;
+	std::vector<std::vector<rect_t> > active_[2];
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// Runs a spatial join; see spatial_join().
+///////////////////////////////////////////////////////////////////////////
+template<class coord_t, class dest_t>
+class spatial_join_op {
+public:
+	typedef rectangle<coord_t, bid_t> rect_t;
+	typedef stream<rect_t> stream_t;
+
+	spatial_join_op(stream_t* red, stream_t* blue, dest_t& dest,
+					const spatial_join_params& params):
+		red_(red), blue_(blue), dest_(dest), params_(params),
+		part_count_(1), next_part_(0), ae_(NO_ERROR) {
+		if (params_.memory == 0)
+			params_.memory = MM_manager.memory_available();
+		if (params_.memory == 0)
+			params_.memory = TPIE_AMI_SPATIAL_JOIN_DEFAULT_MEMORY;
+		if (params_.threads == 0)
+			params_.threads = 1;
+		if (params_.tiles == 0)
+			params_.tiles = 1;
+	}
+
+	err run();
+
+protected:
+
+	///////////////////////////////////////////////////////////////////////////
+	/// Collects the pairs found by one thread, and pushes them to the
+	/// destination in batches. A pair found in a partition is kept only if
+	/// the lower left corner of the intersection lies in a tile of that
+	/// partition, since the pair is found in every partition both
+	/// rectangles were copied to.
+	///////////////////////////////////////////////////////////////////////////
+	class collector {
+	public:
+		collector(spatial_join_op* op, TPIE_OS_SIZE_T part): op_(op), part_(part) {}
+		~collector() { flush(); }
+
+		void push(const rect_t& red, const rect_t& blue) {
+			if (op_->part_count_ > 1 &&
+				op_->partition(std::max(red.get_left(), blue.get_left()),
+							   std::max(red.get_lower(), blue.get_lower())) != part_)
+				return;
+			buf_.push_back(spatial_join_pair_t(red.get_id(), blue.get_id()));
+			if (buf_.size() >= 4096)
+				flush();
+		}
+
+		void flush() {
+			if (buf_.empty())
+				return;
+			boost::mutex::scoped_lock lock(op_->dest_mutex_);
+			for (TPIE_OS_SIZE_T i = 0; i < buf_.size(); i++)
+				op_->dest_.push(buf_[i]);
+			buf_.clear();
+		}
+
+	protected:
+		spatial_join_op* op_;
+		TPIE_OS_SIZE_T part_;
+		std::vector<spatial_join_pair_t> buf_;
+	};
+	friend class collector;
+
+	/** The partition of the tile holding (x, y). */
+	TPIE_OS_SIZE_T partition(coord_t x, coord_t y) const {
+		return (tile(y, mbr_.get_lower(), mbr_.get_upper()) * params_.tiles +
+				tile(x, mbr_.get_left(), mbr_.get_right())) % part_count_;
+	}
+
+	TPIE_OS_SIZE_T tile(coord_t x, coord_t lo, coord_t hi) const {
+		double t = (hi > lo) ? (double(x) - double(lo)) / (double(hi) - double(lo)) * params_.tiles: 0.0;
+		if (t <= 0.0)
+			return 0;
+		return std::min(TPIE_OS_SIZE_T(t), params_.tiles - 1);
+	}
+
+	err distribute(stream_t* in, std::vector<stream_t*>& parts);
+	err join_in_memory(stream_t* red, stream_t* blue, TPIE_OS_SIZE_T part);
+	err join_sorted(stream_t* red, stream_t* blue, TPIE_OS_SIZE_T part);
+	void worker();
+
+	stream_t* red_;
+	stream_t* blue_;
+	dest_t& dest_;
+	spatial_join_params params_;
+
+	/** The bounding rectangle of both inputs. */
+	rect_t mbr_;
+	TPIE_OS_SIZE_T part_count_;
+	std::vector<stream_t*> red_parts_;
+	std::vector<stream_t*> blue_parts_;
+	/** The partitions too large for the memory of a thread. */
+	std::vector<bool> large_;
+
+	TPIE_OS_SIZE_T next_part_;
+	err ae_;
+	boost::mutex part_mutex_;
+	boost::mutex io_mutex_;
+	boost::mutex dest_mutex_;
+};
+
+//// *spatial_join_op::run* ////
+	template<class coord_t, class dest_t>
+	err spatial_join_op<coord_t, dest_t>::run() {
+		err ae = NO_ERROR;
+		rect_t* r;
+		TPIE_OS_SIZE_T i;
+
+		dest_.begin();
+
+		// The bounding rectangle, for the tiles and strips.
+		TPIE_OS_OFFSET n = red_->stream_len() + blue_->stream_len();
+		bool first = true;
+		stream_t* in[2] = {red_, blue_};
+		for (i = 0; i < 2; i++) {
+			in[i]->seek(0);
+			while ((ae = in[i]->read_item(&r)) == NO_ERROR) {
+				if (first)
+					mbr_ = *r;
+				mbr_.extend(*r);
+				first = false;
+			}
+			if (ae != END_OF_STREAM) {
+				dest_.end();
+				return ae;
+			}
+		}
+		if (red_->stream_len() == 0 || blue_->stream_len() == 0) {
+			dest_.end();
+			return NO_ERROR;
+		}
+
+		// A partition is loaded into memory twice over (the arrays and the
+		// active lists of the sweep), and every thread holds one.
+		TPIE_OS_OFFSET part_memory = params_.memory / params_.threads;
+		TPIE_OS_OFFSET bytes = 2 * n * TPIE_OS_OFFSET(sizeof(rect_t));
+
+		if (params_.method == SPATIAL_JOIN_SSSJ) {
+			part_count_ = 1;
+			ae = join_sorted(red_, blue_, 0);
+		} else if (bytes <= TPIE_OS_OFFSET(params_.memory)) {
+			part_count_ = 1;
+			ae = join_in_memory(red_, blue_, 0);
+		} else {
+			// Partition, with room for the replication of rectangles that
+			// cross tile boundaries.
+			part_count_ = TPIE_OS_SIZE_T((bytes + part_memory - 1) / part_memory);
+			part_count_ = std::max(part_count_ + part_count_ / 4, params_.threads);
+			part_count_ = std::min(part_count_, params_.tiles * params_.tiles);
+			if ((ae = distribute(red_, red_parts_)) == NO_ERROR)
+				ae = distribute(blue_, blue_parts_);
+
+			// The partitions that still do not fit (with skewed data) are
+			// sorted and swept, unless PBSM was asked for.
+			large_.resize(part_count_, false);
+			if (params_.method == SPATIAL_JOIN_AUTO)
+				for (i = 0; i < part_count_ && ae == NO_ERROR; i++)
+					large_[i] = 2 * (red_parts_[i]->stream_len() + blue_parts_[i]->stream_len()) *
+						TPIE_OS_OFFSET(sizeof(rect_t)) > part_memory;
+
+			if (ae == NO_ERROR) {
+				if (params_.threads == 1)
+					worker();
+				else {
+					boost::thread_group threads;
+					for (i = 0; i < params_.threads; i++)
+						threads.create_thread(boost::bind(&spatial_join_op::worker, this));
+					threads.join_all();
+				}
+				ae = ae_;
+			}
+			for (i = 0; i < part_count_ && ae == NO_ERROR; i++)
+				if (large_[i])
+					ae = join_sorted(red_parts_[i], blue_parts_[i], i);
+
+			for (i = 0; i < red_parts_.size(); i++)
+				delete red_parts_[i];
+			for (i = 0; i < blue_parts_.size(); i++)
+				delete blue_parts_[i];
+		}
+
+		dest_.end();
+		return ae;
+	}
+
+//// *spatial_join_op::distribute* ////
+	template<class coord_t, class dest_t>
+	err spatial_join_op<coord_t, dest_t>::distribute(stream_t* in, std::vector<stream_t*>& parts) {
+		err ae = NO_ERROR;
+		rect_t* r;
+		TPIE_OS_SIZE_T i, row, col, p;
+		TPIE_OS_SIZE_T tiles = params_.tiles;
+
+		for (i = 0; i < part_count_; i++) {
+			parts.push_back(new stream_t);
+			parts.back()->persist(PERSIST_DELETE);
+		}
+
+		// Copy each rectangle to the partitions of the tiles it overlaps.
+		std::vector<bool> written(part_count_);
+		in->seek(0);
+		while ((ae = in->read_item(&r)) == NO_ERROR) {
+			std::fill(written.begin(), written.end(), false);
+			TPIE_OS_SIZE_T row_lo = tile(r->get_lower(), mbr_.get_lower(), mbr_.get_upper());
+			TPIE_OS_SIZE_T row_hi = tile(r->get_upper(), mbr_.get_lower(), mbr_.get_upper());
+			TPIE_OS_SIZE_T col_lo = tile(r->get_left(), mbr_.get_left(), mbr_.get_right());
+			TPIE_OS_SIZE_T col_hi = tile(r->get_right(), mbr_.get_left(), mbr_.get_right());
+			for (row = row_lo; row <= row_hi && ae == NO_ERROR; row++)
+				for (col = col_lo; col <= col_hi && ae == NO_ERROR; col++) {
+					p = (row * tiles + col) % part_count_;
+					if (!written[p]) {
+						written[p] = true;
+						ae = parts[p]->write_item(*r);
+					}
+				}
+			if (ae != NO_ERROR)
+				return ae;
+		}
+		return (ae == END_OF_STREAM) ? NO_ERROR: ae;
+	}
+
+//// *spatial_join_op::worker* ////
+	template<class coord_t, class dest_t>
+	void spatial_join_op<coord_t, dest_t>::worker() {
+		TPIE_OS_SIZE_T p;
+		err ae;
+		while (true) {
+			{
+				boost::mutex::scoped_lock lock(part_mutex_);
+				while (next_part_ < part_count_ && large_[next_part_])
+					next_part_++;
+				if (next_part_ == part_count_ || ae_ != NO_ERROR)
+					return;
+				p = next_part_++;
+			}
+			if ((ae = join_in_memory(red_parts_[p], blue_parts_[p], p)) != NO_ERROR) {
+				boost::mutex::scoped_lock lock(part_mutex_);
+				ae_ = ae;
+			}
+		}
+	}
+
+//// *spatial_join_op::join_in_memory* ////
+	template<class coord_t, class dest_t>
+	err spatial_join_op<coord_t, dest_t>::join_in_memory(stream_t* red, stream_t* blue,
+														  TPIE_OS_SIZE_T part) {
+		err ae = NO_ERROR;
+		rect_t* r;
+		std::vector<rect_t> a[2];
+		stream_t* in[2] = {red, blue};
+
+		// The streams are read one thread at a time.
+		{
+			boost::mutex::scoped_lock lock(io_mutex_);
+			for (int c = 0; c < 2 && ae == NO_ERROR; c++) {
+				a[c].reserve((TPIE_OS_SIZE_T) in[c]->stream_len());
+				in[c]->seek(0);
+				while ((ae = in[c]->read_item(&r)) == NO_ERROR)
+					a[c].push_back(*r);
+				if (ae == END_OF_STREAM)
+					ae = NO_ERROR;
+			}
+		}
+		if (ae != NO_ERROR)
+			return ae;
+
+		// Sort on the lower boundaries and sweep.
+		std::sort(a[0].begin(), a[0].end());
+		std::sort(a[1].begin(), a[1].end());
+		spatial_join_sweep<coord_t> sweep(mbr_.get_left(), mbr_.get_right(), params_.strips);
+		collector out(this, part);
+		TPIE_OS_SIZE_T i = 0, j = 0;
+		while (i < a[0].size() || j < a[1].size()) {
+			if (j == a[1].size() || (i < a[0].size() && a[0][i].get_lower() <= a[1][j].get_lower()))
+				sweep.process(a[0][i++], true, out);
+			else
+				sweep.process(a[1][j++], false, out);
+		}
+		return NO_ERROR;
+	}
+
+//// *spatial_join_op::join_sorted* ////
+	template<class coord_t, class dest_t>
+	err spatial_join_op<coord_t, dest_t>::join_sorted(stream_t* red, stream_t* blue,
+													  TPIE_OS_SIZE_T part) {
+		err ae = NO_ERROR;
+		stream_t* in[2] = {red, blue};
+		stream_t* sorted[2] = {NULL, NULL};
+		rect_t* r[2] = {NULL, NULL};
+		int c;
+
+		// Sort both inputs on the lower boundaries (rectangle::operator<).
+		for (c = 0; c < 2 && ae == NO_ERROR; c++) {
+			sorted[c] = new stream_t;
+			sorted[c]->persist(PERSIST_DELETE);
+			ae = sort_or_copy(in[c], sorted[c]);
+		}
+
+		// Sweep the two sorted streams together.
+		if (ae == NO_ERROR) {
+			spatial_join_sweep<coord_t> sweep(mbr_.get_left(), mbr_.get_right(), params_.strips);
+			collector out(this, part);
+			for (c = 0; c < 2; c++) {
+				sorted[c]->seek(0);
+				if (sorted[c]->read_item(&r[c]) != NO_ERROR)
+					r[c] = NULL;
+			}
+			while (r[0] != NULL || r[1] != NULL) {
+				c = (r[1] == NULL || (r[0] != NULL && r[0]->get_lower() <= r[1]->get_lower())) ? 0: 1;
+				sweep.process(*r[c], c == 0, out);
+				if ((ae = sorted[c]->read_item(&r[c])) != NO_ERROR) {
+					r[c] = NULL;
+					if (ae != END_OF_STREAM)
+						break;
+					ae = NO_ERROR;
+				}
+			}
+		}
+
+		delete sorted[0];
+		delete sorted[1];
+		return ae;
+	}
+
+///////////////////////////////////////////////////////////////////////////
+/// Reports every pair of intersecting (closed) rectangles, one from \p red
+/// and one from \p blue, to \p dest, as a spatial_join_pair_t of their
+/// ids. \p dest is a push destination with begin(), push() and end()
+/// methods, like the pipeline sinks in streaming.h; push() is called from
+/// one thread at a time. Each pair is reported once, in no particular
+/// order.
+///
+/// By default (SPATIAL_JOIN_AUTO), inputs that fit in memory are joined
+/// by a plane sweep in memory. Larger inputs are partitioned as in PBSM
+/// [Patel and DeWitt, 1996]: the plane is cut into tiles, assigned round
+/// robin to enough partitions for one to fit in the memory of a thread,
+/// and the partitions are joined in memory, in parallel by \p
+/// params.threads threads. Partitions that still do not fit, because of
+/// skew, are joined as in SSSJ [Arge et al., 1998]: both sides are sorted
+/// with ami::sort and swept together, keeping only the active rectangles
+/// in memory. SPATIAL_JOIN_PBSM always joins partitions in memory, and
+/// SPATIAL_JOIN_SSSJ sorts and sweeps the whole inputs.
+///////////////////////////////////////////////////////////////////////////
+template<class coord_t, class dest_t>
+err spatial_join(stream<rectangle<coord_t, bid_t> >* red, stream<rectangle<coord_t, bid_t> >* blue,
+				 dest_t& dest, const spatial_join_params& params = spatial_join_params()) {
+	if (red == NULL || blue == NULL) {
+		TP_LOG_WARNING_ID("spatial_join: NULL input stream. Aborted.");
+		return NULL_POINTER;
+	}
+	spatial_join_op<coord_t, dest_t> op(red, blue, dest, params);
+	return op.run();
+}
+
+///////////////////////////////////////////////////////////////////////////
+/// Writes the pairs of ids of intersecting red and blue rectangles to \p
+/// out; see above.
+///////////////////////////////////////////////////////////////////////////
+template<class coord_t>
+err spatial_join(stream<rectangle<coord_t, bid_t> >* red, stream<rectangle<coord_t, bid_t> >* blue,
+				 stream<spatial_join_pair_t>* out, const spatial_join_params& params = spatial_join_params()) {
+	stream_sink<stream<spatial_join_pair_t> > sink(out);
+	return spatial_join(red, blue, sink, params);
+}
+
+	} } //end of tpie::ami namespace
+
+#endif //_TPIE_AMI_SPATIAL_JOIN_H
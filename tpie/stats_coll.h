@@ -47,6 +47,8 @@ namespace tpie {
 	BLOCK_DELETE,
 	/** Number of block sync operations */ 
 	BLOCK_SYNC,
+	/** Number of blocks read ahead */ 
+	BLOCK_PREFETCH,
 	/** Number of collection open operations */ 
 	COLLECTION_OPEN,
 	/** Number of collection close operations */ 
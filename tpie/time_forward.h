@@ -0,0 +1,228 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; eval: (progn (c-set-style "stroustrup") (c-set-offset 'innamespace 0)); -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2010, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+///////////////////////////////////////////////////////////////////////////
+/// \file time_forward.h
+/// Time-forward processing of directed acyclic graphs.
+///////////////////////////////////////////////////////////////////////////
+
+#ifndef _TPIE_AMI_TIME_FORWARD_H
+#define _TPIE_AMI_TIME_FORWARD_H
+
+#include <tpie/config.h>
+#include <tpie/portability.h>
+// For pair.
+#include <utility>
+// For vector.
+#include <vector>
+
+// TPIE stuff.
+#include <tpie/stream.h>
+#include <tpie/sort.h>
+#include <tpie/priority_queue.h>
+#include <tpie/progress_indicator_base.h>
+
+namespace tpie {
+
+namespace ami {
+
+///////////////////////////////////////////////////////////////////////////
+/// A value sent along the edge from one vertex to a later one, for
+/// time_forward_process().
+///////////////////////////////////////////////////////////////////////////
+template <typename vertex_t, typename value_t>
+struct tfp_message {
+	vertex_t to;
+	vertex_t from;
+	value_t value;
+
+	tfp_message() {}
+	tfp_message(const vertex_t& t, const vertex_t& f, const value_t& v):
+		to(t), from(f), value(v) {}
+};
+
+///////////////////////////////////////////////////////////////////////////
+/// Evaluates a directed acyclic graph; see time_forward_process().
+///////////////////////////////////////////////////////////////////////////
+template <typename vertex_t, typename F>
+class time_forward_op {
+public:
+	typedef typename F::result_type value_t;
+	typedef tfp_message<vertex_t, value_t> message_t;
+	typedef std::pair<vertex_t, vertex_t> edge_t;
+
+	time_forward_op(F& f, TPIE_OS_SIZE_T memory, progress_indicator_base* indicator):
+		f_(f), memory_(memory), indicator_(indicator) {}
+
+	err run(stream<vertex_t>* vertices, stream<edge_t>* edges);
+
+protected:
+	/** Orders the messages by destination only, so pop_equals() pops all
+	 * messages to a vertex. */
+	class to_less {
+	public:
+		bool operator()(const message_t& a, const message_t& b) const {
+			return a.to < b.to;
+		}
+	};
+
+	typedef priority_queue<message_t, to_less> queue_t;
+
+	/** Appends the messages popped by pop_equals() to the inbox. */
+	class collector {
+	public:
+		collector(std::vector<message_t>* in): in_(in) {}
+		void operator()(const message_t& m) {
+			in_->push_back(m);
+		}
+	private:
+		std::vector<message_t>* in_;
+	};
+
+	err process(stream<vertex_t>* vertices, stream<edge_t>* edges, queue_t& pq);
+
+	F& f_;
+	TPIE_OS_SIZE_T memory_;
+	progress_indicator_base* indicator_;
+};
+
+//// *time_forward_op::run* ////
+	template <typename vertex_t, typename F>
+	err time_forward_op<vertex_t, F>::run(stream<vertex_t>* vertices, stream<edge_t>* edges) {
+		err ae = NO_ERROR;
+
+		// The out-edges are read in order of source, alongside the vertices.
+		stream<edge_t>* by_from = new stream<edge_t>;
+		by_from->persist(PERSIST_DELETE);
+		if ((ae = tpie::ami::sort_or_copy(edges, by_from)) != NO_ERROR) {
+			delete by_from;
+			return ae;
+		}
+
+		// Leave a quarter of the memory to the streams when none is given.
+		queue_t* pq;
+		try {
+			pq = memory_ ? new queue_t(memory_): new queue_t(0.75);
+		} catch (const priority_queue_error&) {
+			TP_LOG_WARNING_ID("time_forward_process: not enough memory for the priority queue.");
+			delete by_from;
+			return INSUFFICIENT_MAIN_MEMORY;
+		}
+		ae = process(vertices, by_from, *pq);
+		delete pq;
+		delete by_from;
+		return ae;
+	}
+
+//// *time_forward_op::process* ////
+	template <typename vertex_t, typename F>
+	err time_forward_op<vertex_t, F>::process(stream<vertex_t>* vertices, stream<edge_t>* edges,
+											   queue_t& pq) {
+		err ae;
+		vertex_t* v;
+		edge_t* e;
+		vertex_t prev = vertex_t();
+		bool first = true;
+		std::vector<message_t> in;
+
+		if (indicator_) {
+			indicator_->set_percentage_range(0, vertices->stream_len());
+			indicator_->init("Time-forward processing");
+		}
+
+		vertices->seek(0);
+		edges->seek(0);
+		err ee = edges->read_item(&e);
+		while ((ae = vertices->read_item(&v)) == NO_ERROR) {
+			if (!first && !(prev < *v)) {
+				TP_LOG_WARNING_ID("time_forward_process: vertices out of order.");
+				return OBJECT_INVALID;
+			}
+			first = false;
+			prev = *v;
+
+			// Deliver the messages to v at once, and drop those to vertices
+			// not in the stream.
+			in.clear();
+			while (!pq.empty() && pq.top().to < *v)
+				pq.pop();
+			if (!pq.empty() && !(*v < pq.top().to))
+				pq.pop_equals(collector(&in));
+
+			value_t value = f_(*v, in);
+
+			while (ee == NO_ERROR && e->first < *v)
+				ee = edges->read_item(&e);
+			while (ee == NO_ERROR && !(*v < e->first)) {
+				if (!(*v < e->second)) {
+					TP_LOG_WARNING_ID("time_forward_process: edge against the order of the vertices.");
+					return OBJECT_INVALID;
+				}
+				pq.push(message_t(e->second, *v, value));
+				ee = edges->read_item(&e);
+			}
+			if (ee != NO_ERROR && ee != END_OF_STREAM)
+				return ee;
+
+			if (indicator_)
+				indicator_->step_percentage();
+		}
+		if (ae != END_OF_STREAM)
+			return ae;
+		if (indicator_)
+			indicator_->done();
+		return NO_ERROR;
+	}
+
+///////////////////////////////////////////////////////////////////////////
+/// Evaluates the directed acyclic graph with the vertices of \p vertices
+/// and the edges of \p edges by time-forward processing [Chiang et al.,
+/// 1995]. The vertices must be in increasing order, and this order must be
+/// topological: every edge (u, v) must have u < v.
+///
+/// For each vertex v in order, f(v, in) is called with the vector of the
+/// tfp_message objects sent to v, and the value it returns is sent to all
+/// the out-neighbours of v. F is an adaptable function object; its
+/// result_type is the type of the values. Messages wait in an
+/// ami::priority_queue keyed on their destination, and the messages to a
+/// vertex are collected with one pop_equals(). The edges are sorted by
+/// source first, so this takes O(sort(E)) I/Os.
+///
+/// The priority queue uses \p memory bytes of memory (0 means three
+/// quarters of the available memory). \p indicator, if given, advances
+/// with the vertices. Returns OBJECT_INVALID if the vertices are out of
+/// order or an edge goes against the order. Edges from or to vertices
+/// not in \p vertices are ignored.
+///////////////////////////////////////////////////////////////////////////
+template <typename vertex_t, typename F>
+err time_forward_process(stream<vertex_t>* vertices,
+						 stream<std::pair<vertex_t, vertex_t> >* edges,
+						 F& f, TPIE_OS_SIZE_T memory = 0,
+						 progress_indicator_base* indicator = NULL) {
+	if (vertices == NULL || edges == NULL) {
+		TP_LOG_WARNING_ID("time_forward_process: NULL stream. Aborted.");
+		return NULL_POINTER;
+	}
+	time_forward_op<vertex_t, F> op(f, memory, indicator);
+	return op.run(vertices, edges);
+}
+
+	} } //end of tpie::ami namespace
+
+#endif //_TPIE_AMI_TIME_FORWARD_H